@@ -23,6 +23,7 @@
 
 #include <QObject>
 #include <QHostAddress>
+#include <chrono>
 
 namespace QTFTP
 {
@@ -50,10 +51,24 @@ class AbstractSocket : public QObject
         virtual qint64 writeDatagram(const QByteArray &datagram, const QHostAddress &host, quint16 port) = 0;
         virtual void close() = 0;
 
+        virtual bool receiveDatagram(QByteArray &datagram, QHostAddress &address, quint16 &port, QHostAddress &destinationAddress);
+        virtual qint64 writeDatagramFrom(const QByteArray &datagram, const QHostAddress &host, quint16 port, const QHostAddress &sourceAddress);
+        virtual bool isSendErrorTransient() const;
+        virtual void setWriteNotificationEnabled(bool enabled);
+
+        virtual qintptr socketDescriptor() const;
+        virtual bool setBufferSizes(int receiveBytes, int sendBytes);
+        virtual int receiveBufferSize() const;
+        virtual int sendBufferSize() const;
+        virtual bool receiveDrops(uint32_t &drops) const;
+        virtual bool enableReceiveTimestamps();
+        virtual bool lastReceiveTime(std::chrono::steady_clock::time_point &receiveTime) const;
+
 
     signals:
         void error(QAbstractSocket::SocketError socketError);
         void readyRead();
+        void readyWrite();
 
 };
 
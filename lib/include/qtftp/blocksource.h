@@ -0,0 +1,203 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#ifndef BLOCKSOURCE_H
+#define BLOCKSOURCE_H
+
+#include "qtftp/directoryindex.h"
+#include "qtftp/directoryhandle.h"
+#include <QByteArray>
+#include <QDateTime>
+#include <QFile>
+#include <QHostAddress>
+#include <QString>
+#include <functional>
+#include <map>
+#include <memory>
+#include <vector>
+
+namespace QTFTP
+{
+
+/**
+ * @brief The BlockSource class is the interface to the contents of a file that is sent to a client
+ *
+ * A source is opened once per transfer. From then on size() and the data returned by readAt() must not
+ * change, so every block of a transfer comes from the same version of the contents.
+ */
+class BlockSource
+{
+    public:
+        virtual ~BlockSource() = default;
+
+        /**
+         * @brief open prepare the contents for reading, calling open() on a source that is open has no effect
+         * @return false if the contents are not available, see errorString()
+         */
+        virtual bool open() = 0;
+        virtual QString errorString() const = 0;
+
+        /**
+         * @brief name get the name of the source for log messages, for files the absolute path
+         */
+        virtual QString name() const = 0;
+        virtual qint64 size() const = 0;
+
+        /**
+         * @brief readAt read \p maxSize bytes (or less at the end of the contents) starting at \p offset
+         * @return nr of bytes read or -1 on error
+         */
+        virtual qint64 readAt(qint64 offset, char *data, qint64 maxSize) = 0;
+
+        virtual QString shareKey() const;
+        virtual bool isCurrentVersion() const;
+};
+
+
+/**
+ * @brief The FileBlockSource class reads the contents of a file on disk
+ */
+class FileBlockSource : public BlockSource
+{
+    public:
+        explicit FileBlockSource(const QString &filePath);
+        FileBlockSource(const QString &filePath, const DirectoryIndex::FileMetadata &metadata, std::shared_ptr<DirectoryIndex> index,
+                        const QString &indexName);
+
+        bool open() override;
+        QString errorString() const override;
+        QString name() const override;
+        qint64 size() const override;
+        qint64 readAt(qint64 offset, char *data, qint64 maxSize) override;
+        QString shareKey() const override;
+        bool isCurrentVersion() const override;
+
+        void setDirectoryHandle(std::shared_ptr<DirectoryHandle> dirHandle, const QString &relativeName);
+        int openError() const;
+
+    private:
+        QString   m_filePath;
+        QFile     m_file;
+        qint64    m_fileSize;       /// size of the file when it was opened
+        QDateTime m_lastModified;   /// modification time of the file when it was opened
+        std::shared_ptr<DirectoryIndex> m_index;    /// if not null, metadata is taken from this index instead of the file system
+        QString   m_indexName;      /// name of the file in m_index
+        std::shared_ptr<DirectoryHandle> m_dirHandle;   /// if not null, the file is opened relative to this directory
+        QString   m_relativeName;   /// name of the file relative to m_dirHandle
+        int       m_openError;      /// errno value of the last failed open through m_dirHandle
+};
+
+
+/**
+ * @brief The MemoryBlockSource class sends the contents of a byte array
+ */
+class MemoryBlockSource : public BlockSource
+{
+    public:
+        MemoryBlockSource(const QString &name, const QByteArray &contents);
+
+        bool open() override;
+        QString errorString() const override;
+        QString name() const override;
+        qint64 size() const override;
+        qint64 readAt(qint64 offset, char *data, qint64 maxSize) override;
+
+    private:
+        QString    m_name;
+        QByteArray m_contents;
+};
+
+
+/**
+ * @brief The BlockSourceProvider class looks up the source of a requested file
+ *
+ * Providers are registered per binding of the TftpServer (see TftpServer::addBlockSourceProvider()). For a
+ * read request the providers of the binding are asked in the order they were added. If none of them has
+ * the file, it is looked up in the files directory of the binding.
+ */
+class BlockSourceProvider
+{
+    public:
+        virtual ~BlockSourceProvider() = default;
+
+        /**
+         * @brief find get the source of a file
+         * @param fileName file name as it appears in the read request
+         * @param peerAddr address of the client that requests the file
+         * @return the source, which does not need to be opened yet, or nullptr if this provider does not have the file
+         */
+        virtual std::shared_ptr<BlockSource> find(const QString &fileName, const QHostAddress &peerAddr) = 0;
+};
+
+typedef std::vector<std::shared_ptr<BlockSourceProvider>> BlockSourceProviders;
+
+
+/**
+ * @brief The DirectoryProvider class provides the files in a directory on disk
+ *
+ * With a DirectoryIndex, requests for files that don't exist are answered without touching the file system and the
+ * size and modification time of existing files are taken from the index. With a DirectoryHandle, files are opened
+ * relative to the open directory and requests for files outside the directory are treated as requests for files
+ * that don't exist.
+ */
+class DirectoryProvider : public BlockSourceProvider
+{
+    public:
+        explicit DirectoryProvider(const QString &filesDir, std::shared_ptr<DirectoryIndex> index=nullptr,
+                                   std::shared_ptr<DirectoryHandle> dirHandle=nullptr);
+
+        static std::shared_ptr<DirectoryProvider> create(const QString &filesDir);
+        std::shared_ptr<BlockSource> find(const QString &fileName, const QHostAddress &peerAddr) override;
+
+    private:
+        std::shared_ptr<BlockSource> findBeneath(const QString &fileName);
+
+        QString m_filesDir;
+        std::shared_ptr<DirectoryIndex> m_index;   /// may be null, then every request is looked up on disk
+        std::shared_ptr<DirectoryHandle> m_dirHandle;   /// may be null, then files are opened by path
+};
+
+
+/**
+ * @brief The MemoryProvider class provides files that are kept in memory or generated for each request
+ *
+ * A generator is called for every read request of its file name, so it can produce contents that depend on
+ * the client, for example a boot configuration that contains the client address.
+ */
+class MemoryProvider : public BlockSourceProvider
+{
+    public:
+        typedef std::function<QByteArray(const QString &fileName, const QHostAddress &peerAddr)> Generator;
+
+        void addFile(const QString &fileName, const QByteArray &contents);
+        void addGenerator(const QString &fileName, Generator generator);
+        void removeFile(const QString &fileName);
+
+        std::shared_ptr<BlockSource> find(const QString &fileName, const QHostAddress &peerAddr) override;
+
+    private:
+        std::map<QString, QByteArray> m_files;
+        std::map<QString, Generator>  m_generators;
+};
+
+
+} // QTFTP namespace end
+
+#endif // BLOCKSOURCE_H
@@ -0,0 +1,71 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#ifndef CONGESTIONCONTROLLER_H
+#define CONGESTIONCONTROLLER_H
+
+#include <cstdint>
+#include <limits>
+
+namespace QTFTP
+{
+
+/**
+ * @brief The CongestionController class adjusts the effective send window of a windowed transfer (AIMD)
+ *
+ * The window grows by one block for each window of cleanly acknowledged blocks, and is halved on a time-out, on an
+ * ACK that reports lost blocks, and when the ACK delay rises well above the lowest delay seen (a queue builds up on
+ * the path). The window stays between 1 and the window size negotiated with the client. After a decrease, further
+ * loss and delay signals are ignored until one window of blocks has been acknowledged, so one burst of losses halves
+ * the window only once.
+ */
+class CongestionController
+{
+    public:
+        static constexpr unsigned int InitialWindow = 4;
+        static constexpr unsigned int DelayIncreaseFactor = 2;  /// ACK delays above this factor times the lowest delay signal congestion
+        static constexpr uint64_t MinQueueingDelayUs = 2000;    /// smaller rises of the ACK delay are jitter, not congestion
+        static constexpr uint64_t UnknownAckDelay = std::numeric_limits<uint64_t>::max();  /// the ACK delay is no valid sample
+
+        explicit CongestionController(unsigned int maxWindow=1);
+
+        void setMaxWindow(unsigned int maxWindow);
+        unsigned int maxWindow() const;
+        unsigned int window() const;
+        uint64_t smoothedAckDelayUs() const;
+
+        void ackReceived(unsigned int blocksAcked, uint64_t ackDelayUs);
+        void lossDetected();
+        void timeOut();
+
+    private:
+        void decrease();
+
+        double       m_window;
+        unsigned int m_maxWindow;
+        uint64_t     m_minAckDelayUs;       /// 0 until the first ACK delay is known
+        uint64_t     m_smoothedAckDelayUs;
+        unsigned int m_blocksUntilDecrease; /// nr of blocks to acknowledge before the window may be decreased again
+};
+
+
+} // QTFTP namespace end
+
+#endif // CONGESTIONCONTROLLER_H
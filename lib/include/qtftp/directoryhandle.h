@@ -0,0 +1,74 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#ifndef DIRECTORYHANDLE_H
+#define DIRECTORYHANDLE_H
+
+#include <QDateTime>
+#include <QFile>
+#include <QString>
+
+namespace QTFTP
+{
+
+/**
+ * @brief The DirectoryHandle class keeps a files directory open and opens files below it
+ *
+ * Files are opened relative to the open directory with openat2() and RESOLVE_BENEATH, so a requested name is resolved
+ * by the kernel in one system call and can never lead to a file outside the directory. On kernels without openat2()
+ * the name is resolved one component at a time with openat().
+ *
+ * Symbolic links below the directory are followed as long as they stay inside of it. A link with an absolute target,
+ * or a relative one that leads outside of the directory, is answered as if the file does not exist. This is the same
+ * on kernels with and without openat2().
+ *
+ * Renaming or replacing the directory itself does not affect an open handle, it keeps referring to the directory
+ * that was opened.
+ */
+class DirectoryHandle
+{
+    public:
+        explicit DirectoryHandle(const QString &dirPath);
+        ~DirectoryHandle();
+
+        DirectoryHandle(const DirectoryHandle&) = delete;
+        DirectoryHandle &operator=(const DirectoryHandle&) = delete;
+
+        bool open();
+        bool isOpen() const;
+        QString path() const;
+        int openFile(const QString &relativeName, QFile &file, qint64 &fileSize, QDateTime &lastModified) const;
+
+        static QString relativeName(const QString &fileName);
+        static bool isNotFoundError(int errorNr);
+        static QString errorString(int errorNr);
+
+    private:
+        int openBeneath(const QByteArray &relativeName, int openFlags) const;
+        int openByComponents(const QByteArray &relativeName, int openFlags) const;
+
+        QString m_path;
+        int     m_dirFd;
+};
+
+
+} // QTFTP namespace end
+
+#endif // DIRECTORYHANDLE_H
@@ -0,0 +1,100 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#ifndef DIRECTORYINDEX_H
+#define DIRECTORYINDEX_H
+
+#include <QDateTime>
+#include <QObject>
+#include <QSocketNotifier>
+#include <QString>
+#include <map>
+#include <memory>
+
+namespace QTFTP
+{
+
+/**
+ * @brief The DirectoryIndex class keeps the names, sizes and modification times of all files below a directory in memory
+ *
+ * The index is built when start() is called and kept up to date with inotify, so looking up a file (or finding out that
+ * it does not exist) needs no system calls on the file system. Before each lookup the pending inotify events are
+ * processed, so changes made before a request arrived are always seen.
+ *
+ * Paths that the index can't follow reliably (symbolic links, directories that can't be read or watched, paths with
+ * "..") are reported as LookupResult::Unknown, the caller must then check the file system itself. On platforms without
+ * inotify start() fails and every lookup returns Unknown.
+ */
+class DirectoryIndex : public QObject
+{
+    Q_OBJECT
+
+    public:
+        enum class LookupResult { Unknown, Missing, Found };
+
+        struct FileMetadata
+        {
+            public:
+                qint64    m_size;
+                QDateTime m_lastModified;
+        };
+
+        explicit DirectoryIndex(const QString &filesDir, QObject *parent=nullptr);
+        ~DirectoryIndex() override;
+
+        bool start();
+        bool isActive() const;
+        QString filesDir() const;
+        size_t entryCount() const;
+        LookupResult lookup(const QString &fileName, FileMetadata *metadata=nullptr);
+
+    private slots:
+        void processEvents();
+
+    private:
+        enum class EntryType { File, Directory, Other };
+
+        struct Entry
+        {
+            public:
+                EntryType    m_type;
+                FileMetadata m_metadata;
+        };
+
+        void clear();
+        void rescan();
+        void scanDirectory(const QString &relativeDir);
+        void addEntry(const QString &relativePath);
+        void updateEntry(const QString &relativePath);
+        void removeEntry(const QString &relativePath);
+        QString absolutePath(const QString &relativePath) const;
+
+        QString m_filesDir;
+        int     m_inotifyFd;
+        bool    m_active;          /// false until the index is built, or when the files directory itself was removed
+        std::unique_ptr<QSocketNotifier> m_notifier;
+        std::map<QString, Entry> m_entries;   /// key is the path relative to m_filesDir
+        std::map<int, QString>   m_watches;   /// inotify watch descriptor -> relative path of the watched directory
+};
+
+
+} // QTFTP namespace end
+
+#endif // DIRECTORYINDEX_H
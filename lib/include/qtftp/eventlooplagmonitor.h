@@ -0,0 +1,70 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#ifndef EVENTLOOPLAGMONITOR_H
+#define EVENTLOOPLAGMONITOR_H
+
+#include "qtftp/histogram.h"
+#include <QObject>
+#include <QTimer>
+#include <chrono>
+
+namespace QTFTP
+{
+
+/**
+ * @brief The EventLoopLagMonitor class measures how long the event loop of its thread is blocked
+ *
+ * The monitor runs a timer on the event loop. The time between the moment the timer should have expired and
+ * the moment its timeout is actually handled is recorded in a histogram (in microseconds). A tick() signal is
+ * emitted after each measurement, so a stalled event loop can also be detected by the absence of ticks.
+ */
+class EventLoopLagMonitor : public QObject
+{
+    Q_OBJECT
+
+    public:
+        explicit EventLoopLagMonitor(Histogram &lagHistogram, QObject *parent=nullptr);
+
+        void start(unsigned int intervalMs);
+        void stop();
+        bool isActive() const;
+        uint64_t lastLagUs() const;
+        uint64_t maxLagUs() const;
+
+    signals:
+        void tick(quint64 lagUs);
+
+    private slots:
+        void handleTimeOut();
+
+    private:
+        Histogram  &m_lagHistogram;
+        QTimer      m_timer;
+        unsigned int m_intervalMs;
+        std::chrono::steady_clock::time_point m_expectedExpiry;
+        uint64_t    m_lastLagUs;
+        uint64_t    m_maxLagUs;
+};
+
+
+} // QTFTP namespace end
+
+#endif // EVENTLOOPLAGMONITOR_H
@@ -0,0 +1,108 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#ifndef FILENAMEREWRITER_H
+#define FILENAMEREWRITER_H
+
+#include <QHash>
+#include <QRegularExpression>
+#include <QString>
+#include <map>
+#include <vector>
+
+namespace QTFTP
+{
+
+/**
+ * @brief The FileNameRewriter class rewrites the file names in read and write requests before they are looked up
+ *
+ * Rules are applied in the order they were added, each rule to the result of the previous one. A rule consists of
+ * flags, a pattern and a replacement:
+ * <pre>
+ *   p   the pattern is a literal prefix, a matching prefix is replaced by the replacement
+ *   r   the pattern is a regular expression, the first match is replaced (\0..\9 in the replacement insert captures)
+ *   i   ignore case when matching
+ *   g   (only with r) replace every match instead of the first one
+ *   e   stop rewriting when this rule matched
+ * </pre>
+ * A run of consecutive prefix rules is compiled into a trie and applied as one step in which the longest matching
+ * prefix wins, so the time to apply hundreds of prefix rules hardly depends on their number. A prefix rule that could
+ * match the result of an earlier rule of the run starts a new run, so that it is still applied to that result. Regular
+ * expression rules of the form ^literal without back-references in the replacement are treated as prefix rules, in a
+ * run of their own if their prefix overlaps one of the run. Results are cached per requested name.
+ */
+class FileNameRewriter
+{
+    public:
+        static constexpr int DefaultMaxCachedNames = 4096;
+
+        explicit FileNameRewriter(int maxCachedNames=DefaultMaxCachedNames);
+
+        void addRule(const QString &flags, const QString &pattern, const QString &replacement);
+        void loadRules(const QString &rulesFileName);
+        size_t ruleCount() const;
+        QString rewrite(const QString &fileName);
+
+    private:
+        struct Rule
+        {
+            public:
+                QString m_replacement;
+                QRegularExpression m_regex;   /// invalid for prefix rules
+                QString m_prefix;             /// empty for regular expression rules
+                bool m_ignoreCase;
+                bool m_global;
+                bool m_stop;
+        };
+
+        struct TrieNode
+        {
+            public:
+                std::map<ushort, uint32_t> m_children;  /// character -> index of child node
+                int m_ruleIndex;                        /// rule of the prefix that ends in this node, -1 if none
+        };
+
+        struct Stage
+        {
+            public:
+                int m_regexRule;                        /// -1 for a stage of prefix rules
+                std::vector<TrieNode> m_exactTrie;      /// prefix rules that match case
+                std::vector<TrieNode> m_foldedTrie;     /// prefix rules that ignore case, keys are lower case
+                std::vector<int> m_prefixRules;         /// indexes of the prefix rules in the tries
+        };
+
+        void addPrefixRule(const QString &prefix, bool ignoreCase, bool fromRegex, int ruleIndex);
+        bool fitsPrefixStage(const Stage &stage, const QString &prefix, bool ignoreCase, bool fromRegex) const;
+        static bool overlaps(const QString &first, const QString &second, bool ignoreCase);
+        int longestPrefix(const std::vector<TrieNode> &trie, const QString &fileName, bool foldCase, int &matchLength) const;
+        bool applyRegexRule(const Rule &rule, QString &fileName) const;
+        static QString expandReplacement(const QString &replacement, const QRegularExpressionMatch &match);
+        static bool literalPrefix(const QString &pattern, const QString &replacement, QString &prefix);
+
+        std::vector<Rule>  m_rules;
+        std::vector<Stage> m_stages;
+        QHash<QString, QString> m_cache;   /// requested name -> rewritten name
+        int m_maxCachedNames;
+};
+
+
+} // QTFTP namespace end
+
+#endif // FILENAMEREWRITER_H
@@ -0,0 +1,73 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <atomic>
+#include <cstdint>
+
+namespace QTFTP
+{
+
+/**
+ * @brief The Histogram class is a fixed size, lock-free log-linear histogram of unsigned integer values
+ *
+ * Values below 16 each have their own bucket. Above that every power of 2 is split into 8 linear sub-buckets,
+ * so the relative error of a value derived from the histogram is at most 12.5%. Values of 2^40 and larger are
+ * counted in the last bucket. All updates are relaxed atomic additions, so values can be recorded from any
+ * thread while another thread reads the histogram.
+ */
+class Histogram
+{
+    public:
+        static constexpr unsigned int SubBucketBits = 3;
+        static constexpr unsigned int SubBucketCount = 1u << SubBucketBits;
+        static constexpr unsigned int MaxExponent = 40;
+        static constexpr unsigned int BucketCount = 2 * SubBucketCount + (MaxExponent - SubBucketBits - 1) * SubBucketCount;
+
+        Histogram();
+        Histogram(const Histogram &) = delete;
+        Histogram &operator=(const Histogram &) = delete;
+
+        void record(uint64_t value);
+        void merge(const Histogram &otherHistogram);
+        void reset();
+
+        uint64_t count() const;
+        uint64_t sum() const;
+        uint64_t mean() const;
+        uint64_t percentile(double fraction) const;
+        uint64_t countBelow(uint64_t value) const;
+
+        uint64_t bucketValue(unsigned int bucketIndex) const;
+        static unsigned int bucketIndex(uint64_t value);
+        static uint64_t bucketLowerBound(unsigned int bucketIndex);
+
+    private:
+        std::atomic<uint64_t> m_buckets[BucketCount];
+        std::atomic<uint64_t> m_count;
+        std::atomic<uint64_t> m_sum;
+};
+
+
+} // QTFTP namespace end
+
+#endif // HISTOGRAM_H
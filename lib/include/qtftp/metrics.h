@@ -0,0 +1,214 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "qtftp/histogram.h"
+#include "qtftp/tftp_constants.h"
+#include <QHostAddress>
+#include <QByteArray>
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace QTFTP
+{
+
+/**
+ * @brief The Counter class is a lock-free, monotonically increasing metric value
+ */
+class Counter
+{
+    public:
+        Counter();
+        Counter(const Counter &) = delete;
+        Counter &operator=(const Counter &) = delete;
+
+        void add(uint64_t amount=1);
+        uint64_t value() const;
+
+    private:
+        std::atomic<uint64_t> m_value;
+};
+
+
+/**
+ * @brief The Gauge class is a lock-free metric value that can go up and down
+ */
+class Gauge
+{
+    public:
+        Gauge();
+        Gauge(const Gauge &) = delete;
+        Gauge &operator=(const Gauge &) = delete;
+
+        void add(int64_t amount=1);
+        void sub(int64_t amount=1);
+        void set(int64_t newValue);
+        int64_t value() const;
+
+    private:
+        std::atomic<int64_t> m_value;
+};
+
+
+/**
+ * @brief The BindingMetrics struct holds the metrics of one binding (listening address and port) of a TftpServer
+ *
+ * All durations are recorded in microseconds.
+ */
+struct BindingMetrics
+{
+    public:
+        static constexpr unsigned int ErrorCodeCount = TftpCode::OptionNegotiationAbort + 1;
+
+        BindingMetrics(const QHostAddress &bindAddress, uint16_t port);
+        BindingMetrics(const BindingMetrics &) = delete;
+        BindingMetrics &operator=(const BindingMetrics &) = delete;
+
+        const QHostAddress m_bindAddress;
+        const uint16_t     m_port;
+
+        Counter   m_readRequests;       /// RRQ datagrams received
+        Counter   m_writeRequests;      /// WRQ datagrams received, including those refused because uploads are not allowed
+        Gauge     m_activeSessions;
+        Counter   m_sessionsFinished;   /// sessions that completed successfully
+        Counter   m_sessionsFailed;
+        Counter   m_bytesSent;          /// all bytes sent by sessions, including retransmissions and error datagrams
+        Counter   m_datagramsSent;
+        Counter   m_retransmits;
+        Counter   m_sendsBlocked;       /// datagrams that could not be sent right away because the socket send buffer was full
+        Counter   m_receiveDrops;       /// datagrams the kernel dropped because the receive buffer of a socket was full
+        Gauge     m_receiveBufferBytes; /// receive buffer size of the listening socket, as reported by the kernel
+        Gauge     m_sendBufferBytes;    /// send buffer size of the listening socket, as reported by the kernel
+        Counter   m_bytesReceived;      /// file data received by uploads, excluding duplicates and protocol headers
+        Counter   m_errorsSent[ErrorCodeCount]; /// TFTP error datagrams sent, indexed by TFTP error code
+        Histogram m_ackRttUs;           /// time between sending a DATA datagram and receiving its ACK, merged when a session ends
+        Histogram m_receiveQueueDelayUs; /// time received datagrams waited in a session socket before they were read, needs kernel timestamps
+        Histogram m_sessionDurationUs;
+};
+
+
+/**
+ * @brief The SubnetLatency struct is a snapshot of the ACK latency statistics of one client subnet
+ */
+struct SubnetLatency
+{
+    public:
+        QHostAddress m_network;
+        int          m_prefixLength;
+        uint64_t     m_count;
+        uint64_t     m_sumUs;
+        uint64_t     m_p50Us;
+        uint64_t     m_p99Us;
+};
+
+
+/**
+ * @brief The AdmissionMetrics struct holds the metrics of the admission control of a TftpServer
+ *
+ * All durations are recorded in microseconds.
+ */
+struct AdmissionMetrics
+{
+    public:
+        Gauge     m_queuedRequests;     /// read requests waiting for a free session slot
+        Histogram m_queueWaitUs;        /// time read requests waited in the queue before their session was started
+        Counter   m_requestsRejected;   /// requests refused because no session slot was free and the queue was full
+        Counter   m_requestsExpired;    /// queued read requests dropped because they waited too long
+        Counter   m_requestsRateLimited; /// requests dropped because their client sent more requests per second than allowed
+};
+
+
+/**
+ * @brief The PacingMetrics struct holds the metrics of the Pacer of a TftpServer
+ *
+ * All durations are recorded in microseconds.
+ */
+struct PacingMetrics
+{
+    public:
+        Gauge     m_queuedDatagrams;    /// DATA datagrams waiting until the rate limits allow them to be sent
+        Histogram m_delayUs;            /// time delayed DATA datagrams waited before they were sent
+        Counter   m_datagramsDelayed;   /// DATA datagrams that could not be sent right away
+};
+
+
+/**
+ * @brief The ServerMetrics class collects the metrics of all bindings of a TftpServer
+ *
+ * Besides the metrics of each binding, ServerMetrics keeps server-wide and per client subnet aggregates of the
+ * ACK latency of all sessions.
+ */
+class ServerMetrics
+{
+    public:
+        static constexpr unsigned int MaxLatencySubnets = 4096;
+
+        ServerMetrics();
+        ServerMetrics(const ServerMetrics &) = delete;
+        ServerMetrics &operator=(const ServerMetrics &) = delete;
+
+        std::shared_ptr<BindingMetrics> addBinding(const QHostAddress &bindAddress, uint16_t port);
+        std::vector<std::shared_ptr<const BindingMetrics>> bindings() const;
+
+        void setLatencySubnetPrefixLengths(int ipv4PrefixLength, int ipv6PrefixLength);
+        void mergeAckDelays(BindingMetrics *binding, const QHostAddress &peerAddress, const Histogram &sessionAckDelays);
+        void resetAckDelays();
+        const Histogram &ackDelays() const;
+        std::vector<SubnetLatency> ackDelaysBySubnet() const;
+        Histogram &eventLoopLag();
+        const Histogram &eventLoopLag() const;
+        AdmissionMetrics &admission();
+        const AdmissionMetrics &admission() const;
+        std::shared_ptr<PacingMetrics> pacing();
+        const PacingMetrics &pacing() const;
+        int64_t activeSessions() const;
+
+        QByteArray toPrometheusText() const;
+
+    private:
+        struct SubnetEntry
+        {
+            public:
+                QHostAddress m_network;
+                int          m_prefixLength;
+                std::unique_ptr<Histogram> m_ackDelays;
+        };
+
+        std::vector<std::shared_ptr<BindingMetrics>> m_bindings;
+        Histogram m_ackDelays;              /// ACK delays in us of all sessions of all bindings
+        Histogram m_eventLoopLagUs;         /// recorded by the EventLoopLagMonitor of the server
+        AdmissionMetrics m_admission;
+        int m_ipv4SubnetPrefixLength;
+        int m_ipv6SubnetPrefixLength;
+        mutable std::mutex m_subnetMutex;   /// protects m_subnets
+        std::map<QString, SubnetEntry> m_subnets;
+        std::shared_ptr<PacingMetrics> m_pacing;  /// shared with the Pacer, which may outlive the server with its sessions
+};
+
+
+} // QTFTP namespace end
+
+#endif // METRICS_H
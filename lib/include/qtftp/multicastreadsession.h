@@ -0,0 +1,96 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#ifndef MULTICASTREADSESSION_H
+#define MULTICASTREADSESSION_H
+
+#include "qtftp/readsession.h"
+#include <QHostAddress>
+#include <vector>
+
+namespace QTFTP
+{
+
+/**
+ * @brief The MulticastReadSession class sends one file to a group of clients with TFTP multicast (RFC2090)
+ *
+ * DATA datagrams are sent to a multicast group. One client of the group, the master client, acknowledges each
+ * block. Clients that request the same file while the transfer is in progress join the group and collect the
+ * blocks sent for the master client. When the master client has received the whole file, the next client in
+ * the group becomes master and reports the first block it is missing, from which the transfer continues.
+ * The session finishes when the last client of the group has left.
+ *
+ * Multicast is only used for octet mode transfers to IPv4 clients. If the multicast option can't be
+ * acknowledged the session behaves like a unicast ReadSession for its first client.
+ */
+class MulticastReadSession : public ReadSession
+{
+    Q_OBJECT
+
+    public:
+        MulticastReadSession(const QHostAddress &peerAddr, uint16_t peerPort, QByteArray rrqDatagram, QString filesDir,
+                             const QHostAddress &groupAddress, uint16_t groupPort, unsigned int slowNetworkThresholdUs,
+                             std::shared_ptr<UdpSocketFactory> socketFactory=std::make_shared<UdpSocketFactory>(),
+                             std::shared_ptr<BindingMetrics> metrics=nullptr, std::shared_ptr<TransferGroupRegistry> transferGroups=nullptr,
+                             BlockSourceProviders providers=BlockSourceProviders(), std::shared_ptr<DirectoryProvider> directoryProvider=nullptr,
+                             const QHostAddress &localAddr=QHostAddress(QHostAddress::Any), std::shared_ptr<Pacer> pacer=nullptr,
+                             std::shared_ptr<SendScheduler> scheduler=nullptr);
+
+        bool isMulticast() const;
+        const QHostAddress &groupAddress() const;
+        uint16_t groupPort() const;
+        bool hasClient(const SessionIdent &client) const;
+        size_t clientCount() const;
+        bool addClient(const QHostAddress &peerAddr, uint16_t peerPort, const QByteArray &rrqDatagram, const QString &filesDir,
+                       const BlockSourceProviders &providers=BlockSourceProviders(), const std::shared_ptr<DirectoryProvider> &directoryProvider=nullptr);
+
+    signals:
+        void clientJoined(QHostAddress peerAddr, quint16 peerPort);
+
+    protected slots:
+        void dataReceived() override;
+        void retransmitData() override;
+
+    protected:
+        bool handleExtraOption(const QString &optionName, const QString &optionValue, QByteArray &oackDatagram) override;
+        void sendDataDatagram(const QByteArray &datagram) override;
+        unsigned int maxWindowSize() const override;
+        void retransmitLimitReached() override;
+
+    private:
+        QByteArray assembleMulticastOption(bool isMaster) const;
+        void sendMasterOack();
+        void removeClient(std::vector<SessionIdent>::iterator client, bool hasCompleted);
+        uint16_t lastBlockNr() const;
+
+        QHostAddress m_groupAddress;
+        uint16_t     m_groupPort;
+        bool         m_multicastAllowed;     /// file and transfer mode are suitable for multicast
+        bool         m_isMulticast;          /// multicast option was acknowledged
+        bool         m_waitingForMaster;     /// new master client was selected, but has not reported its first missing block yet
+        unsigned int m_completedClients;
+        QString      m_shareKey;             /// share key of the source of the file, clients join if their request resolves to the same key
+        std::vector<SessionIdent> m_clients; /// clients that are still receiving, the first one is the master client
+};
+
+
+} // QTFTP namespace end
+
+#endif // MULTICASTREADSESSION_H
@@ -0,0 +1,142 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#ifndef PACER_H
+#define PACER_H
+
+#include <QObject>
+#include <QHash>
+#include <QHostAddress>
+#include <QTimer>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <vector>
+
+namespace QTFTP
+{
+
+class Session;
+struct BindingMetrics;
+struct PacingMetrics;
+
+
+/**
+ * @brief The TokenBucket class limits a byte rate while allowing bursts up to a maximum size
+ *
+ * The bucket is refilled at the configured rate up to the burst size. A datagram may be sent as soon as the
+ * bucket is not empty; sending it may leave the bucket in debt, so datagrams larger than the burst size still pass.
+ */
+class TokenBucket
+{
+    public:
+        TokenBucket();
+
+        void setRate(uint64_t bytesPerSecond, uint64_t burstBytes=0);
+        bool isLimited() const;
+        std::chrono::nanoseconds delay(std::chrono::steady_clock::time_point now);
+        void consume(uint64_t bytes);
+        bool isFull(std::chrono::steady_clock::time_point now);
+
+    private:
+        void refill(std::chrono::steady_clock::time_point now);
+
+        uint64_t m_rate;     /// bytes per second, 0 if not limited
+        double   m_burst;
+        double   m_tokens;   /// negative while in debt
+        std::chrono::steady_clock::time_point m_lastRefill;
+};
+
+
+/**
+ * @brief The Pacer class spreads the DATA datagrams of all sessions of a server over time
+ *
+ * Rates are limited by a hierarchy of token buckets: server-wide, per binding, per client subnet and per session.
+ * A datagram is sent when all buckets on its path allow it; otherwise it is queued and sent from a precise timer as
+ * soon as the buckets are refilled. Datagrams of one session are sent in the order they were queued. Without any
+ * limit configured the pacer sends every datagram right away.
+ */
+class Pacer : public QObject
+{
+    Q_OBJECT
+
+    public:
+        static constexpr unsigned int DefaultBurstMs = 20;       /// burst size used when none is given, in ms worth of the rate
+        static constexpr int MaxSubnetBuckets = 4096;            /// idle subnet buckets are removed beyond this nr
+
+        explicit Pacer(std::shared_ptr<PacingMetrics> metrics, QObject *parent=nullptr);
+
+        void setGlobalRate(uint64_t bytesPerSecond, uint64_t burstBytes=0);
+        void setBindingRate(const BindingMetrics *binding, uint64_t bytesPerSecond, uint64_t burstBytes=0);
+        void setSubnetRate(uint64_t bytesPerSecond, uint64_t burstBytes=0, int ipv4PrefixLength=24, int ipv6PrefixLength=64);
+        void setSessionRate(uint64_t bytesPerSecond, uint64_t burstBytes=0);
+        bool isEnabled() const;
+        void initSessionBucket(TokenBucket &sessionBucket) const;
+
+        bool admit(const Session *session, TokenBucket &sessionBucket, const BindingMetrics *binding, const QHostAddress &peerAddress,
+                   uint64_t bytes, std::function<void()> deferredSend);
+        void cancel(const Session *session);
+        size_t queuedCount() const;
+
+    private slots:
+        void sendDue();
+
+    private:
+        struct QueuedSend
+        {
+            public:
+                const Session *m_session;     /// null once sent or cancelled
+                TokenBucket   *m_sessionBucket;
+                const BindingMetrics *m_binding;
+                QHostAddress   m_subnet;
+                uint64_t       m_bytes;
+                std::function<void()> m_send;
+                std::chrono::steady_clock::time_point m_queuedAt;
+        };
+
+        QHostAddress subnetOf(const QHostAddress &peerAddress) const;
+        TokenBucket *subnetBucket(const QHostAddress &subnet, std::chrono::steady_clock::time_point now);
+        std::chrono::nanoseconds delay(TokenBucket &sessionBucket, const BindingMetrics *binding, const QHostAddress &subnet,
+                                       std::chrono::steady_clock::time_point now);
+        void consume(TokenBucket &sessionBucket, const BindingMetrics *binding, const QHostAddress &subnet, uint64_t bytes);
+        void startTimer(std::chrono::nanoseconds delay);
+        void removeSentEntries();
+
+        std::shared_ptr<PacingMetrics> m_metrics;
+        QTimer       m_timer;
+        TokenBucket  m_globalBucket;
+        std::map<const BindingMetrics*, TokenBucket> m_bindingBuckets;
+        uint64_t     m_subnetRate;
+        uint64_t     m_subnetBurst;
+        int          m_ipv4SubnetPrefixLength;
+        int          m_ipv6SubnetPrefixLength;
+        QHash<QHostAddress, TokenBucket> m_subnetBuckets;
+        uint64_t     m_sessionRate;
+        uint64_t     m_sessionBurst;
+        std::vector<QueuedSend> m_queue;         /// oldest first
+        QHash<const Session*, unsigned int> m_queuedPerSession;
+        bool         m_sending;                  /// true while sendDue() calls the send functions of queued entries
+};
+
+
+} // QTFTP namespace end
+
+#endif // PACER_H
@@ -0,0 +1,122 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#ifndef PACKFILE_H
+#define PACKFILE_H
+
+#include "qtftp/blocksource.h"
+#include <QFile>
+#include <QString>
+#include <cstdint>
+#include <memory>
+
+namespace QTFTP
+{
+
+/**
+ * @brief The PackFileHeader struct is written at the start of a pack file
+ *
+ * A pack file consists of a PackFileHeader, a hash table of m_slotCount PackSlot records, the file names
+ * (UTF-8, not terminated) and the file contents. All values are in host byte order.
+ */
+struct PackFileHeader
+{
+    public:
+        char     m_magic[8];        /// "QTFTPPAK"
+        uint32_t m_version;
+        uint32_t m_fileCount;
+        uint32_t m_slotCount;       /// power of 2
+        uint32_t m_slotSize;        /// sizeof(PackSlot)
+        uint64_t m_slotsOffset;
+};
+
+/**
+ * @brief The PackSlot struct is one slot of the open addressing hash table of a pack file, empty if m_nameLength is 0
+ */
+struct PackSlot
+{
+    public:
+        uint64_t m_nameHash;        /// FNV-1a hash of the file name
+        uint64_t m_nameOffset;
+        uint64_t m_dataOffset;
+        uint64_t m_dataSize;
+        uint32_t m_nameLength;
+        uint32_t m_reserved;
+};
+
+static_assert(sizeof(PackFileHeader) == 32, "PackFileHeader is part of the pack file format and must be 32 bytes");
+static_assert(sizeof(PackSlot) == 40, "PackSlot is part of the pack file format and must be 40 bytes");
+
+constexpr uint32_t PackFileVersion = 1;
+
+
+/**
+ * @brief The PackFile class gives access to the files in a read-only pack file
+ *
+ * The pack file is memory mapped when it is opened. Looking up a file is one hash table probe in the mapped
+ * memory, no file system access is needed. The pack file must not be modified while it is open; to update
+ * it, build a new pack file and rename it over the old one, then restart qtftpd.
+ */
+class PackFile
+{
+    public:
+        explicit PackFile(const QString &packPath);
+        PackFile(const PackFile&) = delete;
+        PackFile &operator=(const PackFile&) = delete;
+
+        bool open();
+        QString errorString() const;
+        QString path() const;
+        uint32_t fileCount() const;
+        bool find(const QString &fileName, const char **data, qint64 *size) const;
+
+        static QString normalizedName(const QString &fileName);
+        static bool build(const QString &sourceDir, const QString &packPath, QString *errorString=nullptr);
+
+    private:
+        static uint64_t nameHash(const QByteArray &name);
+
+        QFile                 m_file;
+        const uchar          *m_map;
+        qint64                m_mapSize;
+        const PackFileHeader *m_header;
+        const PackSlot       *m_slots;
+        QString               m_errorString;
+};
+
+
+/**
+ * @brief The PackProvider class provides the files of a pack file
+ */
+class PackProvider : public BlockSourceProvider
+{
+    public:
+        explicit PackProvider(std::shared_ptr<const PackFile> packFile);
+
+        std::shared_ptr<BlockSource> find(const QString &fileName, const QHostAddress &peerAddr) override;
+
+    private:
+        std::shared_ptr<const PackFile> m_packFile;
+};
+
+
+} // QTFTP namespace end
+
+#endif // PACKFILE_H
@@ -23,8 +23,11 @@
 
 #include "qtftp/session.h"
 #include "qtftp/udpsocketfactory.h"
+#include "qtftp/transfergroup.h"
+#include "qtftp/blocksource.h"
+#include "qtftp/congestioncontroller.h"
 #include <QByteArray>
-#include <chrono>
+#include <QTimer>
 
 namespace QTFTP
 {
@@ -35,11 +38,20 @@ class ReadSession : public Session
     Q_OBJECT
 
     public:
+        static constexpr unsigned int MaxWindowSize = 64;          /// max accepted value of the windowsize option (RFC7440)
+
         ReadSession(const QHostAddress &peerAddr, uint16_t peerPort, QByteArray rrqDatagram, QString filesDir,
-                    unsigned int slowNetworkThresholdUs, std::shared_ptr<UdpSocketFactory> socketFactory=std::make_shared<UdpSocketFactory>());
+                    unsigned int slowNetworkThresholdUs, std::shared_ptr<UdpSocketFactory> socketFactory=std::make_shared<UdpSocketFactory>(),
+                    std::shared_ptr<BindingMetrics> metrics=nullptr, std::shared_ptr<TransferGroupRegistry> transferGroups=nullptr,
+                    BlockSourceProviders providers=BlockSourceProviders(), std::shared_ptr<DirectoryProvider> directoryProvider=nullptr,
+                    const QHostAddress &localAddr=QHostAddress(QHostAddress::Any), std::shared_ptr<Pacer> pacer=nullptr,
+                    std::shared_ptr<SendScheduler> scheduler=nullptr);
 
         unsigned averageAckDelayUs() const;
         uint16_t currBlockNr() const;
+        unsigned int blockSize() const;
+        unsigned int windowSize() const;
+        unsigned int congestionWindow() const;
 
     signals:
         void progress(unsigned int progressPerc);
@@ -48,18 +60,56 @@ class ReadSession : public Session
         void dataReceived() override;
         void retransmitData() override;
 
+    protected:
+        ReadSession(const QHostAddress &peerAddr, uint16_t peerPort, unsigned int slowNetworkThresholdUs,
+                    std::shared_ptr<UdpSocketFactory> socketFactory, std::shared_ptr<BindingMetrics> metrics,
+                    std::shared_ptr<TransferGroupRegistry> transferGroups, BlockSourceProviders providers,
+                    std::shared_ptr<DirectoryProvider> directoryProvider, const QHostAddress &localAddr, std::shared_ptr<Pacer> pacer,
+                    std::shared_ptr<SendScheduler> scheduler);
+
+        bool parseRrq(const QByteArray &rrqDatagram, const QString &filesDir, unsigned int &optionsOffset);
+        bool handleRrqOptions(const QByteArray &rrqDgram, unsigned int offset);
+        virtual bool handleExtraOption(const QString &optionName, const QString &optionValue, QByteArray &oackDatagram);
+        virtual void sendDataDatagram(const QByteArray &datagram);
+        virtual unsigned int maxWindowSize() const;
+        void sendBufferFull() override;
+        void handleAck(uint16_t ackBlockNr);
+        void restartFromBlock(uint16_t blockNr);
+        bool lastBlockSent() const;
+        qint64 transferSize() const;
+        QString sourceShareKey() const;
+        static std::shared_ptr<BlockSource> lookupBlockSource(const BlockSourceProviders &providers, const std::shared_ptr<DirectoryProvider> &directoryProvider,
+                                                              const QString &fileName, const QString &filesDir, const QHostAddress &peerAddr);
+
+    private slots:
+        void sendSpacedBlock();
+
     private:
+        std::shared_ptr<BlockSource> findBlockSource(const QString &fileName, const QString &filesDir) const;
         void loadNextBlock();
         void sendDataPacket(bool isRetransmit=false);
-        bool handleRrqOptions(const QByteArray &rrqDgram, unsigned int offset);
+        void handleWindowAck(uint16_t ackBlockNr);
+        void sendWindow();
+        bool sendNextWindowBlock();
+        void checkSlowNetwork();
 
         uint16_t     m_blockNr;
+        uint32_t     m_nextBlockIndex;      /// index in the file of the next block to load, does not wrap like m_blockNr
         unsigned int m_blockSize;
+        unsigned int m_windowSize;          /// negotiated windowsize, 1 for lock-step transfers
+        uint32_t     m_windowAckIndex;      /// index of the first block of the window that is not acknowledged yet
+        uint32_t     m_windowEndIndex;      /// index after the last block of the window that is being sent
+        uint32_t     m_windowHighIndex;     /// index after the last block that was ever sent, blocks before it are retransmits
+        bool         m_windowResent;        /// the window was sent again for an ACK that reported missing blocks
+        CongestionController m_congestion;  /// nr of blocks of a window that may be sent without spacing them out
+        QTimer       m_windowTimer;         /// spaces out the blocks of a window beyond the congestion window
         QByteArray   m_blockToSend;
-        QByteArray   m_asciiOverflowBuffer; /// used if block size is exceeded after CR/LF conversions
-        char         m_lastCharRead;        ///needed for CR/LF conversion in netascii mode
-        std::chrono::high_resolution_clock::time_point m_previousSendTime;
-        std::vector<unsigned int> m_ackTimes; /// used to calculate average time delay between data sent and ack received
+        BlockSourceProviders m_providers;    /// asked for the requested file before the files directory
+        std::shared_ptr<DirectoryProvider> m_directoryProvider;   /// provides the files directory of the binding, may be null
+        std::shared_ptr<BlockSource> m_blockSource;
+        std::shared_ptr<TransferGroupRegistry> m_transferGroups; /// may be null, then this session has a group of its own
+        std::shared_ptr<TransferGroup> m_transferGroup;          /// produces the data blocks, shared with sessions for the same file
+        bool         m_ackDelayAmbiguous;   /// a block was sent again since the last ACK, so its delay is no sample (Karn's rule)
         bool         m_slowNetworkReported;
         unsigned int m_slowNetworkThresholdUs; /// threshold for time between data package sending and ack receipt
 };
@@ -0,0 +1,67 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#ifndef REQUESTRATELIMITER_H
+#define REQUESTRATELIMITER_H
+
+#include <QHostAddress>
+#include <array>
+#include <chrono>
+#include <cstdint>
+
+namespace QTFTP
+{
+
+/**
+ * @brief The RequestRateLimiter class limits the nr of requests per second of each client address
+ *
+ * The request counts are kept in a count-min sketch: Depth rows of Width counters, each row indexed by a hash of the
+ * client address with a seed of its own. The estimated count of an address is the lowest of its counters, which is
+ * never less than the real count and only more when addresses collide in every row. The memory used is fixed, also
+ * when a flood of requests comes from spoofed, ever changing addresses. All counters are halved every
+ * DecayIntervalMs, so a steady rate of r requests per second settles at a count of about r.
+ */
+class RequestRateLimiter
+{
+    public:
+        static constexpr unsigned int Depth = 4;
+        static constexpr unsigned int Width = 4096;              /// must be a power of 2
+        static constexpr unsigned int DecayIntervalMs = 500;
+
+        RequestRateLimiter();
+
+        void setMaxRequestsPerSecond(unsigned int maxRequests);
+        unsigned int maxRequestsPerSecond() const;
+        bool allow(const QHostAddress &peerAddress, std::chrono::steady_clock::time_point now=std::chrono::steady_clock::now());
+        unsigned int estimate(const QHostAddress &peerAddress) const;
+
+    private:
+        void decay(std::chrono::steady_clock::time_point now);
+
+        unsigned int m_maxRequests;         /// per second, 0 if not limited
+        std::array<uint32_t, Depth> m_seeds;
+        std::array<std::array<uint16_t, Width>, Depth> m_counters;
+        std::chrono::steady_clock::time_point m_lastDecay;
+};
+
+
+} // QTFTP namespace end
+
+#endif // REQUESTRATELIMITER_H
@@ -0,0 +1,95 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#ifndef SENDQUEUE_H
+#define SENDQUEUE_H
+
+#include <QObject>
+#include <QHostAddress>
+#include <QTimer>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace QTFTP
+{
+
+class AbstractSocket;
+
+
+/**
+ * @brief The SendQueue class writes datagrams to a socket and parks them while the socket can't accept more
+ *
+ * Under load the kernel may refuse a datagram because the send buffer of the socket or the queue of the network
+ * interface is full (EAGAIN, ENOBUFS). Such a datagram is kept, together with all datagrams sent after it, and the
+ * queue resumes sending when the socket reports it is writable again. If it is still refused then, the queue retries
+ * every RetryIntervalMs. Datagrams are always written in the order they were sent. The queue gives up when it could
+ * not write a datagram for longer than MaxBlockedMs, more than MaxQueuedDatagrams are waiting or the socket reports a
+ * permanent error: it drops all datagrams and emits sendFailed() from the event loop. send() never throws, so a send
+ * error can't escape from the event loop.
+ */
+class SendQueue : public QObject
+{
+    Q_OBJECT
+
+    public:
+        static constexpr size_t MaxQueuedDatagrams = 256;
+        static constexpr int RetryIntervalMs = 10;
+        static constexpr int MaxBlockedMs = 5000;
+
+        explicit SendQueue(std::shared_ptr<AbstractSocket> socket, QObject *parent=nullptr);
+
+        void send(const QByteArray &datagram, const QHostAddress &address, quint16 port, std::function<void()> sentCallback);
+        bool isBlocked() const;
+        size_t queuedCount() const;
+
+    signals:
+        void blocked();
+        void sendFailed(QString errMsg);
+
+    private slots:
+        void resume();
+
+    private:
+        struct QueuedDatagram
+        {
+            public:
+                QByteArray            m_datagram;
+                QHostAddress          m_address;
+                quint16               m_port;
+                std::function<void()> m_sent;
+        };
+
+        bool write(const QueuedDatagram &queuedDatagram);
+        void fail(const std::string &errMsg);
+
+        std::shared_ptr<AbstractSocket> m_socket;
+        std::deque<QueuedDatagram> m_queue;         /// oldest first
+        QTimer       m_retryTimer;
+        bool         m_failed;      /// the queue gave up, datagrams are dropped
+        std::chrono::steady_clock::time_point m_blockedSince;   /// time the queue was blocked, or last wrote a datagram
+};
+
+
+} // QTFTP namespace end
+
+#endif // SENDQUEUE_H
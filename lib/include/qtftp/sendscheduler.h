@@ -0,0 +1,104 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#ifndef SENDSCHEDULER_H
+#define SENDSCHEDULER_H
+
+#include <QObject>
+#include <QTimer>
+#include <deque>
+#include <functional>
+#include <map>
+
+namespace QTFTP
+{
+
+class Session;
+struct BindingMetrics;
+
+
+/**
+ * @brief The SendScheduler class shares the sending of DATA datagrams fairly between sessions
+ *
+ * At most roundBytes() are sent in one pass of the event loop, so ACKs of other sessions are handled between large
+ * windows of blocks. A datagram that doesn't fit in the current pass is queued. In the next pass the queued
+ * datagrams of priority transfers (small files) are sent first, one datagram per transfer in turn. The others are
+ * sent by deficit round-robin: in each round a session may send Quantum bytes times the weight of its binding.
+ * Datagrams of one session are always sent in the order they were scheduled.
+ */
+class SendScheduler : public QObject
+{
+    Q_OBJECT
+
+    public:
+        static constexpr uint64_t DefaultRoundBytes = 256 * 1024;  /// nr of bytes sent in one pass of the event loop
+        static constexpr uint64_t Quantum = 8 * 1024;              /// nr of bytes a session of weight 1 may send per round
+
+        explicit SendScheduler(QObject *parent=nullptr);
+
+        void setRoundBytes(uint64_t roundBytes);
+        uint64_t roundBytes() const;
+        void setBindingWeight(const BindingMetrics *binding, unsigned int weight);
+        void setPriorityTransferSize(int64_t maxTransferSize);
+        bool isPriorityTransfer(int64_t transferSize) const;
+
+        bool schedule(const Session *session, const BindingMetrics *binding, bool isPriority, uint64_t bytes,
+                      std::function<void()> deferredSend);
+        void cancel(const Session *session);
+        size_t queuedCount() const;
+
+    private slots:
+        void sendRound();
+
+    private:
+        struct QueuedSend
+        {
+            public:
+                uint64_t              m_bytes;
+                std::function<void()> m_send;
+        };
+
+        struct Flow
+        {
+            public:
+                std::deque<QueuedSend> m_queue;
+                uint64_t     m_deficit;      /// nr of bytes the session may still send in this round
+                unsigned int m_weight;
+                bool         m_hasQuantum;   /// true when the quantum of this round was added to m_deficit
+        };
+
+        void sendFirst(Flow &flow);
+        void startTurnTimer();
+
+        QTimer       m_timer;              /// starts the next pass
+        uint64_t     m_roundBytes;
+        uint64_t     m_turnBytes;          /// nr of bytes sent in the current pass of the event loop
+        int64_t      m_priorityTransferSize; /// transfers up to this size have priority, 0 for none
+        std::map<const BindingMetrics*, unsigned int> m_bindingWeights;
+        std::map<const Session*, Flow> m_flows;
+        std::deque<const Session*> m_priorityFlows;
+        std::deque<const Session*> m_activeFlows;   /// deficit round-robin order
+        bool         m_sending;            /// true while sendRound() calls the send functions of queued datagrams
+};
+
+
+} // QTFTP namespace end
+
+#endif // SENDSCHEDULER_H
@@ -22,9 +22,16 @@
 #define SESSION_H
 
 #include "qtftp/tftp_constants.h"
+#include "qtftp/histogram.h"
+#include "qtftp/pacer.h"
+#include "qtftp/sendscheduler.h"
+#include "qtftp/sendqueue.h"
 #include <QHostAddress>
 #include <QFile>
 #include <QTimer>
+#include <atomic>
+#include <chrono>
+#include <functional>
 #include <memory>
 
 
@@ -34,6 +41,7 @@ namespace QTFTP
 
 class AbstractSocket;
 class UdpSocketFactory;
+struct BindingMetrics;
 
 /**
  * @brief The SessionIdent struct uniquely identifies a TFTP session
@@ -61,10 +69,13 @@ class Session : public QObject
         enum class State { OptionsNegotation, Busy, Finished, InError };
 
         Session(const QHostAddress &peerAddr, uint16_t peerPort,
-                std::shared_ptr<UdpSocketFactory> socketFactory, QObject *parent=nullptr);
+                std::shared_ptr<UdpSocketFactory> socketFactory, std::shared_ptr<BindingMetrics> metrics=nullptr,
+                const QHostAddress &localAddr=QHostAddress(QHostAddress::Any), std::shared_ptr<Pacer> pacer=nullptr,
+                std::shared_ptr<SendScheduler> scheduler=nullptr, QObject *parent=nullptr);
         ~Session();
 
         State   state() const;
+        uint32_t sessionId() const;
         QString filePath() const;
         bool    fileExists() const;
         bool    atEndOfFile() const;
@@ -75,11 +86,19 @@ class Session : public QObject
         QString lastFileError() const;
         TftpCode::Mode transferMode() const;
         const SessionIdent &peerIdent() const;
+        const Histogram &ackDelays() const;
+        BindingMetrics *metrics() const;
+        uint64_t bytesSent() const;
+        unsigned int totalRetransmits() const;
+        qint64  durationMs() const;
         bool operator==(const SessionIdent &sessionIdent) const;
         bool operator==(const Session &otherSession) const;
 
         bool    openFile(QIODevice::OpenModeFlag openMode);
         bool    readFromFile(QByteArray &buffer, qint64 maxSize);
+        void    setSocketBufferSizes(int receiveBytes, int sendBytes);
+        uint32_t collectReceiveDrops();
+        void    setKernelTimestamping(bool enabled);
         static void setRetransmitTimeOut(unsigned int newTimeOut);
         static void setMaxRetransmissions(unsigned int newMax);
 
@@ -88,12 +107,21 @@ class Session : public QObject
 
         void setTransferMode(TftpCode::Mode newMode);
         void setFilePath(const QString &directory, const QString &fileName);
+        void setFilePath(const QString &filePath);
         void setState(State newState, QString msg=QString());
         void readDatagram(QByteArray &datagram, QHostAddress *peerAddress=nullptr, quint16 *peerPort=nullptr);
         void sendDatagram(QByteArray datagram, bool startRetransmitTimer=false);
+        void sendDatagramTo(QByteArray datagram, const QHostAddress &address, uint16_t port, bool startRetransmitTimer=false);
+        void startRetransmitTimer();
         void stopRetransmitTimer();
         void resetRetransmitCounter();
+        unsigned int retransmitCount() const;
+        void recordAckDelay(uint64_t delayUs);
+        uint64_t roundTripUs() const;
+        void classifyTransfer(int64_t transferSize);
         virtual void retransmitData() = 0;
+        virtual void retransmitLimitReached();
+        virtual void sendBufferFull();
 
 
     protected slots:
@@ -101,6 +129,7 @@ class Session : public QObject
 
     private slots:
         void handleExpiredRetransmitTimer();
+        void handleSendBlocked();
 
     signals:
         void finished();
@@ -108,13 +137,36 @@ class Session : public QObject
         void slowNetwork();
 
     private:
+        void updateMetricsAtEnd(State endState);
+        void sendPacedDatagram(const QByteArray &datagram, const QHostAddress &address, uint16_t port, bool startRetransmitTimer);
+        void transmitDatagram(const QByteArray &datagram, const QHostAddress &address, uint16_t port, bool startRetransmitTimer);
+        void datagramSent(const QByteArray &datagram, bool startRetransmitTimer);
+        std::function<void()> deferredSend(std::function<void()> sendFunction);
+
         QFile               m_file; //file to read or write
         std::shared_ptr<AbstractSocket> m_sessionSocket;
+        SendQueue           m_sendQueue;   //parks datagrams while the send buffer of m_sessionSocket is full
         QTimer              m_retransmitTimer;  //to check for timeout on receiving ACK
         unsigned int        m_retransmitCount;
         SessionIdent        m_peerIdent;
         TftpCode::Mode      m_transferMode;
         State               m_state;
+        uint32_t            m_sessionId;   //unique id of this session, used to correlate trace events
+        std::shared_ptr<BindingMetrics> m_metrics; //metrics of the binding that received the request, may be null
+        std::chrono::steady_clock::time_point m_startTime;
+        std::chrono::steady_clock::time_point m_endTime;   //time the session finished or failed
+        uint64_t            m_bytesSent;
+        unsigned int        m_totalRetransmits;
+        Histogram           m_ackDelays;   //time between sending a datagram and receiving its ACK in us
+        std::shared_ptr<Pacer> m_pacer;    //spreads DATA datagrams over time, may be null
+        TokenBucket         m_pacingBucket; //rate limit of this session, see Pacer::setSessionRate()
+        std::shared_ptr<SendScheduler> m_scheduler; //shares sending DATA datagrams between sessions, may be null
+        bool                m_isPriorityTransfer;   //see SendScheduler::isPriorityTransfer()
+        uint32_t            m_receiveDrops;  //drop count of the session socket at the previous collectReceiveDrops()
+        bool                m_kernelTimestamps;  //the session socket reports kernel receive timestamps
+        std::chrono::steady_clock::time_point m_lastSendTime;     //time the last DATA datagram was written to the session socket
+        std::chrono::steady_clock::time_point m_lastReceiveTime;  //time the kernel received the last datagram that was read
+        static std::atomic<uint32_t> m_nextSessionId;
         static unsigned int m_retransmitTimeOut;
         static unsigned int m_maxRetransmissions;
 };
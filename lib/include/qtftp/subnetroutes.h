@@ -0,0 +1,80 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#ifndef SUBNETROUTES_H
+#define SUBNETROUTES_H
+
+#include "qtftp/blocksource.h"
+#include <QHostAddress>
+#include <QString>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <vector>
+
+namespace QTFTP
+{
+
+/**
+ * @brief The SubnetRoutes class selects the files directory for a read request by the address of the client
+ *
+ * Each route maps a client subnet (IPv4 or IPv6 prefix) to a files directory. The routes are stored in one binary
+ * trie per address family, so finding the route with the longest matching prefix takes at most 32 (IPv4) or 128
+ * (IPv6) steps, however many routes there are. IPv4-mapped IPv6 addresses are looked up as IPv4 addresses.
+ *
+ * Routes with the same files directory share one DirectoryProvider, so each directory is indexed only once.
+ */
+class SubnetRoutes
+{
+    public:
+        struct Route
+        {
+            public:
+                QString m_filesDir;
+                std::shared_ptr<DirectoryProvider> m_directoryProvider;
+        };
+
+        SubnetRoutes();
+
+        void addRoute(const QHostAddress &network, int prefixLength, const QString &filesDir);
+        void loadRoutes(const QString &routesFileName, const QString &baseDir=QString());
+        size_t routeCount() const;
+        const Route *find(const QHostAddress &peerAddr) const;
+
+    private:
+        struct TrieNode
+        {
+            public:
+                uint32_t m_children[2];  /// index of the child node for bit value 0 and 1, 0 if none (the root is never a child)
+                int m_routeIndex;        /// route of the prefix that ends in this node, -1 if none
+        };
+
+        static int longestMatch(const std::vector<TrieNode> &trie, const uint8_t *addrBytes, int addrBits);
+
+        std::vector<Route>    m_routes;
+        std::vector<TrieNode> m_ipv4Trie;
+        std::vector<TrieNode> m_ipv6Trie;
+        std::map<QString, std::shared_ptr<DirectoryProvider>> m_providers;  /// files directory -> provider
+};
+
+
+} // QTFTP namespace end
+
+#endif // SUBNETROUTES_H
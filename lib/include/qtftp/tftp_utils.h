@@ -61,15 +61,18 @@ inline void assignWordInByteArray(QByteArray &byteArray, unsigned int indexInByt
  * @return the word value at index \p indexInByteArray in \p byteArray
  * @pre byteArray.size() >= (indexInByteArray+1)
  */
-inline uint16_t readWordInByteArray(QByteArray &byteArray, unsigned int indexInByteArray)
+inline uint16_t readWordInByteArray(const QByteArray &byteArray, unsigned int indexInByteArray)
 {
     assert( indexInByteArray % 2 == 0 ); //index should be even location in bytearray
-    uint16_t *wordArrayPtr = reinterpret_cast<uint16_t*>( byteArray.data() );
+    const uint16_t *wordArrayPtr = reinterpret_cast<const uint16_t*>( byteArray.constData() );
     return wordArrayPtr[indexInByteArray/2];
 }
 
 
 QByteArray assembleTftpErrorDatagram(TftpCode::ErrorCode ec, const QString &errMsg);
+QString rrqFileName(const QByteArray &rrqDatagram);
+bool findRrqOption(const QByteArray &rrqDatagram, const QString &optionName, QString *optionValue=nullptr);
+QHostAddress subnetAddress(const QHostAddress &address, int ipv4PrefixLength, int ipv6PrefixLength, int &prefixLength);
 
 
 } // QTFTP namespace end
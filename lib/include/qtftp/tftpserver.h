@@ -22,8 +22,21 @@
 #define QTFTPSERVER_H
 
 #include "qtftp/udpsocket.h"
+#include "qtftp/metrics.h"
+#include "qtftp/eventlooplagmonitor.h"
+#include "qtftp/transfergroup.h"
+#include "qtftp/blocksource.h"
+#include "qtftp/filenamerewriter.h"
+#include "qtftp/subnetroutes.h"
+#include "qtftp/pacer.h"
+#include "qtftp/sendscheduler.h"
+#include "qtftp/requestratelimiter.h"
 #include <QObject>
+#include <QHash>
 #include <QHostAddress>
+#include <QTimer>
+#include <chrono>
+#include <deque>
 #include <memory>
 #include <vector>
 #include <map>
@@ -38,6 +51,9 @@ constexpr int DefaultTftpPortNr = 69;
 
 struct SessionIdent;
 class ReadSession;
+class MulticastReadSession;
+class WriteSession;
+class WriteBehindWriter;
 class UdpSocketFactory;
 
 class ConnectionRequestSocket : public QObject
@@ -45,27 +61,67 @@ class ConnectionRequestSocket : public QObject
     Q_OBJECT
 
     public:
-        ConnectionRequestSocket(const QString &filesDir, std::shared_ptr<UdpSocketFactory> socketFactory);
+        static constexpr int AutoTuneStartBytes = 512 * 1024;       /// buffer size set when auto-tuning raises a kernel default size
+        static constexpr int MaxAutoTuneBytes = 8 * 1024 * 1024;    /// auto-tuning doesn't raise buffer sizes beyond this
+
+        ConnectionRequestSocket(const QString &filesDir, std::shared_ptr<UdpSocketFactory> socketFactory, bool allowUploads=false);
+        ConnectionRequestSocket(const QString &filesDir, std::shared_ptr<AbstractSocket> wildcardSocket, const QHostAddress &bindAddress,
+                                bool allowUploads=false);
         virtual ~ConnectionRequestSocket() = default;
 
         const QString &filesDir() const;
+        bool allowUploads() const;
         QString errorString() const;
         bool hasPendingDatagrams() const;
         qint64 pendingDatagramSize() const;
         quint16 localPort() const;
         QHostAddress localAddress() const;
+        bool sharesSocket() const;
 
         bool bind(const QHostAddress &address, quint16 port = 0, QAbstractSocket::BindMode mode = QAbstractSocket::DefaultForPlatform);
         qint64 readDatagram(char *data, qint64 maxSize, QHostAddress *address = nullptr, quint16 *port = nullptr);
         qint64 writeDatagram(const QByteArray &datagram, const QHostAddress &host, quint16 port);
+        bool isSendErrorTransient() const;
         void close();
 
+        void setMetrics(std::shared_ptr<BindingMetrics> metrics);
+        std::shared_ptr<BindingMetrics> metrics() const;
+        void addBlockSourceProvider(std::shared_ptr<BlockSourceProvider> provider);
+        const BlockSourceProviders &blockSourceProviders() const;
+        void setDirectoryProvider(std::shared_ptr<DirectoryProvider> directoryProvider);
+        std::shared_ptr<DirectoryProvider> directoryProvider() const;
+        void setFileNameRewriter(std::shared_ptr<FileNameRewriter> fileNameRewriter);
+        QByteArray rewriteRequest(const QByteArray &requestDgram);
+        void setSubnetRoutes(std::shared_ptr<SubnetRoutes> subnetRoutes);
+        void setMaxSessions(unsigned int maxSessions);
+        unsigned int maxSessions() const;
+        void setSocketBufferSizes(int receiveBytes, int sendBytes);
+        void setSocketBufferAutoTuning(bool enabled);
+        int receiveBufferSize() const;
+        int sendBufferSize() const;
+        uint32_t collectReceiveDrops();
+        bool tuneSocketBuffers(uint32_t newReceiveDrops);
+        void selectFilesDir(const QHostAddress &peerAddr, QString &filesDir, std::shared_ptr<DirectoryProvider> &directoryProvider) const;
+
     signals:
         void readyRead();
 
     private:
         std::shared_ptr<AbstractSocket> m_socket;
+        QHostAddress m_bindAddress;   /// null unless m_socket is a wildcard socket shared with other bindings
         QString m_filesDir;
+        bool m_allowUploads;  /// accept write requests
+        std::shared_ptr<BindingMetrics> m_metrics;
+        BlockSourceProviders m_providers;
+        std::shared_ptr<DirectoryProvider> m_directoryProvider;  /// provides the files in m_filesDir, may be null
+        std::shared_ptr<FileNameRewriter> m_fileNameRewriter;    /// may be null
+        std::shared_ptr<SubnetRoutes> m_subnetRoutes;            /// may be null, then all clients read from m_filesDir
+        unsigned int m_maxSessions;   /// 0 if the nr of sessions of this binding is not limited
+        int m_receiveBufferSize;      /// requested SO_RCVBUF of the listening and session sockets, 0 for the kernel default
+        int m_sendBufferSize;         /// requested SO_SNDBUF of the listening and session sockets, 0 for the kernel default
+        bool m_autoTuneBuffers;       /// raise the buffer sizes when datagrams are dropped or sends blocked
+        uint32_t m_receiveDrops;      /// drop count of the listening socket at the previous collectReceiveDrops()
+        uint64_t m_sendsBlocked;      /// value of BindingMetrics::m_sendsBlocked at the previous tuneSocketBuffers()
 };
 
 
@@ -74,35 +130,120 @@ class TftpServer : public QObject
     Q_OBJECT
 
     public:
+        static constexpr unsigned int DefaultMaxQueueWaitMs = 5000;
+        static constexpr int SocketStatsIntervalMs = 1000;  /// interval at which kernel drop counters are read
+
         explicit TftpServer(std::shared_ptr<UdpSocketFactory> socketFactory, QObject *parent = nullptr);
         //explicit TftpServer(std::shared_ptr<UdpSocketFactory> socketFactory, QObject *parent = nullptr);
         virtual ~TftpServer() = default;
 
-        virtual void bind(const QString &filesDir, const QHostAddress &hostAddr=QHostAddress(QHostAddress::LocalHost), uint16_t port=69);
+        virtual void bind(const QString &filesDir, const QHostAddress &hostAddr=QHostAddress(QHostAddress::LocalHost), uint16_t port=69,
+                          bool allowUploads=false);
         virtual void close();
 
+        void enableWildcardBinding();
         void setSlowNetworkDetectionThreshold(unsigned int ackLatencyUs);
+        void addBlockSourceProvider(std::shared_ptr<BlockSourceProvider> provider, const QHostAddress &hostAddr, uint16_t port);
+        void setFileNameRewriter(std::shared_ptr<FileNameRewriter> fileNameRewriter, const QHostAddress &hostAddr, uint16_t port);
+        void setSubnetRoutes(std::shared_ptr<SubnetRoutes> subnetRoutes, const QHostAddress &hostAddr, uint16_t port);
+        void setSessionLimits(unsigned int maxSessions, unsigned int maxQueuedRequests, unsigned int maxQueueWaitMs=DefaultMaxQueueWaitMs);
+        void setMaxSessions(unsigned int maxSessions, const QHostAddress &hostAddr, uint16_t port);
+        void setMaxRequestsPerSecond(unsigned int maxRequests);
+        void setGlobalPacingRate(uint64_t bytesPerSecond, uint64_t burstBytes=0);
+        void setSubnetPacingRate(uint64_t bytesPerSecond, uint64_t burstBytes=0, int ipv4PrefixLength=24, int ipv6PrefixLength=64);
+        void setSessionPacingRate(uint64_t bytesPerSecond, uint64_t burstBytes=0);
+        void setPacingRate(uint64_t bytesPerSecond, uint64_t burstBytes, const QHostAddress &hostAddr, uint16_t port);
+        void setPriorityTransferSize(int64_t maxTransferSize);
+        void setSchedulingWeight(unsigned int weight, const QHostAddress &hostAddr, uint16_t port);
+        void setSocketBufferSizes(int receiveBytes, int sendBytes, const QHostAddress &hostAddr, uint16_t port);
+        void setSocketBufferAutoTuning(bool enabled, const QHostAddress &hostAddr, uint16_t port);
+        void setKernelTimestamping(bool enabled);
+        void enableMulticast(const QHostAddress &firstGroupAddress, uint16_t groupPort, unsigned int nrOfGroups=1);
+        const ServerMetrics &metrics() const;
+        void setAckLatencySubnetPrefixLengths(int ipv4PrefixLength, int ipv6PrefixLength);
+        void resetAckLatencyStatistics();
+        EventLoopLagMonitor &eventLoopLagMonitor();
+        const TransferGroupRegistry &transferGroups() const;
 
         std::vector<std::pair<QHostAddress, uint16_t>> bindings() const;
         std::shared_ptr<const ReadSession> findReadSession(const SessionIdent &sessionIdent) const;
+        std::shared_ptr<const WriteSession> findWriteSession(const SessionIdent &sessionIdent) const;
 
     signals:
         void newReadSession(std::shared_ptr<const ReadSession> newSession);
+        void newWriteSession(std::shared_ptr<const WriteSession> newSession);
         void receivedFile();
 
     private slots:
         void dataReceived();
         void removeSession();
+        void checkSocketBuffers();
 
     private:
+        struct WildcardListener
+        {
+            public:
+                uint16_t m_port;   /// port that was passed to bind()
+                std::shared_ptr<AbstractSocket> m_socket;
+                QHash<QHostAddress, std::shared_ptr<ConnectionRequestSocket>> m_bindings;  /// binding address -> binding
+                std::shared_ptr<ConnectionRequestSocket> m_anyBinding;  /// binding for destination addresses without a binding of their own, may be null
+        };
+
+        struct PendingRequest
+        {
+            public:
+                ConnectionRequestSocket *m_binding;
+                QByteArray   m_datagram;
+                QHostAddress m_peerAddress;
+                quint16      m_peerPort;
+                std::chrono::steady_clock::time_point m_queuedAt;
+        };
+
+        std::shared_ptr<ConnectionRequestSocket> bindWildcard(const QString &filesDir, const QHostAddress &hostAddr, uint16_t port, bool allowUploads);
+        void wildcardDataReceived(WildcardListener &listener);
+        void handleRequest(ConnectionRequestSocket &mainSocket, const QByteArray &dgram, const QHostAddress &peerAddress, quint16 peerPort);
+        void startReadSession(ConnectionRequestSocket &mainSocket, const QByteArray &dgram, const QHostAddress &peerAddress, quint16 peerPort);
+        bool hasFreeSessionSlot(const ConnectionRequestSocket &mainSocket) const;
+        bool isQueued(const QHostAddress &peerAddress, quint16 peerPort) const;
+        void rejectRequest(ConnectionRequestSocket &mainSocket, const QHostAddress &peerAddress, quint16 peerPort);
+        bool sendErrorReply(ConnectionRequestSocket &mainSocket, TftpCode::ErrorCode errorCode, const QString &errorMsg,
+                            const QHostAddress &peerAddress, quint16 peerPort);
+        bool exceedsRequestRate(const QHostAddress &peerAddress);
+        void dropExpiredRequests();
+        void startQueuedRequests();
         std::shared_ptr<ReadSession> doFindReadSession(const SessionIdent &sessionIdent) const;
-        void handleNewData(std::shared_ptr<ConnectionRequestSocket> mainSocket);
+        std::shared_ptr<WriteSession> doFindWriteSession(const SessionIdent &sessionIdent) const;
+        std::shared_ptr<ConnectionRequestSocket> findBinding(const QHostAddress &hostAddr, uint16_t port) const;
+        void handleNewData(ConnectionRequestSocket &mainSocket);
+        bool joinMulticastSession(const QHostAddress &peerAddress, uint16_t peerPort, const QByteArray &rrqDatagram, const QString &filesDir,
+                                  const BlockSourceProviders &providers, const std::shared_ptr<DirectoryProvider> &directoryProvider);
+        QHostAddress allocateMulticastGroup() const;
 
         std::shared_ptr<UdpSocketFactory> m_socketFactory;  ///creates real sockets in production code, test stub sockets in unit tests
         //std::shared_ptr<UdpSocket> m_mainSocket; //could have been unique_ptr, but shared_ptr needed in socket stub for testing
         std::vector<std::shared_ptr<ConnectionRequestSocket>> m_mainSockets; /// sockets that listen for new connection requests
+        std::vector<std::shared_ptr<WildcardListener>> m_wildcardListeners; /// wildcard sockets shared by the bindings in m_mainSockets
+        bool m_wildcardBinding;   /// bind() adds bindings to a wildcard socket per port
         std::vector< std::shared_ptr<ReadSession> > m_readSessions;
+        std::vector< std::shared_ptr<MulticastReadSession> > m_multicastSessions; /// also present in m_readSessions
+        std::vector< std::shared_ptr<WriteSession> > m_writeSessions;
+        std::shared_ptr<WriteBehindWriter> m_writer; /// writes uploaded files, created when the first upload starts
+        QHostAddress m_multicastFirstGroup;  /// null if multicast (RFC2090) is disabled
+        uint16_t     m_multicastGroupPort;
+        unsigned int m_multicastGroupCount;
+        std::shared_ptr<TransferGroupRegistry> m_transferGroups; /// lets sessions for the same file share file reads
         unsigned int m_slowNetworkThreshold;
+        ServerMetrics m_metrics;
+        EventLoopLagMonitor m_eventLoopLagMonitor; /// not started by default
+        std::deque<PendingRequest> m_pendingRequests; /// read requests waiting for a free session slot, oldest first
+        unsigned int m_maxSessions;          /// 0 if the nr of sessions of all bindings together is not limited
+        unsigned int m_maxQueuedRequests;
+        unsigned int m_maxQueueWaitMs;
+        RequestRateLimiter m_requestRateLimiter;
+        std::shared_ptr<Pacer> m_pacer;      /// shared with the read sessions, which may outlive the server
+        std::shared_ptr<SendScheduler> m_scheduler; /// shared with the read sessions, which may outlive the server
+        QTimer m_socketStatsTimer;           /// reads the kernel drop counters of the sockets every SocketStatsIntervalMs
+        bool m_kernelTimestamping;           /// new sessions measure ACK delays with kernel receive timestamps
         //std::map<std::pair<QHostAddress, uint16_t>, QString> m_filesDirs;
 
 };
@@ -0,0 +1,165 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#ifndef TRACERING_H
+#define TRACERING_H
+
+#include <QHostAddress>
+#include <QString>
+#include <atomic>
+#include <cstdint>
+
+namespace QTFTP
+{
+
+/**
+ * @brief The TraceEvent struct is one compact binary record in a trace ring
+ *
+ * The meaning of m_arg1 and m_arg2 depends on the event type:
+ * <pre>
+ *   Rrq          arg1: peer port      arg2: peer IPv4 address (0 for IPv6 peers, which have FlagIpv6Peer set)
+ *   PeerAddress6 arg1, arg2: 8 bytes of the IPv6 address of the peer, most significant byte first. Recorded
+ *                twice after the Rrq of an IPv6 peer, blockNr 0 holds bytes 0-7 and blockNr 1 bytes 8-15.
+ *   Oack         arg1: block size     arg2: 0
+ *   DataSent     arg1: payload size   arg2: 0
+ *   AckReceived  arg1: ack delay us   arg2: 0
+ *   Retransmit   arg1: payload size   arg2: retransmission nr
+ *   Error        arg1: 0              arg2: 0
+ *   Finished     arg1: 0              arg2: 0
+ * </pre>
+ */
+struct TraceEvent
+{
+    public:
+        enum Type : uint8_t { Invalid, Rrq, Oack, DataSent, AckReceived, Retransmit, Error, Finished, PeerAddress6 };
+        static constexpr uint8_t FlagIpv6Peer = 0x01;   /// in m_flags of a Rrq event: the peer address follows in PeerAddress6 events
+
+        uint64_t m_timestampNs; /// steady clock time in nanoseconds
+        uint32_t m_sessionId;
+        uint16_t m_blockNr;
+        uint8_t  m_type;
+        uint8_t  m_flags;
+        uint32_t m_arg1;
+        uint32_t m_arg2;
+};
+
+static_assert(sizeof(TraceEvent) == 24, "TraceEvent is part of the trace file format and must be 24 bytes");
+
+
+/**
+ * @brief The TraceFileHeader struct is written at the start of a trace dump
+ *
+ * A trace dump consists of one TraceFileHeader, followed for each ring by a TraceRingHeader and
+ * TraceRingHeader::m_eventCount TraceEvent records (oldest first). All values are in host byte order.
+ */
+struct TraceFileHeader
+{
+    public:
+        char     m_magic[8];        /// "QTFTPTRC"
+        uint32_t m_version;
+        uint32_t m_eventSize;       /// sizeof(TraceEvent)
+        uint64_t m_steadyClockNs;   /// steady clock at the time of the dump
+        uint64_t m_systemClockNs;   /// wall clock (ns since epoch) at the time of the dump
+        uint32_t m_ringCount;
+        uint32_t m_reserved;
+};
+
+struct TraceRingHeader
+{
+    public:
+        uint32_t m_threadIndex;
+        uint32_t m_eventCount;
+};
+
+constexpr uint32_t TraceFileVersion = 2;
+
+
+/**
+ * @brief The TraceRing class is a fixed size single-producer ring buffer of trace events
+ *
+ * Only the thread that owns the ring writes to it. Any other thread (or a signal handler) may take a
+ * snapshot at the same time: every slot carries a sequence number, so events that are overwritten
+ * while being copied are detected and skipped instead of being dumped half-written.
+ */
+class TraceRing
+{
+    public:
+        static constexpr unsigned int Capacity = 4096; /// must be a power of 2
+
+        explicit TraceRing(uint32_t threadIndex);
+
+        void push(const TraceEvent &event);
+        unsigned int snapshot(TraceEvent *destination, unsigned int maxEvents) const;
+        uint32_t threadIndex() const;
+
+    private:
+        struct Slot
+        {
+            std::atomic<uint64_t> m_seq;
+            std::atomic<uint64_t> m_words[3];
+        };
+
+        Slot                  m_slots[Capacity];
+        std::atomic<uint64_t> m_head;
+        uint32_t              m_threadIndex;
+};
+
+
+/**
+ * @brief The TraceRecorder class records protocol events in per-thread lock-free trace rings
+ *
+ * Recording is disabled by default. When disabled, the cost of a trace point is one relaxed atomic load.
+ */
+class TraceRecorder
+{
+    public:
+        static constexpr unsigned int MaxThreads = 64;
+
+        static void setEnabled(bool enabled);
+        static bool isEnabled();
+
+        static inline void record(TraceEvent::Type type, uint32_t sessionId, uint16_t blockNr=0, uint32_t arg1=0, uint32_t arg2=0)
+        {
+            if (m_enabled.load(std::memory_order_relaxed))
+            {
+                doRecord(type, sessionId, blockNr, arg1, arg2);
+            }
+        }
+
+        static void recordRrq(uint32_t sessionId, const QHostAddress &peerAddress, uint16_t peerPort);
+
+        static void setDumpFile(const QString &fileName);
+        static void setDumpOnSessionError(bool dumpOnError);
+        static void sessionError(uint32_t sessionId);
+
+        static bool dumpToFile(const QString &fileName);
+        static bool dumpToConfiguredFile();
+        static bool dumpToFd(int fd);
+
+    private:
+        static void doRecord(TraceEvent::Type type, uint32_t sessionId, uint16_t blockNr, uint32_t arg1, uint32_t arg2, uint8_t flags=0);
+
+        static std::atomic<bool> m_enabled;
+};
+
+
+} // QTFTP namespace end
+
+#endif // TRACERING_H
@@ -0,0 +1,112 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#ifndef TRANSFERGROUP_H
+#define TRANSFERGROUP_H
+
+#include "qtftp/tftp_constants.h"
+#include "qtftp/blocksource.h"
+#include <QByteArray>
+#include <QString>
+#include <deque>
+#include <map>
+#include <memory>
+#include <tuple>
+
+namespace QTFTP
+{
+
+/**
+ * @brief The TransferGroup class produces the data blocks of one version of a file for all read sessions that
+ * transfer it with the same block size and transfer mode
+ *
+ * The block source is opened once when the group is created, so all sessions of the group send the same version
+ * of the file, even if it is replaced while they are in progress. Blocks that were produced are kept in a cache
+ * of bounded size, so sessions that are close together in the file share one file read per block. Each
+ * session only keeps its own position and retransmit state.
+ */
+class TransferGroup
+{
+    public:
+        static constexpr size_t DefaultMaxCacheBytes = 4 * 1024 * 1024;
+
+        TransferGroup(std::shared_ptr<BlockSource> source, unsigned int blockSize, TftpCode::Mode mode, size_t maxCacheBytes=DefaultMaxCacheBytes);
+        TransferGroup(const QString &filePath, unsigned int blockSize, TftpCode::Mode mode, size_t maxCacheBytes=DefaultMaxCacheBytes);
+        TransferGroup(const TransferGroup&) = delete;
+        TransferGroup &operator=(const TransferGroup&) = delete;
+
+        bool open();
+        QString errorString() const;
+        QString filePath() const;
+        unsigned int blockSize() const;
+        TftpCode::Mode mode() const;
+        qint64 fileSize() const;
+        bool isCurrentVersion() const;
+
+        QByteArray block(uint32_t blockIndex);
+        uint64_t fileReads() const;
+        size_t cachedBytes() const;
+
+    private:
+        QByteArray readOctetBlock(uint32_t blockIndex);
+        QByteArray readNextAsciiBlock();
+        void addToCache(uint32_t blockIndex, const QByteArray &blockData);
+
+        std::shared_ptr<BlockSource> m_source;
+        unsigned int   m_blockSize;
+        TftpCode::Mode m_mode;
+        size_t         m_maxCacheBytes;
+        qint64         m_fileSize;        /// size of the source when it was opened
+        std::map<uint32_t, QByteArray> m_cache;
+        std::deque<uint32_t> m_cacheOrder; /// block indexes in the order they were cached, oldest first
+        size_t         m_cachedBytes;
+        uint64_t       m_fileReads;
+        uint32_t       m_nextAsciiBlock;  /// netascii blocks can only be produced in order
+        qint64         m_asciiReadPos;    /// position in the source of the next netascii block
+        QByteArray     m_asciiOverflowBuffer; /// used if block size is exceeded after CR/LF conversions
+};
+
+
+/**
+ * @brief The TransferGroupRegistry class hands out the TransferGroup for a file, block size and transfer mode
+ *
+ * A group lives as long as a session uses it. If the file changed since the group was created, a new group
+ * is created for new sessions, while the sessions in progress continue with the old version.
+ */
+class TransferGroupRegistry
+{
+    public:
+        explicit TransferGroupRegistry(size_t maxCacheBytesPerGroup=TransferGroup::DefaultMaxCacheBytes);
+
+        std::shared_ptr<TransferGroup> acquire(std::shared_ptr<BlockSource> source, unsigned int blockSize, TftpCode::Mode mode);
+        std::shared_ptr<TransferGroup> acquire(const QString &filePath, unsigned int blockSize, TftpCode::Mode mode);
+        size_t activeGroupCount() const;
+
+    private:
+        typedef std::tuple<QString, unsigned int, int> GroupKey;
+
+        std::map<GroupKey, std::weak_ptr<TransferGroup>> m_groups;
+        size_t m_maxCacheBytesPerGroup;
+};
+
+
+} // QTFTP namespace end
+
+#endif // TRANSFERGROUP_H
@@ -24,6 +24,9 @@
 #include "qtftp/abstractsocket.h"
 #include <QObject>
 #include <QUdpSocket>
+#include <memory>
+
+class QSocketNotifier;
 
 class QHostAddress;
 
@@ -56,9 +59,16 @@ class UdpSocket : public AbstractSocket
         virtual void close() override;
         qint64 readDatagram(char * data, qint64 maxSize, QHostAddress *address = nullptr, quint16 *port = nullptr) override;
         qint64 writeDatagram(const QByteArray & datagram, const QHostAddress & host, quint16 port) override;
+        bool receiveDatagram(QByteArray &datagram, QHostAddress &address, quint16 &port, QHostAddress &destinationAddress) override;
+        qint64 writeDatagramFrom(const QByteArray &datagram, const QHostAddress &host, quint16 port, const QHostAddress &sourceAddress) override;
+        bool isSendErrorTransient() const override;
+        void setWriteNotificationEnabled(bool enabled) override;
+        qintptr socketDescriptor() const override;
 
     private:
         QUdpSocket m_socket;
+        std::unique_ptr<QSocketNotifier> m_writeNotifier;   /// created when write notification is enabled the first time
+        int        m_writeErrno;    /// errno of the last failed write, 0 if the last write succeeded
 };
 
 
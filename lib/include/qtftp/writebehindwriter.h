@@ -0,0 +1,126 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#ifndef WRITEBEHINDWRITER_H
+#define WRITEBEHINDWRITER_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QString>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+class QSaveFile;
+
+namespace QTFTP
+{
+
+/**
+ * @brief The UploadFile class is the handle of a file that is written by a WriteBehindWriter
+ *
+ * The signals of this class are emitted from the writer thread. Connect them with an automatic or queued
+ * connection to receive them in the thread of the session.
+ */
+class UploadFile : public QObject
+{
+    Q_OBJECT
+
+    public:
+        UploadFile(const QString &targetPath, qint64 expectedSize);
+        ~UploadFile() override;
+
+        const QString &targetPath() const;
+        uint64_t queuedBytes() const;
+        bool hasFailed() const;
+        QString errorString() const;
+
+    signals:
+        void bytesWritten();
+        void committed(bool success, QString errorString);
+
+    private:
+        void setFailed(const QString &errorString);
+
+        QString                    m_targetPath;
+        qint64                     m_expectedSize;  /// 0 if unknown
+        std::unique_ptr<QSaveFile> m_file;          /// only used by the writer thread
+        std::atomic<uint64_t>      m_queuedBytes;   /// bytes handed to the writer that are not written yet
+        std::atomic<bool>          m_failed;
+        mutable std::mutex         m_errorMutex;
+        QString                    m_errorString;
+
+        friend class WriteBehindWriter;
+};
+
+
+/**
+ * @brief The WriteBehindWriter class writes uploaded files in a background thread
+ *
+ * Sessions hand over received data and continue immediately. The writer thread merges data that is queued
+ * for the same file into large writes. Files are written to a temporary file in the target directory, which
+ * is renamed to the target name when the upload is committed, so a file is never seen partially written.
+ */
+class WriteBehindWriter
+{
+    public:
+        static constexpr int MaxWriteSize = 1024 * 1024; /// max nr of bytes merged into one write
+
+        WriteBehindWriter();
+        ~WriteBehindWriter();
+        WriteBehindWriter(const WriteBehindWriter&) = delete;
+        WriteBehindWriter &operator=(const WriteBehindWriter&) = delete;
+
+        std::shared_ptr<UploadFile> open(const QString &targetPath, qint64 expectedSize=0);
+        void write(const std::shared_ptr<UploadFile> &file, const QByteArray &data);
+        void commit(const std::shared_ptr<UploadFile> &file);
+        void discard(const std::shared_ptr<UploadFile> &file);
+
+    private:
+        struct Job
+        {
+            public:
+                enum class Type { Open, Write, Commit, Discard };
+
+                Type                        m_type;
+                std::shared_ptr<UploadFile> m_file;
+                QByteArray                  m_data;
+        };
+
+        void enqueue(Job &&job);
+        void run();
+        void doOpen(UploadFile &file);
+        void doWrite(UploadFile &file, const QByteArray &data);
+        void doCommit(UploadFile &file);
+
+        std::mutex              m_mutex;
+        std::condition_variable m_jobAvailable;
+        std::deque<Job>         m_jobs;
+        bool                    m_stop;
+        std::thread             m_thread;
+};
+
+
+} // QTFTP namespace end
+
+#endif // WRITEBEHINDWRITER_H
@@ -0,0 +1,95 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#ifndef WRITESESSION_H
+#define WRITESESSION_H
+
+#include "qtftp/session.h"
+#include "qtftp/udpsocketfactory.h"
+#include "qtftp/writebehindwriter.h"
+#include <QByteArray>
+#include <memory>
+
+namespace QTFTP
+{
+
+/**
+ * @brief The WriteSession class receives a file that a peer uploads with a WRQ
+ *
+ * Received blocks are acknowledged as soon as they are in memory and handed to a WriteBehindWriter, which
+ * writes them to disk in a background thread. The upload is written to a temporary file that replaces the
+ * target file when the last block has been written, so readers never see a partially uploaded file.
+ */
+class WriteSession : public Session
+{
+    Q_OBJECT
+
+    public:
+        static constexpr unsigned int MaxWindowSize = 64;          /// max accepted value of the windowsize option (RFC7440)
+        static constexpr int WriteBatchSize = 64 * 1024;           /// nr of bytes collected before they are handed to the writer
+        static constexpr uint64_t MaxQueuedBytes = 16 * 1024 * 1024; /// ACKs are held back while more bytes wait for the disk
+
+        WriteSession(const QHostAddress &peerAddr, uint16_t peerPort, QByteArray wrqDatagram, QString filesDir,
+                     std::shared_ptr<WriteBehindWriter> writer, std::shared_ptr<UdpSocketFactory> socketFactory=std::make_shared<UdpSocketFactory>(),
+                     std::shared_ptr<BindingMetrics> metrics=nullptr, const QHostAddress &localAddr=QHostAddress(QHostAddress::Any));
+        ~WriteSession() override;
+
+        uint16_t currBlockNr() const;
+        unsigned int blockSize() const;
+        unsigned int windowSize() const;
+        uint64_t bytesReceived() const;
+
+    protected slots:
+        void dataReceived() override;
+        void retransmitData() override;
+
+    private slots:
+        void handleBytesWritten();
+        void handleCommitted(bool success, QString errorString);
+
+    private:
+        bool parseWrq(const QByteArray &wrqDatagram, const QString &filesDir, unsigned int &optionsOffset);
+        bool handleWrqOptions(const QByteArray &wrqDgram, unsigned int offset);
+        void handleData(uint16_t blockNr, const QByteArray &datagram);
+        void appendToWriteBuffer(const char *data, int size);
+        void flushWriteBuffer();
+        void sendAck(uint16_t blockNr);
+        void abortUpload(TftpCode::ErrorCode errorCode, const QString &errorMsg);
+
+        std::shared_ptr<WriteBehindWriter> m_writer;
+        std::shared_ptr<UploadFile> m_uploadFile;
+        QByteArray   m_writeBuffer;         /// received data that is not handed to the writer yet
+        QByteArray   m_oackDatagram;        /// sent again when the retransmit timer expires during option negotiation
+        uint16_t     m_blockNr;             /// last block that was received in sequence
+        unsigned int m_blockSize;
+        unsigned int m_windowSize;
+        unsigned int m_blocksInWindow;      /// nr of blocks received since the last ACK
+        qint64       m_expectedSize;        /// value of the tsize option, 0 if unknown
+        uint64_t     m_bytesReceived;
+        bool         m_pendingCr;           /// netascii: last block ended with a CR
+        bool         m_gapAcked;            /// an ACK was sent for the block before a missing block
+        bool         m_ackDeferred;         /// an ACK is due, but waits until the writer caught up
+        bool         m_lastBlockReceived;
+};
+
+
+} // QTFTP namespace end
+
+#endif // WRITESESSION_H
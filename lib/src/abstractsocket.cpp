@@ -19,6 +19,21 @@
 ****************************************************************************/
 
 #include "qtftp/abstractsocket.h"
+#include <QTimer>
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/socket.h>
+#endif
+#ifdef __linux__
+#include <linux/sock_diag.h>
+#include <linux/sockios.h>
+#include <sys/ioctl.h>
+#endif
+#include <algorithm>
+#include <cerrno>
+#include <ctime>
 
 namespace QTFTP
 {
@@ -34,4 +49,225 @@ AbstractSocket::~AbstractSocket()
 }
 
 
+/**
+ * @brief AbstractSocket::receiveDatagram read the next pending datagram and the local address it was sent to
+ * @param destinationAddress [out] destination address of the datagram, of interest if the socket is bound to a wildcard address
+ * @return false if no datagram could be read
+ *
+ * The default implementation reports the local address of the socket as destination address.
+ */
+bool AbstractSocket::receiveDatagram(QByteArray &datagram, QHostAddress &address, quint16 &port, QHostAddress &destinationAddress)
+{
+    datagram.resize(static_cast<int>(std::max<qint64>(pendingDatagramSize(), 0)));
+    qint64 datagramSize = readDatagram(datagram.data(), datagram.size(), &address, &port);
+    if (datagramSize < 0)
+    {
+        return false;
+    }
+    datagram.resize(static_cast<int>(datagramSize));
+    destinationAddress = localAddress();
+    return true;
+}
+
+
+/**
+ * @brief AbstractSocket::writeDatagramFrom send a datagram from a specific local address
+ * @param sourceAddress local address to send from, of interest if the socket is bound to a wildcard address
+ *
+ * The default implementation ignores \p sourceAddress.
+ */
+qint64 AbstractSocket::writeDatagramFrom(const QByteArray &datagram, const QHostAddress &host, quint16 port, const QHostAddress &sourceAddress)
+{
+    Q_UNUSED(sourceAddress);
+    return writeDatagram(datagram, host, port);
+}
+
+
+/**
+ * @brief AbstractSocket::isSendErrorTransient check if the last failed writeDatagram() may succeed when retried later
+ *
+ * A transient error means the send buffer of the socket or the queue of the network interface was full (EAGAIN,
+ * ENOBUFS). The default implementation reports every error as permanent.
+ */
+bool AbstractSocket::isSendErrorTransient() const
+{
+    return false;
+}
+
+
+/**
+ * @brief AbstractSocket::setWriteNotificationEnabled emit readyWrite() once when the socket can accept datagrams again
+ *
+ * The default implementation can't tell when the socket is writable, it emits readyWrite() after 1 ms.
+ */
+void AbstractSocket::setWriteNotificationEnabled(bool enabled)
+{
+    if (enabled)
+    {
+        QTimer::singleShot(1, this, [this]() { emit readyWrite(); });
+    }
+}
+
+
+/**
+ * @brief AbstractSocket::socketDescriptor get the native descriptor of the socket
+ * @return -1 if the socket has no native descriptor, the default implementation
+ *
+ * The default implementations of the socket buffer functions below use the native descriptor.
+ */
+qintptr AbstractSocket::socketDescriptor() const
+{
+    return -1;
+}
+
+
+/**
+ * @brief AbstractSocket::setBufferSizes set the size of the kernel receive (SO_RCVBUF) and send (SO_SNDBUF) buffers
+ * @param receiveBytes requested size of the receive buffer, 0 to leave it unchanged
+ * @param sendBytes requested size of the send buffer, 0 to leave it unchanged
+ * @return false if a size could not be set
+ *
+ * The kernel limits the sizes (net.core.rmem_max and net.core.wmem_max on Linux) without reporting an error, use
+ * receiveBufferSize() and sendBufferSize() to get the size that is actually used.
+ */
+bool AbstractSocket::setBufferSizes(int receiveBytes, int sendBytes)
+{
+    auto descriptor = socketDescriptor();
+    if (descriptor == -1)
+    {
+        return false;
+    }
+    bool sizesSet = true;
+    if (receiveBytes > 0)
+    {
+        sizesSet = setsockopt(descriptor, SOL_SOCKET, SO_RCVBUF, reinterpret_cast<const char*>(&receiveBytes), sizeof(receiveBytes)) == 0;
+    }
+    if (sendBytes > 0)
+    {
+        sizesSet = setsockopt(descriptor, SOL_SOCKET, SO_SNDBUF, reinterpret_cast<const char*>(&sendBytes), sizeof(sendBytes)) == 0 && sizesSet;
+    }
+    return sizesSet;
+}
+
+
+/**
+ * @brief AbstractSocket::receiveBufferSize get the size of the kernel receive buffer as reported by the kernel
+ * @return 0 if the size is not known
+ *
+ * Linux reports twice the requested size, it uses the extra space for its own bookkeeping.
+ */
+int AbstractSocket::receiveBufferSize() const
+{
+    int bufferSize = 0;
+    socklen_t optionLength = sizeof(bufferSize);
+    auto descriptor = socketDescriptor();
+    if (descriptor == -1 || getsockopt(descriptor, SOL_SOCKET, SO_RCVBUF, reinterpret_cast<char*>(&bufferSize), &optionLength) != 0)
+    {
+        return 0;
+    }
+    return bufferSize;
+}
+
+
+/**
+ * @brief AbstractSocket::sendBufferSize get the size of the kernel send buffer as reported by the kernel
+ * @return 0 if the size is not known
+ */
+int AbstractSocket::sendBufferSize() const
+{
+    int bufferSize = 0;
+    socklen_t optionLength = sizeof(bufferSize);
+    auto descriptor = socketDescriptor();
+    if (descriptor == -1 || getsockopt(descriptor, SOL_SOCKET, SO_SNDBUF, reinterpret_cast<char*>(&bufferSize), &optionLength) != 0)
+    {
+        return 0;
+    }
+    return bufferSize;
+}
+
+
+/**
+ * @brief AbstractSocket::receiveDrops get the nr of received datagrams the kernel dropped because the receive buffer was full
+ * @param drops [out] the nr of datagrams dropped since the socket was created, wraps around at 2^32
+ * @return false if the platform does not report drops
+ *
+ * This is the counter that SO_RXQ_OVFL attaches to received datagrams. QUdpSocket reads the datagrams itself and
+ * drops that ancillary data, so the counter is read with SO_MEMINFO (Linux 4.6 and later) instead.
+ */
+bool AbstractSocket::receiveDrops(uint32_t &drops) const
+{
+#if defined(__linux__) && defined(SO_MEMINFO)
+    uint32_t memInfo[SK_MEMINFO_VARS] = {};
+    socklen_t optionLength = sizeof(memInfo);
+    auto descriptor = socketDescriptor();
+    if (descriptor == -1 || getsockopt(static_cast<int>(descriptor), SOL_SOCKET, SO_MEMINFO, memInfo, &optionLength) != 0 ||
+        optionLength <= SK_MEMINFO_DROPS * sizeof(uint32_t))
+    {
+        return false;
+    }
+    drops = memInfo[SK_MEMINFO_DROPS];
+    return true;
+#else
+    Q_UNUSED(drops);
+    return false;
+#endif
+}
+
+
+/**
+ * @brief AbstractSocket::enableReceiveTimestamps let the kernel record the time at which each datagram arrives
+ * @return false if the platform does not timestamp received datagrams
+ *
+ * SO_TIMESTAMPING delivers the timestamps as ancillary data on recvmsg(), which QUdpSocket drops like it drops the
+ * SO_RXQ_OVFL counter. The software receive timestamp of the last datagram that was read is requested with the
+ * SIOCGSTAMPNS ioctl instead (Linux only), see lastReceiveTime().
+ */
+bool AbstractSocket::enableReceiveTimestamps()
+{
+#if defined(__linux__) && defined(SIOCGSTAMPNS)
+    timespec stamp;
+    auto descriptor = socketDescriptor();
+    //the first request enables timestamping of the socket and fails with ENOENT because no datagram was stamped yet
+    return descriptor != -1 && (ioctl(static_cast<int>(descriptor), SIOCGSTAMPNS, &stamp) == 0 || errno == ENOENT);
+#else
+    return false;
+#endif
+}
+
+
+/**
+ * @brief AbstractSocket::lastReceiveTime get the time at which the kernel received the datagram that was read last
+ * @param receiveTime [out] the receive time, converted from the wall clock of the kernel timestamp to the steady clock
+ * @return false if no timestamp is available, timestamps must be enabled with enableReceiveTimestamps() first
+ *
+ * The time between \p receiveTime and the moment the datagram was read is the time the datagram waited in the receive
+ * queue of the socket, i.e. the time the event loop was too busy to read it.
+ */
+bool AbstractSocket::lastReceiveTime(std::chrono::steady_clock::time_point &receiveTime) const
+{
+#if defined(__linux__) && defined(SIOCGSTAMPNS)
+    timespec stamp;
+    auto descriptor = socketDescriptor();
+    if (descriptor == -1 || ioctl(static_cast<int>(descriptor), SIOCGSTAMPNS, &stamp) != 0)
+    {
+        return false;
+    }
+    auto stampTime = std::chrono::system_clock::time_point(std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                                                               std::chrono::seconds(stamp.tv_sec) + std::chrono::nanoseconds(stamp.tv_nsec)));
+    auto steadyNow = std::chrono::steady_clock::now();
+    auto stampAge = std::chrono::system_clock::now() - stampTime;
+    if (stampAge < std::chrono::system_clock::duration::zero())
+    {
+        //wall clock was set back after the datagram was received
+        return false;
+    }
+    receiveTime = steadyNow - std::chrono::duration_cast<std::chrono::steady_clock::duration>(stampAge);
+    return true;
+#else
+    Q_UNUSED(receiveTime);
+    return false;
+#endif
+}
+
+
 } // QTFTP namespace end
@@ -0,0 +1,396 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#include "qtftp/blocksource.h"
+#include <QDir>
+#include <QFileInfo>
+#include <algorithm>
+#include <cstring>
+
+namespace QTFTP
+{
+
+/**
+ * @brief BlockSource::shareKey get the key under which sessions share the blocks produced from this source
+ * @return key that is equal for sources with the same contents, or an empty string if the contents may not be shared
+ *
+ * The default implementation returns an empty string, which gives every session a group of its own.
+ */
+QString BlockSource::shareKey() const
+{
+    return QString();
+}
+
+
+/**
+ * @brief BlockSource::isCurrentVersion check if the contents this source was opened with are still the latest version
+ *
+ * New sessions don't share blocks with a source that is no longer the current version. The default implementation
+ * returns true.
+ */
+bool BlockSource::isCurrentVersion() const
+{
+    return true;
+}
+
+
+
+FileBlockSource::FileBlockSource(const QString &filePath) : m_filePath(filePath),
+                                                            m_file(filePath),
+                                                            m_fileSize(0),
+                                                            m_openError(0)
+{
+}
+
+
+/**
+ * @brief FileBlockSource::FileBlockSource constructor for a file of which the metadata is known from a DirectoryIndex
+ * @param metadata size and modification time of the file according to \p index
+ * @param indexName name of the file in \p index, used to check if the file is still the current version
+ */
+FileBlockSource::FileBlockSource(const QString &filePath, const DirectoryIndex::FileMetadata &metadata, std::shared_ptr<DirectoryIndex> index,
+                                 const QString &indexName) : m_filePath(filePath),
+                                                             m_file(filePath),
+                                                             m_fileSize(metadata.m_size),
+                                                             m_lastModified(metadata.m_lastModified),
+                                                             m_index(index),
+                                                             m_indexName(indexName),
+                                                             m_openError(0)
+{
+}
+
+
+/**
+ * @brief FileBlockSource::setDirectoryHandle open the file relative to an open directory instead of by its path
+ * @param relativeName name of the file relative to \p dirHandle, see DirectoryHandle::relativeName()
+ */
+void FileBlockSource::setDirectoryHandle(std::shared_ptr<DirectoryHandle> dirHandle, const QString &relativeName)
+{
+    m_dirHandle = dirHandle;
+    m_relativeName = relativeName;
+}
+
+
+/**
+ * @brief FileBlockSource::openError get the errno value of the last open() that failed, if the file is opened through a DirectoryHandle
+ */
+int FileBlockSource::openError() const
+{
+    return m_openError;
+}
+
+
+/**
+ * @brief FileBlockSource::open open the file and remember the version that will be sent
+ */
+bool FileBlockSource::open()
+{
+    if (m_file.isOpen())
+    {
+        return true;
+    }
+    if (m_dirHandle)
+    {
+        //the size and modification time of the open file are known without another system call
+        m_openError = m_dirHandle->openFile(m_relativeName, m_file, m_fileSize, m_lastModified);
+        return m_openError == 0;
+    }
+    if ( ! m_file.open(QIODevice::ReadOnly) )
+    {
+        return false;
+    }
+    if (m_index)
+    {
+        return true;
+    }
+    m_fileSize = m_file.size();
+    m_lastModified = QFileInfo(m_file.fileName()).lastModified();
+    return true;
+}
+
+
+QString FileBlockSource::errorString() const
+{
+    return (m_openError != 0) ? DirectoryHandle::errorString(m_openError) : m_file.errorString();
+}
+
+
+QString FileBlockSource::name() const
+{
+    return m_filePath;
+}
+
+
+/**
+ * @brief FileBlockSource::size get the size of the file at the time it was opened
+ */
+qint64 FileBlockSource::size() const
+{
+    return (m_file.isOpen() || m_index) ? m_fileSize : m_file.size();
+}
+
+
+qint64 FileBlockSource::readAt(qint64 offset, char *data, qint64 maxSize)
+{
+    qint64 bytesToRead = std::min(maxSize, m_fileSize - offset);
+    if (bytesToRead <= 0)
+    {
+        return 0;
+    }
+    if ( ! m_file.seek(offset) )
+    {
+        return -1;
+    }
+    return m_file.read(data, bytesToRead);
+}
+
+
+QString FileBlockSource::shareKey() const
+{
+    return m_filePath;
+}
+
+
+/**
+ * @brief FileBlockSource::isCurrentVersion check if the file still has the size and modification time it had when opened, according to the index if there is one
+ */
+bool FileBlockSource::isCurrentVersion() const
+{
+    if (m_index)
+    {
+        DirectoryIndex::FileMetadata metadata;
+        switch (m_index->lookup(m_indexName, &metadata))
+        {
+            case DirectoryIndex::LookupResult::Found:
+                return metadata.m_size == m_fileSize && metadata.m_lastModified == m_lastModified;
+            case DirectoryIndex::LookupResult::Missing:
+                return false;
+            case DirectoryIndex::LookupResult::Unknown:
+                break;
+        }
+    }
+    QFileInfo fileInfo(m_filePath);
+    return fileInfo.exists() && fileInfo.size() == m_fileSize && fileInfo.lastModified() == m_lastModified;
+}
+
+
+
+MemoryBlockSource::MemoryBlockSource(const QString &name, const QByteArray &contents) : m_name(name),
+                                                                                        m_contents(contents)
+{
+}
+
+
+bool MemoryBlockSource::open()
+{
+    return true;
+}
+
+
+QString MemoryBlockSource::errorString() const
+{
+    return QString();
+}
+
+
+QString MemoryBlockSource::name() const
+{
+    return m_name;
+}
+
+
+qint64 MemoryBlockSource::size() const
+{
+    return m_contents.size();
+}
+
+
+qint64 MemoryBlockSource::readAt(qint64 offset, char *data, qint64 maxSize)
+{
+    qint64 bytesToRead = std::min(maxSize, static_cast<qint64>(m_contents.size()) - offset);
+    if (bytesToRead <= 0)
+    {
+        return 0;
+    }
+    std::memcpy(data, m_contents.constData() + offset, static_cast<size_t>(bytesToRead));
+    return bytesToRead;
+}
+
+
+
+DirectoryProvider::DirectoryProvider(const QString &filesDir, std::shared_ptr<DirectoryIndex> index,
+                                     std::shared_ptr<DirectoryHandle> dirHandle) : m_filesDir(filesDir),
+                                                                                   m_index(index),
+                                                                                   m_dirHandle(dirHandle)
+{
+}
+
+
+/**
+ * @brief DirectoryProvider::create create a provider for a directory with an index and a directory handle
+ *
+ * Without an index every request is looked up on disk, without a directory handle files are opened by path. Both
+ * are slower but give the same results, so a provider is created without them if they can't be set up.
+ */
+std::shared_ptr<DirectoryProvider> DirectoryProvider::create(const QString &filesDir)
+{
+    auto directoryIndex = std::make_shared<DirectoryIndex>(filesDir);
+    if ( ! directoryIndex->start() )
+    {
+        directoryIndex.reset();
+    }
+    auto dirHandle = std::make_shared<DirectoryHandle>(filesDir);
+    if ( ! dirHandle->open() )
+    {
+        dirHandle.reset();
+    }
+    return std::make_shared<DirectoryProvider>(filesDir, directoryIndex, dirHandle);
+}
+
+
+std::shared_ptr<BlockSource> DirectoryProvider::find(const QString &fileName, const QHostAddress &peerAddr)
+{
+    Q_UNUSED(peerAddr);
+
+    if (m_dirHandle)
+    {
+        return findBeneath(fileName);
+    }
+
+    //same name form as findBeneath(), so a file has one name (and share key) however it was requested
+    QString relativeName = DirectoryHandle::relativeName(fileName);
+    if (relativeName.isEmpty())
+    {
+        return nullptr;
+    }
+    QFileInfo fileInfo(QDir(m_filesDir), relativeName);
+    if (m_index)
+    {
+        DirectoryIndex::FileMetadata metadata;
+        switch (m_index->lookup(relativeName, &metadata))
+        {
+            case DirectoryIndex::LookupResult::Found:
+                return std::make_shared<FileBlockSource>(fileInfo.absoluteFilePath(), metadata, m_index, relativeName);
+            case DirectoryIndex::LookupResult::Missing:
+                return nullptr;
+            case DirectoryIndex::LookupResult::Unknown:
+                break;
+        }
+    }
+    if ( ! fileInfo.exists() )
+    {
+        return nullptr;
+    }
+    return std::make_shared<FileBlockSource>(fileInfo.absoluteFilePath());
+}
+
+
+
+/**
+ * @brief DirectoryProvider::findBeneath look up a file relative to the directory handle
+ *
+ * If the index does not know the file, the file is opened right away: that tells if it exists and the session
+ * needs the open file anyway.
+ */
+std::shared_ptr<BlockSource> DirectoryProvider::findBeneath(const QString &fileName)
+{
+    QString relativeName = DirectoryHandle::relativeName(fileName);
+    if (relativeName.isEmpty())
+    {
+        return nullptr;
+    }
+
+    QString filePath = m_dirHandle->path() + '/' + relativeName;
+    std::shared_ptr<FileBlockSource> source;
+    if (m_index)
+    {
+        DirectoryIndex::FileMetadata metadata;
+        switch (m_index->lookup(relativeName, &metadata))
+        {
+            case DirectoryIndex::LookupResult::Found:
+                source = std::make_shared<FileBlockSource>(filePath, metadata, m_index, relativeName);
+                source->setDirectoryHandle(m_dirHandle, relativeName);
+                return source;
+            case DirectoryIndex::LookupResult::Missing:
+                return nullptr;
+            case DirectoryIndex::LookupResult::Unknown:
+                break;
+        }
+    }
+
+    source = std::make_shared<FileBlockSource>(filePath);
+    source->setDirectoryHandle(m_dirHandle, relativeName);
+    if ( ! source->open() && DirectoryHandle::isNotFoundError(source->openError()) )
+    {
+        return nullptr;
+    }
+    return source;
+}
+
+
+
+/**
+ * @brief MemoryProvider::addFile provide a file with fixed contents, replacing a file or generator with the same name
+ *
+ * Transfers of the file that are in progress continue with the contents they started with.
+ */
+void MemoryProvider::addFile(const QString &fileName, const QByteArray &contents)
+{
+    m_generators.erase(fileName);
+    m_files[fileName] = contents;
+}
+
+
+/**
+ * @brief MemoryProvider::addGenerator provide a file of which the contents are produced for each read request
+ */
+void MemoryProvider::addGenerator(const QString &fileName, MemoryProvider::Generator generator)
+{
+    m_files.erase(fileName);
+    m_generators[fileName] = generator;
+}
+
+
+void MemoryProvider::removeFile(const QString &fileName)
+{
+    m_files.erase(fileName);
+    m_generators.erase(fileName);
+}
+
+
+std::shared_ptr<BlockSource> MemoryProvider::find(const QString &fileName, const QHostAddress &peerAddr)
+{
+    auto fileIter = m_files.find(fileName);
+    if (fileIter != m_files.end())
+    {
+        return std::make_shared<MemoryBlockSource>(fileName, fileIter->second);
+    }
+
+    auto generatorIter = m_generators.find(fileName);
+    if (generatorIter != m_generators.end())
+    {
+        return std::make_shared<MemoryBlockSource>(fileName, generatorIter->second(fileName, peerAddr));
+    }
+
+    return nullptr;
+}
+
+
+} // QTFTP namespace end
@@ -0,0 +1,144 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#include "qtftp/congestioncontroller.h"
+#include <algorithm>
+
+namespace QTFTP
+{
+
+constexpr unsigned int CongestionController::InitialWindow;
+constexpr unsigned int CongestionController::DelayIncreaseFactor;
+constexpr uint64_t CongestionController::MinQueueingDelayUs;
+constexpr uint64_t CongestionController::UnknownAckDelay;
+
+static constexpr double DecreaseFactor = 0.5;
+static constexpr unsigned int AckDelaySmoothing = 8;   /// weight of the smoothed ACK delay against a new sample
+
+
+CongestionController::CongestionController(unsigned int maxWindow) : m_window(1.0),
+                                                                     m_maxWindow(1),
+                                                                     m_minAckDelayUs(0),
+                                                                     m_smoothedAckDelayUs(0),
+                                                                     m_blocksUntilDecrease(0)
+{
+    setMaxWindow(maxWindow);
+}
+
+
+/**
+ * @brief CongestionController::setMaxWindow set the window size negotiated with the client and restart at the initial window
+ */
+void CongestionController::setMaxWindow(unsigned int maxWindow)
+{
+    m_maxWindow = std::max(maxWindow, 1u);
+    m_window = std::min(InitialWindow, m_maxWindow);
+    m_blocksUntilDecrease = 0;
+}
+
+
+unsigned int CongestionController::maxWindow() const
+{
+    return m_maxWindow;
+}
+
+
+/**
+ * @brief CongestionController::window get the nr of blocks that may be sent without waiting, 1..maxWindow()
+ */
+unsigned int CongestionController::window() const
+{
+    return std::min(std::max(static_cast<unsigned int>(m_window), 1u), m_maxWindow);
+}
+
+
+/**
+ * @brief CongestionController::smoothedAckDelayUs get the moving average of the ACK delay, 0 if no ACK was received yet
+ */
+uint64_t CongestionController::smoothedAckDelayUs() const
+{
+    return m_smoothedAckDelayUs;
+}
+
+
+/**
+ * @brief CongestionController::ackReceived account for a cumulative ACK of a completely received window
+ * @param blocksAcked nr of blocks acknowledged by the ACK
+ * @param ackDelayUs time between sending the last block of the window and receiving its ACK, or UnknownAckDelay when
+ *                   the window contained retransmitted blocks (Karn's rule), then only the window grows
+ */
+void CongestionController::ackReceived(unsigned int blocksAcked, uint64_t ackDelayUs)
+{
+    bool delayRose = false;
+    if (ackDelayUs != UnknownAckDelay)
+    {
+        m_smoothedAckDelayUs = (m_smoothedAckDelayUs == 0) ? ackDelayUs :
+                               (m_smoothedAckDelayUs * (AckDelaySmoothing - 1) + ackDelayUs) / AckDelaySmoothing;
+        delayRose = m_minAckDelayUs > 0 && ackDelayUs > m_minAckDelayUs * DelayIncreaseFactor &&
+                    ackDelayUs - m_minAckDelayUs > MinQueueingDelayUs;
+        if (m_minAckDelayUs == 0 || ackDelayUs < m_minAckDelayUs)
+        {
+            m_minAckDelayUs = std::max<uint64_t>(ackDelayUs, 1);
+        }
+    }
+    m_blocksUntilDecrease -= std::min(m_blocksUntilDecrease, blocksAcked);
+
+    if (delayRose)
+    {
+        decrease();
+        return;
+    }
+    m_window = std::min(m_window + static_cast<double>(blocksAcked) / m_window, static_cast<double>(m_maxWindow));
+}
+
+
+/**
+ * @brief CongestionController::lossDetected account for an ACK that reports that blocks of the window were lost
+ */
+void CongestionController::lossDetected()
+{
+    decrease();
+}
+
+
+/**
+ * @brief CongestionController::timeOut account for a window that was not acknowledged in time
+ *
+ * A time-out always decreases the window, also shortly after a previous decrease.
+ */
+void CongestionController::timeOut()
+{
+    m_blocksUntilDecrease = 0;
+    decrease();
+}
+
+
+void CongestionController::decrease()
+{
+    if (m_blocksUntilDecrease > 0)
+    {
+        return;
+    }
+    m_window = std::max(m_window * DecreaseFactor, 1.0);
+    m_blocksUntilDecrease = window();
+}
+
+
+} // QTFTP namespace end
@@ -0,0 +1,314 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#include "qtftp/directoryhandle.h"
+#include <QDir>
+#include <QStringList>
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#if defined(SYS_openat2) && __has_include(<linux/openat2.h>)
+#include <linux/openat2.h>
+#define QTFTP_HAVE_OPENAT2
+#endif
+#endif
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <vector>
+
+namespace QTFTP
+{
+
+#ifdef QTFTP_HAVE_OPENAT2
+static std::atomic<bool> g_openat2Unsupported(false); /// set when the running kernel returned ENOSYS for openat2()
+#endif
+
+
+DirectoryHandle::DirectoryHandle(const QString &dirPath) : m_path(QDir(dirPath).absolutePath()),
+                                                           m_dirFd(-1)
+{
+}
+
+
+DirectoryHandle::~DirectoryHandle()
+{
+#ifdef __linux__
+    if (m_dirFd >= 0)
+    {
+        ::close(m_dirFd);
+    }
+#endif
+}
+
+
+/**
+ * @brief DirectoryHandle::open open the directory
+ * @return false if the directory can't be opened or the platform does not support opening files relative to a directory
+ */
+bool DirectoryHandle::open()
+{
+#ifdef __linux__
+    if (m_dirFd < 0)
+    {
+        m_dirFd = ::open(QFile::encodeName(m_path).constData(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+    }
+    return m_dirFd >= 0;
+#else
+    return false;
+#endif
+}
+
+
+bool DirectoryHandle::isOpen() const
+{
+    return m_dirFd >= 0;
+}
+
+
+/**
+ * @brief DirectoryHandle::path get the absolute path of the directory at the time it was opened
+ */
+QString DirectoryHandle::path() const
+{
+    return m_path;
+}
+
+
+/**
+ * @brief DirectoryHandle::openFile open a regular file below the directory for reading
+ * @param relativeName name of the file relative to the directory, see relativeName()
+ * @param file if successful, \p file is opened on the file (and closes it when closed itself)
+ * @param fileSize if successful, the size of the file is stored in this parameter
+ * @param lastModified if successful, the modification time of the file is stored in this parameter
+ * @return 0 if the file was opened, otherwise the errno value that describes the error
+ */
+int DirectoryHandle::openFile(const QString &relativeName, QFile &file, qint64 &fileSize, QDateTime &lastModified) const
+{
+#ifdef __linux__
+    if (m_dirFd < 0)
+    {
+        return EBADF;
+    }
+    if (relativeName.isEmpty())
+    {
+        return ENOENT;
+    }
+
+    //O_NONBLOCK: don't hang on a fifo, the file is rejected below anyway
+    int fileFd = openBeneath(QFile::encodeName(relativeName), O_RDONLY | O_CLOEXEC | O_NOCTTY | O_NONBLOCK);
+    if (fileFd < 0)
+    {
+        return errno;
+    }
+
+    struct stat fileStat;
+    if (fstat(fileFd, &fileStat) != 0)
+    {
+        int errorNr = errno;
+        ::close(fileFd);
+        return errorNr;
+    }
+    if (!S_ISREG(fileStat.st_mode))
+    {
+        ::close(fileFd);
+        return S_ISDIR(fileStat.st_mode) ? EISDIR : EACCES;
+    }
+    if ( ! file.open(fileFd, QIODevice::ReadOnly, QFileDevice::AutoCloseHandle) )
+    {
+        ::close(fileFd);
+        return EIO;
+    }
+    fileSize = static_cast<qint64>(fileStat.st_size);
+    lastModified = QDateTime::fromMSecsSinceEpoch(static_cast<qint64>(fileStat.st_mtim.tv_sec) * 1000 + fileStat.st_mtim.tv_nsec / 1000000);
+    return 0;
+#else
+    Q_UNUSED(relativeName);
+    Q_UNUSED(file);
+    Q_UNUSED(fileSize);
+    Q_UNUSED(lastModified);
+    return ENOSYS;
+#endif
+}
+
+
+/**
+ * @brief DirectoryHandle::relativeName get the name of a requested file relative to the directory
+ * @return the name without leading slashes, or an empty string if the name contains ".." or refers to the directory itself
+ *
+ * Many clients put a '/' in front of the file name, it is taken to mean the root of the files directory.
+ */
+QString DirectoryHandle::relativeName(const QString &fileName)
+{
+    if (fileName.split("/").contains(".."))
+    {
+        return QString();
+    }
+    QString name = QDir::cleanPath(fileName);
+    while (name.startsWith("/"))
+    {
+        name.remove(0, 1);
+    }
+    return (name == ".") ? QString() : name;
+}
+
+
+/**
+ * @brief DirectoryHandle::isNotFoundError check if an error returned by openFile() means that the file does not exist below the directory
+ */
+bool DirectoryHandle::isNotFoundError(int errorNr)
+{
+    return errorNr == ENOENT || errorNr == ENOTDIR || errorNr == EXDEV || errorNr == ELOOP || errorNr == ENAMETOOLONG;
+}
+
+
+QString DirectoryHandle::errorString(int errorNr)
+{
+    return QString::fromLocal8Bit(std::strerror(errorNr));
+}
+
+
+/**
+ * @brief DirectoryHandle::openBeneath open a file relative to the directory without leaving it
+ * @return file descriptor, or -1 with errno set
+ *
+ * Symbolic links are followed as long as they stay inside the directory. A link with an absolute target, or one that
+ * leads outside of the directory with "..", fails with EXDEV. Both openat2() and the openByComponents() fallback
+ * resolve a name the same way.
+ */
+int DirectoryHandle::openBeneath(const QByteArray &relativeName, int openFlags) const
+{
+#ifdef QTFTP_HAVE_OPENAT2
+    if ( ! g_openat2Unsupported.load(std::memory_order_relaxed) )
+    {
+        struct open_how how;
+        std::memset(&how, 0, sizeof(how));
+        how.flags = static_cast<uint64_t>(openFlags);
+        how.resolve = RESOLVE_BENEATH;
+        long fileFd = syscall(SYS_openat2, m_dirFd, relativeName.constData(), &how, sizeof(how));
+        if (fileFd >= 0 || errno != ENOSYS)
+        {
+            return static_cast<int>(fileFd);
+        }
+        g_openat2Unsupported.store(true, std::memory_order_relaxed);
+    }
+#endif
+    return openByComponents(relativeName, openFlags);
+}
+
+
+/**
+ * @brief DirectoryHandle::openByComponents open a file relative to the directory, one path component at a time
+ * @return file descriptor, or -1 with errno set
+ *
+ * Fallback for kernels without openat2(). Each component is opened with O_NOFOLLOW, a symbolic link is read with
+ * readlinkat() and its target takes the place of the link in the remaining path. The directories that were passed
+ * are kept open, so a ".." component (from a link target) goes back one of them and fails with EXDEV when it would
+ * leave the directory. More than MaxSymbolicLinks links in one name fail with ELOOP, like the kernel does.
+ */
+int DirectoryHandle::openByComponents(const QByteArray &relativeName, int openFlags) const
+{
+#ifdef __linux__
+    static constexpr int MaxSymbolicLinks = 40;
+    QList<QByteArray> components = relativeName.split('/');
+    std::vector<int> dirFds;   //the directories below m_dirFd on the way to the file, deepest last
+    auto closeDirs = [&dirFds]()
+                     {
+                         for (int nextFd : dirFds)
+                         {
+                             ::close(nextFd);
+                         }
+                     };
+    int linkCount = 0;
+    while ( ! components.isEmpty() )
+    {
+        QByteArray component = components.takeFirst();
+        bool isLast = components.isEmpty();
+        int dirFd = dirFds.empty() ? m_dirFd : dirFds.back();
+        if (component == "..")
+        {
+            if (dirFds.empty())
+            {
+                errno = EXDEV;
+                return -1;
+            }
+            ::close(dirFds.back());
+            dirFds.pop_back();
+            continue;
+        }
+        if ((component.isEmpty() || component == ".") && !isLast)
+        {
+            continue;
+        }
+
+        char linkTarget[PATH_MAX];
+        ssize_t targetLength = readlinkat(dirFd, component.constData(), linkTarget, sizeof(linkTarget));
+        if (targetLength >= 0)
+        {
+            if (++linkCount > MaxSymbolicLinks || targetLength == static_cast<ssize_t>(sizeof(linkTarget)))
+            {
+                closeDirs();
+                errno = (linkCount > MaxSymbolicLinks) ? ELOOP : ENAMETOOLONG;
+                return -1;
+            }
+            QByteArray target(linkTarget, static_cast<int>(targetLength));
+            if (target.startsWith('/'))
+            {
+                closeDirs();
+                errno = EXDEV;
+                return -1;
+            }
+            components = target.split('/') + components;
+            continue;
+        }
+        if (errno != EINVAL)
+        {
+            //EINVAL: not a link
+            int readlinkErrno = errno;
+            closeDirs();
+            errno = readlinkErrno;
+            return -1;
+        }
+
+        //O_NOFOLLOW: the component may have been replaced by a link since it was checked
+        int nextFd = openat(dirFd, component.constData(), isLast ? (openFlags | O_NOFOLLOW) : (O_PATH | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC));
+        if (nextFd < 0 || isLast)
+        {
+            int openErrno = errno;
+            closeDirs();
+            errno = openErrno;
+            return nextFd;
+        }
+        dirFds.push_back(nextFd);
+    }
+    closeDirs();
+#else
+    Q_UNUSED(relativeName);
+    Q_UNUSED(openFlags);
+#endif
+    errno = ENOENT;
+    return -1;
+}
+
+
+} // QTFTP namespace end
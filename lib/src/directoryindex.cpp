@@ -0,0 +1,408 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#include "qtftp/directoryindex.h"
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QStringList>
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace QTFTP
+{
+
+#ifdef __linux__
+static constexpr uint32_t WatchMask = IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_MOVED_FROM | IN_MOVED_TO |
+                                      IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR | IN_DONT_FOLLOW;
+#endif
+
+
+DirectoryIndex::DirectoryIndex(const QString &filesDir, QObject *parent) : QObject(parent),
+                                                                            m_filesDir(QDir(filesDir).absolutePath()),
+                                                                            m_inotifyFd(-1),
+                                                                            m_active(false)
+{
+}
+
+
+DirectoryIndex::~DirectoryIndex()
+{
+    m_notifier.reset();
+#ifdef __linux__
+    if (m_inotifyFd >= 0)
+    {
+        ::close(m_inotifyFd);
+    }
+#endif
+}
+
+
+/**
+ * @brief DirectoryIndex::start build the index and start watching the files directory for changes
+ * @return false if the files directory can't be watched, the index is not used then
+ */
+bool DirectoryIndex::start()
+{
+#ifdef __linux__
+    if (m_inotifyFd < 0)
+    {
+        m_inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (m_inotifyFd < 0)
+        {
+            return false;
+        }
+        m_notifier = std::make_unique<QSocketNotifier>(m_inotifyFd, QSocketNotifier::Read);
+        connect(m_notifier.get(), &QSocketNotifier::activated, this, &DirectoryIndex::processEvents);
+    }
+    rescan();
+    return m_active;
+#else
+    return false;
+#endif
+}
+
+
+bool DirectoryIndex::isActive() const
+{
+    return m_active;
+}
+
+
+QString DirectoryIndex::filesDir() const
+{
+    return m_filesDir;
+}
+
+
+/**
+ * @brief DirectoryIndex::entryCount get the nr of files, directories and other entries in the index
+ */
+size_t DirectoryIndex::entryCount() const
+{
+    return m_entries.size();
+}
+
+
+/**
+ * @brief DirectoryIndex::lookup look up a requested file in the index
+ * @param fileName file name as it appears in a request, relative to the files directory
+ * @param metadata if not null and the file was found, its size and modification time are stored in this parameter
+ * @return Found or Missing if the index knows the answer, Unknown if the caller must check the file system
+ */
+DirectoryIndex::LookupResult DirectoryIndex::lookup(const QString &fileName, FileMetadata *metadata)
+{
+    if (m_active)
+    {
+        //changes made before the request arrived are already queued by the kernel, process them first
+        processEvents();
+    }
+    if (!m_active || fileName.isEmpty() || QDir::isAbsolutePath(fileName))
+    {
+        return LookupResult::Unknown;
+    }
+
+    if (fileName.split("/").contains(".."))
+    {
+        //the kernel resolves ".." after following links, which the index can't reproduce
+        return LookupResult::Unknown;
+    }
+    QStringList pathParts = QDir::cleanPath(fileName).split("/");
+    if (pathParts.contains("."))
+    {
+        return LookupResult::Unknown;
+    }
+
+    QString relativePath;
+    for (int partNr=0; partNr<pathParts.size(); ++partNr)
+    {
+        relativePath = (partNr == 0) ? pathParts.at(partNr) : relativePath + '/' + pathParts.at(partNr);
+        auto entryIter = m_entries.find(relativePath);
+        if (entryIter == m_entries.end())
+        {
+            //all entries of the parent directory are in the index
+            return LookupResult::Missing;
+        }
+        const Entry &entry = entryIter->second;
+        if (entry.m_type == EntryType::Other)
+        {
+            return LookupResult::Unknown;
+        }
+        if (partNr < pathParts.size() - 1)
+        {
+            if (entry.m_type != EntryType::Directory)
+            {
+                return LookupResult::Missing;
+            }
+            continue;
+        }
+        if (entry.m_type == EntryType::Directory)
+        {
+            //let opening the file report the error
+            return LookupResult::Unknown;
+        }
+        if (metadata)
+        {
+            *metadata = entry.m_metadata;
+        }
+        return LookupResult::Found;
+    }
+    return LookupResult::Unknown;
+}
+
+
+/**
+ * @brief DirectoryIndex::processEvents apply all pending inotify events to the index
+ */
+void DirectoryIndex::processEvents()
+{
+#ifdef __linux__
+    alignas(struct inotify_event) char eventBuffer[16 * 1024];
+    bool overflow = false;
+    while (true)
+    {
+        ssize_t bytesRead = ::read(m_inotifyFd, eventBuffer, sizeof(eventBuffer));
+        if (bytesRead <= 0)
+        {
+            break;
+        }
+        for (char *eventPtr = eventBuffer; eventPtr < eventBuffer + bytesRead; )
+        {
+            auto event = reinterpret_cast<const struct inotify_event*>(eventPtr);
+            eventPtr += sizeof(struct inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW)
+            {
+                overflow = true;
+                continue;
+            }
+            auto watchIter = m_watches.find(event->wd);
+            if (watchIter == m_watches.end())
+            {
+                continue;
+            }
+            if (event->mask & IN_IGNORED)
+            {
+                m_watches.erase(watchIter);
+                continue;
+            }
+            QString dirPath = watchIter->second;
+            if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF))
+            {
+                if (dirPath.isEmpty())
+                {
+                    //the files directory itself is gone, from now on the file system has to be checked
+                    clear();
+                }
+                continue;
+            }
+            if (event->len == 0)
+            {
+                continue;
+            }
+
+            QString entryName = QFile::decodeName(event->name);
+            QString relativePath = dirPath.isEmpty() ? entryName : dirPath + '/' + entryName;
+            if (event->mask & (IN_DELETE | IN_MOVED_FROM))
+            {
+                removeEntry(relativePath);
+            }
+            else
+            {
+                updateEntry(relativePath);
+            }
+        }
+    }
+
+    if (overflow && m_active)
+    {
+        //events were lost, the index can only be trusted after reading the directory again
+        rescan();
+    }
+#endif
+}
+
+
+/**
+ * @brief DirectoryIndex::clear remove all entries and watches, the index is inactive afterwards
+ */
+void DirectoryIndex::clear()
+{
+#ifdef __linux__
+    for (const auto &nextWatch : m_watches)
+    {
+        inotify_rm_watch(m_inotifyFd, nextWatch.first);
+    }
+#endif
+    m_watches.clear();
+    m_entries.clear();
+    m_active = false;
+}
+
+
+/**
+ * @brief DirectoryIndex::rescan rebuild the index from the contents of the files directory
+ */
+void DirectoryIndex::rescan()
+{
+    clear();
+#ifdef __linux__
+    int watchDescriptor = inotify_add_watch(m_inotifyFd, QFile::encodeName(m_filesDir).constData(), WatchMask);
+    if (watchDescriptor < 0)
+    {
+        return;
+    }
+    m_watches[watchDescriptor] = QString();
+    scanDirectory(QString());
+    m_active = true;
+#endif
+}
+
+
+/**
+ * @brief DirectoryIndex::scanDirectory add all entries of a watched directory (and its subdirectories) to the index
+ */
+void DirectoryIndex::scanDirectory(const QString &relativeDir)
+{
+    QDir dir(absolutePath(relativeDir));
+    auto entryNames = dir.entryList(QDir::AllEntries | QDir::NoDotAndDotDot | QDir::Hidden | QDir::System);
+    for (const auto &nextName : entryNames)
+    {
+        addEntry(relativeDir.isEmpty() ? nextName : relativeDir + '/' + nextName);
+    }
+}
+
+
+/**
+ * @brief DirectoryIndex::addEntry add a file or directory that is not in the index yet
+ *
+ * A directory is watched before it is read, so files created while it is being read are not missed.
+ */
+void DirectoryIndex::addEntry(const QString &relativePath)
+{
+    QFileInfo entryInfo(absolutePath(relativePath));
+    Entry entry{EntryType::Other, FileMetadata{0, QDateTime()}};
+    if (entryInfo.isSymLink())
+    {
+        //the target may be outside the watched tree
+    }
+    else if (entryInfo.isDir())
+    {
+#ifdef __linux__
+        if (entryInfo.isReadable() && entryInfo.isExecutable())
+        {
+            int watchDescriptor = inotify_add_watch(m_inotifyFd, QFile::encodeName(entryInfo.absoluteFilePath()).constData(), WatchMask);
+            if (watchDescriptor >= 0)
+            {
+                m_watches[watchDescriptor] = relativePath;
+                entry.m_type = EntryType::Directory;
+            }
+        }
+#endif
+    }
+    else if (entryInfo.isFile())
+    {
+        entry.m_type = EntryType::File;
+        entry.m_metadata = FileMetadata{entryInfo.size(), entryInfo.lastModified()};
+    }
+    m_entries[relativePath] = entry;
+
+    if (entry.m_type == EntryType::Directory)
+    {
+        scanDirectory(relativePath);
+    }
+}
+
+
+/**
+ * @brief DirectoryIndex::updateEntry read the metadata of an entry again after an inotify event
+ */
+void DirectoryIndex::updateEntry(const QString &relativePath)
+{
+    QFileInfo entryInfo(absolutePath(relativePath));
+    auto entryIter = m_entries.find(relativePath);
+    if (entryIter != m_entries.end() && entryIter->second.m_type == EntryType::Directory)
+    {
+        if (entryInfo.isDir() && !entryInfo.isSymLink())
+        {
+            //contents of the directory are kept up to date by its own watch
+            return;
+        }
+        removeEntry(relativePath);
+    }
+    if (!entryInfo.exists() && !entryInfo.isSymLink())
+    {
+        removeEntry(relativePath);
+        return;
+    }
+    addEntry(relativePath);
+}
+
+
+/**
+ * @brief DirectoryIndex::removeEntry remove an entry and, if it is a directory, everything below it
+ */
+void DirectoryIndex::removeEntry(const QString &relativePath)
+{
+    QString dirPrefix = relativePath + '/';
+    auto entryIter = m_entries.find(relativePath);
+    if (entryIter == m_entries.end())
+    {
+        return;
+    }
+    bool isDirectory = (entryIter->second.m_type == EntryType::Directory);
+    m_entries.erase(entryIter);
+    if (!isDirectory)
+    {
+        return;
+    }
+
+    //entries below a directory are sorted directly after it
+    for (auto childIter = m_entries.lower_bound(dirPrefix); childIter != m_entries.end() && childIter->first.startsWith(dirPrefix); )
+    {
+        childIter = m_entries.erase(childIter);
+    }
+    for (auto watchIter = m_watches.begin(); watchIter != m_watches.end(); )
+    {
+        if (watchIter->second == relativePath || watchIter->second.startsWith(dirPrefix))
+        {
+#ifdef __linux__
+            //a directory that was moved away is still watched at its new location
+            inotify_rm_watch(m_inotifyFd, watchIter->first);
+#endif
+            watchIter = m_watches.erase(watchIter);
+        }
+        else
+        {
+            ++watchIter;
+        }
+    }
+}
+
+
+QString DirectoryIndex::absolutePath(const QString &relativePath) const
+{
+    return relativePath.isEmpty() ? m_filesDir : m_filesDir + '/' + relativePath;
+}
+
+
+} // QTFTP namespace end
@@ -0,0 +1,101 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#include "qtftp/eventlooplagmonitor.h"
+#include <algorithm>
+
+namespace QTFTP
+{
+
+/**
+ * @brief EventLoopLagMonitor::EventLoopLagMonitor
+ * @param lagHistogram histogram in which the measured lag of each timer expiry is recorded
+ */
+EventLoopLagMonitor::EventLoopLagMonitor(Histogram &lagHistogram, QObject *parent) : QObject(parent),
+                                                                                     m_lagHistogram(lagHistogram),
+                                                                                     m_intervalMs(0),
+                                                                                     m_lastLagUs(0),
+                                                                                     m_maxLagUs(0)
+{
+    m_timer.setSingleShot(true);
+    m_timer.setTimerType(Qt::PreciseTimer);
+    connect(&m_timer, &QTimer::timeout, this, &EventLoopLagMonitor::handleTimeOut);
+}
+
+
+/**
+ * @brief EventLoopLagMonitor::start start measuring the event loop lag
+ * @param intervalMs time between measurements in ms
+ */
+void EventLoopLagMonitor::start(unsigned int intervalMs)
+{
+    m_intervalMs = std::max(intervalMs, 1u);
+    m_expectedExpiry = std::chrono::steady_clock::now() + std::chrono::milliseconds(m_intervalMs);
+    m_timer.start(static_cast<int>(m_intervalMs));
+}
+
+
+void EventLoopLagMonitor::stop()
+{
+    m_timer.stop();
+}
+
+
+bool EventLoopLagMonitor::isActive() const
+{
+    return m_timer.isActive();
+}
+
+
+/**
+ * @brief EventLoopLagMonitor::lastLagUs get the lag of the most recent measurement in microseconds
+ */
+uint64_t EventLoopLagMonitor::lastLagUs() const
+{
+    return m_lastLagUs;
+}
+
+
+/**
+ * @brief EventLoopLagMonitor::maxLagUs get the largest lag measured since the monitor was created in microseconds
+ */
+uint64_t EventLoopLagMonitor::maxLagUs() const
+{
+    return m_maxLagUs;
+}
+
+
+void EventLoopLagMonitor::handleTimeOut()
+{
+    auto now = std::chrono::steady_clock::now();
+    auto lag = std::chrono::duration_cast<std::chrono::microseconds>(now - m_expectedExpiry).count();
+    m_lastLagUs = static_cast<uint64_t>(std::max<long long>(lag, 0));
+    m_maxLagUs = std::max(m_maxLagUs, m_lastLagUs);
+    m_lagHistogram.record(m_lastLagUs);
+
+    //restart relative to now, so a long stall is counted once instead of in every following measurement
+    m_expectedExpiry = now + std::chrono::milliseconds(m_intervalMs);
+    m_timer.start(static_cast<int>(m_intervalMs));
+
+    emit tick(m_lastLagUs);
+}
+
+
+} // QTFTP namespace end
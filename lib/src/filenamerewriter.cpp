@@ -0,0 +1,409 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#include "qtftp/filenamerewriter.h"
+#include "qtftp/tftp_error.h"
+#include <QFile>
+#include <QStringList>
+#include <QTextStream>
+
+using namespace std::string_literals;
+
+namespace QTFTP
+{
+
+FileNameRewriter::FileNameRewriter(int maxCachedNames) : m_maxCachedNames(maxCachedNames)
+{
+}
+
+
+/**
+ * @brief FileNameRewriter::addRule add a rule after the rules that were added before
+ * @param flags combination of the flag characters described at the class
+ * @throw TftpError if \p flags or \p pattern is not valid
+ */
+void FileNameRewriter::addRule(const QString &flags, const QString &pattern, const QString &replacement)
+{
+    bool isPrefix = false;
+    bool isRegex = false;
+    bool ignoreCase = false;
+    Rule rule{replacement, QRegularExpression(), QString(), false, false, false};
+    for (QChar nextFlag : flags)
+    {
+        switch (nextFlag.toLatin1())
+        {
+            case 'p': isPrefix = true; break;
+            case 'r': isRegex = true; break;
+            case 'i': ignoreCase = true; break;
+            case 'g': rule.m_global = true; break;
+            case 'e': rule.m_stop = true; break;
+            default:
+                throw TftpError("Invalid rewrite rule flag '"s + QString(nextFlag).toStdString() + "'");
+        }
+    }
+    if (isPrefix == isRegex)
+    {
+        throw TftpError("Rewrite rule for "s + pattern.toStdString() + " must have either flag 'p' or flag 'r'");
+    }
+    if (pattern.isEmpty())
+    {
+        throw TftpError("Rewrite rule without pattern");
+    }
+
+    rule.m_ignoreCase = ignoreCase;
+    int ruleIndex = static_cast<int>(m_rules.size());
+    QString prefix = pattern;
+    bool fromRegex = false;
+    if (isRegex && !rule.m_global && literalPrefix(pattern, replacement, prefix))
+    {
+        //matched faster by the prefix trie
+        isPrefix = true;
+        fromRegex = true;
+    }
+
+    if (isPrefix)
+    {
+        rule.m_prefix = prefix;
+        addPrefixRule(prefix, ignoreCase, fromRegex, ruleIndex);
+    }
+    else
+    {
+        rule.m_regex = QRegularExpression(pattern, ignoreCase ? QRegularExpression::CaseInsensitiveOption : QRegularExpression::NoPatternOption);
+        if (!rule.m_regex.isValid())
+        {
+            throw TftpError("Invalid regular expression "s + pattern.toStdString() + " in rewrite rule: " + rule.m_regex.errorString().toStdString());
+        }
+        rule.m_regex.optimize();
+        m_stages.push_back(Stage{ruleIndex, {}, {}, {}});
+    }
+    m_rules.push_back(rule);
+    m_cache.clear();
+}
+
+
+/**
+ * @brief FileNameRewriter::loadRules add the rules in a rules file
+ * @throw TftpError if the file can't be read or contains an invalid rule
+ *
+ * Each line of the file contains the flags, the pattern and (optionally) the replacement of one rule, separated by
+ * white space. Empty lines and lines starting with '#' are ignored.
+ */
+void FileNameRewriter::loadRules(const QString &rulesFileName)
+{
+    QFile rulesFile(rulesFileName);
+    if ( ! rulesFile.open(QIODevice::ReadOnly | QIODevice::Text) )
+    {
+        throw TftpError("Could not open rewrite rules file "s + rulesFileName.toStdString() + ": " + rulesFile.errorString().toStdString());
+    }
+
+    QTextStream rulesStream(&rulesFile);
+    QRegularExpression fieldSeparator("\\s+");
+    unsigned int lineNr = 0;
+    while (!rulesStream.atEnd())
+    {
+        ++lineNr;
+        QString line = rulesStream.readLine().trimmed();
+        if (line.isEmpty() || line.startsWith("#"))
+        {
+            continue;
+        }
+        QStringList fields = line.split(fieldSeparator);
+        try
+        {
+            if (fields.size() < 2 || fields.size() > 3)
+            {
+                throw TftpError("expected <flags> <pattern> [<replacement>]");
+            }
+            addRule(fields.at(0), fields.at(1), (fields.size() == 3) ? fields.at(2) : QString());
+        }
+        catch (const TftpError &ruleErr)
+        {
+            throw TftpError("Rewrite rules file "s + rulesFileName.toStdString() + " line " + std::to_string(lineNr) + ": " + ruleErr.what());
+        }
+    }
+}
+
+
+size_t FileNameRewriter::ruleCount() const
+{
+    return m_rules.size();
+}
+
+
+/**
+ * @brief FileNameRewriter::rewrite apply all rules to a requested file name
+ * @return the rewritten name, which is \p fileName itself if no rule matched
+ */
+QString FileNameRewriter::rewrite(const QString &fileName)
+{
+    if (m_stages.empty())
+    {
+        return fileName;
+    }
+    auto cacheIter = m_cache.constFind(fileName);
+    if (cacheIter != m_cache.constEnd())
+    {
+        return cacheIter.value();
+    }
+
+    QString rewrittenName = fileName;
+    for (const auto &nextStage : m_stages)
+    {
+        const Rule *matchedRule = nullptr;
+        if (nextStage.m_regexRule >= 0)
+        {
+            const Rule &rule = m_rules[static_cast<size_t>(nextStage.m_regexRule)];
+            if (applyRegexRule(rule, rewrittenName))
+            {
+                matchedRule = &rule;
+            }
+        }
+        else
+        {
+            int exactLength = 0;
+            int foldedLength = 0;
+            int exactRule = longestPrefix(nextStage.m_exactTrie, rewrittenName, false, exactLength);
+            int foldedRule = longestPrefix(nextStage.m_foldedTrie, rewrittenName, true, foldedLength);
+            int ruleIndex = (foldedRule >= 0 && foldedLength > exactLength) ? foldedRule : exactRule;
+            if (ruleIndex >= 0)
+            {
+                matchedRule = &m_rules[static_cast<size_t>(ruleIndex)];
+                rewrittenName = matchedRule->m_replacement + rewrittenName.mid(std::max(exactLength, foldedLength));
+            }
+        }
+        if (matchedRule && matchedRule->m_stop)
+        {
+            break;
+        }
+    }
+
+    if (m_cache.size() >= m_maxCachedNames)
+    {
+        m_cache.clear();
+    }
+    if (m_maxCachedNames > 0)
+    {
+        m_cache.insert(fileName, rewrittenName);
+    }
+    return rewrittenName;
+}
+
+
+/**
+ * @brief FileNameRewriter::addPrefixRule add a prefix to the trie of the last stage, starting a new stage if the rule doesn't fit in it
+ * @param fromRegex the rule was given as a regular expression, which must not be overruled by a longer prefix
+ */
+void FileNameRewriter::addPrefixRule(const QString &prefix, bool ignoreCase, bool fromRegex, int ruleIndex)
+{
+    if (m_stages.empty() || !fitsPrefixStage(m_stages.back(), prefix, ignoreCase, fromRegex))
+    {
+        m_stages.push_back(Stage{-1, std::vector<TrieNode>(1, TrieNode{{}, -1}), std::vector<TrieNode>(1, TrieNode{{}, -1}), {}});
+    }
+    m_stages.back().m_prefixRules.push_back(ruleIndex);
+    std::vector<TrieNode> &trie = ignoreCase ? m_stages.back().m_foldedTrie : m_stages.back().m_exactTrie;
+
+    uint32_t nodeIndex = 0;
+    for (QChar nextChar : prefix)
+    {
+        ushort key = ignoreCase ? nextChar.toLower().unicode() : nextChar.unicode();
+        auto childIter = trie[nodeIndex].m_children.find(key);
+        if (childIter == trie[nodeIndex].m_children.end())
+        {
+            trie.push_back(TrieNode{{}, -1});
+            uint32_t childIndex = static_cast<uint32_t>(trie.size() - 1);
+            trie[nodeIndex].m_children[key] = childIndex;
+            nodeIndex = childIndex;
+        }
+        else
+        {
+            nodeIndex = childIter->second;
+        }
+    }
+    //an earlier rule with the same prefix keeps precedence
+    if (trie[nodeIndex].m_ruleIndex < 0)
+    {
+        trie[nodeIndex].m_ruleIndex = ruleIndex;
+    }
+}
+
+
+/**
+ * @brief FileNameRewriter::fitsPrefixStage check if a prefix rule can be applied in the same step as the rules of a stage
+ *
+ * That is not the case if a rule of the stage replaces a prefix by a text that the new prefix may match, because the
+ * new rule must see the result of the earlier one. A rule that was given as a regular expression must also not share
+ * the stage with a rule whose prefix overlaps its own, as in the stage the longest prefix would win instead of the
+ * first rule.
+ */
+bool FileNameRewriter::fitsPrefixStage(const Stage &stage, const QString &prefix, bool ignoreCase, bool fromRegex) const
+{
+    if (stage.m_regexRule >= 0)
+    {
+        return false;
+    }
+    for (int stageRule : stage.m_prefixRules)
+    {
+        const Rule &rule = m_rules[static_cast<size_t>(stageRule)];
+        bool foldCase = ignoreCase || rule.m_ignoreCase;
+        if (overlaps(rule.m_replacement, prefix, foldCase) || (fromRegex && overlaps(rule.m_prefix, prefix, foldCase)))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/**
+ * @brief FileNameRewriter::overlaps check if one of two texts starts with the other one
+ */
+bool FileNameRewriter::overlaps(const QString &first, const QString &second, bool ignoreCase)
+{
+    Qt::CaseSensitivity caseSensitivity = ignoreCase ? Qt::CaseInsensitive : Qt::CaseSensitive;
+    return first.startsWith(second, caseSensitivity) || second.startsWith(first, caseSensitivity);
+}
+
+
+/**
+ * @brief FileNameRewriter::longestPrefix find the rule with the longest prefix of \p fileName in a trie
+ * @param matchLength if a rule was found, the length of its prefix is stored in this parameter
+ * @return index of the rule or -1 if no prefix matches
+ */
+int FileNameRewriter::longestPrefix(const std::vector<TrieNode> &trie, const QString &fileName, bool foldCase, int &matchLength) const
+{
+    int ruleIndex = -1;
+    uint32_t nodeIndex = 0;
+    for (int charNr=0; charNr<fileName.size(); ++charNr)
+    {
+        ushort key = foldCase ? fileName.at(charNr).toLower().unicode() : fileName.at(charNr).unicode();
+        auto childIter = trie[nodeIndex].m_children.find(key);
+        if (childIter == trie[nodeIndex].m_children.end())
+        {
+            break;
+        }
+        nodeIndex = childIter->second;
+        if (trie[nodeIndex].m_ruleIndex >= 0)
+        {
+            ruleIndex = trie[nodeIndex].m_ruleIndex;
+            matchLength = charNr + 1;
+        }
+    }
+    return ruleIndex;
+}
+
+
+/**
+ * @brief FileNameRewriter::applyRegexRule replace the first (or with flag 'g' every) match of a regular expression rule
+ * @return true if the expression matched
+ */
+bool FileNameRewriter::applyRegexRule(const Rule &rule, QString &fileName) const
+{
+    QString rewrittenName;
+    int offset = 0;
+    bool matched = false;
+    while (offset <= fileName.size())
+    {
+        QRegularExpressionMatch match = rule.m_regex.match(fileName, offset);
+        if (!match.hasMatch())
+        {
+            break;
+        }
+        matched = true;
+        rewrittenName += fileName.mid(offset, match.capturedStart() - offset) + expandReplacement(rule.m_replacement, match);
+        offset = match.capturedEnd();
+        if (!rule.m_global)
+        {
+            break;
+        }
+        if (match.capturedEnd() == match.capturedStart())
+        {
+            //empty match, copy one character to make progress
+            rewrittenName += fileName.mid(offset, 1);
+            ++offset;
+        }
+    }
+    if (matched)
+    {
+        fileName = rewrittenName + fileName.mid(offset);
+    }
+    return matched;
+}
+
+
+/**
+ * @brief FileNameRewriter::expandReplacement replace \0..\9 in a replacement by the captured texts, \\ by a backslash
+ */
+QString FileNameRewriter::expandReplacement(const QString &replacement, const QRegularExpressionMatch &match)
+{
+    if (!replacement.contains("\\"))
+    {
+        return replacement;
+    }
+    QString expanded;
+    for (int charNr=0; charNr<replacement.size(); ++charNr)
+    {
+        QChar nextChar = replacement.at(charNr);
+        if (nextChar == '\\' && charNr + 1 < replacement.size())
+        {
+            QChar escapedChar = replacement.at(charNr + 1);
+            if (escapedChar.isDigit())
+            {
+                expanded += match.captured(escapedChar.toLatin1() - '0');
+                ++charNr;
+                continue;
+            }
+            if (escapedChar == '\\')
+            {
+                expanded += escapedChar;
+                ++charNr;
+                continue;
+            }
+        }
+        expanded += nextChar;
+    }
+    return expanded;
+}
+
+
+/**
+ * @brief FileNameRewriter::literalPrefix check if a regular expression rule is a plain prefix rule in disguise
+ * @param prefix if so, the literal prefix is stored in this parameter
+ * @return true for patterns like ^literal of which the replacement does not refer to captures
+ */
+bool FileNameRewriter::literalPrefix(const QString &pattern, const QString &replacement, QString &prefix)
+{
+    static const QString RegexMetaChars("\\.^$|?*+()[]{}");
+    if (!pattern.startsWith("^") || pattern.size() < 2 || replacement.contains("\\"))
+    {
+        return false;
+    }
+    for (int charNr=1; charNr<pattern.size(); ++charNr)
+    {
+        if (RegexMetaChars.contains(pattern.at(charNr)))
+        {
+            return false;
+        }
+    }
+    prefix = pattern.mid(1);
+    return true;
+}
+
+
+} // QTFTP namespace end
@@ -0,0 +1,223 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#include "qtftp/histogram.h"
+#include <algorithm>
+#include <cmath>
+
+namespace QTFTP
+{
+
+constexpr unsigned int Histogram::SubBucketBits;
+constexpr unsigned int Histogram::SubBucketCount;
+constexpr unsigned int Histogram::MaxExponent;
+constexpr unsigned int Histogram::BucketCount;
+
+static constexpr unsigned int LinearBucketCount = 2 * Histogram::SubBucketCount;
+
+
+Histogram::Histogram() : m_count(0),
+                         m_sum(0)
+{
+    for (auto &nextBucket : m_buckets)
+    {
+        nextBucket.store(0, std::memory_order_relaxed);
+    }
+}
+
+
+/**
+ * @brief Histogram::record add one sample to the histogram
+ */
+void Histogram::record(uint64_t value)
+{
+    m_buckets[bucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(value, std::memory_order_relaxed);
+}
+
+
+/**
+ * @brief Histogram::merge add all samples of another histogram to this histogram
+ */
+void Histogram::merge(const Histogram &otherHistogram)
+{
+    for (unsigned int index=0; index<BucketCount; ++index)
+    {
+        auto otherValue = otherHistogram.m_buckets[index].load(std::memory_order_relaxed);
+        if (otherValue != 0)
+        {
+            m_buckets[index].fetch_add(otherValue, std::memory_order_relaxed);
+        }
+    }
+    m_count.fetch_add(otherHistogram.m_count.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    m_sum.fetch_add(otherHistogram.m_sum.load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+
+/**
+ * @brief Histogram::reset remove all samples from the histogram
+ *
+ * Samples that are recorded by another thread while the reset is in progress may be partially lost.
+ */
+void Histogram::reset()
+{
+    for (auto &nextBucket : m_buckets)
+    {
+        nextBucket.store(0, std::memory_order_relaxed);
+    }
+    m_count.store(0, std::memory_order_relaxed);
+    m_sum.store(0, std::memory_order_relaxed);
+}
+
+
+uint64_t Histogram::count() const
+{
+    return m_count.load(std::memory_order_relaxed);
+}
+
+
+uint64_t Histogram::sum() const
+{
+    return m_sum.load(std::memory_order_relaxed);
+}
+
+
+/**
+ * @brief Histogram::mean get the exact average of all recorded samples, rounded to the nearest integer
+ * @return the average or 0 if no samples were recorded
+ */
+uint64_t Histogram::mean() const
+{
+    auto nrOfSamples = count();
+    if (nrOfSamples == 0)
+    {
+        return 0;
+    }
+    return (sum() + nrOfSamples / 2) / nrOfSamples;
+}
+
+
+/**
+ * @brief Histogram::percentile estimate the value below which \p fraction of the samples fall
+ * @param fraction value between 0.0 and 1.0, for example 0.99 for the 99th percentile
+ * @return the middle of the bucket that contains the requested percentile, 0 if the histogram is empty
+ */
+uint64_t Histogram::percentile(double fraction) const
+{
+    uint64_t totalCount = 0;
+    for (const auto &nextBucket : m_buckets)
+    {
+        totalCount += nextBucket.load(std::memory_order_relaxed);
+    }
+    if (totalCount == 0)
+    {
+        return 0;
+    }
+
+    fraction = std::min(std::max(fraction, 0.0), 1.0);
+    uint64_t rank = std::max<uint64_t>(static_cast<uint64_t>(std::ceil(fraction * static_cast<double>(totalCount))), 1);
+    uint64_t seenCount = 0;
+    for (unsigned int index=0; index<BucketCount; ++index)
+    {
+        seenCount += m_buckets[index].load(std::memory_order_relaxed);
+        if (seenCount >= rank)
+        {
+            if (index < LinearBucketCount || index == BucketCount-1)
+            {
+                return bucketLowerBound(index);
+            }
+            auto lowerBound = bucketLowerBound(index);
+            return lowerBound + (bucketLowerBound(index+1) - lowerBound) / 2;
+        }
+    }
+
+    return bucketLowerBound(BucketCount-1);
+}
+
+
+/**
+ * @brief Histogram::countBelow get the nr of samples that are smaller than \p value
+ *
+ * The result is exact if \p value is the lower bound of a bucket (for example any power of 2), otherwise
+ * the samples in the bucket that contains \p value are not counted.
+ */
+uint64_t Histogram::countBelow(uint64_t value) const
+{
+    unsigned int lastIndex = bucketIndex(value);
+    if (value > bucketLowerBound(BucketCount-1))
+    {
+        lastIndex = BucketCount;
+    }
+    uint64_t belowCount = 0;
+    for (unsigned int index=0; index<lastIndex; ++index)
+    {
+        belowCount += m_buckets[index].load(std::memory_order_relaxed);
+    }
+    return belowCount;
+}
+
+
+uint64_t Histogram::bucketValue(unsigned int bucketIndex) const
+{
+    return bucketIndex < BucketCount ? m_buckets[bucketIndex].load(std::memory_order_relaxed) : 0;
+}
+
+
+/**
+ * @brief Histogram::bucketIndex get the index of the bucket in which \p value is counted
+ */
+unsigned int Histogram::bucketIndex(uint64_t value)
+{
+    if (value < LinearBucketCount)
+    {
+        return static_cast<unsigned int>(value);
+    }
+
+    unsigned int exponent = SubBucketBits + 1;
+    while (exponent < 63 && (value >> (exponent+1)) != 0)
+    {
+        ++exponent;
+    }
+    if (exponent >= MaxExponent)
+    {
+        return BucketCount - 1;
+    }
+    auto subBucket = static_cast<unsigned int>((value >> (exponent - SubBucketBits)) & (SubBucketCount - 1));
+    return LinearBucketCount + (exponent - SubBucketBits - 1) * SubBucketCount + subBucket;
+}
+
+
+/**
+ * @brief Histogram::bucketLowerBound get the smallest value that is counted in bucket \p bucketIndex
+ */
+uint64_t Histogram::bucketLowerBound(unsigned int bucketIndex)
+{
+    if (bucketIndex < LinearBucketCount)
+    {
+        return bucketIndex;
+    }
+    unsigned int exponent = (bucketIndex - LinearBucketCount) / SubBucketCount + SubBucketBits + 1;
+    uint64_t subBucket = (bucketIndex - LinearBucketCount) % SubBucketCount;
+    return (uint64_t(1) << exponent) + (subBucket << (exponent - SubBucketBits));
+}
+
+
+} // QTFTP namespace end
@@ -0,0 +1,431 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#include "qtftp/metrics.h"
+#include "qtftp/tftp_utils.h"
+#include <algorithm>
+
+namespace QTFTP
+{
+
+constexpr unsigned int BindingMetrics::ErrorCodeCount;
+constexpr unsigned int ServerMetrics::MaxLatencySubnets;
+
+static constexpr int DefaultIpv4SubnetPrefixLength = 24;
+static constexpr int DefaultIpv6SubnetPrefixLength = 64;
+
+// Histograms are exported with a bucket boundary at every 4th power of 2 (16us, 64us, 256us ... ~71 minutes)
+static constexpr unsigned int FirstExportedExponent = 4;
+static constexpr unsigned int LastExportedExponent = 32;
+static constexpr unsigned int ExportedExponentStep = 2;
+
+
+Counter::Counter() : m_value(0)
+{
+}
+
+
+void Counter::add(uint64_t amount)
+{
+    m_value.fetch_add(amount, std::memory_order_relaxed);
+}
+
+
+uint64_t Counter::value() const
+{
+    return m_value.load(std::memory_order_relaxed);
+}
+
+
+Gauge::Gauge() : m_value(0)
+{
+}
+
+
+void Gauge::add(int64_t amount)
+{
+    m_value.fetch_add(amount, std::memory_order_relaxed);
+}
+
+
+void Gauge::sub(int64_t amount)
+{
+    m_value.fetch_sub(amount, std::memory_order_relaxed);
+}
+
+
+void Gauge::set(int64_t newValue)
+{
+    m_value.store(newValue, std::memory_order_relaxed);
+}
+
+
+int64_t Gauge::value() const
+{
+    return m_value.load(std::memory_order_relaxed);
+}
+
+
+BindingMetrics::BindingMetrics(const QHostAddress &bindAddress, uint16_t port) : m_bindAddress(bindAddress),
+                                                                                 m_port(port)
+{
+}
+
+
+ServerMetrics::ServerMetrics() : m_ipv4SubnetPrefixLength(DefaultIpv4SubnetPrefixLength),
+                                 m_ipv6SubnetPrefixLength(DefaultIpv6SubnetPrefixLength),
+                                 m_pacing(std::make_shared<PacingMetrics>())
+{
+}
+
+
+/**
+ * @brief ServerMetrics::addBinding create the metrics for a new binding of the server
+ * @return the metrics object that the sessions of the binding should update
+ */
+std::shared_ptr<BindingMetrics> ServerMetrics::addBinding(const QHostAddress &bindAddress, uint16_t port)
+{
+    auto newMetrics = std::make_shared<BindingMetrics>(bindAddress, port);
+    m_bindings.push_back(newMetrics);
+    return newMetrics;
+}
+
+
+std::vector<std::shared_ptr<const BindingMetrics>> ServerMetrics::bindings() const
+{
+    return std::vector<std::shared_ptr<const BindingMetrics>>(m_bindings.begin(), m_bindings.end());
+}
+
+
+/**
+ * @brief ServerMetrics::setLatencySubnetPrefixLengths set the size of the client subnets for which ACK latency is aggregated
+ * @param ipv4PrefixLength prefix length for IPv4 clients (0-32, default 24)
+ * @param ipv6PrefixLength prefix length for IPv6 clients (0-128, default 64)
+ *
+ * Statistics already aggregated per subnet are discarded.
+ */
+void ServerMetrics::setLatencySubnetPrefixLengths(int ipv4PrefixLength, int ipv6PrefixLength)
+{
+    std::lock_guard<std::mutex> subnetLock(m_subnetMutex);
+    m_ipv4SubnetPrefixLength = std::min(std::max(ipv4PrefixLength, 0), 32);
+    m_ipv6SubnetPrefixLength = std::min(std::max(ipv6PrefixLength, 0), 128);
+    m_subnets.clear();
+}
+
+
+/**
+ * @brief ServerMetrics::mergeAckDelays add the ACK delays of a finished session to the aggregated latency statistics
+ * @param binding the metrics of the binding that served the session, may be null
+ * @param peerAddress address of the client, determines the subnet to which the delays are added
+ * @param sessionAckDelays the ACK delays of the session in microseconds
+ *
+ * At most MaxLatencySubnets client subnets are tracked, delays of clients in additional subnets are only
+ * added to the per-binding and server-wide statistics.
+ */
+void ServerMetrics::mergeAckDelays(BindingMetrics *binding, const QHostAddress &peerAddress, const Histogram &sessionAckDelays)
+{
+    if (sessionAckDelays.count() == 0)
+    {
+        return;
+    }
+
+    if (binding)
+    {
+        binding->m_ackRttUs.merge(sessionAckDelays);
+    }
+    m_ackDelays.merge(sessionAckDelays);
+
+    std::lock_guard<std::mutex> subnetLock(m_subnetMutex);
+    int prefixLength = 0;
+    QHostAddress network = subnetAddress(peerAddress, m_ipv4SubnetPrefixLength, m_ipv6SubnetPrefixLength, prefixLength);
+    QString subnetKey = network.toString() + '/' + QString::number(prefixLength);
+    auto subnetIter = m_subnets.find(subnetKey);
+    if (subnetIter == m_subnets.end())
+    {
+        if (m_subnets.size() >= MaxLatencySubnets)
+        {
+            return;
+        }
+        SubnetEntry newEntry { network, prefixLength, std::make_unique<Histogram>() };
+        subnetIter = m_subnets.emplace(subnetKey, std::move(newEntry)).first;
+    }
+    subnetIter->second.m_ackDelays->merge(sessionAckDelays);
+}
+
+
+/**
+ * @brief ServerMetrics::resetAckDelays discard all aggregated ACK latency statistics (per binding, server-wide and per subnet)
+ */
+void ServerMetrics::resetAckDelays()
+{
+    for (auto &nextBinding : m_bindings)
+    {
+        nextBinding->m_ackRttUs.reset();
+    }
+    m_ackDelays.reset();
+    std::lock_guard<std::mutex> subnetLock(m_subnetMutex);
+    m_subnets.clear();
+}
+
+
+/**
+ * @brief ServerMetrics::ackDelays get the ACK delays in microseconds of all finished sessions of all bindings
+ */
+const Histogram &ServerMetrics::ackDelays() const
+{
+    return m_ackDelays;
+}
+
+
+/**
+ * @brief ServerMetrics::ackDelaysBySubnet get a snapshot of the ACK latency of each client subnet
+ */
+std::vector<SubnetLatency> ServerMetrics::ackDelaysBySubnet() const
+{
+    std::lock_guard<std::mutex> subnetLock(m_subnetMutex);
+    std::vector<SubnetLatency> subnetLatencies;
+    subnetLatencies.reserve(m_subnets.size());
+    for (const auto &nextSubnet : m_subnets)
+    {
+        const Histogram &delays = *nextSubnet.second.m_ackDelays;
+        subnetLatencies.push_back( { nextSubnet.second.m_network, nextSubnet.second.m_prefixLength,
+                                     delays.count(), delays.sum(), delays.percentile(0.5), delays.percentile(0.99) } );
+    }
+    return subnetLatencies;
+}
+
+
+/**
+ * @brief ServerMetrics::eventLoopLag get the histogram of event loop scheduling delays in microseconds
+ */
+Histogram &ServerMetrics::eventLoopLag()
+{
+    return m_eventLoopLagUs;
+}
+
+
+const Histogram &ServerMetrics::eventLoopLag() const
+{
+    return m_eventLoopLagUs;
+}
+
+
+/**
+ * @brief ServerMetrics::admission get the metrics of the queue of read requests waiting for a free session slot
+ */
+AdmissionMetrics &ServerMetrics::admission()
+{
+    return m_admission;
+}
+
+
+const AdmissionMetrics &ServerMetrics::admission() const
+{
+    return m_admission;
+}
+
+
+/**
+ * @brief ServerMetrics::pacing get the metrics of the DATA datagrams delayed by the rate limits of the server
+ */
+std::shared_ptr<PacingMetrics> ServerMetrics::pacing()
+{
+    return m_pacing;
+}
+
+
+const PacingMetrics &ServerMetrics::pacing() const
+{
+    return *m_pacing;
+}
+
+
+/**
+ * @brief ServerMetrics::activeSessions get the nr of transfers in progress on all bindings
+ */
+int64_t ServerMetrics::activeSessions() const
+{
+    int64_t sessionCount = 0;
+    for (const auto &nextBinding : m_bindings)
+    {
+        sessionCount += nextBinding->m_activeSessions.value();
+    }
+    return sessionCount;
+}
+
+
+static void appendFamilyHeader(QByteArray &output, const char *name, const char *help, const char *type)
+{
+    output.append("# HELP ").append(name).append(' ').append(help).append('\n');
+    output.append("# TYPE ").append(name).append(' ').append(type).append('\n');
+}
+
+
+static QByteArray bindingLabels(const BindingMetrics &binding)
+{
+    return "bind_addr=\"" + binding.m_bindAddress.toString().toLatin1() + "\",port=\"" + QByteArray::number(binding.m_port) + '"';
+}
+
+
+template<typename ValueGetter>
+static void appendFamily(QByteArray &output, const std::vector<std::shared_ptr<BindingMetrics>> &bindings,
+                         const char *name, const char *help, const char *type, ValueGetter getValue)
+{
+    appendFamilyHeader(output, name, help, type);
+    for (const auto &nextBinding : bindings)
+    {
+        output.append(name).append('{').append(bindingLabels(*nextBinding)).append("} ");
+        output.append(QByteArray::number(getValue(*nextBinding))).append('\n');
+    }
+}
+
+
+/**
+ * @brief appendHistogram append a histogram with values in microseconds as a Prometheus histogram in seconds
+ *
+ * The upper bound of a Prometheus bucket (le) is inclusive, a sample that equals the bound is counted in the bucket.
+ * The samples are whole microseconds and each power of 2 starts a bucket of the Histogram, so the bound just below a
+ * power of 2 (for example 1023 us) is a real bucket edge and the exported counts are exact.
+ */
+static void appendHistogram(QByteArray &output, const char *name, const QByteArray &labels, const Histogram &histogram)
+{
+    QByteArray bucketLabelPrefix = labels.isEmpty() ? QByteArray() : labels + ',';
+    QByteArray labelSet = labels.isEmpty() ? QByteArray() : "{" + labels + '}';
+    for (unsigned int exponent=FirstExportedExponent; exponent<=LastExportedExponent; exponent+=ExportedExponentStep)
+    {
+        uint64_t nextBucketUs = uint64_t(1) << exponent;
+        output.append(name).append("_bucket{").append(bucketLabelPrefix).append("le=\"");
+        output.append(QByteArray::number(static_cast<double>(nextBucketUs - 1) / 1e6, 'g', 12)).append("\"} ");
+        output.append(QByteArray::number(static_cast<qulonglong>(histogram.countBelow(nextBucketUs)))).append('\n');
+    }
+    auto totalCount = QByteArray::number(static_cast<qulonglong>(histogram.count()));
+    output.append(name).append("_bucket{").append(bucketLabelPrefix).append("le=\"+Inf\"} ").append(totalCount).append('\n');
+    output.append(name).append("_sum").append(labelSet).append(' ');
+    output.append(QByteArray::number(static_cast<double>(histogram.sum()) / 1e6, 'g', 12)).append('\n');
+    output.append(name).append("_count").append(labelSet).append(' ').append(totalCount).append('\n');
+}
+
+
+/**
+ * @brief ServerMetrics::toPrometheusText render the metrics of all bindings in the Prometheus text exposition format
+ *
+ * Rates (for example read requests per second) are not exported directly, they are derived by Prometheus from the
+ * counters with the rate() function.
+ */
+QByteArray ServerMetrics::toPrometheusText() const
+{
+    QByteArray output;
+
+    appendFamily(output, m_bindings, "qtftp_read_requests_total", "Read requests received", "counter",
+                 [](const BindingMetrics &binding) { return static_cast<qulonglong>(binding.m_readRequests.value()); });
+    appendFamily(output, m_bindings, "qtftp_write_requests_total", "Write requests received", "counter",
+                 [](const BindingMetrics &binding) { return static_cast<qulonglong>(binding.m_writeRequests.value()); });
+    appendFamily(output, m_bindings, "qtftp_active_sessions", "Transfers in progress", "gauge",
+                 [](const BindingMetrics &binding) { return static_cast<qlonglong>(binding.m_activeSessions.value()); });
+    appendFamily(output, m_bindings, "qtftp_sessions_finished_total", "Transfers completed successfully", "counter",
+                 [](const BindingMetrics &binding) { return static_cast<qulonglong>(binding.m_sessionsFinished.value()); });
+    appendFamily(output, m_bindings, "qtftp_sessions_failed_total", "Transfers ended with an error", "counter",
+                 [](const BindingMetrics &binding) { return static_cast<qulonglong>(binding.m_sessionsFailed.value()); });
+    appendFamily(output, m_bindings, "qtftp_sent_bytes_total", "Bytes sent by transfers, including retransmissions", "counter",
+                 [](const BindingMetrics &binding) { return static_cast<qulonglong>(binding.m_bytesSent.value()); });
+    appendFamily(output, m_bindings, "qtftp_sent_datagrams_total", "Datagrams sent by transfers, including retransmissions", "counter",
+                 [](const BindingMetrics &binding) { return static_cast<qulonglong>(binding.m_datagramsSent.value()); });
+    appendFamily(output, m_bindings, "qtftp_retransmits_total", "Datagrams retransmitted after an ACK time-out", "counter",
+                 [](const BindingMetrics &binding) { return static_cast<qulonglong>(binding.m_retransmits.value()); });
+    appendFamily(output, m_bindings, "qtftp_send_blocked_total", "Datagrams that waited or were dropped because the socket send buffer was full", "counter",
+                 [](const BindingMetrics &binding) { return static_cast<qulonglong>(binding.m_sendsBlocked.value()); });
+    appendFamily(output, m_bindings, "qtftp_receive_drops_total", "Datagrams dropped by the kernel because a socket receive buffer was full", "counter",
+                 [](const BindingMetrics &binding) { return static_cast<qulonglong>(binding.m_receiveDrops.value()); });
+    appendFamily(output, m_bindings, "qtftp_receive_buffer_bytes", "Receive buffer size of the listening socket", "gauge",
+                 [](const BindingMetrics &binding) { return static_cast<qlonglong>(binding.m_receiveBufferBytes.value()); });
+    appendFamily(output, m_bindings, "qtftp_send_buffer_bytes", "Send buffer size of the listening socket", "gauge",
+                 [](const BindingMetrics &binding) { return static_cast<qlonglong>(binding.m_sendBufferBytes.value()); });
+    appendFamily(output, m_bindings, "qtftp_received_bytes_total", "File bytes received by uploads", "counter",
+                 [](const BindingMetrics &binding) { return static_cast<qulonglong>(binding.m_bytesReceived.value()); });
+
+    appendFamilyHeader(output, "qtftp_errors_sent_total", "TFTP error datagrams sent, by TFTP error code", "counter");
+    for (const auto &nextBinding : m_bindings)
+    {
+        auto labels = bindingLabels(*nextBinding);
+        for (unsigned int errorCode=0; errorCode<BindingMetrics::ErrorCodeCount; ++errorCode)
+        {
+            output.append("qtftp_errors_sent_total{").append(labels).append(",code=\"").append(QByteArray::number(errorCode)).append("\"} ");
+            output.append(QByteArray::number(static_cast<qulonglong>(nextBinding->m_errorsSent[errorCode].value()))).append('\n');
+        }
+    }
+
+    appendFamilyHeader(output, "qtftp_ack_rtt_seconds", "Time between sending a DATA datagram and receiving its ACK, of finished transfers", "histogram");
+    for (const auto &nextBinding : m_bindings)
+    {
+        appendHistogram(output, "qtftp_ack_rtt_seconds", bindingLabels(*nextBinding), nextBinding->m_ackRttUs);
+    }
+
+    appendFamilyHeader(output, "qtftp_receive_queue_delay_seconds", "Time received datagrams waited in the socket receive queue before the server read them", "histogram");
+    for (const auto &nextBinding : m_bindings)
+    {
+        appendHistogram(output, "qtftp_receive_queue_delay_seconds", bindingLabels(*nextBinding), nextBinding->m_receiveQueueDelayUs);
+    }
+
+    appendFamilyHeader(output, "qtftp_session_duration_seconds", "Duration of transfers from RRQ until completion or failure", "histogram");
+    for (const auto &nextBinding : m_bindings)
+    {
+        appendHistogram(output, "qtftp_session_duration_seconds", bindingLabels(*nextBinding), nextBinding->m_sessionDurationUs);
+    }
+
+    appendFamilyHeader(output, "qtftp_event_loop_lag_seconds", "Delay between the planned and actual expiry of the event loop probe timer", "histogram");
+    appendHistogram(output, "qtftp_event_loop_lag_seconds", QByteArray(), m_eventLoopLagUs);
+
+    appendFamilyHeader(output, "qtftp_request_queue_depth", "Read requests waiting for a free session slot", "gauge");
+    output.append("qtftp_request_queue_depth ").append(QByteArray::number(static_cast<qlonglong>(m_admission.m_queuedRequests.value()))).append('\n');
+    appendFamilyHeader(output, "qtftp_request_queue_wait_seconds", "Time read requests waited for a free session slot", "histogram");
+    appendHistogram(output, "qtftp_request_queue_wait_seconds", QByteArray(), m_admission.m_queueWaitUs);
+    appendFamilyHeader(output, "qtftp_requests_rejected_total", "Requests refused because no session slot was free and the queue was full", "counter");
+    output.append("qtftp_requests_rejected_total ").append(QByteArray::number(static_cast<qulonglong>(m_admission.m_requestsRejected.value()))).append('\n');
+    appendFamilyHeader(output, "qtftp_requests_expired_total", "Queued read requests dropped because they waited too long", "counter");
+    output.append("qtftp_requests_expired_total ").append(QByteArray::number(static_cast<qulonglong>(m_admission.m_requestsExpired.value()))).append('\n');
+    appendFamilyHeader(output, "qtftp_requests_rate_limited_total", "Requests dropped because their client exceeded the request rate limit", "counter");
+    output.append("qtftp_requests_rate_limited_total ").append(QByteArray::number(static_cast<qulonglong>(m_admission.m_requestsRateLimited.value()))).append('\n');
+
+    appendFamilyHeader(output, "qtftp_pacing_queue_depth", "DATA datagrams waiting until the rate limits allow them to be sent", "gauge");
+    output.append("qtftp_pacing_queue_depth ").append(QByteArray::number(static_cast<qlonglong>(m_pacing->m_queuedDatagrams.value()))).append('\n');
+    appendFamilyHeader(output, "qtftp_pacing_delay_seconds", "Time delayed DATA datagrams waited for the rate limits", "histogram");
+    appendHistogram(output, "qtftp_pacing_delay_seconds", QByteArray(), m_pacing->m_delayUs);
+    appendFamilyHeader(output, "qtftp_pacing_delayed_datagrams_total", "DATA datagrams that could not be sent right away because of the rate limits", "counter");
+    output.append("qtftp_pacing_delayed_datagrams_total ").append(QByteArray::number(static_cast<qulonglong>(m_pacing->m_datagramsDelayed.value()))).append('\n');
+
+    appendFamilyHeader(output, "qtftp_subnet_ack_rtt_seconds", "ACK round trip time of finished transfers by client subnet", "summary");
+    for (const auto &nextSubnet : ackDelaysBySubnet())
+    {
+        QByteArray labels = "subnet=\"" + nextSubnet.m_network.toString().toLatin1() + '/' + QByteArray::number(nextSubnet.m_prefixLength) + '"';
+        output.append("qtftp_subnet_ack_rtt_seconds{").append(labels).append(",quantile=\"0.5\"} ");
+        output.append(QByteArray::number(static_cast<double>(nextSubnet.m_p50Us) / 1e6, 'g', 6)).append('\n');
+        output.append("qtftp_subnet_ack_rtt_seconds{").append(labels).append(",quantile=\"0.99\"} ");
+        output.append(QByteArray::number(static_cast<double>(nextSubnet.m_p99Us) / 1e6, 'g', 6)).append('\n');
+        output.append("qtftp_subnet_ack_rtt_seconds_sum{").append(labels).append("} ");
+        output.append(QByteArray::number(static_cast<double>(nextSubnet.m_sumUs) / 1e6, 'g', 12)).append('\n');
+        output.append("qtftp_subnet_ack_rtt_seconds_count{").append(labels).append("} ");
+        output.append(QByteArray::number(static_cast<qulonglong>(nextSubnet.m_count))).append('\n');
+    }
+
+    return output;
+}
+
+
+} // QTFTP namespace end
@@ -0,0 +1,491 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#include "qtftp/multicastreadsession.h"
+#include "qtftp/tftp_utils.h"
+#include "qtftp/tftp_constants.h"
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <arpa/inet.h>
+#endif
+#include <algorithm>
+#include <limits>
+
+namespace QTFTP
+{
+
+/**
+ * @brief MulticastReadSession::MulticastReadSession
+ * @param peerAddr address of the first client, which will be the master client
+ * @param peerPort
+ * @param rrqDatagram must contain a RRQ packet with the multicast option
+ * @param filesDir
+ * @param groupAddress IPv4 multicast group the DATA datagrams are sent to
+ * @param groupPort UDP port the DATA datagrams are sent to
+ * @param slowNetworkThresholdUs
+ * @param socketFactory
+ * @param metrics metrics of the binding that received the RRQ, may be null
+ * @param transferGroups registry of the groups that share file reads between sessions, may be null
+ * @param providers providers that are asked for the requested file before it is looked up in \p filesDir
+ * @param directoryProvider provides the files in \p filesDir, may be null
+ * @param localAddr address the session socket is bound to, the address the RRQ was sent to
+ * @param pacer spreads the DATA datagrams of all sessions over time, may be null
+ * @param scheduler shares sending DATA datagrams fairly between sessions, may be null
+ */
+MulticastReadSession::MulticastReadSession(const QHostAddress &peerAddr, uint16_t peerPort, QByteArray rrqDatagram, QString filesDir,
+                                           const QHostAddress &groupAddress, uint16_t groupPort, unsigned int slowNetworkThresholdUs,
+                                           std::shared_ptr<UdpSocketFactory> socketFactory,
+                                           std::shared_ptr<BindingMetrics> metrics,
+                                           std::shared_ptr<TransferGroupRegistry> transferGroups,
+                                           BlockSourceProviders providers,
+                                           std::shared_ptr<DirectoryProvider> directoryProvider,
+                                           const QHostAddress &localAddr,
+                                           std::shared_ptr<Pacer> pacer,
+                                           std::shared_ptr<SendScheduler> scheduler) : ReadSession(peerAddr, peerPort, slowNetworkThresholdUs, socketFactory,
+                                                                                       metrics, transferGroups, providers, directoryProvider, localAddr, pacer,
+                                                                                       scheduler),
+                                                                           m_groupAddress(groupAddress),
+                                                                           m_groupPort(groupPort),
+                                                                           m_multicastAllowed(false),
+                                                                           m_isMulticast(false),
+                                                                           m_waitingForMaster(false),
+                                                                           m_completedClients(0)
+{
+    unsigned int optionsOffset = 0;
+    if ( ! parseRrq(rrqDatagram, filesDir, optionsOffset) )
+    {
+        return;
+    }
+    m_shareKey = sourceShareKey();
+
+    //A new master client reports the first block it misses with a 16 bit block number, so the
+    //file must fit in 65535 blocks of the block size that will be negotiated.
+    unsigned int requestedBlockSize = DefaultTftpBlockSize;
+    QString blockSizeStr;
+    if (findRrqOption(rrqDatagram, "blksize", &blockSizeStr))
+    {
+        bool convOk;
+        unsigned int blockSize = blockSizeStr.toUInt(&convOk, 10);
+        if (convOk && blockSize>=8 && blockSize<=65464)
+        {
+            requestedBlockSize = blockSize;
+        }
+    }
+    m_multicastAllowed = transferMode() == TftpCode::Octet &&
+                         peerAddr.protocol() == QAbstractSocket::IPv4Protocol &&
+                         transferSize() / requestedBlockSize < std::numeric_limits<uint16_t>::max();
+
+    auto waitForOAck = handleRrqOptions(rrqDatagram, optionsOffset);
+    if (!waitForOAck)
+    {
+        restartFromBlock(1);
+    }
+}
+
+
+/**
+ * @brief MulticastReadSession::isMulticast check if the client accepted a multicast transfer
+ * @return false if the multicast option was not acknowledged and this session is a unicast transfer
+ */
+bool MulticastReadSession::isMulticast() const
+{
+    return m_isMulticast;
+}
+
+
+const QHostAddress &MulticastReadSession::groupAddress() const
+{
+    return m_groupAddress;
+}
+
+
+uint16_t MulticastReadSession::groupPort() const
+{
+    return m_groupPort;
+}
+
+
+bool MulticastReadSession::hasClient(const SessionIdent &client) const
+{
+    return std::find(m_clients.begin(), m_clients.end(), client) != m_clients.end();
+}
+
+
+/**
+ * @brief MulticastReadSession::clientCount get the nr of clients that are still receiving the file
+ */
+size_t MulticastReadSession::clientCount() const
+{
+    return m_clients.size();
+}
+
+
+/**
+ * @brief MulticastReadSession::addClient let a client that requests the same file join this transfer
+ * @param peerAddr address of the new client
+ * @param peerPort
+ * @param rrqDatagram RRQ of the new client
+ * @param filesDir directory in which the requested file is looked up
+ * @param providers block source providers of the binding that received the request
+ * @param directoryProvider files directory of the client, as selected by the binding, may be null
+ * @return true if the client joined, false if the request can't be served by this transfer
+ *
+ * The requested file is looked up like a new session would, with \p providers first. The client joins when that
+ * gives a source with the same share key as the file of this transfer (see BlockSource::shareKey()), so names that
+ * differ only in form, like "/file" and "file", join the same transfer. Sources without a share key, like
+ * generated contents, may differ per client, so their clients never join.
+ *
+ * The new client receives an OACK that tells it to listen to the multicast group. It is not the master
+ * client, so it only collects blocks until it becomes master. If the client is already member of the group
+ * (it repeated its RRQ because the OACK was lost) the OACK is sent again.
+ */
+bool MulticastReadSession::addClient(const QHostAddress &peerAddr, uint16_t peerPort, const QByteArray &rrqDatagram, const QString &filesDir,
+                                     const BlockSourceProviders &providers, const std::shared_ptr<DirectoryProvider> &directoryProvider)
+{
+    if (!m_isMulticast || state() == State::Finished || state() == State::InError)
+    {
+        return false;
+    }
+
+    //the mode follows the file name, which may take more bytes than characters
+    int fileNameEnd = rrqDatagram.indexOf('\0', 2);
+    if (fileNameEnd < 0)
+    {
+        return false;
+    }
+    QString fileName = rrqFileName(rrqDatagram);
+    QString mode = QString(rrqDatagram.data() + fileNameEnd + 1).toLower();
+    if (peerAddr.protocol() != QAbstractSocket::IPv4Protocol || mode != "octet" || !findRrqOption(rrqDatagram, "multicast") ||
+        m_shareKey.isEmpty())
+    {
+        return false;
+    }
+    auto requestedSource = lookupBlockSource(providers, directoryProvider, fileName, filesDir, peerAddr);
+    if (!requestedSource || requestedSource->shareKey() != m_shareKey)
+    {
+        return false;
+    }
+
+    //all clients of the group receive the same DATA datagrams, so the block size must match
+    QString blockSizeStr;
+    bool wantsBlockSize = findRrqOption(rrqDatagram, "blksize", &blockSizeStr);
+    if ((wantsBlockSize ? blockSizeStr.toUInt() : DefaultTftpBlockSize) != blockSize())
+    {
+        return false;
+    }
+
+    SessionIdent newClient(peerAddr, peerPort);
+    auto clientIter = std::find(m_clients.begin(), m_clients.end(), newClient);
+    bool isNewClient = (clientIter == m_clients.end());
+    if (isNewClient)
+    {
+        m_clients.push_back(newClient);
+    }
+    else if (clientIter == m_clients.begin())
+    {
+        sendMasterOack();
+        return true;
+    }
+
+    uint16_t tempWord( htons(uint16_t(TftpCode::TFTP_OACK)) );
+    QByteArray oackDatagram( reinterpret_cast<char*>(&tempWord), sizeof(tempWord) );
+    if (wantsBlockSize)
+    {
+        oackDatagram.append("blksize");
+        oackDatagram.append(char(0x0));
+        oackDatagram.append(static_cast<const char*>(QString::number(blockSize()).toLatin1()));
+        oackDatagram.append(char(0x0));
+    }
+    QString tsizeStr;
+    if (findRrqOption(rrqDatagram, "tsize", &tsizeStr) && tsizeStr == "0")
+    {
+        oackDatagram.append("tsize");
+        oackDatagram.append(char(0x0));
+        oackDatagram.append(static_cast<const char*>(QString::number(transferSize()).toLatin1()));
+        oackDatagram.append(char(0x0));
+    }
+    oackDatagram.append("multicast");
+    oackDatagram.append(char(0x0));
+    oackDatagram.append(assembleMulticastOption(false));
+    oackDatagram.append(char(0x0));
+    sendDatagramTo(oackDatagram, peerAddr, peerPort);
+
+    if (isNewClient)
+    {
+        emit clientJoined(peerAddr, peerPort);
+    }
+    return true;
+}
+
+
+/**
+ * @brief MulticastReadSession::maxWindowSize the master client acknowledges every block (RFC2090), so the windowsize option is ignored
+ */
+unsigned int MulticastReadSession::maxWindowSize() const
+{
+    return 1;
+}
+
+
+/**
+ * @brief MulticastReadSession::handleExtraOption acknowledge the multicast option of the first client
+ *
+ * The value of the multicast option in the OACK has format "addr,port,mc", where mc is 1 for the master client.
+ */
+bool MulticastReadSession::handleExtraOption(const QString &optionName, const QString &optionValue, QByteArray &oackDatagram)
+{
+    Q_UNUSED(optionValue);
+    if (optionName != "multicast" || !m_multicastAllowed || m_isMulticast)
+    {
+        return false;
+    }
+
+    m_isMulticast = true;
+    m_clients.push_back(peerIdent());
+    oackDatagram.append(static_cast<const char*>(optionName.toLatin1()));
+    oackDatagram.append(char(0x0));
+    oackDatagram.append(assembleMulticastOption(true));
+    oackDatagram.append(char(0x0));
+    return true;
+}
+
+
+/**
+ * @brief MulticastReadSession::dataReceived handles ACK and ERROR datagrams of all clients of the group
+ *
+ * Only the master client acknowledges blocks. The other clients only send an ACK for the last block of the
+ * file, or an ERROR when they leave the group.
+ */
+void MulticastReadSession::dataReceived()
+{
+    if (!m_isMulticast)
+    {
+        ReadSession::dataReceived();
+        return;
+    }
+
+    QByteArray datagram;
+    QHostAddress senderAddress;
+    quint16 senderPort = 0;
+    readDatagram(datagram, &senderAddress, &senderPort);
+    if (state() == State::InError || state() == State::Finished)
+    {
+        return;
+    }
+
+    auto client = std::find(m_clients.begin(), m_clients.end(), SessionIdent(senderAddress, senderPort));
+    if (client == m_clients.end())
+    {
+        QByteArray errorDgram = assembleTftpErrorDatagram(TftpCode::UnknownTID, "Unknown transfer ID");
+        sendDatagramTo(errorDgram, senderAddress, senderPort);
+        return;
+    }
+
+    if (datagram.size() < 4)
+    {
+        QByteArray errorDgram = assembleTftpErrorDatagram(TftpCode::Undefined, "Malformed datagram");
+        sendDatagramTo(errorDgram, senderAddress, senderPort);
+        removeClient(client, false);
+        return;
+    }
+
+    uint16_t opCode = ntohs( readWordInByteArray(datagram, 0) );
+    if (opCode == TftpCode::TFTP_ERROR)
+    {
+        //client left the group
+        removeClient(client, false);
+        return;
+    }
+    if (opCode != TftpCode::TFTP_ACK)
+    {
+        QByteArray errorDgram = assembleTftpErrorDatagram(TftpCode::IllegalOp, "Unexpected TFTP opcode");
+        sendDatagramTo(errorDgram, senderAddress, senderPort);
+        removeClient(client, false);
+        return;
+    }
+
+    uint16_t ackBlockNr = ntohs( readWordInByteArray(datagram, 2) );
+    if (client != m_clients.begin())
+    {
+        if (ackBlockNr == lastBlockNr())
+        {
+            removeClient(client, true);
+        }
+        return;
+    }
+
+    if (m_waitingForMaster)
+    {
+        //new master client reports the last block it received without gaps
+        m_waitingForMaster = false;
+        stopRetransmitTimer();
+        if (state() == State::OptionsNegotation)
+        {
+            setState(State::Busy);
+        }
+        if (ackBlockNr >= lastBlockNr())
+        {
+            removeClient(client, true);
+            return;
+        }
+        restartFromBlock(static_cast<uint16_t>(ackBlockNr + 1));
+        return;
+    }
+
+    if (ackBlockNr == currBlockNr() && lastBlockSent())
+    {
+        stopRetransmitTimer();
+        removeClient(client, true);
+        return;
+    }
+    if (state() == State::OptionsNegotation || ackBlockNr == currBlockNr() || ackBlockNr + 1 == currBlockNr())
+    {
+        handleAck(ackBlockNr);
+        return;
+    }
+    if (ackBlockNr < currBlockNr())
+    {
+        restartFromBlock(static_cast<uint16_t>(ackBlockNr + 1));
+        return;
+    }
+
+    QByteArray errorDgram = assembleTftpErrorDatagram(TftpCode::IllegalOp, "Ack contains wrong block number");
+    sendDatagramTo(errorDgram, senderAddress, senderPort);
+    removeClient(client, false);
+}
+
+
+/**
+ * @brief MulticastReadSession::retransmitData retransmit the OACK to a new master client or the last data block
+ */
+void MulticastReadSession::retransmitData()
+{
+    if (m_waitingForMaster)
+    {
+        sendMasterOack();
+        return;
+    }
+    ReadSession::retransmitData();
+}
+
+
+/**
+ * @brief MulticastReadSession::retransmitLimitReached drop a master client that stopped responding
+ *
+ * The next client of the group becomes master, so one unresponsive client does not stop the transfer for
+ * the whole group.
+ */
+void MulticastReadSession::retransmitLimitReached()
+{
+    if (!m_isMulticast || m_clients.empty())
+    {
+        ReadSession::retransmitLimitReached();
+        return;
+    }
+    removeClient(m_clients.begin(), false);
+}
+
+
+/**
+ * @brief MulticastReadSession::sendDataDatagram send a DATA datagram to the multicast group
+ */
+void MulticastReadSession::sendDataDatagram(const QByteArray &datagram)
+{
+    if (!m_isMulticast)
+    {
+        ReadSession::sendDataDatagram(datagram);
+        return;
+    }
+    sendDatagramTo(datagram, m_groupAddress, m_groupPort, true);
+}
+
+
+QByteArray MulticastReadSession::assembleMulticastOption(bool isMaster) const
+{
+    return QString("%1,%2,%3").arg(m_groupAddress.toString()).arg(m_groupPort).arg(isMaster ? 1 : 0).toLatin1();
+}
+
+
+/**
+ * @brief MulticastReadSession::sendMasterOack tell the first client of the group that it is master client
+ */
+void MulticastReadSession::sendMasterOack()
+{
+    uint16_t tempWord( htons(uint16_t(TftpCode::TFTP_OACK)) );
+    QByteArray oackDatagram( reinterpret_cast<char*>(&tempWord), sizeof(tempWord) );
+    oackDatagram.append("multicast");
+    oackDatagram.append(char(0x0));
+    oackDatagram.append(assembleMulticastOption(true));
+    oackDatagram.append(char(0x0));
+    sendDatagramTo(oackDatagram, m_clients.front().m_address, m_clients.front().m_port, true);
+}
+
+
+/**
+ * @brief MulticastReadSession::removeClient remove a client from the group and select a new master if needed
+ * @param client the client to remove
+ * @param hasCompleted true if the client received the whole file
+ *
+ * The session finishes when the last client has left. It ends in error if none of the clients received the
+ * whole file.
+ */
+void MulticastReadSession::removeClient(std::vector<SessionIdent>::iterator client, bool hasCompleted)
+{
+    bool wasMaster = (client == m_clients.begin());
+    if (hasCompleted)
+    {
+        ++m_completedClients;
+    }
+    m_clients.erase(client);
+
+    if (m_clients.empty())
+    {
+        stopRetransmitTimer();
+        if (m_completedClients > 0)
+        {
+            setState(State::Finished);
+        }
+        else
+        {
+            setState(State::InError, "All multicast clients left before the transfer completed");
+        }
+        return;
+    }
+
+    if (wasMaster)
+    {
+        stopRetransmitTimer();
+        m_waitingForMaster = true;
+        sendMasterOack();
+    }
+}
+
+
+/**
+ * @brief MulticastReadSession::lastBlockNr get the number of the last (not completely filled) block of the file
+ */
+uint16_t MulticastReadSession::lastBlockNr() const
+{
+    return static_cast<uint16_t>(transferSize() / blockSize() + 1);
+}
+
+
+} // QTFTP namespace end
@@ -0,0 +1,431 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#include "qtftp/pacer.h"
+#include "qtftp/metrics.h"
+#include "qtftp/tftp_utils.h"
+#include <algorithm>
+#include <limits>
+
+namespace QTFTP
+{
+
+constexpr unsigned int Pacer::DefaultBurstMs;
+constexpr int Pacer::MaxSubnetBuckets;
+
+
+TokenBucket::TokenBucket() : m_rate(0),
+                             m_burst(0.0),
+                             m_tokens(0.0),
+                             m_lastRefill(std::chrono::steady_clock::now())
+{
+}
+
+
+/**
+ * @brief TokenBucket::setRate set the rate and burst size of the bucket, the bucket starts full
+ * @param bytesPerSecond the rate limit, 0 to remove the limit
+ * @param burstBytes nr of bytes that may be sent at once, 0 for Pacer::DefaultBurstMs worth of the rate
+ */
+void TokenBucket::setRate(uint64_t bytesPerSecond, uint64_t burstBytes)
+{
+    m_rate = bytesPerSecond;
+    if (burstBytes == 0)
+    {
+        burstBytes = std::max<uint64_t>(bytesPerSecond * Pacer::DefaultBurstMs / 1000, 1);
+    }
+    m_burst = static_cast<double>(burstBytes);
+    m_tokens = m_burst;
+    m_lastRefill = std::chrono::steady_clock::now();
+}
+
+
+bool TokenBucket::isLimited() const
+{
+    return m_rate > 0;
+}
+
+
+/**
+ * @brief TokenBucket::delay get the time until the bucket allows the next datagram, 0 if it may be sent now
+ */
+std::chrono::nanoseconds TokenBucket::delay(std::chrono::steady_clock::time_point now)
+{
+    if (m_rate == 0)
+    {
+        return std::chrono::nanoseconds(0);
+    }
+    refill(now);
+    if (m_tokens >= 0.0)
+    {
+        return std::chrono::nanoseconds(0);
+    }
+    //wait until the debt is paid off, round up so the bucket is not empty when the timer expires
+    return std::chrono::nanoseconds(static_cast<int64_t>(-m_tokens * 1e9 / static_cast<double>(m_rate)) + 1);
+}
+
+
+void TokenBucket::consume(uint64_t bytes)
+{
+    if (m_rate > 0)
+    {
+        m_tokens -= static_cast<double>(bytes);
+    }
+}
+
+
+/**
+ * @brief TokenBucket::isFull check that the bucket has been refilled completely, so forgetting it changes nothing
+ */
+bool TokenBucket::isFull(std::chrono::steady_clock::time_point now)
+{
+    refill(now);
+    return m_tokens >= m_burst;
+}
+
+
+void TokenBucket::refill(std::chrono::steady_clock::time_point now)
+{
+    if (now <= m_lastRefill)
+    {
+        return;
+    }
+    double elapsedSec = std::chrono::duration<double>(now - m_lastRefill).count();
+    m_tokens = std::min(m_burst, m_tokens + elapsedSec * static_cast<double>(m_rate));
+    m_lastRefill = now;
+}
+
+
+/**
+ * @brief Pacer::Pacer
+ * @param metrics the pacer records its queue depth and the delay of datagrams here
+ */
+Pacer::Pacer(std::shared_ptr<PacingMetrics> metrics, QObject *parent) : QObject(parent),
+                                                                        m_metrics(metrics),
+                                                                        m_subnetRate(0),
+                                                                        m_subnetBurst(0),
+                                                                        m_ipv4SubnetPrefixLength(24),
+                                                                        m_ipv6SubnetPrefixLength(64),
+                                                                        m_sessionRate(0),
+                                                                        m_sessionBurst(0),
+                                                                        m_sending(false)
+{
+    m_timer.setSingleShot(true);
+    m_timer.setTimerType(Qt::PreciseTimer);
+    connect(&m_timer, &QTimer::timeout, this, &Pacer::sendDue);
+}
+
+
+/**
+ * @brief Pacer::setGlobalRate limit the rate of DATA datagrams of all sessions together
+ * @param bytesPerSecond the rate limit, 0 for no limit
+ * @param burstBytes nr of bytes that may be sent at once, 0 for DefaultBurstMs worth of the rate
+ */
+void Pacer::setGlobalRate(uint64_t bytesPerSecond, uint64_t burstBytes)
+{
+    m_globalBucket.setRate(bytesPerSecond, burstBytes);
+}
+
+
+/**
+ * @brief Pacer::setBindingRate limit the rate of DATA datagrams of all sessions of one binding together
+ * @param binding the metrics of the binding, these identify the binding of a session
+ */
+void Pacer::setBindingRate(const BindingMetrics *binding, uint64_t bytesPerSecond, uint64_t burstBytes)
+{
+    if (bytesPerSecond == 0)
+    {
+        m_bindingBuckets.erase(binding);
+        return;
+    }
+    m_bindingBuckets[binding].setRate(bytesPerSecond, burstBytes);
+}
+
+
+/**
+ * @brief Pacer::setSubnetRate limit the rate of DATA datagrams to each client subnet
+ *
+ * Each subnet (of \p ipv4PrefixLength or \p ipv6PrefixLength bits) gets its own bucket, so a subnet behind a slow
+ * link is limited without limiting the others.
+ */
+void Pacer::setSubnetRate(uint64_t bytesPerSecond, uint64_t burstBytes, int ipv4PrefixLength, int ipv6PrefixLength)
+{
+    m_subnetRate = bytesPerSecond;
+    m_subnetBurst = burstBytes;
+    m_ipv4SubnetPrefixLength = std::min(std::max(ipv4PrefixLength, 0), 32);
+    m_ipv6SubnetPrefixLength = std::min(std::max(ipv6PrefixLength, 0), 128);
+    m_subnetBuckets.clear();
+}
+
+
+/**
+ * @brief Pacer::setSessionRate limit the rate of DATA datagrams of each session, applies to sessions started afterwards
+ */
+void Pacer::setSessionRate(uint64_t bytesPerSecond, uint64_t burstBytes)
+{
+    m_sessionRate = bytesPerSecond;
+    m_sessionBurst = burstBytes;
+}
+
+
+/**
+ * @brief Pacer::isEnabled check that at least one rate limit is configured
+ */
+bool Pacer::isEnabled() const
+{
+    return m_globalBucket.isLimited() || !m_bindingBuckets.empty() || m_subnetRate > 0 || m_sessionRate > 0;
+}
+
+
+/**
+ * @brief Pacer::initSessionBucket give the bucket of a new session the configured session rate
+ */
+void Pacer::initSessionBucket(TokenBucket &sessionBucket) const
+{
+    if (m_sessionRate > 0)
+    {
+        sessionBucket.setRate(m_sessionRate, m_sessionBurst);
+    }
+}
+
+
+/**
+ * @brief Pacer::admit check whether a datagram of \p session may be sent now
+ * @param sessionBucket bucket of the session, must stay valid until the datagram is sent or cancel() is called
+ * @param binding metrics of the binding of the session, may be null
+ * @param bytes size of the datagram
+ * @param deferredSend called to send the datagram later, if it can't be sent now
+ * @return true if the datagram may be sent right away (the tokens are taken), false if it was queued
+ */
+bool Pacer::admit(const Session *session, TokenBucket &sessionBucket, const BindingMetrics *binding, const QHostAddress &peerAddress,
+                  uint64_t bytes, std::function<void()> deferredSend)
+{
+    auto now = std::chrono::steady_clock::now();
+    QHostAddress subnet = subnetOf(peerAddress);
+    if ( ! m_queuedPerSession.contains(session) && delay(sessionBucket, binding, subnet, now).count() == 0 )
+    {
+        consume(sessionBucket, binding, subnet, bytes);
+        return true;
+    }
+
+    m_queue.push_back(QueuedSend{ session, &sessionBucket, binding, subnet, bytes, std::move(deferredSend), now });
+    ++m_queuedPerSession[session];
+    m_metrics->m_queuedDatagrams.add();
+    m_metrics->m_datagramsDelayed.add();
+    if ( ! m_sending )
+    {
+        auto entryDelay = delay(sessionBucket, binding, subnet, now);
+        if ( ! m_timer.isActive() || std::chrono::milliseconds(m_timer.remainingTime()) > entryDelay )
+        {
+            startTimer(entryDelay);
+        }
+    }
+    return false;
+}
+
+
+/**
+ * @brief Pacer::cancel forget the queued datagrams of a session, must be called before the session is destroyed
+ */
+void Pacer::cancel(const Session *session)
+{
+    if ( ! m_queuedPerSession.contains(session) )
+    {
+        return;
+    }
+    for (auto &nextEntry : m_queue)
+    {
+        if (nextEntry.m_session == session)
+        {
+            nextEntry.m_session = nullptr;
+            nextEntry.m_send = nullptr;
+            m_metrics->m_queuedDatagrams.sub();
+        }
+    }
+    m_queuedPerSession.remove(session);
+    if ( ! m_sending )
+    {
+        removeSentEntries();
+    }
+}
+
+
+size_t Pacer::queuedCount() const
+{
+    return static_cast<size_t>(std::count_if(m_queue.begin(), m_queue.end(), [](const QueuedSend &entry) { return entry.m_session != nullptr; }));
+}
+
+
+/**
+ * @brief Pacer::sendDue send the queued datagrams that the buckets allow now, oldest first
+ *
+ * A datagram that is held back by its own session or subnet doesn't hold back datagrams of other sessions.
+ */
+void Pacer::sendDue()
+{
+    auto now = std::chrono::steady_clock::now();
+    auto nextDelay = std::chrono::nanoseconds::max();
+    QHash<const Session*, bool> heldBack;   //keep the datagrams of a session in order
+    m_sending = true;
+    //index based, a send function may queue a new datagram or cancel queued ones
+    for (size_t entryIndex=0; entryIndex<m_queue.size(); ++entryIndex)
+    {
+        const Session *session = m_queue[entryIndex].m_session;
+        if ( session == nullptr || heldBack.contains(session) )
+        {
+            continue;
+        }
+        auto entryDelay = delay(*m_queue[entryIndex].m_sessionBucket, m_queue[entryIndex].m_binding, m_queue[entryIndex].m_subnet, now);
+        if (entryDelay.count() > 0)
+        {
+            heldBack.insert(session, true);
+            nextDelay = std::min(nextDelay, entryDelay);
+            continue;
+        }
+
+        consume(*m_queue[entryIndex].m_sessionBucket, m_queue[entryIndex].m_binding, m_queue[entryIndex].m_subnet, m_queue[entryIndex].m_bytes);
+        auto waitUs = std::chrono::duration_cast<std::chrono::microseconds>(now - m_queue[entryIndex].m_queuedAt);
+        m_metrics->m_delayUs.record(static_cast<uint64_t>(std::max<long long>(waitUs.count(), 0)));
+        m_metrics->m_queuedDatagrams.sub();
+        std::function<void()> sendFunction = std::move(m_queue[entryIndex].m_send);
+        m_queue[entryIndex].m_session = nullptr;
+        if (--m_queuedPerSession[session] == 0)
+        {
+            m_queuedPerSession.remove(session);
+        }
+        sendFunction();
+    }
+    m_sending = false;
+    removeSentEntries();
+
+    if ( ! m_queue.empty() )
+    {
+        if (nextDelay == std::chrono::nanoseconds::max())
+        {
+            //only datagrams queued by the send functions are left
+            nextDelay = std::chrono::nanoseconds(0);
+        }
+        startTimer(nextDelay);
+    }
+}
+
+
+QHostAddress Pacer::subnetOf(const QHostAddress &peerAddress) const
+{
+    if (m_subnetRate == 0)
+    {
+        return QHostAddress();
+    }
+    int prefixLength = 0;
+    return subnetAddress(peerAddress, m_ipv4SubnetPrefixLength, m_ipv6SubnetPrefixLength, prefixLength);
+}
+
+
+/**
+ * @brief Pacer::subnetBucket get the bucket of a client subnet, created when the subnet sends its first datagram
+ * @return null if subnets are not rate limited
+ */
+TokenBucket *Pacer::subnetBucket(const QHostAddress &subnet, std::chrono::steady_clock::time_point now)
+{
+    if (m_subnetRate == 0)
+    {
+        return nullptr;
+    }
+    auto bucketIter = m_subnetBuckets.find(subnet);
+    if (bucketIter != m_subnetBuckets.end())
+    {
+        return &bucketIter.value();
+    }
+
+    if (m_subnetBuckets.size() >= MaxSubnetBuckets)
+    {
+        //a full bucket behaves the same as a new one
+        auto pruneIter = m_subnetBuckets.begin();
+        while (pruneIter != m_subnetBuckets.end())
+        {
+            if (pruneIter.value().isFull(now))
+            {
+                pruneIter = m_subnetBuckets.erase(pruneIter);
+            }
+            else
+            {
+                ++pruneIter;
+            }
+        }
+    }
+    bucketIter = m_subnetBuckets.insert(subnet, TokenBucket());
+    bucketIter.value().setRate(m_subnetRate, m_subnetBurst);
+    return &bucketIter.value();
+}
+
+
+std::chrono::nanoseconds Pacer::delay(TokenBucket &sessionBucket, const BindingMetrics *binding, const QHostAddress &subnet,
+                                      std::chrono::steady_clock::time_point now)
+{
+    auto maxDelay = std::max(sessionBucket.delay(now), m_globalBucket.delay(now));
+    auto bindingIter = m_bindingBuckets.find(binding);
+    if (bindingIter != m_bindingBuckets.end())
+    {
+        maxDelay = std::max(maxDelay, bindingIter->second.delay(now));
+    }
+    TokenBucket *bucketOfSubnet = subnetBucket(subnet, now);
+    if (bucketOfSubnet)
+    {
+        maxDelay = std::max(maxDelay, bucketOfSubnet->delay(now));
+    }
+    return maxDelay;
+}
+
+
+void Pacer::consume(TokenBucket &sessionBucket, const BindingMetrics *binding, const QHostAddress &subnet, uint64_t bytes)
+{
+    sessionBucket.consume(bytes);
+    m_globalBucket.consume(bytes);
+    auto bindingIter = m_bindingBuckets.find(binding);
+    if (bindingIter != m_bindingBuckets.end())
+    {
+        bindingIter->second.consume(bytes);
+    }
+    auto subnetIter = m_subnetBuckets.find(subnet);
+    if (subnetIter != m_subnetBuckets.end())
+    {
+        subnetIter.value().consume(bytes);
+    }
+}
+
+
+/**
+ * @brief Pacer::startTimer start the timer with the delay rounded up to the ms resolution of QTimer
+ */
+void Pacer::startTimer(std::chrono::nanoseconds delay)
+{
+    auto delayMs = std::chrono::duration_cast<std::chrono::milliseconds>(delay + std::chrono::nanoseconds(999999));
+    m_timer.start(static_cast<int>(std::min<long long>(delayMs.count(), std::numeric_limits<int>::max())));
+}
+
+
+void Pacer::removeSentEntries()
+{
+    m_queue.erase(std::remove_if(m_queue.begin(), m_queue.end(), [](const QueuedSend &entry) { return entry.m_session == nullptr; }),
+                  m_queue.end());
+}
+
+
+} // QTFTP namespace end
@@ -0,0 +1,384 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#include "qtftp/packfile.h"
+#include <QDir>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace QTFTP
+{
+
+namespace
+{
+
+/**
+ * @brief The PackBlockSource class sends a file that is stored in a memory mapped pack file
+ */
+class PackBlockSource : public BlockSource
+{
+    public:
+        PackBlockSource(std::shared_ptr<const PackFile> packFile, const QString &fileName, const char *data, qint64 size) : m_packFile(packFile),
+                                                                                                                            m_name(packFile->path() + ':' + fileName),
+                                                                                                                            m_data(data),
+                                                                                                                            m_size(size)
+        {
+        }
+
+        bool open() override
+        {
+            return true;
+        }
+
+        QString errorString() const override
+        {
+            return QString();
+        }
+
+        QString name() const override
+        {
+            return m_name;
+        }
+
+        qint64 size() const override
+        {
+            return m_size;
+        }
+
+        qint64 readAt(qint64 offset, char *data, qint64 maxSize) override
+        {
+            qint64 bytesToRead = std::min(maxSize, m_size - offset);
+            if (bytesToRead <= 0)
+            {
+                return 0;
+            }
+            std::memcpy(data, m_data + offset, static_cast<size_t>(bytesToRead));
+            return bytesToRead;
+        }
+
+        QString shareKey() const override
+        {
+            return m_name;
+        }
+
+    private:
+        std::shared_ptr<const PackFile> m_packFile; /// keeps the mapping alive
+        QString     m_name;
+        const char *m_data;
+        qint64      m_size;
+};
+
+} // anonymous namespace end
+
+
+
+PackFile::PackFile(const QString &packPath) : m_file(packPath),
+                                              m_map(nullptr),
+                                              m_mapSize(0),
+                                              m_header(nullptr),
+                                              m_slots(nullptr)
+{
+}
+
+
+/**
+ * @brief PackFile::open map the pack file into memory and check its header
+ * @return false if the file can't be mapped or is not a valid pack file, see errorString()
+ */
+bool PackFile::open()
+{
+    if ( ! m_file.open(QIODevice::ReadOnly) )
+    {
+        m_errorString = m_file.errorString();
+        return false;
+    }
+    m_mapSize = m_file.size();
+    if (m_mapSize < static_cast<qint64>(sizeof(PackFileHeader)))
+    {
+        m_errorString = QObject::tr("Not a qtftp pack file");
+        return false;
+    }
+    m_map = m_file.map(0, m_mapSize);
+    if (!m_map)
+    {
+        m_errorString = m_file.errorString();
+        return false;
+    }
+
+    auto header = reinterpret_cast<const PackFileHeader*>(m_map);
+    if (std::memcmp(header->m_magic, "QTFTPPAK", sizeof(header->m_magic)) != 0)
+    {
+        m_errorString = QObject::tr("Not a qtftp pack file");
+        return false;
+    }
+    auto mapSize = static_cast<uint64_t>(m_mapSize);
+    if (header->m_version != PackFileVersion || header->m_slotSize != sizeof(PackSlot) || header->m_slotCount == 0 ||
+        (header->m_slotCount & (header->m_slotCount - 1)) != 0 || header->m_slotsOffset > mapSize ||
+        static_cast<uint64_t>(header->m_slotCount) * sizeof(PackSlot) > mapSize - header->m_slotsOffset ||
+        header->m_slotsOffset % alignof(PackSlot) != 0)
+    {
+        m_errorString = QObject::tr("Unsupported version or corrupt qtftp pack file");
+        return false;
+    }
+
+    m_header = header;
+    m_slots = reinterpret_cast<const PackSlot*>(m_map + header->m_slotsOffset);
+    return true;
+}
+
+
+QString PackFile::errorString() const
+{
+    return m_errorString;
+}
+
+
+QString PackFile::path() const
+{
+    return m_file.fileName();
+}
+
+
+uint32_t PackFile::fileCount() const
+{
+    return m_header ? m_header->m_fileCount : 0;
+}
+
+
+/**
+ * @brief PackFile::find look up a file in the pack
+ * @param fileName name of the file as requested by a client, see normalizedName()
+ * @param data if the file was found, a pointer to its contents in the mapped pack file is stored in this parameter
+ * @param size if the file was found, its size is stored in this parameter
+ * @return false if the pack does not contain the file
+ */
+bool PackFile::find(const QString &fileName, const char **data, qint64 *size) const
+{
+    if (!m_header)
+    {
+        return false;
+    }
+    QByteArray name = normalizedName(fileName).toUtf8();
+    if (name.isEmpty())
+    {
+        return false;
+    }
+
+    auto mapSize = static_cast<uint64_t>(m_mapSize);
+    uint64_t hash = nameHash(name);
+    uint32_t mask = m_header->m_slotCount - 1;
+    for (uint32_t probe=0; probe<m_header->m_slotCount; ++probe)
+    {
+        const PackSlot &slot = m_slots[(static_cast<uint32_t>(hash) + probe) & mask];
+        if (slot.m_nameLength == 0)
+        {
+            return false;
+        }
+        if (slot.m_nameHash != hash || slot.m_nameLength != static_cast<uint32_t>(name.size()) ||
+            slot.m_nameOffset > mapSize || slot.m_nameLength > mapSize - slot.m_nameOffset ||
+            std::memcmp(m_map + slot.m_nameOffset, name.constData(), slot.m_nameLength) != 0)
+        {
+            continue;
+        }
+        if (slot.m_dataOffset > mapSize || slot.m_dataSize > mapSize - slot.m_dataOffset)
+        {
+            return false;
+        }
+        *data = reinterpret_cast<const char*>(m_map + slot.m_dataOffset);
+        *size = static_cast<qint64>(slot.m_dataSize);
+        return true;
+    }
+    return false;
+}
+
+
+/**
+ * @brief PackFile::normalizedName get the name under which a requested file is stored in a pack
+ * @return name relative to the root of the pack, or an empty string if \p fileName points outside the pack
+ *
+ * Leading slashes are removed, so "/boot/image" and "boot/image" are the same file.
+ */
+QString PackFile::normalizedName(const QString &fileName)
+{
+    QString name = QDir::cleanPath(fileName);
+    while (name.startsWith("/"))
+    {
+        name.remove(0, 1);
+    }
+    if (name == "." || name == ".." || name.startsWith("../"))
+    {
+        return QString();
+    }
+    return name;
+}
+
+
+/**
+ * @brief PackFile::build write a pack file that contains all files in a directory and its subdirectories
+ * @param sourceDir the directory to pack, file names in the pack are relative to this directory
+ * @param packPath path of the pack file to write, an existing file is replaced when the new one is complete
+ * @param errorString if not null, the reason of a failure is stored in this parameter
+ * @return true if the pack file was written
+ */
+bool PackFile::build(const QString &sourceDir, const QString &packPath, QString *errorString)
+{
+    auto fail = [errorString](const QString &message)
+                {
+                    if (errorString)
+                    {
+                        *errorString = message;
+                    }
+                    return false;
+                };
+
+    QDir rootDir(sourceDir);
+    if (!rootDir.exists())
+    {
+        return fail(QObject::tr("Directory %1 does not exist").arg(sourceDir));
+    }
+
+    struct SourceFile
+    {
+        QByteArray m_name;
+        QString    m_path;
+        qint64     m_size;
+    };
+    std::vector<SourceFile> sourceFiles;
+    QDirIterator dirIter(sourceDir, QDir::Files, QDirIterator::Subdirectories);
+    while (dirIter.hasNext())
+    {
+        QString filePath = dirIter.next();
+        sourceFiles.push_back( SourceFile{rootDir.relativeFilePath(filePath).toUtf8(), filePath, dirIter.fileInfo().size()} );
+    }
+    std::sort(sourceFiles.begin(), sourceFiles.end(), [](const SourceFile &lhs, const SourceFile &rhs) { return lhs.m_name < rhs.m_name; });
+
+    uint32_t slotCount = 1;
+    while (slotCount < sourceFiles.size() * 2)
+    {
+        slotCount <<= 1;
+    }
+    std::vector<PackSlot> slotTable(slotCount, PackSlot{0, 0, 0, 0, 0, 0});
+    QByteArray names;
+    uint64_t namesOffset = sizeof(PackFileHeader) + static_cast<uint64_t>(slotCount) * sizeof(PackSlot);
+    for (const auto &nextFile : sourceFiles)
+    {
+        names.append(nextFile.m_name);
+    }
+    uint64_t dataOffset = (namesOffset + static_cast<uint64_t>(names.size()) + 7) & ~uint64_t(7);
+
+    uint64_t nameOffset = namesOffset;
+    for (const auto &nextFile : sourceFiles)
+    {
+        uint64_t hash = nameHash(nextFile.m_name);
+        uint32_t slotIndex = static_cast<uint32_t>(hash) & (slotCount - 1);
+        while (slotTable[slotIndex].m_nameLength != 0)
+        {
+            slotIndex = (slotIndex + 1) & (slotCount - 1);
+        }
+        slotTable[slotIndex] = PackSlot{hash, nameOffset, dataOffset, static_cast<uint64_t>(nextFile.m_size), static_cast<uint32_t>(nextFile.m_name.size()), 0};
+        nameOffset += static_cast<uint64_t>(nextFile.m_name.size());
+        dataOffset += static_cast<uint64_t>(nextFile.m_size);
+    }
+
+    PackFileHeader header;
+    std::memcpy(header.m_magic, "QTFTPPAK", sizeof(header.m_magic));
+    header.m_version = PackFileVersion;
+    header.m_fileCount = static_cast<uint32_t>(sourceFiles.size());
+    header.m_slotCount = slotCount;
+    header.m_slotSize = sizeof(PackSlot);
+    header.m_slotsOffset = sizeof(PackFileHeader);
+
+    QSaveFile packFile(packPath);
+    if ( ! packFile.open(QIODevice::WriteOnly) )
+    {
+        return fail(packFile.errorString());
+    }
+    packFile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    packFile.write(reinterpret_cast<const char*>(slotTable.data()), static_cast<qint64>(slotTable.size() * sizeof(PackSlot)));
+    packFile.write(names);
+    packFile.write(QByteArray(static_cast<int>((8 - (namesOffset + static_cast<uint64_t>(names.size())) % 8) % 8), '\0'));
+    for (const auto &nextFile : sourceFiles)
+    {
+        QFile sourceFile(nextFile.m_path);
+        if ( ! sourceFile.open(QIODevice::ReadOnly) )
+        {
+            return fail(QObject::tr("Could not open %1: %2").arg(nextFile.m_path).arg(sourceFile.errorString()));
+        }
+        qint64 bytesCopied = 0;
+        while (bytesCopied < nextFile.m_size)
+        {
+            QByteArray chunk = sourceFile.read(std::min<qint64>(1024 * 1024, nextFile.m_size - bytesCopied));
+            if (chunk.isEmpty())
+            {
+                return fail(QObject::tr("File %1 changed while it was packed").arg(nextFile.m_path));
+            }
+            packFile.write(chunk);
+            bytesCopied += chunk.size();
+        }
+    }
+
+    if ( ! packFile.commit() )
+    {
+        return fail(packFile.errorString());
+    }
+    return true;
+}
+
+
+/**
+ * @brief PackFile::nameHash FNV-1a hash of a file name
+ */
+uint64_t PackFile::nameHash(const QByteArray &name)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (char nextChar : name)
+    {
+        hash ^= static_cast<uint8_t>(nextChar);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+
+
+PackProvider::PackProvider(std::shared_ptr<const PackFile> packFile) : m_packFile(packFile)
+{
+}
+
+
+std::shared_ptr<BlockSource> PackProvider::find(const QString &fileName, const QHostAddress &peerAddr)
+{
+    Q_UNUSED(peerAddr);
+
+    const char *data = nullptr;
+    qint64 size = 0;
+    if ( ! m_packFile->find(fileName, &data, &size) )
+    {
+        return nullptr;
+    }
+    return std::make_shared<PackBlockSource>(m_packFile, PackFile::normalizedName(fileName), data, size);
+}
+
+
+} // QTFTP namespace end
@@ -21,21 +21,26 @@
 #include "qtftp/readsession.h"
 #include "qtftp/tftp_utils.h"
 #include "qtftp/tftp_constants.h"
+#include "qtftp/tracering.h"
+#include "tftp_probes.h"
 #ifdef _WIN32
 #include <winsock2.h>
 #else
 #include <arpa/inet.h>
 #endif
+#include <algorithm>
 #include <cassert>
 #include <cmath>
-#include <iostream>
+#include <limits>
 
 using namespace std::string_literals;
 
 namespace QTFTP
 {
 
-static constexpr unsigned int PopulationForAckTimeAverage = 20;
+constexpr unsigned int ReadSession::MaxWindowSize;
+
+static constexpr unsigned int SlowNetworkCheckInterval = 5; /// nr of blocks between evaluations of the slow network rule
 
 /**
  * @brief ReadSession::ReadSession
@@ -44,6 +49,13 @@ static constexpr unsigned int PopulationForAckTimeAverage = 20;
  * @param rrqDatagram must contain a RRQ packet
  * @param filesDir
  * @param socketFactory
+ * @param metrics metrics of the binding that received the RRQ, may be null
+ * @param transferGroups registry of the groups that share file reads between sessions, may be null
+ * @param providers providers that are asked for the requested file before it is looked up in \p filesDir
+ * @param directoryProvider provides the files in \p filesDir, if null the files are looked up on disk for each request
+ * @param localAddr address the session socket is bound to, the address the RRQ was sent to
+ * @param pacer spreads the DATA datagrams of all sessions over time, may be null
+ * @param scheduler shares sending DATA datagrams fairly between sessions, may be null
  *
  * ReadRequest package consists of:
  * <pre>
@@ -54,20 +66,79 @@ static constexpr unsigned int PopulationForAckTimeAverage = 20;
  * </pre>
  *
  * Opcode for read request is 1. Mode should be either 'netascii' or 'octet'.
+ * blksize, tsize, timeout and windowsize (RFC7440) are supported.
  */
 ReadSession::ReadSession(const QHostAddress &peerAddr, uint16_t peerPort, QByteArray rrqDatagram,
-                         QString filesDir, unsigned int slowNetworkThresholdUs, std::shared_ptr<UdpSocketFactory> socketFactory) : Session(peerAddr, peerPort, socketFactory),
-                                                                                              m_blockNr(0),
-                                                                                              m_blockSize(DefaultTftpBlockSize),
-                                                                                              m_lastCharRead('\0'),
-                                                                                              m_slowNetworkReported(false),
-                                                                                              m_slowNetworkThresholdUs(slowNetworkThresholdUs)
+                         QString filesDir, unsigned int slowNetworkThresholdUs, std::shared_ptr<UdpSocketFactory> socketFactory,
+                         std::shared_ptr<BindingMetrics> metrics, std::shared_ptr<TransferGroupRegistry> transferGroups,
+                         BlockSourceProviders providers, std::shared_ptr<DirectoryProvider> directoryProvider,
+                         const QHostAddress &localAddr, std::shared_ptr<Pacer> pacer,
+                         std::shared_ptr<SendScheduler> scheduler) : ReadSession(peerAddr, peerPort, slowNetworkThresholdUs, socketFactory,
+                                                                                 metrics, transferGroups, providers, directoryProvider,
+                                                                                 localAddr, pacer, scheduler)
+{
+    unsigned int optionsOffset = 0;
+    if ( ! parseRrq(rrqDatagram, filesDir, optionsOffset) )
+    {
+        return;
+        //TODO: destroy read session after return
+    }
+
+    auto waitForOAck = handleRrqOptions(rrqDatagram, optionsOffset);
+    if (!waitForOAck)
+    {
+        loadNextBlock();
+        sendDataPacket();
+    }
+}
+
+
+/**
+ * @brief ReadSession::ReadSession constructor for derived classes, does not handle a RRQ
+ *
+ * A derived class must call parseRrq() and handleRrqOptions() (or send the first data block) itself.
+ */
+ReadSession::ReadSession(const QHostAddress &peerAddr, uint16_t peerPort, unsigned int slowNetworkThresholdUs,
+                         std::shared_ptr<UdpSocketFactory> socketFactory, std::shared_ptr<BindingMetrics> metrics,
+                         std::shared_ptr<TransferGroupRegistry> transferGroups, BlockSourceProviders providers,
+                         std::shared_ptr<DirectoryProvider> directoryProvider, const QHostAddress &localAddr,
+                         std::shared_ptr<Pacer> pacer,
+                         std::shared_ptr<SendScheduler> scheduler) : Session(peerAddr, peerPort, socketFactory, metrics, localAddr, pacer, scheduler),
+                                                                     m_blockNr(0),
+                                                                     m_nextBlockIndex(0),
+                                                                     m_blockSize(DefaultTftpBlockSize),
+                                                                     m_windowSize(1),
+                                                                     m_windowAckIndex(0),
+                                                                     m_windowEndIndex(0),
+                                                                     m_windowHighIndex(0),
+                                                                     m_windowResent(false),
+                                                                     m_providers(providers),
+                                                                     m_directoryProvider(directoryProvider),
+                                                                     m_transferGroups(transferGroups),
+                                                                     m_ackDelayAmbiguous(false),
+                                                                     m_slowNetworkReported(false),
+                                                                     m_slowNetworkThresholdUs(slowNetworkThresholdUs)
+{
+    m_windowTimer.setSingleShot(true);
+    m_windowTimer.setTimerType(Qt::PreciseTimer);
+    connect(&m_windowTimer, &QTimer::timeout, this, &ReadSession::sendSpacedBlock);
+}
+
+
+/**
+ * @brief ReadSession::parseRrq read file name and transfer mode from a RRQ and open the requested file
+ * @param rrqDatagram must contain a RRQ packet
+ * @param filesDir directory that contains the requested file, if none of the providers of this session has it
+ * @param optionsOffset if successful, the offset of the first option in \p rrqDatagram will be stored in this parameter
+ * @return true if the file was opened. If false, an error datagram was sent to the peer and the session is in error.
+ */
+bool ReadSession::parseRrq(const QByteArray &rrqDatagram, const QString &filesDir, unsigned int &optionsOffset)
 {
     assert( ntohs( readWordInByteArray(rrqDatagram, 0) ) == TftpCode::TFTP_RRQ );
+    TraceRecorder::recordRrq(sessionId(), peerIdent().m_address, peerIdent().m_port);
 
     unsigned int rrqOffset = 2;
     QString recvdFileName = QString(rrqDatagram.data() + rrqOffset);
-    setFilePath(filesDir, recvdFileName);
     rrqOffset += static_cast<unsigned int>(recvdFileName.length()) + 1;
 
     QString mode = QString( rrqDatagram.data() + rrqOffset ).toLower();
@@ -86,8 +157,7 @@ ReadSession::ReadSession(const QHostAddress &peerAddr, uint16_t peerPort, QByteA
         setState(State::InError, "'mail' transfer mode not supported");
         QByteArray errorDgram = assembleTftpErrorDatagram(TftpCode::IllegalOp, "Mail transfer not supported");
         sendDatagram(errorDgram);
-        return;
-        //TODO: destroy read session after return
+        return false;
     }
     else
     {
@@ -95,34 +165,30 @@ ReadSession::ReadSession(const QHostAddress &peerAddr, uint16_t peerPort, QByteA
         setState(State::InError, QString("RRQ contains illegal transfer mode ")+mode);
         QByteArray errorDgram = assembleTftpErrorDatagram(TftpCode::IllegalOp, "Illegal transfer mode");
         sendDatagram(errorDgram);
-        return;
-        //TODO: destroy read session after return
+        return false;
     }
     rrqOffset += static_cast<unsigned int>(mode.length()) + 1;
 
-    if ( ! fileExists() )
+    m_blockSource = findBlockSource(recvdFileName, filesDir);
+    if ( ! m_blockSource )
     {
+        setFilePath(filesDir, recvdFileName);
         setState(State::InError, "File not found");
         QByteArray errorDgram = assembleTftpErrorDatagram(TftpCode::FileNotFound, "File not found");
         sendDatagram(errorDgram);
-        return;
-        //TODO: destroy read session after return
+        return false;
     }
-    if ( ! openFile(QIODevice::ReadOnly) )
+    setFilePath(m_blockSource->name());
+    if ( ! m_blockSource->open() )
     {
         setState(State::InError, "Could not open file");
-        QByteArray errorDgram = assembleTftpErrorDatagram(TftpCode::Undefined, lastFileError());
+        QByteArray errorDgram = assembleTftpErrorDatagram(TftpCode::Undefined, m_blockSource->errorString());
         sendDatagram(errorDgram);
-        return;
-        //TODO: destroy read session after return
+        return false;
     }
 
-    auto waitForOAck = handleRrqOptions(rrqDatagram, rrqOffset);
-    if (!waitForOAck)
-    {
-        loadNextBlock();
-        sendDataPacket();
-    }
+    optionsOffset = rrqOffset;
+    return true;
 }
 
 
@@ -151,6 +217,7 @@ bool ReadSession::handleRrqOptions(const QByteArray &rrqDgram, unsigned int offs
         QString optionName = QString(rrqDgram.data() + offset).toLower();
         offset += static_cast<unsigned int>(optionName.size()) + 1;
         QString optionValueStr = QString(rrqDgram.data() + offset);
+        offset += static_cast<unsigned int>(optionValueStr.size()) + 1;
         if (optionName == "blksize")
         {
             //RFC2348
@@ -192,14 +259,35 @@ bool ReadSession::handleRrqOptions(const QByteArray &rrqDgram, unsigned int offs
             }
             oackDatagram.append(static_cast<const char*>(optionName.toLatin1()));
             oackDatagram.append(char(0x0));
-            QString fileSizeStr = QString::number(fileSize(), 10);
+            QString fileSizeStr = QString::number(transferSize(), 10);
             oackDatagram.append(static_cast<const char*>(fileSizeStr.toLatin1()));
             oackDatagram.append(char(0x0));
         }
+        else if (optionName == "windowsize" && maxWindowSize() > 1)
+        {
+            //RFC7440
+            bool convOk;
+            unsigned int windowSize = optionValueStr.toUInt(&convOk, 10);
+            if (!convOk || windowSize<1 || windowSize>65535)
+            {
+                continue;
+            }
+            m_windowSize = std::min(windowSize, maxWindowSize());
+            m_congestion.setMaxWindow(m_windowSize);
+            oackDatagram.append(static_cast<const char*>(optionName.toLatin1()));
+            oackDatagram.append(char(0x0));
+            oackDatagram.append(static_cast<const char*>(QString::number(m_windowSize).toLatin1()));
+            oackDatagram.append(char(0x0));
+        }
+        else
+        {
+            handleExtraOption(optionName, optionValueStr, oackDatagram);
+        }
     }
 
     if (static_cast<unsigned long>(oackDatagram.size()) > sizeof(u_int16_t))
     {
+        TraceRecorder::record(TraceEvent::Oack, sessionId(), 0, m_blockSize);
         sendDatagram(oackDatagram, false); //TODO: start retransmit timer after OACK sent ?
         setState(State::OptionsNegotation);
         return true;
@@ -209,18 +297,39 @@ bool ReadSession::handleRrqOptions(const QByteArray &rrqDgram, unsigned int offs
 }
 
 /**
- * @brief ReadSession::averageAckDelayMs calculate average time between sending data package and receiving its ACK datagram
+ * @brief ReadSession::handleExtraOption handle a RRQ option that is not handled by ReadSession itself
+ * @param optionName name of the option in lower case
+ * @param optionValue value of the option
+ * @param oackDatagram OACK that will be sent, append option name and value to acknowledge the option
+ * @return true if the option was acknowledged
+ *
+ * The default implementation ignores the option.
+ */
+bool ReadSession::handleExtraOption(const QString &optionName, const QString &optionValue, QByteArray &oackDatagram)
+{
+    Q_UNUSED(optionName);
+    Q_UNUSED(optionValue);
+    Q_UNUSED(oackDatagram);
+    return false;
+}
+
+
+/**
+ * @brief ReadSession::maxWindowSize get the largest windowsize this session accepts, 1 to ignore the windowsize option
+ */
+unsigned int ReadSession::maxWindowSize() const
+{
+    return MaxWindowSize;
+}
+
+
+/**
+ * @brief ReadSession::averageAckDelayUs calculate average time between sending data package and receiving its ACK datagram
  * @return average time between sent and ACK in us or 0 if no ACK msg has been received yet
  */
 unsigned ReadSession::averageAckDelayUs() const
 {
-    if (m_ackTimes.size() == 0)
-    {
-        return 0;
-    }
-    auto delaySum = std::accumulate(m_ackTimes.begin(), m_ackTimes.end(), 0);
-    float averageDelay = delaySum / static_cast<float>(m_ackTimes.size());
-    return static_cast<unsigned int>(averageDelay + 0.5f);
+    return static_cast<unsigned int>(ackDelays().mean());
 }
 
 
@@ -281,29 +390,51 @@ void ReadSession::dataReceived()
         return;
     }
 
+    uint16_t ackBlockNr =  ntohs( reinterpret_cast<uint16_t*>(datagram.data())[1] );
+    handleAck(ackBlockNr);
+}
+
+
+/**
+ * @brief ReadSession::handleAck process a valid ACK datagram from the peer and send the next block
+ * @param ackBlockNr block number in the ACK datagram
+ */
+void ReadSession::handleAck(uint16_t ackBlockNr)
+{
+    QTFTP_PROBE3(ack_received, sessionId(), ackBlockNr, static_cast<int>(state()));
+    if (TraceRecorder::isEnabled())
+    {
+        uint32_t ackDelayUs = static_cast<uint32_t>(std::min<uint64_t>(roundTripUs(), std::numeric_limits<uint32_t>::max()));
+        TraceRecorder::record(TraceEvent::AckReceived, sessionId(), ackBlockNr, ackDelayUs);
+    }
+    if (m_windowSize > 1)
+    {
+        handleWindowAck(ackBlockNr);
+        return;
+    }
+
     //we received an ACK, so stop re-transmit timer
     stopRetransmitTimer();
 
-    uint16_t ackBlockNr =  ntohs( reinterpret_cast<uint16_t*>(datagram.data())[1] );
-    //static auto lastSend = std::chrono::high_resolution_clock::now();
-    //auto currTime = std::chrono::high_resolution_clock::now();
-    //std::cerr <<  std::chrono::duration_cast<std::chrono::microseconds>(currTime-m_debugStartTime).count()  << ": received ack " << ackBlockNr << "after "
-    //          << std::chrono::duration_cast<std::chrono::microseconds>(currTime-lastSend).count() << " us since send" << std::endl;
     if (m_blockNr > 0 && ackBlockNr == (m_blockNr-1))
     {
         //duplicate ACK received, ignore because data packet was already sent when we received the previous ACK
-    //    std::cerr << std::chrono::duration_cast<std::chrono::microseconds>(currTime-m_debugStartTime).count() << ": duplicate ack recvd" << std::endl;
         return;
     }
     if (ackBlockNr != m_blockNr)
     {
         setState(State::InError, QString("Received ACK with wrong blocknr"));
         QByteArray errorDgram = assembleTftpErrorDatagram(TftpCode::IllegalOp, "Ack contains wrong block number");
-    //    std::cerr << std::chrono::duration_cast<std::chrono::microseconds>(currTime-m_debugStartTime).count() << ": wrong ack recvd, send error" << std::endl;
         sendDatagram(errorDgram);
         return;
     }
 
+    if (m_blockNr > 0 && !m_ackDelayAmbiguous)
+    {
+        recordAckDelay(roundTripUs());
+    }
+    m_ackDelayAmbiguous = false;
+
     if (state() == State::OptionsNegotation)
     {
         setState(State::Busy);
@@ -315,113 +446,381 @@ void ReadSession::dataReceived()
         return;
     }
 
-    // keep running average of time it takes to receive ack from client
-    std::chrono::high_resolution_clock::time_point ackRecvTime = std::chrono::high_resolution_clock::now();
-    if (!m_slowNetworkReported && m_blockNr > 0)
+    if (m_blockNr % SlowNetworkCheckInterval == 0)
+    {
+        checkSlowNetwork();
+    }
+
+    //load and send next block of file
+    loadNextBlock();
+    sendDataPacket();
+}
+
+
+/**
+ * @brief ReadSession::handleWindowAck process an ACK of a transfer with a windowsize larger than 1 (RFC7440)
+ * @param ackBlockNr block number in the ACK datagram
+ *
+ * The peer acknowledges a window when it received all its blocks, or the last block it received in sequence when it
+ * timed out waiting for the rest. An ACK of all blocks that were sent grows the congestion window, an ACK of part of
+ * them (or of none: a duplicate ACK) shrinks it, and the window is sent again from the first block that was not
+ * acknowledged. Once the window was sent again, further duplicates of the ACK are ignored until the retransmit timer
+ * expires, so duplicated or reordered ACKs don't multiply the windows in flight (Sorcerer's Apprentice Syndrome).
+ */
+void ReadSession::handleWindowAck(uint16_t ackBlockNr)
+{
+    if (state() == State::OptionsNegotation)
     {
-        assert(m_previousSendTime != std::chrono::high_resolution_clock::time_point());
-        if (m_ackTimes.size() > PopulationForAckTimeAverage)
+        if (ackBlockNr != 0)
         {
-            m_ackTimes.erase(m_ackTimes.begin());
+            setState(State::InError, QString("Received ACK with wrong blocknr"));
+            QByteArray errorDgram = assembleTftpErrorDatagram(TftpCode::IllegalOp, "Ack contains wrong block number");
+            sendDatagram(errorDgram);
+            return;
         }
-        auto ackDelay = ackRecvTime - m_previousSendTime;
-        auto ackTimeus = std::chrono::duration_cast<std::chrono::microseconds>(ackDelay).count();
-        //std::cerr << "ack time: " << ackTimeus << " , blocknr " << m_blockNr << std::endl;
-        if (ackTimeus < 0)
+        stopRetransmitTimer();
+        setState(State::Busy);
+        sendWindow();
+        return;
+    }
+
+    uint32_t blocksInFlight = m_nextBlockIndex - m_windowAckIndex;
+    uint16_t blocksAcked = static_cast<uint16_t>(ackBlockNr - static_cast<uint16_t>(m_windowAckIndex));
+    if (blocksAcked > blocksInFlight)
+    {
+        if (static_cast<uint16_t>(static_cast<uint16_t>(m_windowAckIndex) - ackBlockNr) <= m_windowSize)
         {
-            ackTimeus = 0;
+            //late ACK of a block of an earlier window, the window was already resent
+            return;
         }
-        m_ackTimes.push_back(static_cast<unsigned int>(ackTimeus));
-        if ( (m_blockNr % 5 == 0) &&
-             (averageAckDelayUs() > m_slowNetworkThresholdUs) )
+        setState(State::InError, QString("Received ACK with wrong blocknr"));
+        QByteArray errorDgram = assembleTftpErrorDatagram(TftpCode::IllegalOp, "Ack contains wrong block number");
+        sendDatagram(errorDgram);
+        return;
+    }
+
+    if (blocksAcked == 0 && m_windowResent)
+    {
+        //the window was already sent again for this ACK
+        return;
+    }
+
+    stopRetransmitTimer();
+    m_windowTimer.stop();
+    m_windowAckIndex += blocksAcked;
+    if (m_windowAckIndex < m_nextBlockIndex || blocksAcked == 0)
+    {
+        //the peer missed a block
+        m_congestion.lossDetected();
+        m_windowResent = true;
+        sendWindow();
+        return;
+    }
+    m_windowResent = false;
+
+    uint64_t ackDelayUs = CongestionController::UnknownAckDelay;
+    if (!m_ackDelayAmbiguous)
+    {
+        ackDelayUs = roundTripUs();
+        recordAckDelay(ackDelayUs);
+    }
+    m_ackDelayAmbiguous = false;
+    m_congestion.ackReceived(blocksAcked, ackDelayUs);
+
+    if (lastBlockSent())
+    {
+        setState(State::Finished);
+        return;
+    }
+    checkSlowNetwork();
+    sendWindow();
+}
+
+
+/**
+ * @brief ReadSession::sendWindow send the window that starts at the first block that is not acknowledged yet
+ *
+ * The peer only acknowledges a complete window, so all blocks of the window are sent. The first blocks, as many as
+ * the congestion window allows, are sent at once. The others are spread over one ACK delay, so the peer receives
+ * about one congestion window of blocks per round trip. When no ACK delay is known yet, or the spacing would be less
+ * than the 1 ms resolution of the timer, the whole window is sent at once.
+ */
+void ReadSession::sendWindow()
+{
+    m_windowTimer.stop();
+    m_nextBlockIndex = m_windowAckIndex;
+    m_blockNr = static_cast<uint16_t>(m_windowAckIndex);
+    m_windowEndIndex = m_windowAckIndex + m_windowSize;
+
+    unsigned int burstSize = m_congestion.window();
+    int spacingMs = 0;
+    if (burstSize < m_windowSize)
+    {
+        spacingMs = static_cast<int>(m_congestion.smoothedAckDelayUs() / burstSize / 1000);
+    }
+    if (spacingMs == 0)
+    {
+        burstSize = m_windowSize;
+    }
+
+    bool moreBlocks = true;
+    for (unsigned int blockCount=0; moreBlocks && blockCount<burstSize; ++blockCount)
+    {
+        moreBlocks = sendNextWindowBlock();
+    }
+    if (moreBlocks)
+    {
+        m_windowTimer.start(spacingMs);
+    }
+}
+
+
+/**
+ * @brief ReadSession::sendSpacedBlock send the next block of the window when the spacing timer expires
+ */
+void ReadSession::sendSpacedBlock()
+{
+    if (state() != State::Busy)
+    {
+        return;
+    }
+    try
+    {
+        if (sendNextWindowBlock())
         {
-            emit slowNetwork();
-            m_slowNetworkReported = true;
+            m_windowTimer.start();
         }
     }
+    catch (const TftpError &sendErr)
+    {
+        setState(State::InError, sendErr.what());
+    }
+}
 
-    //load and send next block of file
+
+/**
+ * @brief ReadSession::sendNextWindowBlock load and send the next block of the window
+ * @return true if the window has more blocks to send
+ */
+bool ReadSession::sendNextWindowBlock()
+{
+    bool isRetransmit = m_nextBlockIndex < m_windowHighIndex;
     loadNextBlock();
-    //currTime = std::chrono::high_resolution_clock::now();
-    //std::cerr << std::chrono::duration_cast<std::chrono::microseconds>(currTime-m_debugStartTime).count() << ": after loadNextBlock" << std::endl;
-    sendDataPacket();
-    //currTime = lastSend = std::chrono::high_resolution_clock::now();
-    //std::cerr << std::chrono::duration_cast<std::chrono::microseconds>(currTime-m_debugStartTime).count() << ": after sendDataPacket" << std::endl;
+    m_windowHighIndex = std::max(m_windowHighIndex, m_nextBlockIndex);
+    if (isRetransmit)
+    {
+        m_blockNr = static_cast<uint16_t>(m_nextBlockIndex);
+        sendDataPacket(true);
+    }
+    else
+    {
+        sendDataPacket();
+    }
+    return !lastBlockSent() && m_nextBlockIndex < m_windowEndIndex;
+}
+
+
+/**
+ * @brief ReadSession::checkSlowNetwork emit slowNetwork() once when the average ACK delay of this session exceeds the threshold
+ */
+void ReadSession::checkSlowNetwork()
+{
+    if (!m_slowNetworkReported && (averageAckDelayUs() > m_slowNetworkThresholdUs) )
+    {
+        emit slowNetwork();
+        m_slowNetworkReported = true;
+    }
 }
 
 
 /**
  * @brief ReadSession::retransmitData retransmit the last data block message
+ *
+ * A windowed transfer shrinks its congestion window and sends the whole unacknowledged window again.
  */
 void ReadSession::retransmitData()
 {
     //TODO: when state is optionsNegotation re-send OACK
+    if (m_windowSize > 1 && state() == State::Busy)
+    {
+        m_congestion.timeOut();
+        m_windowResent = false;
+        sendWindow();
+        return;
+    }
     sendDataPacket(true);
 }
 
 
 /**
- * @brief ReadSession::loadNextBlock loads the next block of data from the source file
+ * @brief ReadSession::sendBufferFull shrink the congestion window of a windowed transfer when the socket can't keep up
+ */
+void ReadSession::sendBufferFull()
+{
+    if (m_windowSize > 1)
+    {
+        m_congestion.lossDetected();
+    }
+}
+
+
+/**
+ * @brief ReadSession::currBlockNr get the number of the last data block that was sent
+ */
+uint16_t ReadSession::currBlockNr() const
+{
+    return m_blockNr;
+}
+
+
+/**
+ * @brief ReadSession::blockSize get the negotiated block size of this session
+ */
+unsigned int ReadSession::blockSize() const
+{
+    return m_blockSize;
+}
+
+
+/**
+ * @brief ReadSession::windowSize get the negotiated windowsize (RFC7440) of this session, 1 if not negotiated
+ */
+unsigned int ReadSession::windowSize() const
+{
+    return m_windowSize;
+}
+
+
+/**
+ * @brief ReadSession::congestionWindow get the nr of blocks of a window that are currently sent without spacing
+ */
+unsigned int ReadSession::congestionWindow() const
+{
+    return m_congestion.window();
+}
+
+
+/**
+ * @brief ReadSession::lastBlockSent check if the last data block of the file has been sent
+ */
+bool ReadSession::lastBlockSent() const
+{
+    return m_blockNr > 0 && static_cast<unsigned int>(m_blockToSend.size()) < m_blockSize;
+}
+
+
+/**
+ * @brief ReadSession::restartFromBlock continue the transfer by sending block \p blockNr
+ * @param blockNr number of the block to send next, must be at least 1
  *
- * If this function is called for a netascii session, line endings will be converted (CR -> CR,0 and LF -> CR,LF).
+ * Only for transfers of less than 65536 blocks, because the block number does not identify the block in larger files.
+ * The block may have been sent before, so its ACK is not taken as a sample of the ACK delay.
  */
-void ReadSession::loadNextBlock()
+void ReadSession::restartFromBlock(uint16_t blockNr)
 {
-    assert( isFileOpen() );
+    assert(blockNr > 0);
+
+    m_blockNr = static_cast<uint16_t>(blockNr - 1);
+    m_nextBlockIndex = m_blockNr;
+    m_ackDelayAmbiguous = true;
+    loadNextBlock();
+    sendDataPacket();
+}
 
-    m_blockToSend.clear();
 
-    if (atEndOfFile())
-    {
-        //Already read entire file. This can happen when the file size is an exact multiple of the block size.
-        //In this case we don't read anything, and an empty block will be sent as the last DATA datagram.
-        return;
-    }
+/**
+ * @brief ReadSession::findBlockSource look up the source of a requested file
+ * @return the source or nullptr if neither the providers of this session nor \p filesDir have the file
+ */
+std::shared_ptr<BlockSource> ReadSession::findBlockSource(const QString &fileName, const QString &filesDir) const
+{
+    return lookupBlockSource(m_providers, m_directoryProvider, fileName, filesDir, peerIdent().m_address);
+}
+
 
-    int lineEndConversionStartIndex = 0;
-    if (transferMode() == TftpCode::NetAscii && !m_asciiOverflowBuffer.isEmpty())
+/**
+ * @brief ReadSession::lookupBlockSource look up the source of a file requested by \p peerAddr
+ * @param providers asked for the file first, in order
+ * @param directoryProvider files directory to look in if none of the providers has the file, may be null
+ * @param filesDir files directory to look in if \p directoryProvider is null
+ * @return the source or nullptr if the file was not found
+ */
+std::shared_ptr<BlockSource> ReadSession::lookupBlockSource(const BlockSourceProviders &providers, const std::shared_ptr<DirectoryProvider> &directoryProvider,
+                                                            const QString &fileName, const QString &filesDir, const QHostAddress &peerAddr)
+{
+    for (const auto &nextProvider : providers)
     {
-        //There is some leftover from previous file read after line ending conversion. Add this to the next block
-        //that we will send before reading contents from file.
-        m_blockToSend = m_asciiOverflowBuffer;
-        m_asciiOverflowBuffer.clear();
-        //Make sure that line endings in overflow buffer are not converted for 2nd time.
-        lineEndConversionStartIndex = m_blockToSend.size();
+        auto source = nextProvider->find(fileName, peerAddr);
+        if (source)
+        {
+            return source;
+        }
     }
-
-    if ( ! readFromFile(m_blockToSend, m_blockSize))
+    if (directoryProvider)
     {
-        throw TftpError("Read error while reading from file "s + filePath().toStdString());
+        return directoryProvider->find(fileName, peerAddr);
     }
+    return DirectoryProvider(filesDir).find(fileName, peerAddr);
+}
+
+
+/**
+ * @brief ReadSession::sourceShareKey get the share key of the source of the requested file, see BlockSource::shareKey()
+ * @return the key, or an empty string if the source may not be shared or the first block was loaded already
+ */
+QString ReadSession::sourceShareKey() const
+{
+    return m_blockSource ? m_blockSource->shareKey() : QString();
+}
+
 
-    if (transferMode() == TftpCode::NetAscii)
+/**
+ * @brief ReadSession::loadNextBlock loads the next block of data from the transfer group of this session
+ * @throw TftpError if the file could not be opened or read
+ *
+ * The transfer group is acquired when the first block is loaded, when the block size is known. In netascii mode
+ * the group converts line endings (CR -> CR,0 and LF -> CR,LF).
+ */
+void ReadSession::loadNextBlock()
+{
+    if (!m_transferGroup)
     {
-        //convert line endings and CR char, making sure that block size is not exceeded
-        for (int index=lineEndConversionStartIndex; index<m_blockToSend.size(); ++index)
+        if (m_transferGroups)
         {
-            if ( static_cast<char>(m_blockToSend[index]) == 0x0D )
-            {
-                //convert CR -> CR,0
-                ++index;
-                m_blockToSend.insert(index, '\0');
-            }
-            else if ( static_cast<char>(m_blockToSend[index]) == 0x0A)
+            m_transferGroup = m_transferGroups->acquire(m_blockSource, m_blockSize, transferMode());
+        }
+        else
+        {
+            //no other sessions to share blocks with, so no need to cache them
+            m_transferGroup = std::make_shared<TransferGroup>(m_blockSource, m_blockSize, transferMode(), 0);
+            if ( ! m_transferGroup->open() )
             {
-                //convert LF -> CR,LF
-                m_blockToSend.insert(index, 0x0D);
-                ++index;
+                throw TftpError("Could not open file "s + filePath().toStdString() + ": " + m_transferGroup->errorString().toStdString());
             }
         }
+        //a group shared with other sessions has a source of its own
+        m_blockSource.reset();
+        classifyTransfer(transferSize());
+    }
 
-        //If m_blockToSend became bigger than TftpBlockSize due to linefeed conversions,
-        //store the surplus in an overflow buffer for the next block.
-        if (static_cast<unsigned int>(m_blockToSend.size()) > m_blockSize)
-        {
-            int surplusNrOfChars = m_blockToSend.size() - static_cast<int>(m_blockSize);
-            m_asciiOverflowBuffer = m_blockToSend.right(surplusNrOfChars);
-            m_blockToSend.chop(surplusNrOfChars);
-        }
+    //When the file size is an exact multiple of the block size, an empty block will be sent as the last DATA datagram.
+    m_blockToSend = m_transferGroup->block(m_nextBlockIndex);
+    ++m_nextBlockIndex;
+}
+
+
+/**
+ * @brief ReadSession::transferSize get the size of the file that is being sent
+ *
+ * Once the first block was loaded, this is the size of the file version that is pinned by the transfer group.
+ */
+qint64 ReadSession::transferSize() const
+{
+    if (m_transferGroup)
+    {
+        return m_transferGroup->fileSize();
     }
+    return m_blockSource ? m_blockSource->size() : 0;
 }
 
 
@@ -446,14 +845,35 @@ void ReadSession::sendDataPacket(bool isRetransmit)
     datagram.append( m_blockToSend );
     assert( static_cast<unsigned int>(datagram.size()) <= (m_blockSize + 4) );
 
-    m_previousSendTime = std::chrono::high_resolution_clock::now();
-    sendDatagram(datagram, true);
-    unsigned int progressPerc = static_cast<unsigned int>(float(posInFile()) / fileSize() * 100.0f + 0.5f);
+    if (isRetransmit)
+    {
+        m_ackDelayAmbiguous = true;
+        QTFTP_PROBE3(retransmit, sessionId(), m_blockNr, retransmitCount()+1);
+        TraceRecorder::record(TraceEvent::Retransmit, sessionId(), m_blockNr, static_cast<uint32_t>(m_blockToSend.size()), retransmitCount()+1);
+    }
+    else
+    {
+        QTFTP_PROBE3(data_sent, sessionId(), m_blockNr, m_blockToSend.size());
+        TraceRecorder::record(TraceEvent::DataSent, sessionId(), m_blockNr, static_cast<uint32_t>(m_blockToSend.size()));
+    }
+    sendDataDatagram(datagram);
+    //in netascii mode the blocks are larger than the file contents they contain, so this is an estimate
+    qint64 bytesDone = std::min(static_cast<qint64>(m_nextBlockIndex) * m_blockSize, transferSize());
+    unsigned int progressPerc = (transferSize() > 0) ? static_cast<unsigned int>(float(bytesDone) / transferSize() * 100.0f + 0.5f) : 100;
     assert(progressPerc <= 100);
     emit progress(progressPerc);
 }
 
 
+/**
+ * @brief ReadSession::sendDataDatagram send an assembled DATA datagram and start the retransmit timer
+ *
+ * The default implementation sends the datagram to the session peer.
+ */
+void ReadSession::sendDataDatagram(const QByteArray &datagram)
+{
+    sendDatagram(datagram, true);
+}
 
 
 } // QTFTP namespace end
@@ -0,0 +1,141 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#include "qtftp/requestratelimiter.h"
+#include <QHash>
+#include <algorithm>
+#include <limits>
+#include <random>
+
+namespace QTFTP
+{
+
+constexpr unsigned int RequestRateLimiter::Depth;
+constexpr unsigned int RequestRateLimiter::Width;
+constexpr unsigned int RequestRateLimiter::DecayIntervalMs;
+
+
+RequestRateLimiter::RequestRateLimiter() : m_maxRequests(0),
+                                           m_lastDecay(std::chrono::steady_clock::now())
+{
+    //random seeds, so clients can't pick addresses that collide with the address of another client
+    std::random_device seedSource;
+    for (auto &nextSeed : m_seeds)
+    {
+        nextSeed = seedSource();
+    }
+    for (auto &nextRow : m_counters)
+    {
+        nextRow.fill(0);
+    }
+}
+
+
+/**
+ * @brief RequestRateLimiter::setMaxRequestsPerSecond set the nr of requests per second allowed from one client address
+ * @param maxRequests the limit, 0 for no limit
+ */
+void RequestRateLimiter::setMaxRequestsPerSecond(unsigned int maxRequests)
+{
+    m_maxRequests = std::min<unsigned int>(maxRequests, std::numeric_limits<uint16_t>::max() - 1);
+}
+
+
+unsigned int RequestRateLimiter::maxRequestsPerSecond() const
+{
+    return m_maxRequests;
+}
+
+
+/**
+ * @brief RequestRateLimiter::allow count a request of \p peerAddress and check that it is within the limit
+ * @return true if the request may be served, always true if there is no limit
+ *
+ * Requests that are not allowed are not counted, so a client that keeps sending requests gets some of them served.
+ */
+bool RequestRateLimiter::allow(const QHostAddress &peerAddress, std::chrono::steady_clock::time_point now)
+{
+    if (m_maxRequests == 0)
+    {
+        return true;
+    }
+    decay(now);
+
+    std::array<uint16_t*, Depth> counters;
+    uint16_t lowestCount = std::numeric_limits<uint16_t>::max();
+    for (unsigned int rowNr=0; rowNr<Depth; ++rowNr)
+    {
+        counters[rowNr] = &m_counters[rowNr][qHash(peerAddress, m_seeds[rowNr]) & (Width - 1)];
+        lowestCount = std::min(lowestCount, *counters[rowNr]);
+    }
+    if (lowestCount >= m_maxRequests)
+    {
+        return false;
+    }
+
+    //conservative update: only raise the counters that are at the estimate, the others already count other addresses
+    for (auto nextCounter : counters)
+    {
+        if (*nextCounter == lowestCount)
+        {
+            ++*nextCounter;
+        }
+    }
+    return true;
+}
+
+
+/**
+ * @brief RequestRateLimiter::estimate get the decayed nr of recent requests of \p peerAddress
+ */
+unsigned int RequestRateLimiter::estimate(const QHostAddress &peerAddress) const
+{
+    uint16_t lowestCount = std::numeric_limits<uint16_t>::max();
+    for (unsigned int rowNr=0; rowNr<Depth; ++rowNr)
+    {
+        lowestCount = std::min(lowestCount, m_counters[rowNr][qHash(peerAddress, m_seeds[rowNr]) & (Width - 1)]);
+    }
+    return lowestCount;
+}
+
+
+/**
+ * @brief RequestRateLimiter::decay halve all counters once for each DecayIntervalMs passed since the previous decay
+ */
+void RequestRateLimiter::decay(std::chrono::steady_clock::time_point now)
+{
+    auto intervals = std::chrono::duration_cast<std::chrono::milliseconds>(now - m_lastDecay).count() / DecayIntervalMs;
+    if (intervals <= 0)
+    {
+        return;
+    }
+    m_lastDecay += std::chrono::milliseconds(intervals * DecayIntervalMs);
+    unsigned int shift = static_cast<unsigned int>(std::min<long long>(intervals, 16));
+    for (auto &nextRow : m_counters)
+    {
+        for (auto &nextCounter : nextRow)
+        {
+            nextCounter = static_cast<uint16_t>(static_cast<uint32_t>(nextCounter) >> shift);
+        }
+    }
+}
+
+
+} // QTFTP namespace end
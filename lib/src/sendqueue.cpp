@@ -0,0 +1,170 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#include "qtftp/sendqueue.h"
+#include "qtftp/abstractsocket.h"
+#include <string>
+
+using namespace std::string_literals;
+
+namespace QTFTP
+{
+
+constexpr size_t SendQueue::MaxQueuedDatagrams;
+constexpr int SendQueue::RetryIntervalMs;
+constexpr int SendQueue::MaxBlockedMs;
+
+
+SendQueue::SendQueue(std::shared_ptr<AbstractSocket> socket, QObject *parent) : QObject(parent),
+                                                                                m_socket(socket),
+                                                                                m_failed(false)
+{
+    m_retryTimer.setSingleShot(true);
+    connect(&m_retryTimer, &QTimer::timeout, this, &SendQueue::resume);
+    connect(m_socket.get(), &AbstractSocket::readyWrite, this, &SendQueue::resume);
+}
+
+
+/**
+ * @brief SendQueue::send write a datagram to the socket, or queue it if the socket can't accept it now
+ * @param sentCallback called when the datagram has been written, right away or later from the event loop
+ *
+ * When too many datagrams are waiting, or the socket reports a permanent error, the datagram is dropped and
+ * sendFailed() is emitted from the event loop, like when the queue gives up in resume(). After that all datagrams
+ * are dropped.
+ */
+void SendQueue::send(const QByteArray &datagram, const QHostAddress &address, quint16 port, std::function<void()> sentCallback)
+{
+    if (m_failed)
+    {
+        return;
+    }
+    QueuedDatagram queuedDatagram { datagram, address, port, sentCallback };
+    if ( ! m_queue.empty() )
+    {
+        if (m_queue.size() >= MaxQueuedDatagrams)
+        {
+            fail("Send queue to "s + address.toString().toStdString() + " port " + std::to_string(port) + " is full");
+            return;
+        }
+        m_queue.push_back(queuedDatagram);
+        return;
+    }
+
+    if ( ! write(queuedDatagram) )
+    {
+        if (m_failed)
+        {
+            return;
+        }
+        m_queue.push_back(queuedDatagram);
+        m_blockedSince = std::chrono::steady_clock::now();
+        m_socket->setWriteNotificationEnabled(true);
+        emit blocked();
+        return;
+    }
+    queuedDatagram.m_sent();
+}
+
+
+/**
+ * @brief SendQueue::isBlocked check if datagrams are waiting for the socket to become writable
+ */
+bool SendQueue::isBlocked() const
+{
+    return !m_queue.empty();
+}
+
+
+size_t SendQueue::queuedCount() const
+{
+    return m_queue.size();
+}
+
+
+/**
+ * @brief SendQueue::resume write the queued datagrams when the socket is writable again or the retry timer expired
+ */
+void SendQueue::resume()
+{
+    m_retryTimer.stop();
+    while ( ! m_queue.empty() )
+    {
+        if ( ! write(m_queue.front()) )
+        {
+            if (m_failed)
+            {
+                return;
+            }
+            auto blockedMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - m_blockedSince).count();
+            if (blockedMs > MaxBlockedMs)
+            {
+                fail("Socket send buffer full for more than "s + std::to_string(MaxBlockedMs) + " ms");
+                return;
+            }
+            //the socket said it was writable but still refuses (e.g. ENOBUFS), poll instead of waiting for readyWrite again
+            m_retryTimer.start(RetryIntervalMs);
+            return;
+        }
+        auto sentDatagram = std::move(m_queue.front());
+        m_queue.pop_front();
+        //the queue makes progress, so it is only blocked since now
+        m_blockedSince = std::chrono::steady_clock::now();
+        sentDatagram.m_sent();
+    }
+}
+
+
+/**
+ * @brief SendQueue::fail drop all queued datagrams and emit sendFailed() from the event loop
+ *
+ * The signal is not emitted right away, send() may be called from code that does not expect the session to end.
+ */
+void SendQueue::fail(const std::string &errMsg)
+{
+    m_failed = true;
+    m_queue.clear();
+    m_retryTimer.stop();
+    QString errorString = QString::fromStdString(errMsg);
+    QTimer::singleShot(0, this, [this, errorString]() { emit sendFailed(errorString); });
+}
+
+
+/**
+ * @brief SendQueue::write write one datagram to the socket
+ * @return false if the socket can't accept the datagram now, or reported a permanent error: then the queue failed
+ */
+bool SendQueue::write(const QueuedDatagram &queuedDatagram)
+{
+    if (m_socket->writeDatagram(queuedDatagram.m_datagram, queuedDatagram.m_address, queuedDatagram.m_port) != -1)
+    {
+        return true;
+    }
+    if (m_socket->isSendErrorTransient())
+    {
+        return false;
+    }
+    fail("Error sending datagram to "s + queuedDatagram.m_address.toString().toStdString() +
+         " port " + std::to_string(queuedDatagram.m_port) + ": " + m_socket->errorString().toStdString());
+    return false;
+}
+
+
+} // QTFTP namespace end
@@ -0,0 +1,251 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#include "qtftp/sendscheduler.h"
+#include <algorithm>
+#include <limits>
+
+namespace QTFTP
+{
+
+constexpr uint64_t SendScheduler::DefaultRoundBytes;
+constexpr uint64_t SendScheduler::Quantum;
+
+
+SendScheduler::SendScheduler(QObject *parent) : QObject(parent),
+                                                m_roundBytes(DefaultRoundBytes),
+                                                m_turnBytes(0),
+                                                m_priorityTransferSize(0),
+                                                m_sending(false)
+{
+    m_timer.setSingleShot(true);
+    connect(&m_timer, &QTimer::timeout, this, &SendScheduler::sendRound);
+}
+
+
+/**
+ * @brief SendScheduler::setRoundBytes set the nr of bytes sent in one pass of the event loop, 0 for no limit
+ */
+void SendScheduler::setRoundBytes(uint64_t roundBytes)
+{
+    m_roundBytes = (roundBytes == 0) ? std::numeric_limits<uint64_t>::max() : roundBytes;
+}
+
+
+uint64_t SendScheduler::roundBytes() const
+{
+    return m_roundBytes;
+}
+
+
+/**
+ * @brief SendScheduler::setBindingWeight give the sessions of a binding \p weight times the share of a session of weight 1
+ * @param binding the metrics of the binding, these identify the binding of a session
+ * @param weight at least 1, applies to sessions that are not waiting to send yet
+ */
+void SendScheduler::setBindingWeight(const BindingMetrics *binding, unsigned int weight)
+{
+    m_bindingWeights[binding] = std::max(weight, 1u);
+}
+
+
+/**
+ * @brief SendScheduler::setPriorityTransferSize let transfers of at most \p maxTransferSize bytes go before all others
+ *
+ * Meant for small files, like first-stage boot files and configuration files that devices need before they can start.
+ * 0 (default) disables the priority class.
+ */
+void SendScheduler::setPriorityTransferSize(int64_t maxTransferSize)
+{
+    m_priorityTransferSize = std::max<int64_t>(maxTransferSize, 0);
+}
+
+
+bool SendScheduler::isPriorityTransfer(int64_t transferSize) const
+{
+    return m_priorityTransferSize > 0 && transferSize <= m_priorityTransferSize;
+}
+
+
+/**
+ * @brief SendScheduler::schedule check whether a DATA datagram of \p session may be sent now
+ * @param binding metrics of the binding of the session, may be null
+ * @param isPriority true if the session transfers a small file, see isPriorityTransfer()
+ * @param bytes size of the datagram
+ * @param deferredSend called to send the datagram later, if it can't be sent now
+ * @return true if the datagram may be sent right away, false if it was queued
+ */
+bool SendScheduler::schedule(const Session *session, const BindingMetrics *binding, bool isPriority, uint64_t bytes,
+                             std::function<void()> deferredSend)
+{
+    if ( ! m_sending && m_flows.empty() && m_turnBytes < m_roundBytes )
+    {
+        m_turnBytes += bytes;
+        startTurnTimer();
+        return true;
+    }
+
+    auto flowIter = m_flows.find(session);
+    if (flowIter == m_flows.end())
+    {
+        auto weightIter = m_bindingWeights.find(binding);
+        unsigned int weight = (weightIter == m_bindingWeights.end()) ? 1 : weightIter->second;
+        flowIter = m_flows.emplace(session, Flow{ std::deque<QueuedSend>(), 0, weight, false }).first;
+        if (isPriority)
+        {
+            m_priorityFlows.push_back(session);
+        }
+        else
+        {
+            m_activeFlows.push_back(session);
+        }
+    }
+    flowIter->second.m_queue.push_back(QueuedSend{ bytes, std::move(deferredSend) });
+    startTurnTimer();
+    return false;
+}
+
+
+/**
+ * @brief SendScheduler::cancel forget the queued datagrams of a session, must be called before the session is destroyed
+ */
+void SendScheduler::cancel(const Session *session)
+{
+    auto flowIter = m_flows.find(session);
+    if (flowIter == m_flows.end())
+    {
+        return;
+    }
+    if (m_sending)
+    {
+        //sendRound() may hold a reference to the flow, it removes the flow when it finds it empty
+        flowIter->second.m_queue.clear();
+        return;
+    }
+    m_flows.erase(flowIter);
+    m_priorityFlows.erase(std::remove(m_priorityFlows.begin(), m_priorityFlows.end(), session), m_priorityFlows.end());
+    m_activeFlows.erase(std::remove(m_activeFlows.begin(), m_activeFlows.end(), session), m_activeFlows.end());
+}
+
+
+size_t SendScheduler::queuedCount() const
+{
+    size_t queued = 0;
+    for (const auto &nextFlow : m_flows)
+    {
+        queued += nextFlow.second.m_queue.size();
+    }
+    return queued;
+}
+
+
+/**
+ * @brief SendScheduler::sendRound start a new pass of the event loop: send queued datagrams until the pass is full
+ */
+void SendScheduler::sendRound()
+{
+    m_turnBytes = 0;
+    m_sending = true;
+
+    //priority transfers first, one datagram per transfer in turn
+    while ( ! m_priorityFlows.empty() && m_turnBytes < m_roundBytes )
+    {
+        const Session *session = m_priorityFlows.front();
+        m_priorityFlows.pop_front();
+        Flow &flow = m_flows[session];
+        if ( ! flow.m_queue.empty() )
+        {
+            sendFirst(flow);
+        }
+        if (flow.m_queue.empty())
+        {
+            m_flows.erase(session);
+        }
+        else
+        {
+            m_priorityFlows.push_back(session);
+        }
+    }
+
+    //deficit round-robin over the other sessions
+    while ( ! m_activeFlows.empty() && m_turnBytes < m_roundBytes )
+    {
+        const Session *session = m_activeFlows.front();
+        Flow &flow = m_flows[session];
+        if ( ! flow.m_hasQuantum )
+        {
+            flow.m_deficit += Quantum * flow.m_weight;
+            flow.m_hasQuantum = true;
+        }
+        while ( ! flow.m_queue.empty() && flow.m_queue.front().m_bytes <= flow.m_deficit && m_turnBytes < m_roundBytes )
+        {
+            flow.m_deficit -= flow.m_queue.front().m_bytes;
+            sendFirst(flow);
+        }
+
+        if (flow.m_queue.empty())
+        {
+            //an idle session does not save up its deficit
+            m_flows.erase(session);
+            m_activeFlows.pop_front();
+        }
+        else if (flow.m_queue.front().m_bytes > flow.m_deficit)
+        {
+            //quantum of this round used up
+            flow.m_hasQuantum = false;
+            m_activeFlows.pop_front();
+            m_activeFlows.push_back(session);
+        }
+        //else the pass is full, the session continues its round in the next pass
+    }
+
+    m_sending = false;
+    if ( ! m_flows.empty() )
+    {
+        startTurnTimer();
+    }
+}
+
+
+/**
+ * @brief SendScheduler::sendFirst send the oldest queued datagram of a session
+ */
+void SendScheduler::sendFirst(Flow &flow)
+{
+    QueuedSend nextSend = std::move(flow.m_queue.front());
+    flow.m_queue.pop_front();
+    m_turnBytes += nextSend.m_bytes;
+    nextSend.m_send();
+}
+
+
+/**
+ * @brief SendScheduler::startTurnTimer make sure sendRound() is called in the next pass of the event loop
+ */
+void SendScheduler::startTurnTimer()
+{
+    if ( ! m_timer.isActive() )
+    {
+        m_timer.start(0);
+    }
+}
+
+
+} // QTFTP namespace end
@@ -21,6 +21,10 @@
 #include "qtftp/session.h"
 #include "qtftp/udpsocketfactory.h"
 #include "qtftp/tftp_error.h"
+#include "qtftp/tracering.h"
+#include "qtftp/metrics.h"
+#include "qtftp/tftp_utils.h"
+#include "tftp_probes.h"
 #include <QFileInfo>
 #include <QDir>
 #include <string>
@@ -42,29 +46,78 @@ bool SessionIdent::operator==(const SessionIdent &otherIdent) const
 }
 
 
+std::atomic<uint32_t> Session::m_nextSessionId(1);
 unsigned int Session::m_retransmitTimeOut = DefaultRetransmitTimeOutms;
 unsigned int Session::m_maxRetransmissions = DefaultMaxRetryCount;
 
 
+/**
+ * @brief Session::Session
+ * @param localAddr local address of the session socket, replies to the peer are sent from this address
+ * @param scheduler shares sending DATA datagrams fairly between sessions, may be null
+ */
 Session::Session(const QHostAddress &peerAddr, uint16_t peerPort,
-                 std::shared_ptr<UdpSocketFactory> socketFactory, QObject *parent) : QObject(parent),
-                                                                    m_file(nullptr),
-                                                                    m_sessionSocket(socketFactory->createNewSocket()),
-                                                                    m_retransmitCount(0),
-                                                                    m_peerIdent(peerAddr, peerPort),
-                                                                    m_transferMode(TftpCode::Octet),
-                                                                    m_state(State::Busy)
+                 std::shared_ptr<UdpSocketFactory> socketFactory, std::shared_ptr<BindingMetrics> metrics,
+                 const QHostAddress &localAddr, std::shared_ptr<Pacer> pacer, std::shared_ptr<SendScheduler> scheduler,
+                 QObject *parent) : QObject(parent),
+                                    m_file(nullptr),
+                                    m_sessionSocket(socketFactory->createNewSocket()),
+                                    m_sendQueue(m_sessionSocket),
+                                    m_retransmitCount(0),
+                                    m_peerIdent(peerAddr, peerPort),
+                                    m_transferMode(TftpCode::Octet),
+                                    m_state(State::Busy),
+                                    m_sessionId(m_nextSessionId.fetch_add(1, std::memory_order_relaxed)),
+                                    m_metrics(metrics),
+                                    m_startTime(std::chrono::steady_clock::now()),
+                                    m_bytesSent(0),
+                                    m_totalRetransmits(0),
+                                    m_pacer(pacer),
+                                    m_scheduler(scheduler),
+                                    m_isPriorityTransfer(false),
+                                    m_receiveDrops(0),
+                                    m_kernelTimestamps(false)
 {
+    if (m_metrics)
+    {
+        m_metrics->m_activeSessions.add();
+    }
+    if (m_pacer)
+    {
+        m_pacer->initSessionBucket(m_pacingBucket);
+    }
+
     //port==0 means: choose random free port
-    m_sessionSocket->bind(QHostAddress::Any, 0);
+    m_sessionSocket->bind(localAddr, 0);
     m_retransmitTimer.setSingleShot(true);
     connect(m_sessionSocket.get(), &AbstractSocket::readyRead, this, &Session::dataReceived);
     connect(&m_retransmitTimer, &QTimer::timeout, this, &Session::handleExpiredRetransmitTimer);
+    connect(&m_sendQueue, &SendQueue::blocked, this, &Session::handleSendBlocked);
+    connect(&m_sendQueue, &SendQueue::sendFailed, this, [this](QString errMsg)
+                                                        {
+                                                            if (m_state != State::Finished && m_state != State::InError)
+                                                            {
+                                                                setState(State::InError, errMsg);
+                                                            }
+                                                        });
 }
 
 
 Session::~Session()
 {
+    if (m_pacer)
+    {
+        m_pacer->cancel(this);
+    }
+    if (m_scheduler)
+    {
+        m_scheduler->cancel(this);
+    }
+    if (m_metrics && m_state != State::Finished && m_state != State::InError)
+    {
+        //session destroyed while transfer still in progress
+        m_metrics->m_activeSessions.sub();
+    }
 }
 
 Session::State Session::state() const
@@ -73,6 +126,17 @@ Session::State Session::state() const
 }
 
 
+/**
+ * @brief Session::sessionId get the process-wide unique id of this session
+ *
+ * The id is used to correlate the events of this session in a trace dump (see TraceRecorder).
+ */
+uint32_t Session::sessionId() const
+{
+    return m_sessionId;
+}
+
+
 QString Session::filePath() const
 {
     return m_file.fileName();
@@ -199,6 +263,7 @@ bool Session::isFileOpen() const
     return m_file.isOpen();
 }
 
+
 void Session::setTransferMode(TftpCode::Mode newMode)
 {
     m_transferMode = newMode;
@@ -216,26 +281,153 @@ void Session::setFilePath(const QString &directory, const QString &fileName)
 }
 
 
+/**
+ * @brief Session::setFilePath set the name of the transferred file as reported by filePath()
+ * @param filePath absolute path of a file on disk or name of a file that is not on disk
+ */
+void Session::setFilePath(const QString &filePath)
+{
+    if (m_file.isOpen())
+    {
+        m_file.close();
+    }
+
+    m_file.setFileName(filePath);
+}
+
+
 /**
  * @brief Session::sendDatagram send a datagram to our session peer
  * @param datagram the payload of the datagram to send
- * @throw TftpError if there was an error while sending the datagram
+ *
+ * An error while sending the datagram ends the session from the event loop.
  */
 void Session::sendDatagram(QByteArray datagram, bool startRetransmitTimer)
 {
-    if( m_sessionSocket->writeDatagram(datagram, m_peerIdent.m_address, m_peerIdent.m_port) == -1 )
+    sendDatagramTo(datagram, m_peerIdent.m_address, m_peerIdent.m_port, startRetransmitTimer);
+}
+
+
+/**
+ * @brief Session::sendDatagramTo send a datagram from the session socket to another destination than our session peer
+ * @param datagram the payload of the datagram to send
+ * @param address destination address, may be a multicast group
+ * @param port destination port
+ *
+ * If the session has a SendScheduler, a DATA datagram may have to wait for the turn of this session. If the session has
+ * a Pacer, a DATA datagram that exceeds a rate limit is sent later. The retransmit timer is then started when it is
+ * actually sent. An error while sending the datagram ends the session from the event loop.
+ */
+void Session::sendDatagramTo(QByteArray datagram, const QHostAddress &address, uint16_t port, bool startRetransmitTimer)
+{
+    if ( m_scheduler && datagram.size() >= 2 && ntohs(readWordInByteArray(datagram, 0)) == TftpCode::TFTP_DATA )
     {
-        throw TftpError( "Error sending tftp error datagram to "s + m_peerIdent.m_address.toString().toStdString() +
-                         " port " + std::to_string(m_peerIdent.m_port));
+        auto scheduledSend = deferredSend([this, datagram, address, port, startRetransmitTimer]()
+                                          { sendPacedDatagram(datagram, address, port, startRetransmitTimer); });
+        if ( ! m_scheduler->schedule(this, m_metrics.get(), m_isPriorityTransfer, static_cast<uint64_t>(datagram.size()), scheduledSend) )
+        {
+            return;
+        }
+    }
+    sendPacedDatagram(datagram, address, port, startRetransmitTimer);
+}
+
+
+/**
+ * @brief Session::sendPacedDatagram send a datagram, or queue it in the Pacer if it is a DATA datagram that exceeds a rate limit
+ *
+ * An error while sending the datagram ends the session from the event loop.
+ */
+void Session::sendPacedDatagram(const QByteArray &datagram, const QHostAddress &address, uint16_t port, bool startRetransmitTimer)
+{
+    if ( m_pacer && datagram.size() >= 2 && ntohs(readWordInByteArray(datagram, 0)) == TftpCode::TFTP_DATA && m_pacer->isEnabled() )
+    {
+        auto pacedSend = deferredSend([this, datagram, address, port, startRetransmitTimer]()
+                                      { transmitDatagram(datagram, address, port, startRetransmitTimer); });
+        if ( ! m_pacer->admit(this, m_pacingBucket, m_metrics.get(), address, static_cast<uint64_t>(datagram.size()), pacedSend) )
+        {
+            return;
+        }
+    }
+    transmitDatagram(datagram, address, port, startRetransmitTimer);
+}
+
+
+/**
+ * @brief Session::deferredSend wrap \p sendFunction to be called later from the event loop, a send error then ends the session
+ */
+std::function<void()> Session::deferredSend(std::function<void()> sendFunction)
+{
+    return [this, sendFunction]()
+           {
+               try
+               {
+                   sendFunction();
+               }
+               catch (const TftpError &sendErr)
+               {
+                   setState(State::InError, sendErr.what());
+               }
+           };
+}
+
+
+/**
+ * @brief Session::transmitDatagram write a datagram to the session socket
+ *
+ * When the send buffer of the socket is full the datagram waits in the SendQueue, the retransmit timer is then started
+ * when the datagram is actually written. An error while writing ends the session from the event loop, see
+ * SendQueue::sendFailed().
+ */
+void Session::transmitDatagram(const QByteArray &datagram, const QHostAddress &address, uint16_t port, bool startRetransmitTimer)
+{
+    m_sendQueue.send(datagram, address, port, [this, datagram, startRetransmitTimer]() { datagramSent(datagram, startRetransmitTimer); });
+}
+
+
+/**
+ * @brief Session::datagramSent account for a datagram that was written to the session socket in the metrics
+ */
+void Session::datagramSent(const QByteArray &datagram, bool startRetransmitTimer)
+{
+    if (datagram.size() >= 4 && ntohs(readWordInByteArray(datagram, 0)) == TftpCode::TFTP_DATA)
+    {
+        m_lastSendTime = std::chrono::steady_clock::now();
+        QTFTP_PROBE3(data_written, m_sessionId, ntohs(readWordInByteArray(datagram, 2)), datagram.size() - 4);
+    }
+    m_bytesSent += static_cast<uint64_t>(datagram.size());
+    if (m_metrics)
+    {
+        m_metrics->m_bytesSent.add(static_cast<uint64_t>(datagram.size()));
+        m_metrics->m_datagramsSent.add();
+        if (datagram.size() >= 4 && ntohs(readWordInByteArray(datagram, 0)) == TftpCode::TFTP_ERROR)
+        {
+            auto errorCode = ntohs(readWordInByteArray(datagram, 2));
+            if (errorCode < BindingMetrics::ErrorCodeCount)
+            {
+                m_metrics->m_errorsSent[errorCode].add();
+            }
+        }
     }
 
     if (startRetransmitTimer)
     {
-        m_retransmitTimer.start(static_cast<int>(m_retransmitTimeOut));
+        this->startRetransmitTimer();
     }
 }
 
 
+/**
+ * @brief Session::startRetransmitTimer (re)start waiting for a datagram from the peer without sending a datagram
+ *
+ * When the timer expires retransmitData() is called, as if the last datagram was sent with the retransmit timer started.
+ */
+void Session::startRetransmitTimer()
+{
+    m_retransmitTimer.start(static_cast<int>(m_retransmitTimeOut));
+}
+
+
 void Session::stopRetransmitTimer()
 {
     m_retransmitTimer.stop();
@@ -249,34 +441,267 @@ void Session::resetRetransmitCounter()
 }
 
 
+/**
+ * @brief Session::retransmitCount get the nr of retransmissions done for the datagram currently waiting for acknowledgement
+ */
+unsigned int Session::retransmitCount() const
+{
+    return m_retransmitCount;
+}
+
+
+/**
+ * @brief Session::classifyTransfer let the SendScheduler give priority to this session if \p transferSize is small
+ */
+void Session::classifyTransfer(int64_t transferSize)
+{
+    m_isPriorityTransfer = m_scheduler && m_scheduler->isPriorityTransfer(transferSize);
+}
+
+
+/**
+ * @brief Session::recordAckDelay add a sample of the time between sending a datagram and receiving its ACK
+ * @param delayUs the delay in microseconds
+ */
+void Session::recordAckDelay(uint64_t delayUs)
+{
+    m_ackDelays.record(delayUs);
+}
+
+
+/**
+ * @brief Session::roundTripUs get the time between writing the last DATA datagram and receiving the last datagram that was read
+ * @return the time in microseconds, 0 if no DATA datagram was sent yet
+ *
+ * The send time is taken when the datagram is written to the socket, after it waited for the Pacer, the SendScheduler
+ * or a full send buffer. With kernel timestamps (see setKernelTimestamping()) the receive time is the time the kernel
+ * received the datagram, so the time it waited in the receive queue while the event loop was busy is not counted.
+ * When the DATA datagram was a retransmission, the ACK may belong to an earlier transmission of it, so the caller
+ * must not take the result as a sample of the ACK delay (Karn's rule).
+ */
+uint64_t Session::roundTripUs() const
+{
+    if (m_lastSendTime == std::chrono::steady_clock::time_point())
+    {
+        return 0;
+    }
+    auto roundTrip = std::chrono::duration_cast<std::chrono::microseconds>(m_lastReceiveTime - m_lastSendTime);
+    return static_cast<uint64_t>(std::max<long long>(roundTrip.count(), 0));
+}
+
+
+/**
+ * @brief Session::ackDelays get the distribution of the ACK delays of this session in microseconds
+ *
+ * The samples are merged into the latency statistics of the TftpServer when the session ends.
+ */
+const Histogram &Session::ackDelays() const
+{
+    return m_ackDelays;
+}
+
+
+/**
+ * @brief Session::bytesSent get the nr of bytes sent to the peer, including retransmissions and protocol headers
+ */
+uint64_t Session::bytesSent() const
+{
+    return m_bytesSent;
+}
+
+
+/**
+ * @brief Session::totalRetransmits get the nr of datagrams retransmitted during this session
+ */
+unsigned int Session::totalRetransmits() const
+{
+    return m_totalRetransmits;
+}
+
+
+/**
+ * @brief Session::setSocketBufferSizes set the kernel buffer sizes of the session socket, see AbstractSocket::setBufferSizes()
+ */
+void Session::setSocketBufferSizes(int receiveBytes, int sendBytes)
+{
+    m_sessionSocket->setBufferSizes(receiveBytes, sendBytes);
+}
+
+
+/**
+ * @brief Session::setKernelTimestamping measure the round trip time with the time the kernel received datagrams
+ *
+ * Without kernel timestamps a datagram counts as received when it is read, so when the event loop is busy the ACK
+ * delays include the time the ACKs waited in the receive queue. With kernel timestamps that time is recorded in
+ * BindingMetrics::m_receiveQueueDelayUs instead. Nothing changes if the socket can't report timestamps.
+ */
+void Session::setKernelTimestamping(bool enabled)
+{
+    m_kernelTimestamps = enabled && m_sessionSocket->enableReceiveTimestamps();
+}
+
+
+/**
+ * @brief Session::collectReceiveDrops add the datagrams the kernel dropped on the session socket since the previous call to the metrics
+ * @return the nr of datagrams dropped since the previous call
+ */
+uint32_t Session::collectReceiveDrops()
+{
+    uint32_t socketDrops = 0;
+    if ( ! m_sessionSocket->receiveDrops(socketDrops) )
+    {
+        return 0;
+    }
+    uint32_t newDrops = socketDrops - m_receiveDrops;
+    m_receiveDrops = socketDrops;
+    if (m_metrics)
+    {
+        m_metrics->m_receiveDrops.add(newDrops);
+    }
+    return newDrops;
+}
+
+
+/**
+ * @brief Session::durationMs get the time from the creation of this session until it finished or failed
+ * @return duration in ms, or time since creation if the session is still in progress
+ */
+qint64 Session::durationMs() const
+{
+    bool hasEnded = (m_state == State::Finished || m_state == State::InError);
+    auto endTime = hasEnded ? m_endTime : std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::milliseconds>(endTime - m_startTime).count();
+}
+
+
+/**
+ * @brief Session::metrics get the metrics of the binding this session belongs to
+ * @return pointer to the metrics or nullptr if this session does not report metrics
+ */
+BindingMetrics *Session::metrics() const
+{
+    return m_metrics.get();
+}
+
+
 void Session::handleExpiredRetransmitTimer()
 {
+    if (m_sendQueue.isBlocked())
+    {
+        //datagrams still wait for room in the send buffer, they are not lost
+        startRetransmitTimer();
+        return;
+    }
     if (m_retransmitCount < m_maxRetransmissions)
     {
+        ++m_totalRetransmits;
+        if (m_metrics)
+        {
+            m_metrics->m_retransmits.add();
+        }
         retransmitData();
         ++m_retransmitCount;
         return;
     }
 
     //max nr of retransmissions reached
+    retransmitLimitReached();
+}
+
+
+/**
+ * @brief Session::retransmitLimitReached called when the datagram waiting for acknowledgement was retransmitted
+ * the maximum nr of times without response
+ *
+ * The default implementation ends the session with an error.
+ */
+void Session::retransmitLimitReached()
+{
     setState(State::InError, QObject::tr("Maximum nr of re-transmissions reached"));
 }
 
 
+/**
+ * @brief Session::sendBufferFull called when a datagram could not be sent because the send buffer of the session socket
+ * is full, so the session can send less
+ *
+ * The default implementation does nothing.
+ */
+void Session::sendBufferFull()
+{
+}
+
+
+/**
+ * @brief Session::handleSendBlocked account for a datagram that waits for room in the send buffer
+ */
+void Session::handleSendBlocked()
+{
+    if (m_metrics)
+    {
+        m_metrics->m_sendsBlocked.add();
+    }
+    sendBufferFull();
+}
+
+
 void Session::setState(Session::State newState, QString msg)
 {
+    QTFTP_PROBE3(state_change, m_sessionId, static_cast<int>(m_state), static_cast<int>(newState));
+    bool isEnding = (newState == State::Finished || newState == State::InError);
+    if (isEnding && m_state != State::Finished && m_state != State::InError)
+    {
+        m_endTime = std::chrono::steady_clock::now();
+        updateMetricsAtEnd(newState);
+        if (m_pacer)
+        {
+            m_pacer->cancel(this);
+        }
+        if (m_scheduler)
+        {
+            m_scheduler->cancel(this);
+        }
+    }
     m_state = newState;
     if (m_state == State::Finished)
     {
+        TraceRecorder::record(TraceEvent::Finished, m_sessionId);
         emit finished();
     }
     else if (m_state == State::InError)
     {
+        TraceRecorder::sessionError(m_sessionId);
         emit error(msg);
     }
 }
 
 
+/**
+ * @brief Session::updateMetricsAtEnd account for the end of this session in the binding metrics
+ * @param endState the state the session is about to enter, Finished or InError
+ */
+void Session::updateMetricsAtEnd(Session::State endState)
+{
+    if (!m_metrics)
+    {
+        return;
+    }
+
+    m_metrics->m_activeSessions.sub();
+    if (endState == State::Finished)
+    {
+        m_metrics->m_sessionsFinished.add();
+    }
+    else
+    {
+        m_metrics->m_sessionsFailed.add();
+    }
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(m_endTime - m_startTime);
+    m_metrics->m_sessionDurationUs.record(static_cast<uint64_t>(std::max<long long>(duration.count(), 0)));
+    collectReceiveDrops();
+}
+
+
 /**
  * @brief Session::readDatagram read a datagram from the session socket
  * @param datagram reference to the bytearray where the datagram will be stored
@@ -292,6 +717,19 @@ void Session::readDatagram(QByteArray &datagram, QHostAddress *peerAddress, quin
     {
         throw TftpError("Error while reading data from read session socket (port "s + std::to_string(m_sessionSocket->localPort()) + ")");
     }
+
+    auto readTime = std::chrono::steady_clock::now();
+    m_lastReceiveTime = readTime;
+    std::chrono::steady_clock::time_point kernelTime;
+    if (m_kernelTimestamps && m_sessionSocket->lastReceiveTime(kernelTime) && kernelTime <= readTime)
+    {
+        m_lastReceiveTime = kernelTime;
+        if (m_metrics)
+        {
+            auto queueDelay = std::chrono::duration_cast<std::chrono::microseconds>(readTime - kernelTime);
+            m_metrics->m_receiveQueueDelayUs.record(static_cast<uint64_t>(queueDelay.count()));
+        }
+    }
 }
 
 
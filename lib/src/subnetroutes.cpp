@@ -0,0 +1,221 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#include "qtftp/subnetroutes.h"
+#include "qtftp/tftp_error.h"
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QRegularExpression>
+#include <QTextStream>
+
+using namespace std::string_literals;
+
+namespace QTFTP
+{
+
+namespace
+{
+
+inline int addressBit(const uint8_t *addrBytes, int bitNr)
+{
+    return (addrBytes[bitNr / 8] >> (7 - bitNr % 8)) & 1;
+}
+
+/**
+ * @brief addressBytes get the bytes of an address in network byte order
+ * @return the nr of bits of the address, 32 for IPv4 (including IPv4-mapped IPv6), 128 for IPv6, 0 otherwise
+ */
+int addressBytes(const QHostAddress &address, uint8_t bytes[16])
+{
+    bool isIpv4 = false;
+    quint32 ipv4Addr = address.toIPv4Address(&isIpv4);
+    if (isIpv4)
+    {
+        bytes[0] = static_cast<uint8_t>(ipv4Addr >> 24);
+        bytes[1] = static_cast<uint8_t>(ipv4Addr >> 16);
+        bytes[2] = static_cast<uint8_t>(ipv4Addr >> 8);
+        bytes[3] = static_cast<uint8_t>(ipv4Addr);
+        return 32;
+    }
+    if (address.protocol() == QAbstractSocket::IPv6Protocol)
+    {
+        Q_IPV6ADDR ipv6Addr = address.toIPv6Address();
+        for (int byteNr=0; byteNr<16; ++byteNr)
+        {
+            bytes[byteNr] = ipv6Addr[byteNr];
+        }
+        return 128;
+    }
+    return 0;
+}
+
+} // anonymous namespace end
+
+
+SubnetRoutes::SubnetRoutes() : m_ipv4Trie(1, TrieNode{ {0, 0}, -1 }),
+                               m_ipv6Trie(1, TrieNode{ {0, 0}, -1 })
+{
+}
+
+
+/**
+ * @brief SubnetRoutes::addRoute serve read requests from clients in a subnet from a files directory
+ * @param network address in the subnet, only the first \p prefixLength bits are used
+ * @param prefixLength nr of leading bits of \p network that clients must match, 0 matches every client
+ * @throw TftpError if the prefix is not valid, the subnet already has a route or \p filesDir is not a readable directory
+ */
+void SubnetRoutes::addRoute(const QHostAddress &network, int prefixLength, const QString &filesDir)
+{
+    uint8_t netBytes[16];
+    int addrBits = addressBytes(network, netBytes);
+    if (addrBits == 0 || prefixLength < 0 || prefixLength > addrBits)
+    {
+        throw TftpError("Invalid subnet "s + network.toString().toStdString() + "/" + std::to_string(prefixLength));
+    }
+    QDir routeDir(filesDir);
+    if ( filesDir.isEmpty() || !routeDir.exists() || !routeDir.isReadable() )
+    {
+        throw TftpError("File directory "s + filesDir.toStdString() + " does not exist or is not readable");
+    }
+
+    auto &trie = (addrBits == 32) ? m_ipv4Trie : m_ipv6Trie;
+    uint32_t nodeIndex = 0;
+    for (int bitNr=0; bitNr<prefixLength; ++bitNr)
+    {
+        int bit = addressBit(netBytes, bitNr);
+        if (trie[nodeIndex].m_children[bit] == 0)
+        {
+            trie[nodeIndex].m_children[bit] = static_cast<uint32_t>(trie.size());
+            trie.push_back(TrieNode{ {0, 0}, -1 });
+        }
+        nodeIndex = trie[nodeIndex].m_children[bit];
+    }
+    if (trie[nodeIndex].m_routeIndex >= 0)
+    {
+        throw TftpError("Duplicate route for subnet "s + network.toString().toStdString() + "/" + std::to_string(prefixLength));
+    }
+
+    QString absoluteDir = routeDir.absolutePath();
+    auto &provider = m_providers[absoluteDir];
+    if (!provider)
+    {
+        provider = DirectoryProvider::create(absoluteDir);
+    }
+    trie[nodeIndex].m_routeIndex = static_cast<int>(m_routes.size());
+    m_routes.push_back(Route{ absoluteDir, provider });
+}
+
+
+/**
+ * @brief SubnetRoutes::loadRoutes add the routes in a routes file
+ * @param baseDir directory relative files directories in the file are relative to
+ * @throw TftpError if the file can't be read or contains an invalid route
+ *
+ * Each line of the file contains a subnet in CIDR notation (e.g. 10.1.0.0/16 or fd00:1::/48) followed by white space
+ * and the files directory, which may contain spaces. Empty lines and lines starting with '#' are ignored.
+ */
+void SubnetRoutes::loadRoutes(const QString &routesFileName, const QString &baseDir)
+{
+    QFile routesFile(routesFileName);
+    if ( ! routesFile.open(QIODevice::ReadOnly | QIODevice::Text) )
+    {
+        throw TftpError("Could not open subnet routes file "s + routesFileName.toStdString() + ": " + routesFile.errorString().toStdString());
+    }
+
+    QTextStream routesStream(&routesFile);
+    QRegularExpression fieldSeparator("\\s+");
+    QDir relativeTo(baseDir.isEmpty() ? QDir::currentPath() : baseDir);
+    unsigned int lineNr = 0;
+    while (!routesStream.atEnd())
+    {
+        ++lineNr;
+        QString line = routesStream.readLine().trimmed();
+        if (line.isEmpty() || line.startsWith("#"))
+        {
+            continue;
+        }
+        try
+        {
+            int separatorPos = line.indexOf(fieldSeparator);
+            if (separatorPos < 0)
+            {
+                throw TftpError("expected <subnet>/<prefix length> <files dir>");
+            }
+            QString subnet = line.left(separatorPos);
+            auto network = QHostAddress::parseSubnet(subnet);
+            if (network.first.isNull() || network.second < 0)
+            {
+                throw TftpError("invalid subnet "s + subnet.toStdString());
+            }
+            addRoute(network.first, network.second, relativeTo.absoluteFilePath(line.mid(separatorPos).trimmed()));
+        }
+        catch (const TftpError &routeErr)
+        {
+            throw TftpError("Subnet routes file "s + routesFileName.toStdString() + " line " + std::to_string(lineNr) + ": " + routeErr.what());
+        }
+    }
+}
+
+
+size_t SubnetRoutes::routeCount() const
+{
+    return m_routes.size();
+}
+
+
+/**
+ * @brief SubnetRoutes::find find the route of the smallest subnet that contains a client address
+ * @return the route, or nullptr if no subnet contains \p peerAddr
+ */
+const SubnetRoutes::Route *SubnetRoutes::find(const QHostAddress &peerAddr) const
+{
+    uint8_t peerBytes[16];
+    int addrBits = addressBytes(peerAddr, peerBytes);
+    if (addrBits == 0)
+    {
+        return nullptr;
+    }
+    int routeIndex = longestMatch((addrBits == 32) ? m_ipv4Trie : m_ipv6Trie, peerBytes, addrBits);
+    return (routeIndex >= 0) ? &m_routes[static_cast<size_t>(routeIndex)] : nullptr;
+}
+
+
+int SubnetRoutes::longestMatch(const std::vector<TrieNode> &trie, const uint8_t *addrBytes, int addrBits)
+{
+    uint32_t nodeIndex = 0;
+    int routeIndex = trie[0].m_routeIndex;
+    for (int bitNr=0; bitNr<addrBits; ++bitNr)
+    {
+        nodeIndex = trie[nodeIndex].m_children[addressBit(addrBytes, bitNr)];
+        if (nodeIndex == 0)
+        {
+            break;
+        }
+        if (trie[nodeIndex].m_routeIndex >= 0)
+        {
+            routeIndex = trie[nodeIndex].m_routeIndex;
+        }
+    }
+    return routeIndex;
+}
+
+
+} // QTFTP namespace end
@@ -0,0 +1,51 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#ifndef TFTP_PROBES_H
+#define TFTP_PROBES_H
+
+/*
+ * USDT (user statically defined tracing) probe points of the qtftp library, provider name "qtftp".
+ * They are only compiled in when cmake option QTFTP_ENABLE_USDT is ON. Even then a probe is a single nop
+ * until a tracer like bpftrace, perf or SystemTap attaches to it.
+ *
+ *   main_datagram(opcode, size, peer port)              datagram received on a listening socket
+ *   session_created(session id, peer port)              new read session created for a RRQ
+ *   ack_received(session id, block nr, session state)   datagram received by a read session, before validation
+ *   data_sent(session id, block nr, payload size)       DATA datagram sent for the first time
+ *   retransmit(session id, block nr, retransmission nr) DATA datagram sent again after a time-out or a lost block
+ *   data_written(session id, block nr, payload size)    DATA datagram written to the session socket
+ *
+ * data_sent and retransmit fire when the session hands the block over for sending, before it may wait for the
+ * SendScheduler, the Pacer and a full send buffer. data_written fires when it is actually written to the socket, so
+ * it is the one to time ACKs from.
+ *   state_change(session id, old state, new state)      Session::State values as integers
+ */
+
+#ifdef QTFTP_ENABLE_USDT
+#include <sys/sdt.h>
+#define QTFTP_PROBE2(name, arg1, arg2)       DTRACE_PROBE2(qtftp, name, arg1, arg2)
+#define QTFTP_PROBE3(name, arg1, arg2, arg3) DTRACE_PROBE3(qtftp, name, arg1, arg2, arg3)
+#else
+#define QTFTP_PROBE2(name, arg1, arg2)       do {} while (0)
+#define QTFTP_PROBE3(name, arg1, arg2, arg3) do {} while (0)
+#endif
+
+#endif // TFTP_PROBES_H
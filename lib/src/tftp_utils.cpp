@@ -19,6 +19,7 @@
 ****************************************************************************/
 
 #include "qtftp/tftp_utils.h"
+#include <algorithm>
 
 
 namespace QTFTP
@@ -51,4 +52,83 @@ QByteArray assembleTftpErrorDatagram(TftpCode::ErrorCode ec, const QString &errM
 }
 
 
+/**
+ * @brief rrqFileName get the file name requested by a read request
+ * @param rrqDatagram must contain a RRQ packet
+ */
+QString rrqFileName(const QByteArray &rrqDatagram)
+{
+    if (rrqDatagram.size() <= 2)
+    {
+        return QString();
+    }
+    return QString(rrqDatagram.data() + 2);
+}
+
+
+/**
+ * @brief findRrqOption check if a read request contains an option (RFC2347)
+ * @param rrqDatagram must contain a RRQ packet
+ * @param optionName name of the option in lower case
+ * @param optionValue if not null the value of the option will be stored in this parameter
+ * @return true if the option is present in \p rrqDatagram
+ */
+bool findRrqOption(const QByteArray &rrqDatagram, const QString &optionName, QString *optionValue)
+{
+    //skip opcode, file name and mode
+    int offset = rrqDatagram.indexOf('\0', 2) + 1;
+    offset = (offset > 0) ? rrqDatagram.indexOf('\0', offset) + 1 : 0;
+    while (offset > 0 && offset < rrqDatagram.size())
+    {
+        int nameEnd = rrqDatagram.indexOf('\0', offset);
+        if (nameEnd == -1)
+        {
+            break;
+        }
+        int valueEnd = rrqDatagram.indexOf('\0', nameEnd + 1);
+        if (valueEnd == -1)
+        {
+            break;
+        }
+        if (QString(rrqDatagram.mid(offset, nameEnd - offset)).toLower() == optionName)
+        {
+            if (optionValue)
+            {
+                *optionValue = QString(rrqDatagram.mid(nameEnd + 1, valueEnd - nameEnd - 1));
+            }
+            return true;
+        }
+        offset = valueEnd + 1;
+    }
+    return false;
+}
+
+
+/**
+ * @brief subnetAddress get the network address of the subnet that contains \p address
+ * @param prefixLength set to the prefix length used, \p ipv4PrefixLength for IPv4 (and IPv4-mapped) addresses, else \p ipv6PrefixLength
+ */
+QHostAddress subnetAddress(const QHostAddress &address, int ipv4PrefixLength, int ipv6PrefixLength, int &prefixLength)
+{
+    bool isIpv4 = false;
+    quint32 ipv4Address = address.toIPv4Address(&isIpv4);
+    if (isIpv4)
+    {
+        //also true for IPv4-mapped IPv6 addresses of clients on a dual stack socket
+        prefixLength = ipv4PrefixLength;
+        quint32 netMask = (prefixLength == 0) ? 0 : (~quint32(0) << (32 - prefixLength));
+        return QHostAddress(ipv4Address & netMask);
+    }
+
+    prefixLength = ipv6PrefixLength;
+    Q_IPV6ADDR ipv6Address = address.toIPv6Address();
+    for (int byteIndex=0; byteIndex<16; ++byteIndex)
+    {
+        int bitsInByte = std::min(std::max(prefixLength - byteIndex*8, 0), 8);
+        ipv6Address[byteIndex] &= static_cast<quint8>(0xFF00 >> bitsInByte);
+    }
+    return QHostAddress(ipv6Address);
+}
+
+
 } // QTFTP namespace end
@@ -20,18 +20,25 @@
 
 #include "qtftp/tftpserver.h"
 #include "qtftp/readsession.h"
+#include "qtftp/multicastreadsession.h"
+#include "qtftp/writesession.h"
+#include "qtftp/writebehindwriter.h"
 #include "qtftp/tftp_error.h"
 #include "qtftp/tftp_constants.h"
 #include "qtftp/tftp_utils.h"
 #include "qtftp/udpsocketfactory.h"
 #include "qtftp/udpsocket.h"
+#include "tftp_probes.h"
 #include <QDir>
+#include <QFileInfo>
 #include <QByteArray>
+#include <QTimer>
 #ifdef _WIN32
 #include <winsock2.h>
 #else
 #include <arpa/inet.h>
 #endif
+#include <algorithm>
 #include <cassert>
 #include <iostream> //TODO: remove after debug
 
@@ -40,6 +47,35 @@ using namespace std::string_literals;
 namespace QTFTP
 {
 
+static constexpr unsigned int MaxDatagramsPerTurn = 32; /// datagrams a main socket may handle before the other sockets get a turn
+
+constexpr int ConnectionRequestSocket::AutoTuneStartBytes;
+constexpr int ConnectionRequestSocket::MaxAutoTuneBytes;
+constexpr int TftpServer::SocketStatsIntervalMs;
+
+namespace
+{
+
+bool isWildcardAddress(const QHostAddress &address)
+{
+    return address == QHostAddress::Any || address == QHostAddress::AnyIPv4 || address == QHostAddress::AnyIPv6;
+}
+
+/**
+ * @brief bindingKey get the key of an address in the bindings of a wildcard socket
+ *
+ * A dual stack wildcard socket reports the destination of IPv4 datagrams as IPv4-mapped IPv6 address.
+ */
+QHostAddress bindingKey(const QHostAddress &address)
+{
+    bool isIpv4 = false;
+    quint32 ipv4Addr = address.toIPv4Address(&isIpv4);
+    return isIpv4 ? QHostAddress(ipv4Addr) : address;
+}
+
+} // anonymous namespace end
+
+
 
 /**
  * @brief bind socket to provided address and port
@@ -48,19 +84,56 @@ namespace QTFTP
  * @param mode bind mode to use
  * @throw TftpError if socket could not be bound successfully
  */
-ConnectionRequestSocket::ConnectionRequestSocket(const QString &filesDir, std::shared_ptr<UdpSocketFactory> socketFactory) : m_socket(socketFactory->createNewSocket(this)),
-                                                                                                                             m_filesDir(filesDir)
+ConnectionRequestSocket::ConnectionRequestSocket(const QString &filesDir, std::shared_ptr<UdpSocketFactory> socketFactory, bool allowUploads) : m_socket(socketFactory->createNewSocket(this)),
+                                                                                                                                                m_filesDir(filesDir),
+                                                                                                                                                m_allowUploads(allowUploads),
+                                                                                                                                                m_maxSessions(0),
+                                                                                                                                                m_receiveBufferSize(0),
+                                                                                                                                                m_sendBufferSize(0),
+                                                                                                                                                m_autoTuneBuffers(false),
+                                                                                                                                                m_receiveDrops(0),
+                                                                                                                                                m_sendsBlocked(0)
 
 {
     connect(m_socket.get(), &AbstractSocket::readyRead, this, &ConnectionRequestSocket::readyRead);
 }
 
 
+/**
+ * @brief ConnectionRequestSocket::ConnectionRequestSocket create a binding that shares a wildcard socket with other bindings
+ * @param wildcardSocket socket bound to a wildcard address, the owner of the socket reads the requests and dispatches them
+ * @param bindAddress requests sent to this address belong to this binding, replies are sent from it
+ *
+ * This binding does not emit readyRead().
+ */
+ConnectionRequestSocket::ConnectionRequestSocket(const QString &filesDir, std::shared_ptr<AbstractSocket> wildcardSocket, const QHostAddress &bindAddress,
+                                                 bool allowUploads) : m_socket(wildcardSocket),
+                                                                      m_bindAddress(bindAddress),
+                                                                      m_filesDir(filesDir),
+                                                                      m_allowUploads(allowUploads),
+                                                                      m_maxSessions(0),
+                                                                      m_receiveBufferSize(0),
+                                                                      m_sendBufferSize(0),
+                                                                      m_autoTuneBuffers(false),
+                                                                      m_receiveDrops(0),
+                                                                      m_sendsBlocked(0)
+{
+}
+
+
 const QString &ConnectionRequestSocket::filesDir() const
 {
     return m_filesDir;
 }
 
+/**
+ * @brief ConnectionRequestSocket::allowUploads check if write requests received on this socket are accepted
+ */
+bool ConnectionRequestSocket::allowUploads() const
+{
+    return m_allowUploads;
+}
+
 QString ConnectionRequestSocket::errorString() const
 {
     return m_socket->errorString();
@@ -83,7 +156,16 @@ quint16 ConnectionRequestSocket::localPort() const
 
 QHostAddress ConnectionRequestSocket::localAddress() const
 {
-    return m_socket->localAddress();
+    return sharesSocket() ? m_bindAddress : m_socket->localAddress();
+}
+
+
+/**
+ * @brief ConnectionRequestSocket::sharesSocket check if this binding shares a wildcard socket with other bindings
+ */
+bool ConnectionRequestSocket::sharesSocket() const
+{
+    return !m_bindAddress.isNull();
 }
 
 bool ConnectionRequestSocket::bind(const QHostAddress &address, quint16 port, QAbstractSocket::BindMode mode)
@@ -98,14 +180,236 @@ qint64 ConnectionRequestSocket::readDatagram(char *data, qint64 maxSize, QHostAd
 
 qint64 ConnectionRequestSocket::writeDatagram(const QByteArray &datagram, const QHostAddress &host, quint16 port)
 {
+    if (sharesSocket())
+    {
+        return m_socket->writeDatagramFrom(datagram, host, port, m_bindAddress);
+    }
     return m_socket->writeDatagram(datagram, host, port);
 }
 
+/**
+ * @brief ConnectionRequestSocket::isSendErrorTransient check if the last failed writeDatagram() was caused by a full send buffer
+ */
+bool ConnectionRequestSocket::isSendErrorTransient() const
+{
+    return m_socket->isSendErrorTransient();
+}
+
 void ConnectionRequestSocket::close()
 {
     m_socket->close();
 }
 
+void ConnectionRequestSocket::setMetrics(std::shared_ptr<BindingMetrics> metrics)
+{
+    m_metrics = metrics;
+    m_metrics->m_receiveBufferBytes.set(m_socket->receiveBufferSize());
+    m_metrics->m_sendBufferBytes.set(m_socket->sendBufferSize());
+}
+
+std::shared_ptr<BindingMetrics> ConnectionRequestSocket::metrics() const
+{
+    return m_metrics;
+}
+
+void ConnectionRequestSocket::addBlockSourceProvider(std::shared_ptr<BlockSourceProvider> provider)
+{
+    m_providers.push_back(provider);
+}
+
+const BlockSourceProviders &ConnectionRequestSocket::blockSourceProviders() const
+{
+    return m_providers;
+}
+
+
+void ConnectionRequestSocket::setDirectoryProvider(std::shared_ptr<DirectoryProvider> directoryProvider)
+{
+    m_directoryProvider = directoryProvider;
+}
+
+
+std::shared_ptr<DirectoryProvider> ConnectionRequestSocket::directoryProvider() const
+{
+    return m_directoryProvider;
+}
+
+
+void ConnectionRequestSocket::setFileNameRewriter(std::shared_ptr<FileNameRewriter> fileNameRewriter)
+{
+    m_fileNameRewriter = fileNameRewriter;
+}
+
+
+/**
+ * @brief ConnectionRequestSocket::rewriteRequest apply the file name rewrite rules of this binding to a RRQ or WRQ
+ * @return the request with the rewritten file name, or \p requestDgram itself if there are no rules or none matched
+ */
+QByteArray ConnectionRequestSocket::rewriteRequest(const QByteArray &requestDgram)
+{
+    if (!m_fileNameRewriter)
+    {
+        return requestDgram;
+    }
+    int nameEnd = requestDgram.indexOf('\0', 2);
+    if (nameEnd < 0)
+    {
+        return requestDgram;
+    }
+    QString fileName = QString::fromUtf8(requestDgram.constData() + 2, nameEnd - 2);
+    QString rewrittenName = m_fileNameRewriter->rewrite(fileName);
+    if (rewrittenName == fileName)
+    {
+        return requestDgram;
+    }
+    return requestDgram.left(2) + rewrittenName.toUtf8() + requestDgram.mid(nameEnd);
+}
+
+
+void ConnectionRequestSocket::setSubnetRoutes(std::shared_ptr<SubnetRoutes> subnetRoutes)
+{
+    m_subnetRoutes = subnetRoutes;
+}
+
+
+/**
+ * @brief ConnectionRequestSocket::setMaxSessions limit the nr of sessions of this binding, 0 for no limit
+ */
+void ConnectionRequestSocket::setMaxSessions(unsigned int maxSessions)
+{
+    m_maxSessions = maxSessions;
+}
+
+
+unsigned int ConnectionRequestSocket::maxSessions() const
+{
+    return m_maxSessions;
+}
+
+
+/**
+ * @brief ConnectionRequestSocket::setSocketBufferSizes set the kernel buffer sizes of the listening socket of this binding
+ * @param receiveBytes SO_RCVBUF, 0 for the kernel default
+ * @param sendBytes SO_SNDBUF, 0 for the kernel default
+ *
+ * The sizes are also used for the sockets of sessions started from this binding, see receiveBufferSize() and
+ * sendBufferSize(). If the listening socket is a wildcard socket shared with other bindings, the sizes set last apply.
+ */
+void ConnectionRequestSocket::setSocketBufferSizes(int receiveBytes, int sendBytes)
+{
+    m_receiveBufferSize = receiveBytes;
+    m_sendBufferSize = sendBytes;
+    m_socket->setBufferSizes(receiveBytes, sendBytes);
+    if (m_metrics)
+    {
+        m_metrics->m_receiveBufferBytes.set(m_socket->receiveBufferSize());
+        m_metrics->m_sendBufferBytes.set(m_socket->sendBufferSize());
+    }
+}
+
+
+/**
+ * @brief ConnectionRequestSocket::setSocketBufferAutoTuning let tuneSocketBuffers() raise the buffer sizes of this binding
+ */
+void ConnectionRequestSocket::setSocketBufferAutoTuning(bool enabled)
+{
+    m_autoTuneBuffers = enabled;
+}
+
+
+/**
+ * @brief ConnectionRequestSocket::receiveBufferSize get the requested receive buffer size of the sockets of this binding
+ * @return 0 if the kernel default is used
+ */
+int ConnectionRequestSocket::receiveBufferSize() const
+{
+    return m_receiveBufferSize;
+}
+
+
+/**
+ * @brief ConnectionRequestSocket::sendBufferSize get the requested send buffer size of the sockets of this binding
+ * @return 0 if the kernel default is used
+ */
+int ConnectionRequestSocket::sendBufferSize() const
+{
+    return m_sendBufferSize;
+}
+
+
+/**
+ * @brief ConnectionRequestSocket::collectReceiveDrops add the datagrams the kernel dropped on the listening socket since the
+ * previous call to the metrics of this binding
+ * @return the nr of datagrams dropped since the previous call
+ *
+ * The kernel doesn't know to which address a dropped datagram was sent, so all bindings that share a wildcard socket
+ * report the drops of that socket.
+ */
+uint32_t ConnectionRequestSocket::collectReceiveDrops()
+{
+    uint32_t socketDrops = 0;
+    if ( ! m_socket->receiveDrops(socketDrops) )
+    {
+        return 0;
+    }
+    uint32_t newDrops = socketDrops - m_receiveDrops;
+    m_receiveDrops = socketDrops;
+    m_metrics->m_receiveDrops.add(newDrops);
+    return newDrops;
+}
+
+
+/**
+ * @brief ConnectionRequestSocket::tuneSocketBuffers raise the buffer sizes if datagrams were dropped or sends were blocked
+ * @param newReceiveDrops the nr of datagrams dropped on the sockets of this binding since the previous call
+ * @return true if the buffer sizes were raised, the sockets of running sessions should then be updated too
+ *
+ * Each call that sees drops doubles the receive buffer size, and each call that sees blocked sends (see
+ * BindingMetrics::m_sendsBlocked) doubles the send buffer size, starting at AutoTuneStartBytes up to MaxAutoTuneBytes.
+ * Nothing is changed if auto-tuning is not enabled.
+ */
+bool ConnectionRequestSocket::tuneSocketBuffers(uint32_t newReceiveDrops)
+{
+    uint64_t sendsBlocked = m_metrics->m_sendsBlocked.value();
+    uint64_t newSendsBlocked = sendsBlocked - m_sendsBlocked;
+    m_sendsBlocked = sendsBlocked;
+    if (!m_autoTuneBuffers)
+    {
+        return false;
+    }
+
+    auto raisedSize = [](int bufferSize) { return std::min(std::max(bufferSize * 2, AutoTuneStartBytes), MaxAutoTuneBytes); };
+    int receiveBytes = (newReceiveDrops > 0) ? raisedSize(m_receiveBufferSize) : m_receiveBufferSize;
+    int sendBytes = (newSendsBlocked > 0) ? raisedSize(m_sendBufferSize) : m_sendBufferSize;
+    if (receiveBytes == m_receiveBufferSize && sendBytes == m_sendBufferSize)
+    {
+        return false;
+    }
+    setSocketBufferSizes(receiveBytes, sendBytes);
+    return true;
+}
+
+
+/**
+ * @brief ConnectionRequestSocket::selectFilesDir get the files directory that read requests from a client are served from
+ * @param filesDir [out] the directory of the subnet route that matches \p peerAddr, or the files directory of this binding
+ * @param directoryProvider [out] the provider of the files in \p filesDir, may be null
+ */
+void ConnectionRequestSocket::selectFilesDir(const QHostAddress &peerAddr, QString &filesDir, std::shared_ptr<DirectoryProvider> &directoryProvider) const
+{
+    const SubnetRoutes::Route *route = m_subnetRoutes ? m_subnetRoutes->find(peerAddr) : nullptr;
+    if (route)
+    {
+        filesDir = route->m_filesDir;
+        directoryProvider = route->m_directoryProvider;
+    }
+    else
+    {
+        filesDir = m_filesDir;
+        directoryProvider = m_directoryProvider;
+    }
+}
+
 
 
 /**
@@ -120,8 +424,21 @@ void ConnectionRequestSocket::close()
 
 TftpServer::TftpServer(std::shared_ptr<UdpSocketFactory> socketFactory, QObject *parent) : QObject(parent),
                                                                                                                     m_socketFactory(socketFactory),
-                                                                                                                    m_slowNetworkThreshold(2000)
+                                                                                                                    m_wildcardBinding(false),
+                                                                                                                    m_multicastGroupPort(0),
+                                                                                                                    m_multicastGroupCount(0),
+                                                                                                                    m_transferGroups(std::make_shared<TransferGroupRegistry>()),
+                                                                                                                    m_slowNetworkThreshold(2000),
+                                                                                                                    m_eventLoopLagMonitor(m_metrics.eventLoopLag()),
+                                                                                                                    m_maxSessions(0),
+                                                                                                                    m_maxQueuedRequests(0),
+                                                                                                                    m_maxQueueWaitMs(DefaultMaxQueueWaitMs),
+                                                                                                                    m_pacer(std::make_shared<Pacer>(m_metrics.pacing())),
+                                                                                                                    m_scheduler(std::make_shared<SendScheduler>()),
+                                                                                                                    m_kernelTimestamping(false)
 {
+    connect(&m_socketStatsTimer, &QTimer::timeout, this, &TftpServer::checkSocketBuffers);
+    m_socketStatsTimer.start(SocketStatsIntervalMs);
 }
 
 
@@ -130,32 +447,62 @@ TftpServer::TftpServer(std::shared_ptr<UdpSocketFactory> socketFactory, QObject
  * @param filesDir read from or write to files requested from \p hostaddr in this directory
  * @param hostAddr listen only for tftp requests originating from this address
  * @param port udp port on which the tftp server will listen for new connections
+ * @param allowUploads if true, write requests are accepted and the uploaded files are stored in \p filesDir
  * @throw TtftpError if an error occurred while binding this server's socket to
  * \p hostAddr and \p portNr.
  */
-void TftpServer::bind(const QString &filesDir, const QHostAddress &hostAddr, uint16_t port)
+void TftpServer::bind(const QString &filesDir, const QHostAddress &hostAddr, uint16_t port, bool allowUploads)
 {
     QDir tftpFileDir(filesDir);
     if ( filesDir.isEmpty() || !tftpFileDir.exists() || !tftpFileDir.isReadable())
     {
         throw TftpError("File directory for tftp server "s + filesDir.toStdString() + " does not exist or is not readable");
     }
+    if ( allowUploads && !QFileInfo(tftpFileDir.absolutePath()).isWritable() )
+    {
+        throw TftpError("File directory for tftp server "s + filesDir.toStdString() + " is not writable, uploads are not possible");
+    }
 
-    auto newSocket = std::make_shared<ConnectionRequestSocket>(filesDir, m_socketFactory);
-    connect(newSocket.get(), &ConnectionRequestSocket::readyRead, this, &TftpServer::dataReceived);
-    if ( ! newSocket->bind(hostAddr, port) )
+    std::shared_ptr<ConnectionRequestSocket> newSocket;
+    if (m_wildcardBinding)
+    {
+        newSocket = bindWildcard(filesDir, hostAddr, port, allowUploads);
+    }
+    else
     {
-        std::string errorMsg( "Could not bind tftp server to host address ");
-        errorMsg += hostAddr.toString().toStdString();
-        errorMsg += " at port ";
-        errorMsg += std::to_string(port);
-        errorMsg += ". "s + newSocket->errorString().toStdString();
-        throw TftpError(errorMsg);
+        newSocket = std::make_shared<ConnectionRequestSocket>(filesDir, m_socketFactory, allowUploads);
+        connect(newSocket.get(), &ConnectionRequestSocket::readyRead, this, &TftpServer::dataReceived);
+        if ( ! newSocket->bind(hostAddr, port) )
+        {
+            std::string errorMsg( "Could not bind tftp server to host address ");
+            errorMsg += hostAddr.toString().toStdString();
+            errorMsg += " at port ";
+            errorMsg += std::to_string(port);
+            errorMsg += ". "s + newSocket->errorString().toStdString();
+            throw TftpError(errorMsg);
+        }
     }
+    newSocket->setMetrics(m_metrics.addBinding(hostAddr, newSocket->localPort()));
+
+    newSocket->setDirectoryProvider(DirectoryProvider::create(filesDir));
     m_mainSockets.push_back(newSocket);
 }
 
 
+/**
+ * @brief TftpServer::enableWildcardBinding let bindings with the same port share one socket bound to the wildcard address
+ *
+ * Must be called before bind(). Instead of binding a socket to the address of each binding, the bindings for a port
+ * share one socket that is bound to the wildcard address. Each request is dispatched to the binding for the address it
+ * was sent to, and the reply is sent from that address. Requests sent to an address without a binding are dropped,
+ * unless there is a binding for the wildcard address itself. This saves sockets on hosts with many addresses.
+ */
+void TftpServer::enableWildcardBinding()
+{
+    m_wildcardBinding = true;
+}
+
+
 /**
  * @brief TftpServer::close stop listening for new tftp requests
  */
@@ -172,9 +519,9 @@ void TftpServer::close()
  * @brief TftpServer::setSlowNetworkDetectionThreshold set the threshold for what is considered a slow network
  * @param ackLatencyUs threshold in microsec for latency between sending data packet and receiving corresponding ack
  *
- * The TftpServer will for each session keep a running average of the time between sending a data package and receipt of
- * the corresponding ack datagram. If this average time exceeds \p ackLatencyUs the slowNetwork signal will be emitted
- * for that session. The signal will be emitted only once for each session.
+ * The TftpServer will for each session keep a histogram of the time between sending a data package and receipt of
+ * the corresponding ack datagram. If the average of this histogram exceeds \p ackLatencyUs (evaluated every 5 blocks)
+ * the slowNetwork signal will be emitted for that session. The signal will be emitted only once for each session.
  */
 void TftpServer::setSlowNetworkDetectionThreshold(unsigned int ackLatencyUs)
 {
@@ -182,195 +529,915 @@ void TftpServer::setSlowNetworkDetectionThreshold(unsigned int ackLatencyUs)
 }
 
 
-std::vector<std::pair<QHostAddress, uint16_t>> TftpServer::bindings() const
+/**
+ * @brief TftpServer::addBlockSourceProvider let a provider serve files for read requests received on a binding
+ * @param provider the provider to add
+ * @param hostAddr address of the binding, as passed to bind()
+ * @param port port of the binding, as returned by bindings()
+ * @throw TftpError if there is no binding for \p hostAddr and \p port
+ *
+ * The providers of a binding are asked for a requested file in the order they were added. Files that none of them
+ * has are looked up in the files directory of the binding.
+ */
+void TftpServer::addBlockSourceProvider(std::shared_ptr<BlockSourceProvider> provider, const QHostAddress &hostAddr, uint16_t port)
 {
-    std::vector<std::pair<QHostAddress, uint16_t>> currentBindings;
-    for (const auto &nextSocket : m_mainSockets)
-    {
-        currentBindings.emplace_back(std::make_pair(nextSocket->localAddress(), nextSocket->localPort()));
-    }
-    return currentBindings;
+    findBinding(hostAddr, port)->addBlockSourceProvider(provider);
 }
 
 
-std::shared_ptr<const ReadSession> TftpServer::findReadSession(const SessionIdent &sessionIdent) const
+/**
+ * @brief TftpServer::setFileNameRewriter rewrite the file names of read and write requests received on a binding
+ * @param fileNameRewriter the rules to apply, nullptr to stop rewriting
+ * @param hostAddr address of the binding, as passed to bind()
+ * @param port port of the binding, as returned by bindings()
+ * @throw TftpError if there is no binding for \p hostAddr and \p port
+ *
+ * The rewritten name is used to look up the file, and is the name reported by the sessions.
+ */
+void TftpServer::setFileNameRewriter(std::shared_ptr<FileNameRewriter> fileNameRewriter, const QHostAddress &hostAddr, uint16_t port)
 {
-    auto readSesPtr = doFindReadSession(sessionIdent);
-    return readSesPtr;
+    findBinding(hostAddr, port)->setFileNameRewriter(fileNameRewriter);
 }
 
 
-void TftpServer::handleNewData(std::shared_ptr<ConnectionRequestSocket> mainSocket)
+/**
+ * @brief TftpServer::setSubnetRoutes serve read requests received on a binding from a files directory per client subnet
+ * @param subnetRoutes the routes to use, nullptr to serve all clients from the files directory of the binding
+ * @param hostAddr address of the binding, as passed to bind()
+ * @param port port of the binding, as returned by bindings()
+ * @throw TftpError if there is no binding for \p hostAddr and \p port
+ *
+ * Clients that are not in any of the subnets read from the files directory of the binding. Write requests always
+ * store files in the files directory of the binding.
+ */
+void TftpServer::setSubnetRoutes(std::shared_ptr<SubnetRoutes> subnetRoutes, const QHostAddress &hostAddr, uint16_t port)
 {
-    QByteArray dgram;
-    int dgramSize = static_cast<int>(mainSocket->pendingDatagramSize());
-    dgram.resize( dgramSize );
-    QHostAddress peerAddress;
-    quint16 peerPort;
+    findBinding(hostAddr, port)->setSubnetRoutes(subnetRoutes);
+}
 
-    while (mainSocket->hasPendingDatagrams())
-    {
-        if (mainSocket->readDatagram( dgram.data(), dgramSize, &peerAddress, &peerPort ) == -1)
-        {
-            auto lastErrStr = mainSocket->errorString().toStdString();
-            throw TftpError("Error while reading data from tftp socket (port "s + std::to_string(mainSocket->localPort()) + ")" + lastErrStr);
-        }
 
-        auto opcode = ntohs( readWordInByteArray(dgram, 0) );
-        switch( opcode )
-        {
-            case TftpCode::TFTP_RRQ:
-                {
-                    std::shared_ptr<ReadSession> readSession = doFindReadSession(SessionIdent(peerAddress, peerPort));
-                    if ( readSession )
-                    {
-                        // YMP-70: ignore duplicate RRQ until we have time to find out why client sends them
-                        /*
-                        QByteArray errorDgram = assembleTftpErrorDatagram(TftpCode::IllegalOp, "Duplicate read request from same peer");
-                        if (m_mainSocket->writeDatagram(errorDgram, peerAddress, peerPort) == -1)
-                        {
-                            throw TftpError("Error while sending error datagram to client "s + peerAddress.toString().toStdString() + ":" + std::to_string(peerPort));
-                        }
-                        */
-                        return;
-                    }
+/**
+ * @brief TftpServer::setSessionLimits limit the nr of transfers in progress of all bindings together
+ * @param maxSessions maximum nr of read and write sessions in progress, 0 for no limit
+ * @param maxQueuedRequests maximum nr of read requests that wait for a free session slot
+ * @param maxQueueWaitMs time after which a waiting read request is dropped, by then the client has retried or given up
+ *
+ * A read request that arrives while the server or its binding (see setMaxSessions()) has the maximum nr of sessions
+ * in progress is queued, and started when a session ends. A read request that finds the queue full, and a write request
+ * that finds no free session slot, is answered with a "server busy" error right away, so the client can try another
+ * server instead of waiting for a time-out. Queued requests are started in the order they arrived.
+ */
+void TftpServer::setSessionLimits(unsigned int maxSessions, unsigned int maxQueuedRequests, unsigned int maxQueueWaitMs)
+{
+    m_maxSessions = maxSessions;
+    m_maxQueuedRequests = maxQueuedRequests;
+    m_maxQueueWaitMs = maxQueueWaitMs;
+}
 
-                    readSession = std::make_shared<ReadSession>(peerAddress, peerPort, dgram, mainSocket->filesDir(), m_slowNetworkThreshold, m_socketFactory);
-                    connect(readSession.get(), &Session::finished, this, &TftpServer::removeSession);
-                    connect(readSession.get(), &Session::error, this, &TftpServer::removeSession);
-                    m_readSessions.push_back( readSession );
-                    emit newReadSession(readSession);
-                }
-                break;
-            /*case ACK: {
-                    ReadSession *rs = findRSession(ti);
-                    if ( !rs )
-                    {
-                        sendError(ti, IllegalOp, "ACK packet without a RRQ");
-                        return;
-                    }
 
-                    if ( rs->parseAck(dgram) )
-                    {
-                        emit sentFile(rs->currentFile(), rs->currentFilename());
-                        std::vector<ReadSession*>::iterator newEnd = std::remove(reads.begin(), reads.end(), rs);
-                        reads.erase(newEnd, reads.end());
-                        //reads.remove(rs);
-                        delete rs;
-                    }
-                } break;
-            case WRQ: {
-                    WriteSession *ws = findWSession(ti);
-                    if ( ws )
-                    {
-                        qWarning("Duplicate write request from same peer");
-                        sendError(ti, IllegalOp, "Duplicate write request from same peer");
-                        return;
-                    }
+/**
+ * @brief TftpServer::setMaxSessions limit the nr of transfers in progress of one binding
+ * @param maxSessions maximum nr of read and write sessions in progress, 0 for no limit
+ * @param hostAddr address of the binding, as passed to bind()
+ * @param port port of the binding, as returned by bindings()
+ * @throw TftpError if there is no binding for \p hostAddr and \p port
+ *
+ * Read requests beyond the limit are queued as described at setSessionLimits().
+ */
+void TftpServer::setMaxSessions(unsigned int maxSessions, const QHostAddress &hostAddr, uint16_t port)
+{
+    findBinding(hostAddr, port)->setMaxSessions(maxSessions);
+}
 
-                    writes.push_back( new WriteSession(ti, dgram) );
-                } break;
-            case DATA: {
-                    WriteSession *ws = findWSession(ti);
-                    if ( !ws )
-                    {
-                        qWarning("DATA packet without a WRQ");
-                        sendError(ti, IllegalOp, "DATA packet without a WRQ");
-                        return;
-                    }
 
-                    if ( ws->parseData(dgram) )
-                    {
-                        emit receivedFile(ws->currentFile(), ws->currentFilename());
-                        std::vector<WriteSession*>::iterator newEnd = std::remove(writes.begin(), writes.end(), ws);
-                        writes.erase(newEnd, writes.end());
-                        //writes.remove(ws);
-                        delete ws;
-                    }
-                } break;
-            case ERROR:
-            {
-                    Session *s;
-                    if ( (s = findWSession(ti) ) )
-                    {
-                        std::vector<WriteSession*>::iterator newEnd = std::remove(writes.begin(), writes.end(), static_cast<WriteSession*>(s));
-                        writes.erase(newEnd, writes.end());
-                        //writes.remove(reinterpret_cast<WriteSession*>(s));
-                    }
-                    else if ( (s = findRSession(ti) ) )
-                    {
-                        std::vector<ReadSession*>::iterator newEnd = std::remove(reads.begin(), reads.end(), static_cast<ReadSession*>(s));
-                        reads.erase(newEnd, reads.end());
-                        //reads.remove(reinterpret_cast<ReadSession*>(s));
-                    }
-                    else
-                    {
-                        qWarning("Error received without a session opened for the peer");
-                    }
+/**
+ * @brief TftpServer::setMaxRequestsPerSecond limit the nr of read and write requests per second from one client address
+ * @param maxRequests the limit, 0 (default) for no limit
+ *
+ * A client that loops on requests, or a flood of requests with spoofed addresses, would otherwise create a session,
+ * a socket and an open file for each request. Requests beyond the limit are dropped without a reply, so a flood with
+ * spoofed addresses can't use the server to send errors to the owners of those addresses. Repeated requests of a
+ * client that already has a session or a queued request don't count.
+ */
+void TftpServer::setMaxRequestsPerSecond(unsigned int maxRequests)
+{
+    m_requestRateLimiter.setMaxRequestsPerSecond(maxRequests);
+}
 
-                    if ( s )
-                    {
-                        qWarning(
-                            "Error packet received, peer session aborted\n%s [%d]",
-                            dgram.data() + 4,
-                            ntohs(wordOfArray(dgram)[1])
-                            );
-                    }
-            }
-                break;
-            */
-            default:
-                QByteArray errorDgram = assembleTftpErrorDatagram(TftpCode::IllegalOp, "Illegal TFTP opcode");
-                if (mainSocket->writeDatagram(errorDgram, peerAddress, peerPort) == -1)
-                {
-                    throw TftpError("Error while sending error datagram to client "s + peerAddress.toString().toStdString() + ":" + std::to_string(peerPort));
-                }
-                return;
-        }
-    } //while
+
+/**
+ * @brief TftpServer::setGlobalPacingRate limit the rate at which DATA datagrams of all sessions together are sent
+ * @param bytesPerSecond rate limit, 0 for no limit
+ * @param burstBytes nr of bytes that may be sent at once, 0 for Pacer::DefaultBurstMs worth of the rate
+ *
+ * Datagrams that exceed a rate limit are delayed instead of sent in a burst that cheap device NICs and switch buffers
+ * can't absorb. The rate limits of the server, the binding, the client subnet and the session all apply to a datagram.
+ */
+void TftpServer::setGlobalPacingRate(uint64_t bytesPerSecond, uint64_t burstBytes)
+{
+    m_pacer->setGlobalRate(bytesPerSecond, burstBytes);
 }
 
 
 /**
- * @brief TftpServer::dataReceived
- * @throw TftpError if an error occurs while reading data from tftp server socket or while sending respons to sender
- * Slot that handles data coming in at the tftp server's main socket
+ * @brief TftpServer::setSubnetPacingRate limit the rate at which DATA datagrams are sent to each client subnet
+ * @param ipv4PrefixLength size of the subnets of IPv4 clients
+ * @param ipv6PrefixLength size of the subnets of IPv6 clients
  */
-void TftpServer::dataReceived()
+void TftpServer::setSubnetPacingRate(uint64_t bytesPerSecond, uint64_t burstBytes, int ipv4PrefixLength, int ipv6PrefixLength)
 {
-    for (auto &nextMainSocket : m_mainSockets)
-    {
-        handleNewData(nextMainSocket);
-    }
+    m_pacer->setSubnetRate(bytesPerSecond, burstBytes, ipv4PrefixLength, ipv6PrefixLength);
 }
 
 
 /**
- * @brief TftpServer::removeSession remove the read or write session that emitted the signal connected to this slot
+ * @brief TftpServer::setSessionPacingRate limit the rate at which each session sends DATA datagrams, applies to new sessions
  */
-void TftpServer::removeSession()
+void TftpServer::setSessionPacingRate(uint64_t bytesPerSecond, uint64_t burstBytes)
 {
-    QObject *finishedSession = sender(); //get the session that emitted the error() or finished() signal
-    if (!finishedSession)
-    {
-        return;
-    }
+    m_pacer->setSessionRate(bytesPerSecond, burstBytes);
+}
 
-    auto session = static_cast<Session*>(finishedSession);
-    auto &peerIdent = session->peerIdent();
 
-    //check if the session that ended is a read session
-    auto readSessionIter = std::find_if(m_readSessions.begin(), m_readSessions.end(), [&peerIdent](auto &nextSession) { return (*nextSession)==peerIdent; } );
-    if (readSessionIter != m_readSessions.end())
+/**
+ * @brief TftpServer::setPacingRate limit the rate at which DATA datagrams of all sessions of one binding together are sent
+ * @throw TftpError if there is no binding for \p hostAddr and \p port
+ */
+void TftpServer::setPacingRate(uint64_t bytesPerSecond, uint64_t burstBytes, const QHostAddress &hostAddr, uint16_t port)
+{
+    m_pacer->setBindingRate(findBinding(hostAddr, port)->metrics().get(), bytesPerSecond, burstBytes);
+}
+
+
+/**
+ * @brief TftpServer::setPriorityTransferSize send the DATA datagrams of downloads of at most \p maxTransferSize bytes first
+ * @param maxTransferSize size of the largest file that has priority, 0 (default) for no priority transfers
+ *
+ * When there are more DATA datagrams to send than fit in one pass of the event loop, the datagrams of small
+ * downloads, like first-stage boot files, go before those of large downloads. Applies to new sessions.
+ */
+void TftpServer::setPriorityTransferSize(int64_t maxTransferSize)
+{
+    m_scheduler->setPriorityTransferSize(maxTransferSize);
+}
+
+
+/**
+ * @brief TftpServer::setSchedulingWeight give the downloads of one binding \p weight times the share of other downloads
+ * @param weight at least 1, the default of every binding
+ * @throw TftpError if there is no binding for \p hostAddr and \p port
+ *
+ * The share is the part of the sending capacity of the server that a download gets while other downloads wait to send.
+ */
+void TftpServer::setSchedulingWeight(unsigned int weight, const QHostAddress &hostAddr, uint16_t port)
+{
+    m_scheduler->setBindingWeight(findBinding(hostAddr, port)->metrics().get(), weight);
+}
+
+
+/**
+ * @brief TftpServer::setSocketBufferSizes set the kernel buffer sizes of the sockets of a binding
+ * @param receiveBytes SO_RCVBUF of the listening socket and of the sockets of new sessions, 0 for the kernel default
+ * @param sendBytes SO_SNDBUF of the listening socket and of the sockets of new sessions, 0 for the kernel default
+ * @throw TftpError if there is no binding for \p hostAddr and \p port
+ *
+ * Larger buffers absorb bursts of requests, ACKs and uploaded DATA without drops. The kernel limits the sizes
+ * (net.core.rmem_max and net.core.wmem_max on Linux), the sizes actually used are exported as metrics.
+ */
+void TftpServer::setSocketBufferSizes(int receiveBytes, int sendBytes, const QHostAddress &hostAddr, uint16_t port)
+{
+    findBinding(hostAddr, port)->setSocketBufferSizes(receiveBytes, sendBytes);
+}
+
+
+/**
+ * @brief TftpServer::setSocketBufferAutoTuning raise the buffer sizes of a binding when the kernel drops datagrams
+ * @throw TftpError if there is no binding for \p hostAddr and \p port
+ *
+ * Every SocketStatsIntervalMs the drop counters of the sockets of the binding are read. If datagrams were dropped the
+ * receive buffer size is doubled, if sends were blocked by a full send buffer the send buffer size is doubled, see
+ * ConnectionRequestSocket::tuneSocketBuffers(). The new sizes apply to the listening socket and all session sockets.
+ */
+void TftpServer::setSocketBufferAutoTuning(bool enabled, const QHostAddress &hostAddr, uint16_t port)
+{
+    findBinding(hostAddr, port)->setSocketBufferAutoTuning(enabled);
+}
+
+
+/**
+ * @brief TftpServer::setKernelTimestamping measure ACK delays with the time the kernel received the ACKs
+ *
+ * When the event loop is busy, ACKs wait in the receive queue of the session sockets before they are read, so ACK
+ * delays measured when the ACK is read mostly show the load of the server. With kernel timestamps the ACK delays,
+ * slow network detection and congestion control only see the network round trip, and the time datagrams waited
+ * is exported separately (qtftp_receive_queue_delay_seconds). Applies to sessions started after the call, see
+ * Session::setKernelTimestamping().
+ */
+void TftpServer::setKernelTimestamping(bool enabled)
+{
+    m_kernelTimestamping = enabled;
+}
+
+
+/**
+ * @brief TftpServer::enableMulticast serve read requests with the multicast option (RFC2090)
+ * @param firstGroupAddress first IPv4 multicast group address that may be used for transfers
+ * @param groupPort UDP port to which DATA datagrams are sent
+ * @param nrOfGroups nr of consecutive group addresses, starting at \p firstGroupAddress, that may be used at the same time
+ * @throw TftpError if \p firstGroupAddress is not an IPv4 multicast address
+ *
+ * Concurrent read requests with the multicast option for the same file share one transfer. Each transfer
+ * that is in progress occupies one group address. When all addresses are in use, new requests are served
+ * by unicast sessions.
+ */
+void TftpServer::enableMulticast(const QHostAddress &firstGroupAddress, uint16_t groupPort, unsigned int nrOfGroups)
+{
+    if (firstGroupAddress.protocol() != QAbstractSocket::IPv4Protocol || !firstGroupAddress.isMulticast())
+    {
+        throw TftpError("Multicast group address "s + firstGroupAddress.toString().toStdString() + " is not an IPv4 multicast address");
+    }
+
+    m_multicastFirstGroup = firstGroupAddress;
+    m_multicastGroupPort = groupPort;
+    m_multicastGroupCount = nrOfGroups;
+}
+
+
+/**
+ * @brief TftpServer::metrics get the counters and histograms of all bindings of this server
+ */
+const ServerMetrics &TftpServer::metrics() const
+{
+    return m_metrics;
+}
+
+
+/**
+ * @brief TftpServer::setAckLatencySubnetPrefixLengths set the size of the client subnets for which ACK latency is aggregated
+ * @param ipv4PrefixLength prefix length used for IPv4 clients (default 24)
+ * @param ipv6PrefixLength prefix length used for IPv6 clients (default 64)
+ *
+ * The ACK latency of each session is merged into the statistics of its binding, of the server and of the
+ * subnet of its client when the session ends. See ServerMetrics::ackDelaysBySubnet().
+ */
+void TftpServer::setAckLatencySubnetPrefixLengths(int ipv4PrefixLength, int ipv6PrefixLength)
+{
+    m_metrics.setLatencySubnetPrefixLengths(ipv4PrefixLength, ipv6PrefixLength);
+}
+
+
+/**
+ * @brief TftpServer::resetAckLatencyStatistics discard the ACK latency statistics of all bindings and client subnets
+ */
+void TftpServer::resetAckLatencyStatistics()
+{
+    m_metrics.resetAckDelays();
+}
+
+
+/**
+ * @brief TftpServer::eventLoopLagMonitor get the probe that measures the lag of the event loop this server runs in
+ *
+ * The monitor is not started by default. Once started, the measured lag is available in the metrics of this server.
+ */
+EventLoopLagMonitor &TftpServer::eventLoopLagMonitor()
+{
+    return m_eventLoopLagMonitor;
+}
+
+
+/**
+ * @brief TftpServer::transferGroups get the groups that let concurrent sessions for the same file share file reads
+ */
+const TransferGroupRegistry &TftpServer::transferGroups() const
+{
+    return *m_transferGroups;
+}
+
+
+std::vector<std::pair<QHostAddress, uint16_t>> TftpServer::bindings() const
+{
+    std::vector<std::pair<QHostAddress, uint16_t>> currentBindings;
+    for (const auto &nextSocket : m_mainSockets)
+    {
+        currentBindings.emplace_back(std::make_pair(nextSocket->localAddress(), nextSocket->localPort()));
+    }
+    return currentBindings;
+}
+
+
+std::shared_ptr<const ReadSession> TftpServer::findReadSession(const SessionIdent &sessionIdent) const
+{
+    auto readSesPtr = doFindReadSession(sessionIdent);
+    return readSesPtr;
+}
+
+
+std::shared_ptr<const WriteSession> TftpServer::findWriteSession(const SessionIdent &sessionIdent) const
+{
+    return doFindWriteSession(sessionIdent);
+}
+
+
+void TftpServer::handleNewData(ConnectionRequestSocket &mainSocket)
+{
+    QByteArray dgram;
+    QHostAddress peerAddress;
+    quint16 peerPort;
+
+    for (unsigned int dgramCount=0; mainSocket.hasPendingDatagrams(); ++dgramCount)
+    {
+        if (dgramCount == MaxDatagramsPerTurn)
+        {
+            //let the other bindings and the sessions have their turn first
+            QTimer::singleShot(0, &mainSocket, [this, &mainSocket]() { handleNewData(mainSocket); });
+            return;
+        }
+        dgram.resize( static_cast<int>(std::max<qint64>(mainSocket.pendingDatagramSize(), 0)) );
+        qint64 dgramSize = mainSocket.readDatagram( dgram.data(), dgram.size(), &peerAddress, &peerPort );
+        if (dgramSize == -1)
+        {
+            auto lastErrStr = mainSocket.errorString().toStdString();
+            throw TftpError("Error while reading data from tftp socket (port "s + std::to_string(mainSocket.localPort()) + ")" + lastErrStr);
+        }
+        dgram.resize( static_cast<int>(dgramSize) );
+        handleRequest(mainSocket, dgram, peerAddress, peerPort);
+    }
+}
+
+
+/**
+ * @brief TftpServer::bindWildcard add a binding to the wildcard socket for a port, bind that socket if it does not exist yet
+ * @throw TftpError if the wildcard socket could not be bound or there already is a binding for \p hostAddr and \p port
+ */
+std::shared_ptr<ConnectionRequestSocket> TftpServer::bindWildcard(const QString &filesDir, const QHostAddress &hostAddr, uint16_t port, bool allowUploads)
+{
+    auto listenerIter = std::find_if(m_wildcardListeners.begin(), m_wildcardListeners.end(), [port](auto &nextListener)
+                                     { return port != 0 && nextListener->m_port == port; });
+    std::shared_ptr<WildcardListener> listener;
+    if (listenerIter != m_wildcardListeners.end())
+    {
+        listener = *listenerIter;
+    }
+    else
+    {
+        listener = std::make_shared<WildcardListener>();
+        listener->m_port = port;
+        listener->m_socket = m_socketFactory->createNewSocket();
+        if ( ! listener->m_socket->bind(QHostAddress::Any, port) )
+        {
+            throw TftpError("Could not bind tftp server to the wildcard address at port "s + std::to_string(port) + ". " + listener->m_socket->errorString().toStdString());
+        }
+        WildcardListener *listenerPtr = listener.get();
+        connect(listener->m_socket.get(), &AbstractSocket::readyRead, this, [this, listenerPtr]() { wildcardDataReceived(*listenerPtr); });
+        m_wildcardListeners.push_back(listener);
+    }
+
+    bool forWildcardAddress = isWildcardAddress(hostAddr);
+    QHostAddress key = bindingKey(hostAddr);
+    if ( forWildcardAddress ? (listener->m_anyBinding != nullptr) : listener->m_bindings.contains(key) )
+    {
+        throw TftpError("There already is a tftp server binding at host address "s + hostAddr.toString().toStdString() + " port " + std::to_string(port));
+    }
+    auto newSocket = std::make_shared<ConnectionRequestSocket>(filesDir, listener->m_socket, hostAddr, allowUploads);
+    if (forWildcardAddress)
+    {
+        listener->m_anyBinding = newSocket;
+    }
+    else
     {
+        listener->m_bindings.insert(key, newSocket);
+    }
+    return newSocket;
+}
+
+
+/**
+ * @brief TftpServer::wildcardDataReceived read the requests from a wildcard socket and dispatch them by destination address
+ * @throw TftpError if an error occurs while reading data from the socket or while sending a response
+ */
+void TftpServer::wildcardDataReceived(WildcardListener &listener)
+{
+    QByteArray dgram;
+    QHostAddress peerAddress;
+    quint16 peerPort = 0;
+    QHostAddress destinationAddress;
+
+    for (unsigned int dgramCount=0; listener.m_socket->hasPendingDatagrams(); ++dgramCount)
+    {
+        if (dgramCount == MaxDatagramsPerTurn)
+        {
+            QTimer::singleShot(0, listener.m_socket.get(), [this, &listener]() { wildcardDataReceived(listener); });
+            return;
+        }
+        if ( ! listener.m_socket->receiveDatagram(dgram, peerAddress, peerPort, destinationAddress) )
+        {
+            auto lastErrStr = listener.m_socket->errorString().toStdString();
+            throw TftpError("Error while reading data from tftp socket (port "s + std::to_string(listener.m_socket->localPort()) + ")" + lastErrStr);
+        }
+        auto bindingIter = listener.m_bindings.constFind(bindingKey(destinationAddress));
+        auto binding = (bindingIter != listener.m_bindings.constEnd()) ? bindingIter.value() : listener.m_anyBinding;
+        if (binding)
+        {
+            handleRequest(*binding, dgram, peerAddress, peerPort);
+        }
+    }
+}
+
+
+/**
+ * @brief TftpServer::handleRequest handle a datagram received by the main socket of a binding
+ * @throw TftpError if an error occurs while sending a response to the peer
+ */
+void TftpServer::handleRequest(ConnectionRequestSocket &mainSocket, const QByteArray &dgram, const QHostAddress &peerAddress, quint16 peerPort)
+{
+    if (dgram.size() < 2)
+    {
+        return;
+    }
+    auto opcode = ntohs( readWordInByteArray(dgram, 0) );
+    QTFTP_PROBE3(main_datagram, opcode, dgram.size(), peerPort);
+    switch( opcode )
+    {
+        case TftpCode::TFTP_RRQ:
+            {
+                mainSocket.metrics()->m_readRequests.add();
+                std::shared_ptr<ReadSession> readSession = doFindReadSession(SessionIdent(peerAddress, peerPort));
+                if ( readSession )
+                {
+                    // YMP-70: ignore duplicate RRQ until we have time to find out why client sends them
+                    /*
+                    QByteArray errorDgram = assembleTftpErrorDatagram(TftpCode::IllegalOp, "Duplicate read request from same peer");
+                    if (m_mainSocket.writeDatagram(errorDgram, peerAddress, peerPort) == -1)
+                    {
+                        throw TftpError("Error while sending error datagram to client "s + peerAddress.toString().toStdString() + ":" + std::to_string(peerPort));
+                    }
+                    */
+                    return;
+                }
+
+                if ( isQueued(peerAddress, peerPort) )
+                {
+                    //the client repeated a request that is waiting for a free session slot
+                    return;
+                }
+                if ( exceedsRequestRate(peerAddress) )
+                {
+                    break;
+                }
+                if ( ! hasFreeSessionSlot(mainSocket) )
+                {
+                    dropExpiredRequests();
+                    if (m_pendingRequests.size() < m_maxQueuedRequests)
+                    {
+                        m_pendingRequests.push_back(PendingRequest{ &mainSocket, dgram, peerAddress, peerPort, std::chrono::steady_clock::now() });
+                        m_metrics.admission().m_queuedRequests.add();
+                        break;
+                    }
+                    rejectRequest(mainSocket, peerAddress, peerPort);
+                    break;
+                }
+                startReadSession(mainSocket, dgram, peerAddress, peerPort);
+            }
+            break;
+        case TftpCode::TFTP_WRQ:
+            {
+                mainSocket.metrics()->m_writeRequests.add();
+                if ( doFindWriteSession(SessionIdent(peerAddress, peerPort)) )
+                {
+                    //duplicate WRQ, the session already answered the first one
+                    break;
+                }
+                if ( exceedsRequestRate(peerAddress) )
+                {
+                    break;
+                }
+                if ( ! mainSocket.allowUploads() )
+                {
+                    sendErrorReply(mainSocket, TftpCode::AccessViolation, "Uploads not allowed", peerAddress, peerPort);
+                    break;
+                }
+                if ( ! hasFreeSessionSlot(mainSocket) )
+                {
+                    //uploads are not queued, the client may retry later
+                    rejectRequest(mainSocket, peerAddress, peerPort);
+                    break;
+                }
+
+                if (!m_writer)
+                {
+                    m_writer = std::make_shared<WriteBehindWriter>();
+                }
+                auto writeSession = std::make_shared<WriteSession>(peerAddress, peerPort, mainSocket.rewriteRequest(dgram), mainSocket.filesDir(), m_writer, m_socketFactory,
+                                                                   mainSocket.metrics(), mainSocket.localAddress());
+                writeSession->setSocketBufferSizes(mainSocket.receiveBufferSize(), mainSocket.sendBufferSize());
+                writeSession->setKernelTimestamping(m_kernelTimestamping);
+                connect(writeSession.get(), &Session::finished, this, &TftpServer::removeSession);
+                connect(writeSession.get(), &Session::error, this, &TftpServer::removeSession);
+                QTFTP_PROBE2(session_created, writeSession->sessionId(), peerPort);
+                m_writeSessions.push_back( writeSession );
+                emit newWriteSession(writeSession);
+            }
+            break;
+        /*case ACK: {
+                ReadSession *rs = findRSession(ti);
+                if ( !rs )
+                {
+                    sendError(ti, IllegalOp, "ACK packet without a RRQ");
+                    return;
+                }
+
+                if ( rs->parseAck(dgram) )
+                {
+                    emit sentFile(rs->currentFile(), rs->currentFilename());
+                    std::vector<ReadSession*>::iterator newEnd = std::remove(reads.begin(), reads.end(), rs);
+                    reads.erase(newEnd, reads.end());
+                    //reads.remove(rs);
+                    delete rs;
+                }
+            } break;
+        case WRQ: {
+                WriteSession *ws = findWSession(ti);
+                if ( ws )
+                {
+                    qWarning("Duplicate write request from same peer");
+                    sendError(ti, IllegalOp, "Duplicate write request from same peer");
+                    return;
+                }
+
+                writes.push_back( new WriteSession(ti, dgram) );
+            } break;
+        case DATA: {
+                WriteSession *ws = findWSession(ti);
+                if ( !ws )
+                {
+                    qWarning("DATA packet without a WRQ");
+                    sendError(ti, IllegalOp, "DATA packet without a WRQ");
+                    return;
+                }
+
+                if ( ws->parseData(dgram) )
+                {
+                    emit receivedFile(ws->currentFile(), ws->currentFilename());
+                    std::vector<WriteSession*>::iterator newEnd = std::remove(writes.begin(), writes.end(), ws);
+                    writes.erase(newEnd, writes.end());
+                    //writes.remove(ws);
+                    delete ws;
+                }
+            } break;
+        case ERROR:
+        {
+                Session *s;
+                if ( (s = findWSession(ti) ) )
+                {
+                    std::vector<WriteSession*>::iterator newEnd = std::remove(writes.begin(), writes.end(), static_cast<WriteSession*>(s));
+                    writes.erase(newEnd, writes.end());
+                    //writes.remove(reinterpret_cast<WriteSession*>(s));
+                }
+                else if ( (s = findRSession(ti) ) )
+                {
+                    std::vector<ReadSession*>::iterator newEnd = std::remove(reads.begin(), reads.end(), static_cast<ReadSession*>(s));
+                    reads.erase(newEnd, reads.end());
+                    //reads.remove(reinterpret_cast<ReadSession*>(s));
+                }
+                else
+                {
+                    qWarning("Error received without a session opened for the peer");
+                }
+
+                if ( s )
+                {
+                    qWarning(
+                        "Error packet received, peer session aborted\n%s [%d]",
+                        dgram.data() + 4,
+                        ntohs(wordOfArray(dgram)[1])
+                        );
+                }
+        }
+            break;
+        */
+        default:
+            sendErrorReply(mainSocket, TftpCode::IllegalOp, "Illegal TFTP opcode", peerAddress, peerPort);
+            return;
+    }
+}
+
+
+/**
+ * @brief TftpServer::hasFreeSessionSlot check that neither the server nor \p mainSocket has its maximum nr of sessions
+ */
+bool TftpServer::hasFreeSessionSlot(const ConnectionRequestSocket &mainSocket) const
+{
+    if (m_maxSessions > 0 && m_metrics.activeSessions() >= static_cast<int64_t>(m_maxSessions))
+    {
+        return false;
+    }
+    return mainSocket.maxSessions() == 0 || mainSocket.metrics()->m_activeSessions.value() < static_cast<int64_t>(mainSocket.maxSessions());
+}
+
+
+bool TftpServer::isQueued(const QHostAddress &peerAddress, quint16 peerPort) const
+{
+    return std::any_of(m_pendingRequests.begin(), m_pendingRequests.end(), [&peerAddress, peerPort](const PendingRequest &pending)
+                                                                          { return pending.m_peerPort == peerPort && pending.m_peerAddress == peerAddress; });
+}
+
+
+/**
+ * @brief TftpServer::rejectRequest answer a request that can't be served now with a "server busy" error
+ * @throw TftpError if the error datagram can't be sent
+ */
+void TftpServer::rejectRequest(ConnectionRequestSocket &mainSocket, const QHostAddress &peerAddress, quint16 peerPort)
+{
+    sendErrorReply(mainSocket, TftpCode::Undefined, "Server busy, try again later", peerAddress, peerPort);
+    m_metrics.admission().m_requestsRejected.add();
+}
+
+
+/**
+ * @brief TftpServer::sendErrorReply answer a request on \p mainSocket with a TFTP error datagram
+ * @return false if the datagram was dropped because the send buffer of the socket is full
+ * @throw TftpError if the datagram can't be sent for another reason
+ *
+ * A request is answered with at most one error datagram and the client repeats its request when it gets no answer, so
+ * the datagram is not queued when the send buffer is full.
+ */
+bool TftpServer::sendErrorReply(ConnectionRequestSocket &mainSocket, TftpCode::ErrorCode errorCode, const QString &errorMsg,
+                                const QHostAddress &peerAddress, quint16 peerPort)
+{
+    QByteArray errorDgram = assembleTftpErrorDatagram(errorCode, errorMsg);
+    if (mainSocket.writeDatagram(errorDgram, peerAddress, peerPort) == -1)
+    {
+        if (mainSocket.isSendErrorTransient())
+        {
+            mainSocket.metrics()->m_sendsBlocked.add();
+            return false;
+        }
+        throw TftpError("Error while sending error datagram to client "s + peerAddress.toString().toStdString() + ":" + std::to_string(peerPort));
+    }
+    mainSocket.metrics()->m_errorsSent[errorCode].add();
+    return true;
+}
+
+
+/**
+ * @brief TftpServer::exceedsRequestRate count a request of \p peerAddress and check whether it exceeds the request rate limit
+ * @return true if the request must be dropped
+ */
+bool TftpServer::exceedsRequestRate(const QHostAddress &peerAddress)
+{
+    if (m_requestRateLimiter.allow(peerAddress))
+    {
+        return false;
+    }
+    m_metrics.admission().m_requestsRateLimited.add();
+    return true;
+}
+
+
+/**
+ * @brief TftpServer::dropExpiredRequests remove queued requests that waited longer than the maximum queue wait time
+ *
+ * Expired requests are dropped silently: the client has retransmitted its request or timed out by now.
+ */
+void TftpServer::dropExpiredRequests()
+{
+    auto now = std::chrono::steady_clock::now();
+    while ( ! m_pendingRequests.empty() &&
+            now - m_pendingRequests.front().m_queuedAt > std::chrono::milliseconds(m_maxQueueWaitMs) )
+    {
+        m_pendingRequests.pop_front();
+        m_metrics.admission().m_queuedRequests.sub();
+        m_metrics.admission().m_requestsExpired.add();
+    }
+}
+
+
+/**
+ * @brief TftpServer::startQueuedRequests start queued read requests, oldest first, for as far as session slots are free
+ *
+ * A request for a binding that is at its own limit stays queued, without blocking requests for other bindings.
+ */
+void TftpServer::startQueuedRequests()
+{
+    dropExpiredRequests();
+    auto pendingIt = m_pendingRequests.begin();
+    while (pendingIt != m_pendingRequests.end())
+    {
+        if (m_maxSessions > 0 && m_metrics.activeSessions() >= static_cast<int64_t>(m_maxSessions))
+        {
+            break;
+        }
+        if ( ! hasFreeSessionSlot(*pendingIt->m_binding) )
+        {
+            ++pendingIt;
+            continue;
+        }
+
+        PendingRequest pending = *pendingIt;
+        pendingIt = m_pendingRequests.erase(pendingIt);
+        m_metrics.admission().m_queuedRequests.sub();
+        auto waitUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - pending.m_queuedAt);
+        m_metrics.admission().m_queueWaitUs.record(static_cast<uint64_t>(waitUs.count()));
+        try
+        {
+            startReadSession(*pending.m_binding, pending.m_datagram, pending.m_peerAddress, pending.m_peerPort);
+        }
+        catch (const TftpError &)
+        {
+            //the session reported the problem to its client, continue with the next request
+        }
+        pendingIt = m_pendingRequests.begin();
+    }
+}
+
+
+/**
+ * @brief TftpServer::startReadSession start a (multicast) read session for a RRQ, or add the client to a multicast transfer
+ */
+void TftpServer::startReadSession(ConnectionRequestSocket &mainSocket, const QByteArray &dgram, const QHostAddress &peerAddress, quint16 peerPort)
+{
+    QString filesDir;
+    std::shared_ptr<DirectoryProvider> directoryProvider;
+    mainSocket.selectFilesDir(peerAddress, filesDir, directoryProvider);
+    QByteArray rrqDgram = mainSocket.rewriteRequest(dgram);
+    bool wantsMulticast = m_multicastGroupCount > 0 && peerAddress.protocol() == QAbstractSocket::IPv4Protocol &&
+                          findRrqOption(rrqDgram, "multicast");
+    if (wantsMulticast && joinMulticastSession(peerAddress, peerPort, rrqDgram, filesDir, mainSocket.blockSourceProviders(), directoryProvider))
+    {
+        return;
+    }
+
+    std::shared_ptr<ReadSession> readSession;
+    QHostAddress groupAddress = wantsMulticast ? allocateMulticastGroup() : QHostAddress();
+    if ( ! groupAddress.isNull() )
+    {
+        auto multicastSession = std::make_shared<MulticastReadSession>(peerAddress, peerPort, rrqDgram, filesDir, groupAddress,
+                                                                       m_multicastGroupPort, m_slowNetworkThreshold, m_socketFactory,
+                                                                       mainSocket.metrics(), m_transferGroups, mainSocket.blockSourceProviders(),
+                                                                       directoryProvider, mainSocket.localAddress(), m_pacer, m_scheduler);
+        if (multicastSession->isMulticast())
+        {
+            m_multicastSessions.push_back(multicastSession);
+        }
+        readSession = multicastSession;
+    }
+    else
+    {
+        readSession = std::make_shared<ReadSession>(peerAddress, peerPort, rrqDgram, filesDir, m_slowNetworkThreshold, m_socketFactory,
+                                                    mainSocket.metrics(), m_transferGroups, mainSocket.blockSourceProviders(),
+                                                    directoryProvider, mainSocket.localAddress(), m_pacer, m_scheduler);
+    }
+    readSession->setSocketBufferSizes(mainSocket.receiveBufferSize(), mainSocket.sendBufferSize());
+    readSession->setKernelTimestamping(m_kernelTimestamping);
+    connect(readSession.get(), &Session::finished, this, &TftpServer::removeSession);
+    connect(readSession.get(), &Session::error, this, &TftpServer::removeSession);
+    QTFTP_PROBE2(session_created, readSession->sessionId(), peerPort);
+    m_readSessions.push_back( readSession );
+    emit newReadSession(readSession);
+}
+
+
+/**
+ * @brief TftpServer::dataReceived
+ * @throw TftpError if an error occurs while reading data from tftp server socket or while sending respons to sender
+ * Slot that handles data coming in at the main socket that emitted the signal connected to this slot
+ */
+void TftpServer::dataReceived()
+{
+    auto mainSocket = qobject_cast<ConnectionRequestSocket*>(sender());
+    if (mainSocket)
+    {
+        handleNewData(*mainSocket);
+    }
+}
+
+
+/**
+ * @brief TftpServer::removeSession remove the read or write session that emitted the signal connected to this slot
+ */
+void TftpServer::removeSession()
+{
+    QObject *finishedSession = sender(); //get the session that emitted the error() or finished() signal
+    if (!finishedSession)
+    {
+        return;
+    }
+
+    auto session = static_cast<Session*>(finishedSession);
+    auto &peerIdent = session->peerIdent();
+
+    //check if the session that ended is a read session
+    auto readSessionIter = std::find_if(m_readSessions.begin(), m_readSessions.end(), [&peerIdent](auto &nextSession) { return (*nextSession)==peerIdent; } );
+    if (readSessionIter != m_readSessions.end())
+    {
+        m_metrics.mergeAckDelays(session->metrics(), peerIdent.m_address, session->ackDelays());
+        m_multicastSessions.erase(std::remove_if(m_multicastSessions.begin(), m_multicastSessions.end(), [session](auto &nextSession) { return nextSession.get() == session; }),
+                                  m_multicastSessions.end());
 #ifndef _WIN32
         // on Windows the next line will cause a null-pointer exception.
         m_readSessions.erase(readSessionIter);
 #endif
+        startQueuedRequests();
         return;
     }
 
-    //TODO: check if the session that ended is a write session
+    auto writeSessionIter = std::find_if(m_writeSessions.begin(), m_writeSessions.end(), [&peerIdent](auto &nextSession) { return (*nextSession)==peerIdent; } );
+    if (writeSessionIter != m_writeSessions.end())
+    {
+        if (session->state() == Session::State::Finished)
+        {
+            emit receivedFile();
+        }
+#ifndef _WIN32
+        m_writeSessions.erase(writeSessionIter);
+#endif
+        startQueuedRequests();
+    }
+}
+
+
+/**
+ * @brief TftpServer::checkSocketBuffers add the datagrams the kernel dropped on the sockets of each binding to its metrics,
+ * and raise the buffer sizes of bindings with auto-tuning enabled
+ */
+void TftpServer::checkSocketBuffers()
+{
+    std::map<const BindingMetrics*, uint32_t> sessionDrops;
+    auto collectDrops = [&sessionDrops](Session &session) { sessionDrops[session.metrics()] += session.collectReceiveDrops(); };
+    std::for_each(m_readSessions.begin(), m_readSessions.end(), [&collectDrops](auto &nextSession) { collectDrops(*nextSession); });
+    std::for_each(m_writeSessions.begin(), m_writeSessions.end(), [&collectDrops](auto &nextSession) { collectDrops(*nextSession); });
+
+    for (auto &nextSocket : m_mainSockets)
+    {
+        const BindingMetrics *binding = nextSocket->metrics().get();
+        if ( ! nextSocket->tuneSocketBuffers(nextSocket->collectReceiveDrops() + sessionDrops[binding]) )
+        {
+            continue;
+        }
+        auto resizeSocket = [&nextSocket, binding](Session &session)
+                            {
+                                if (session.metrics() == binding)
+                                {
+                                    session.setSocketBufferSizes(nextSocket->receiveBufferSize(), nextSocket->sendBufferSize());
+                                }
+                            };
+        std::for_each(m_readSessions.begin(), m_readSessions.end(), [&resizeSocket](auto &nextSession) { resizeSocket(*nextSession); });
+        std::for_each(m_writeSessions.begin(), m_writeSessions.end(), [&resizeSocket](auto &nextSession) { resizeSocket(*nextSession); });
+    }
+}
+
+
+/**
+ * @brief TftpServer::joinMulticastSession let a client join a multicast transfer of the requested file that is in progress
+ * @return true if the client joined an existing transfer
+ */
+bool TftpServer::joinMulticastSession(const QHostAddress &peerAddress, uint16_t peerPort, const QByteArray &rrqDatagram, const QString &filesDir,
+                                      const BlockSourceProviders &providers, const std::shared_ptr<DirectoryProvider> &directoryProvider)
+{
+    for (auto &nextSession : m_multicastSessions)
+    {
+        if (nextSession->addClient(peerAddress, peerPort, rrqDatagram, filesDir, providers, directoryProvider))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/**
+ * @brief TftpServer::allocateMulticastGroup find a multicast group address that is not used by a transfer in progress
+ * @return the group address or a null address if all group addresses are in use
+ */
+QHostAddress TftpServer::allocateMulticastGroup() const
+{
+    for (unsigned int groupNr=0; groupNr<m_multicastGroupCount; ++groupNr)
+    {
+        QHostAddress candidate(m_multicastFirstGroup.toIPv4Address() + groupNr);
+        auto inUse = std::any_of(m_multicastSessions.begin(), m_multicastSessions.end(), [&candidate](auto &nextSession) { return nextSession->groupAddress() == candidate; });
+        if (!inUse)
+        {
+            return candidate;
+        }
+    }
+    return QHostAddress();
+}
+
+
+/**
+ * @brief TftpServer::findBinding find the socket of a binding
+ * @throw TftpError if there is no binding for \p hostAddr and \p port
+ */
+std::shared_ptr<ConnectionRequestSocket> TftpServer::findBinding(const QHostAddress &hostAddr, uint16_t port) const
+{
+    auto socketIter = std::find_if(m_mainSockets.begin(), m_mainSockets.end(), [&hostAddr, port](auto &nextSocket)
+                                   { return nextSocket->localAddress() == hostAddr && nextSocket->localPort() == port; });
+    if (socketIter == m_mainSockets.end())
+    {
+        throw TftpError("No tftp server binding at host address "s + hostAddr.toString().toStdString() + " port " + std::to_string(port));
+    }
+    return *socketIter;
 }
 
 
@@ -390,4 +1457,11 @@ std::shared_ptr<ReadSession> TftpServer::doFindReadSession(const SessionIdent &s
 
 
 
+std::shared_ptr<WriteSession> TftpServer::doFindWriteSession(const SessionIdent &sessionIdent) const
+{
+    auto writeSessionIter = std::find_if(m_writeSessions.begin(), m_writeSessions.end(), [&sessionIdent](auto &nextSession) { return (*nextSession)==sessionIdent; } );
+    return (writeSessionIter != m_writeSessions.end()) ? *writeSessionIter : std::shared_ptr<WriteSession>();
+}
+
+
 } // namespace end
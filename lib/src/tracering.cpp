@@ -0,0 +1,407 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#include "qtftp/tracering.h"
+#include <QFile>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+namespace QTFTP
+{
+
+static constexpr uint64_t MinNsBetweenErrorDumps = 1000000000ULL;
+
+//The ring registry is a fixed size array, so that a signal handler can walk it without taking a lock
+static std::atomic<TraceRing*> g_traceRings[TraceRecorder::MaxThreads];
+static std::atomic<unsigned int> g_traceRingCount(0);
+
+static char g_dumpFileName[4096] = { '\0' };
+static std::atomic<bool> g_dumpOnSessionError(false);
+static std::atomic<uint64_t> g_lastErrorDumpNs(0);
+
+//Buffer used to take a snapshot of one ring while dumping. Static instead of on the stack, because a dump
+//may be taken from within a signal handler.
+static TraceEvent g_dumpBuffer[TraceRing::Capacity];
+static std::atomic_flag g_dumpBusy = ATOMIC_FLAG_INIT;
+
+constexpr uint8_t TraceEvent::FlagIpv6Peer;
+constexpr unsigned int TraceRing::Capacity;
+constexpr unsigned int TraceRecorder::MaxThreads;
+std::atomic<bool> TraceRecorder::m_enabled(false);
+
+
+static uint64_t steadyClockNs()
+{
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+
+static bool writeAll(int fd, const void *data, size_t size)
+{
+    const char *dataPtr = static_cast<const char*>(data);
+    while (size > 0)
+    {
+#ifdef _WIN32
+        auto written = _write(fd, dataPtr, static_cast<unsigned int>(size));
+#else
+        auto written = ::write(fd, dataPtr, size);
+#endif
+        if (written <= 0)
+        {
+            return false;
+        }
+        dataPtr += written;
+        size -= static_cast<size_t>(written);
+    }
+    return true;
+}
+
+
+TraceRing::TraceRing(uint32_t threadIndex) : m_head(0),
+                                             m_threadIndex(threadIndex)
+{
+    for (auto &nextSlot : m_slots)
+    {
+        nextSlot.m_seq.store(0, std::memory_order_relaxed);
+        for (auto &nextWord : nextSlot.m_words)
+        {
+            nextWord.store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+
+/**
+ * @brief TraceRing::push append an event to the ring, overwriting the oldest event when the ring is full
+ * @param event the event to store
+ *
+ * Must only be called by the thread that owns this ring.
+ */
+void TraceRing::push(const TraceEvent &event)
+{
+    uint64_t pos = m_head.load(std::memory_order_relaxed);
+    Slot &slot = m_slots[pos & (Capacity-1)];
+
+    uint64_t words[3];
+    std::memcpy(words, &event, sizeof(words));
+
+    //sequence 0 marks the slot as being written, pos+1 marks it as complete
+    slot.m_seq.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (unsigned int wordNr=0; wordNr<3; ++wordNr)
+    {
+        slot.m_words[wordNr].store(words[wordNr], std::memory_order_relaxed);
+    }
+    slot.m_seq.store(pos+1, std::memory_order_release);
+    m_head.store(pos+1, std::memory_order_release);
+}
+
+
+/**
+ * @brief TraceRing::snapshot copy the events currently in the ring
+ * @param destination buffer that receives the events, oldest first
+ * @param maxEvents capacity of \p destination
+ * @return the number of events copied
+ *
+ * Safe to call from any thread while the owning thread keeps pushing events. Events that are overwritten
+ * during the copy are left out.
+ */
+unsigned int TraceRing::snapshot(TraceEvent *destination, unsigned int maxEvents) const
+{
+    uint64_t head = m_head.load(std::memory_order_acquire);
+    uint64_t start = head > Capacity ? head - Capacity : 0;
+    unsigned int eventsCopied = 0;
+
+    for (uint64_t pos=start; pos<head && eventsCopied<maxEvents; ++pos)
+    {
+        const Slot &slot = m_slots[pos & (Capacity-1)];
+        uint64_t seqBefore = slot.m_seq.load(std::memory_order_acquire);
+        if (seqBefore != pos+1)
+        {
+            continue;
+        }
+        uint64_t words[3];
+        for (unsigned int wordNr=0; wordNr<3; ++wordNr)
+        {
+            words[wordNr] = slot.m_words[wordNr].load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.m_seq.load(std::memory_order_relaxed) != seqBefore)
+        {
+            continue;
+        }
+        std::memcpy(&destination[eventsCopied], words, sizeof(words));
+        ++eventsCopied;
+    }
+
+    return eventsCopied;
+}
+
+
+uint32_t TraceRing::threadIndex() const
+{
+    return m_threadIndex;
+}
+
+
+void TraceRecorder::setEnabled(bool enabled)
+{
+    m_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+
+bool TraceRecorder::isEnabled()
+{
+    return m_enabled.load(std::memory_order_relaxed);
+}
+
+
+/**
+ * @brief TraceRecorder::doRecord append an event to the trace ring of the calling thread
+ *
+ * The ring of a thread is created at the first event recorded by that thread. Rings are never freed, so
+ * events of threads that have already exited are still included in a dump. Threads beyond MaxThreads are not traced.
+ */
+void TraceRecorder::doRecord(TraceEvent::Type type, uint32_t sessionId, uint16_t blockNr, uint32_t arg1, uint32_t arg2, uint8_t flags)
+{
+    thread_local TraceRing *threadRing = nullptr;
+    thread_local bool noRingAvailable = false;
+
+    if (!threadRing)
+    {
+        if (noRingAvailable)
+        {
+            return;
+        }
+        unsigned int ringIndex = g_traceRingCount.fetch_add(1);
+        if (ringIndex >= MaxThreads)
+        {
+            noRingAvailable = true;
+            return;
+        }
+        threadRing = new TraceRing(ringIndex);
+        g_traceRings[ringIndex].store(threadRing, std::memory_order_release);
+    }
+
+    TraceEvent event;
+    event.m_timestampNs = steadyClockNs();
+    event.m_sessionId = sessionId;
+    event.m_blockNr = blockNr;
+    event.m_type = type;
+    event.m_flags = flags;
+    event.m_arg1 = arg1;
+    event.m_arg2 = arg2;
+    threadRing->push(event);
+}
+
+
+/**
+ * @brief TraceRecorder::recordRrq record the read request of a session and the address of its peer
+ *
+ * The address of an IPv6 peer does not fit in the Rrq event, it is recorded in two PeerAddress6 events that follow it.
+ */
+void TraceRecorder::recordRrq(uint32_t sessionId, const QHostAddress &peerAddress, uint16_t peerPort)
+{
+    if (!isEnabled())
+    {
+        return;
+    }
+    bool isIpv4 = false;
+    uint32_t ipv4Address = peerAddress.toIPv4Address(&isIpv4);
+    if (isIpv4 || peerAddress.protocol() != QAbstractSocket::IPv6Protocol)
+    {
+        doRecord(TraceEvent::Rrq, sessionId, 0, peerPort, ipv4Address);
+        return;
+    }
+
+    doRecord(TraceEvent::Rrq, sessionId, 0, peerPort, 0, TraceEvent::FlagIpv6Peer);
+    Q_IPV6ADDR ipv6Address = peerAddress.toIPv6Address();
+    for (uint16_t partNr=0; partNr<2; ++partNr)
+    {
+        uint32_t words[2] = { 0, 0 };
+        for (unsigned int byteNr=0; byteNr<8; ++byteNr)
+        {
+            words[byteNr / 4] = (words[byteNr / 4] << 8) | ipv6Address[partNr * 8 + byteNr];
+        }
+        doRecord(TraceEvent::PeerAddress6, sessionId, partNr, words[0], words[1]);
+    }
+}
+
+
+/**
+ * @brief TraceRecorder::setDumpFile set the file that dumpToConfiguredFile() writes to
+ * @param fileName name of the dump file, an empty name disables dumping
+ *
+ * Call this before installing a signal handler that calls dumpToConfiguredFile().
+ */
+void TraceRecorder::setDumpFile(const QString &fileName)
+{
+    QByteArray nativeName = QFile::encodeName(fileName);
+    auto nameLength = std::min<size_t>(static_cast<size_t>(nativeName.size()), sizeof(g_dumpFileName)-1);
+    std::memcpy(g_dumpFileName, nativeName.constData(), nameLength);
+    g_dumpFileName[nameLength] = '\0';
+}
+
+
+/**
+ * @brief TraceRecorder::setDumpOnSessionError dump the trace rings to the configured dump file when a session fails
+ * @param dumpOnError true to enable
+ *
+ * To keep a burst of failing sessions from hammering the disk, at most one dump per second is written.
+ */
+void TraceRecorder::setDumpOnSessionError(bool dumpOnError)
+{
+    g_dumpOnSessionError.store(dumpOnError, std::memory_order_relaxed);
+}
+
+
+/**
+ * @brief TraceRecorder::sessionError record that session \p sessionId went into error state and dump if configured
+ */
+void TraceRecorder::sessionError(uint32_t sessionId)
+{
+    record(TraceEvent::Error, sessionId);
+
+    if (!isEnabled() || !g_dumpOnSessionError.load(std::memory_order_relaxed))
+    {
+        return;
+    }
+    uint64_t nowNs = steadyClockNs();
+    uint64_t lastDumpNs = g_lastErrorDumpNs.load(std::memory_order_relaxed);
+    if (lastDumpNs != 0 && nowNs - lastDumpNs < MinNsBetweenErrorDumps)
+    {
+        return;
+    }
+    if (g_lastErrorDumpNs.compare_exchange_strong(lastDumpNs, nowNs))
+    {
+        dumpToConfiguredFile();
+    }
+}
+
+
+/**
+ * @brief TraceRecorder::dumpToFile write the contents of all trace rings to a file
+ * @param fileName the file to (over)write
+ * @return true if the dump was written successfully
+ */
+bool TraceRecorder::dumpToFile(const QString &fileName)
+{
+    QFile dumpFile(fileName);
+    if (!dumpFile.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        return false;
+    }
+    bool dumpOk = dumpToFd(dumpFile.handle());
+    dumpFile.close();
+    return dumpOk;
+}
+
+
+/**
+ * @brief TraceRecorder::dumpToConfiguredFile write the contents of all trace rings to the file set with setDumpFile()
+ * @return true if the dump was written successfully
+ *
+ * This function only uses async-signal-safe system calls, so it may be called from a signal handler.
+ */
+bool TraceRecorder::dumpToConfiguredFile()
+{
+    if (g_dumpFileName[0] == '\0')
+    {
+        return false;
+    }
+#ifdef _WIN32
+    int fd = _open(g_dumpFileName, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+    int fd = ::open(g_dumpFileName, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP);
+#endif
+    if (fd < 0)
+    {
+        return false;
+    }
+    bool dumpOk = dumpToFd(fd);
+#ifdef _WIN32
+    _close(fd);
+#else
+    ::close(fd);
+#endif
+    return dumpOk;
+}
+
+
+/**
+ * @brief TraceRecorder::dumpToFd write the contents of all trace rings to an open file descriptor
+ * @param fd file descriptor opened for writing
+ * @return true if the dump was written successfully, false on a write error or if another dump is in progress
+ *
+ * This function does not allocate memory and does not take locks, so it may be called from a signal handler.
+ */
+bool TraceRecorder::dumpToFd(int fd)
+{
+    if (g_dumpBusy.test_and_set(std::memory_order_acquire))
+    {
+        return false;
+    }
+
+    //a ring may be registered while we are dumping, so take the list of rings once
+    const TraceRing *rings[MaxThreads];
+    unsigned int ringCount = std::min(g_traceRingCount.load(std::memory_order_acquire), MaxThreads);
+    unsigned int availableRings = 0;
+    for (unsigned int ringNr=0; ringNr<ringCount; ++ringNr)
+    {
+        const TraceRing *ring = g_traceRings[ringNr].load(std::memory_order_acquire);
+        if (ring)
+        {
+            rings[availableRings++] = ring;
+        }
+    }
+
+    TraceFileHeader fileHeader;
+    std::memset(&fileHeader, 0, sizeof(fileHeader));
+    std::memcpy(fileHeader.m_magic, "QTFTPTRC", sizeof(fileHeader.m_magic));
+    fileHeader.m_version = TraceFileVersion;
+    fileHeader.m_eventSize = sizeof(TraceEvent);
+    fileHeader.m_steadyClockNs = steadyClockNs();
+    fileHeader.m_systemClockNs = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count());
+    fileHeader.m_ringCount = availableRings;
+    bool writeOk = writeAll(fd, &fileHeader, sizeof(fileHeader));
+
+    for (unsigned int ringNr=0; ringNr<availableRings && writeOk; ++ringNr)
+    {
+        TraceRingHeader ringHeader;
+        ringHeader.m_threadIndex = rings[ringNr]->threadIndex();
+        ringHeader.m_eventCount = rings[ringNr]->snapshot(g_dumpBuffer, TraceRing::Capacity);
+        writeOk = writeAll(fd, &ringHeader, sizeof(ringHeader)) &&
+                  writeAll(fd, g_dumpBuffer, ringHeader.m_eventCount * sizeof(TraceEvent));
+    }
+
+    g_dumpBusy.clear(std::memory_order_release);
+    return writeOk;
+}
+
+
+} // QTFTP namespace end
@@ -0,0 +1,342 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#include "qtftp/transfergroup.h"
+#include "qtftp/tftp_error.h"
+#include <algorithm>
+#include <string>
+
+using namespace std::string_literals;
+
+namespace QTFTP
+{
+
+/**
+ * @brief TransferGroup::TransferGroup
+ * @param source contents to transfer
+ * @param blockSize negotiated block size of the sessions in this group
+ * @param mode transfer mode of the sessions in this group
+ * @param maxCacheBytes maximum nr of bytes of produced blocks kept in memory, 0 disables the cache
+ */
+TransferGroup::TransferGroup(std::shared_ptr<BlockSource> source, unsigned int blockSize, TftpCode::Mode mode, size_t maxCacheBytes) : m_source(source),
+                                                                                                                                     m_blockSize(blockSize),
+                                                                                                                                     m_mode(mode),
+                                                                                                                                     m_maxCacheBytes(maxCacheBytes),
+                                                                                                                                     m_fileSize(0),
+                                                                                                                                     m_cachedBytes(0),
+                                                                                                                                     m_fileReads(0),
+                                                                                                                                     m_nextAsciiBlock(0),
+                                                                                                                                     m_asciiReadPos(0)
+{
+}
+
+
+/**
+ * @brief TransferGroup::TransferGroup transfer a file on disk
+ * @param filePath absolute path of the file to transfer
+ */
+TransferGroup::TransferGroup(const QString &filePath, unsigned int blockSize, TftpCode::Mode mode, size_t maxCacheBytes) : TransferGroup(std::make_shared<FileBlockSource>(filePath),
+                                                                                                                                         blockSize, mode, maxCacheBytes)
+{
+}
+
+
+/**
+ * @brief TransferGroup::open open the block source and remember the version that will be sent
+ * @return false if the source could not be opened, see errorString()
+ */
+bool TransferGroup::open()
+{
+    if ( ! m_source->open() )
+    {
+        return false;
+    }
+    m_fileSize = m_source->size();
+    return true;
+}
+
+
+QString TransferGroup::errorString() const
+{
+    return m_source->errorString();
+}
+
+
+/**
+ * @brief TransferGroup::filePath get the name of the block source, for files on disk the absolute path
+ */
+QString TransferGroup::filePath() const
+{
+    return m_source->name();
+}
+
+
+unsigned int TransferGroup::blockSize() const
+{
+    return m_blockSize;
+}
+
+
+TftpCode::Mode TransferGroup::mode() const
+{
+    return m_mode;
+}
+
+
+/**
+ * @brief TransferGroup::fileSize get the size of the file at the time it was opened
+ */
+qint64 TransferGroup::fileSize() const
+{
+    return m_fileSize;
+}
+
+
+/**
+ * @brief TransferGroup::isCurrentVersion check if the block source still has the contents it had when opened
+ */
+bool TransferGroup::isCurrentVersion() const
+{
+    return m_source->isCurrentVersion();
+}
+
+
+/**
+ * @brief TransferGroup::block get the contents of a data block
+ * @param blockIndex index of the block in the file, the first block has index 0 (TFTP block number 1)
+ * @return the block data, which is less than blockSize() bytes for the last block of the file
+ * @throw TftpError if the file could not be read
+ *
+ * In netascii mode line endings are converted (CR -> CR,0 and LF -> CR,LF). Because converted blocks don't map
+ * to a fixed position in the file, netascii blocks are produced in order. A block that was already dropped from
+ * the cache is produced again by starting over at the beginning of the file.
+ */
+QByteArray TransferGroup::block(uint32_t blockIndex)
+{
+    auto cacheIter = m_cache.find(blockIndex);
+    if (cacheIter != m_cache.end())
+    {
+        return cacheIter->second;
+    }
+
+    QByteArray blockData;
+    if (m_mode != TftpCode::NetAscii)
+    {
+        blockData = readOctetBlock(blockIndex);
+        addToCache(blockIndex, blockData);
+        return blockData;
+    }
+
+    if (blockIndex < m_nextAsciiBlock)
+    {
+        m_asciiReadPos = 0;
+        m_asciiOverflowBuffer.clear();
+        m_nextAsciiBlock = 0;
+    }
+    while (m_nextAsciiBlock <= blockIndex)
+    {
+        blockData = readNextAsciiBlock();
+        addToCache(m_nextAsciiBlock, blockData);
+        ++m_nextAsciiBlock;
+    }
+    return blockData;
+}
+
+
+/**
+ * @brief TransferGroup::fileReads get the nr of read operations done on the file by this group
+ */
+uint64_t TransferGroup::fileReads() const
+{
+    return m_fileReads;
+}
+
+
+size_t TransferGroup::cachedBytes() const
+{
+    return m_cachedBytes;
+}
+
+
+QByteArray TransferGroup::readOctetBlock(uint32_t blockIndex)
+{
+    QByteArray blockData;
+    qint64 blockPos = static_cast<qint64>(blockIndex) * m_blockSize;
+    if (blockPos >= m_fileSize)
+    {
+        //file size is an exact multiple of the block size, last block is empty
+        return blockData;
+    }
+
+    qint64 bytesToRead = std::min<qint64>(m_blockSize, m_fileSize - blockPos);
+    blockData.resize(static_cast<int>(bytesToRead));
+    ++m_fileReads;
+    if ( m_source->readAt(blockPos, blockData.data(), bytesToRead) != bytesToRead )
+    {
+        throw TftpError("Read error while reading from file "s + m_source->name().toStdString());
+    }
+    return blockData;
+}
+
+
+QByteArray TransferGroup::readNextAsciiBlock()
+{
+    //There may be some leftover from the previous block after line ending conversion. Add this to the block
+    //before reading contents from file, and make sure that those line endings are not converted for 2nd time.
+    QByteArray blockData = m_asciiOverflowBuffer;
+    m_asciiOverflowBuffer.clear();
+    int lineEndConversionStartIndex = blockData.size();
+
+    qint64 bytesToRead = std::min<qint64>(static_cast<qint64>(m_blockSize) - blockData.size(), m_fileSize - m_asciiReadPos);
+    if (bytesToRead > 0)
+    {
+        blockData.resize(static_cast<int>(blockData.size() + bytesToRead));
+        ++m_fileReads;
+        if (m_source->readAt(m_asciiReadPos, blockData.data() + lineEndConversionStartIndex, bytesToRead) != bytesToRead)
+        {
+            throw TftpError("Read error while reading from file "s + m_source->name().toStdString());
+        }
+        m_asciiReadPos += bytesToRead;
+    }
+
+    //convert line endings and CR char, making sure that block size is not exceeded
+    for (int index=lineEndConversionStartIndex; index<blockData.size(); ++index)
+    {
+        if ( static_cast<char>(blockData[index]) == 0x0D )
+        {
+            //convert CR -> CR,0
+            ++index;
+            blockData.insert(index, '\0');
+        }
+        else if ( static_cast<char>(blockData[index]) == 0x0A)
+        {
+            //convert LF -> CR,LF
+            blockData.insert(index, 0x0D);
+            ++index;
+        }
+    }
+
+    //If the block became bigger than the block size due to linefeed conversions,
+    //store the surplus in an overflow buffer for the next block.
+    if (static_cast<unsigned int>(blockData.size()) > m_blockSize)
+    {
+        int surplusNrOfChars = blockData.size() - static_cast<int>(m_blockSize);
+        m_asciiOverflowBuffer = blockData.right(surplusNrOfChars);
+        blockData.chop(surplusNrOfChars);
+    }
+    return blockData;
+}
+
+
+/**
+ * @brief TransferGroup::addToCache keep a produced block, dropping the oldest blocks if the cache gets too big
+ */
+void TransferGroup::addToCache(uint32_t blockIndex, const QByteArray &blockData)
+{
+    if (m_maxCacheBytes == 0 || m_cache.count(blockIndex) != 0)
+    {
+        return;
+    }
+
+    m_cache.emplace(blockIndex, blockData);
+    m_cacheOrder.push_back(blockIndex);
+    m_cachedBytes += static_cast<size_t>(blockData.size());
+    while (m_cachedBytes > m_maxCacheBytes && !m_cacheOrder.empty())
+    {
+        auto oldestIter = m_cache.find(m_cacheOrder.front());
+        m_cachedBytes -= static_cast<size_t>(oldestIter->second.size());
+        m_cache.erase(oldestIter);
+        m_cacheOrder.pop_front();
+    }
+}
+
+
+
+TransferGroupRegistry::TransferGroupRegistry(size_t maxCacheBytesPerGroup) : m_maxCacheBytesPerGroup(maxCacheBytesPerGroup)
+{
+}
+
+
+/**
+ * @brief TransferGroupRegistry::acquire get the group that sends the current version of a file on disk
+ * @param filePath absolute path of the file
+ * @throw TftpError if the file could not be opened
+ */
+std::shared_ptr<TransferGroup> TransferGroupRegistry::acquire(const QString &filePath, unsigned int blockSize, TftpCode::Mode mode)
+{
+    return acquire(std::make_shared<FileBlockSource>(filePath), blockSize, mode);
+}
+
+
+/**
+ * @brief TransferGroupRegistry::acquire get the group that sends the current version of the contents of a block source
+ * @param source block source for the requested file, only opened if no group for the same contents exists
+ * @param blockSize negotiated block size
+ * @param mode transfer mode
+ * @return group that is shared with other sessions transferring the same contents with the same block size and mode,
+ * or a group of its own if the source has no share key
+ * @throw TftpError if the source could not be opened
+ */
+std::shared_ptr<TransferGroup> TransferGroupRegistry::acquire(std::shared_ptr<BlockSource> source, unsigned int blockSize, TftpCode::Mode mode)
+{
+    QString shareKey = source->shareKey();
+    if (shareKey.isEmpty())
+    {
+        auto privateGroup = std::make_shared<TransferGroup>(source, blockSize, mode, 0);
+        if ( ! privateGroup->open() )
+        {
+            throw TftpError("Could not open file "s + source->name().toStdString() + ": " + privateGroup->errorString().toStdString());
+        }
+        return privateGroup;
+    }
+
+    //forget groups that are no longer used by any session
+    for (auto groupIter = m_groups.begin(); groupIter != m_groups.end(); )
+    {
+        groupIter = groupIter->second.expired() ? m_groups.erase(groupIter) : std::next(groupIter);
+    }
+
+    GroupKey key(shareKey, blockSize, static_cast<int>(mode));
+    auto existingGroup = m_groups[key].lock();
+    if (existingGroup && existingGroup->isCurrentVersion())
+    {
+        return existingGroup;
+    }
+
+    auto newGroup = std::make_shared<TransferGroup>(source, blockSize, mode, m_maxCacheBytesPerGroup);
+    if ( ! newGroup->open() )
+    {
+        throw TftpError("Could not open file "s + source->name().toStdString() + ": " + newGroup->errorString().toStdString());
+    }
+    m_groups[key] = newGroup;
+    return newGroup;
+}
+
+
+/**
+ * @brief TransferGroupRegistry::activeGroupCount get the nr of groups that are used by at least one session
+ */
+size_t TransferGroupRegistry::activeGroupCount() const
+{
+    return static_cast<size_t>(std::count_if(m_groups.begin(), m_groups.end(), [](auto &nextGroup) { return !nextGroup.second.expired(); }));
+}
+
+
+} // QTFTP namespace end
@@ -20,13 +20,20 @@
 
 #include "qtftp/udpsocket.h"
 #include <QAbstractSocket>
+#include <QSocketNotifier>
+#include <QtGlobal>
+#include <cerrno>
+#if QT_VERSION >= QT_VERSION_CHECK(5, 8, 0)
+#include <QNetworkDatagram>
+#endif
 
 namespace QTFTP
 {
 
 
 UdpSocket::UdpSocket(QObject *parent) : AbstractSocket(parent),
-                                        m_socket(this)
+                                        m_socket(this),
+                                        m_writeErrno(0)
 {
     connect(&m_socket, &QAbstractSocket::readyRead, this, &UdpSocket::readyRead);
     //debug start
@@ -78,6 +85,7 @@ bool UdpSocket::bind(const QHostAddress &address, quint16 port, QAbstractSocket:
 
 void UdpSocket::close()
 {
+    m_writeNotifier.reset();
     m_socket.close();
 }
 
@@ -90,7 +98,107 @@ qint64 UdpSocket::readDatagram(char *data, qint64 maxSize, QHostAddress *address
 
 qint64 UdpSocket::writeDatagram(const QByteArray &datagram, const QHostAddress &host, quint16 port)
 {
-    return m_socket.writeDatagram(datagram, host, port);
+    errno = 0;
+    qint64 bytesWritten = m_socket.writeDatagram(datagram, host, port);
+    m_writeErrno = (bytesWritten == -1) ? errno : 0;
+    return bytesWritten;
+}
+
+
+/**
+ * @brief UdpSocket::receiveDatagram read the next pending datagram and the local address it was sent to
+ *
+ * QUdpSocket requests the destination address of received datagrams from the kernel (IP_PKTINFO, IPV6_RECVPKTINFO).
+ * Qt versions before 5.8 can't report it, then the local address of the socket is reported.
+ */
+bool UdpSocket::receiveDatagram(QByteArray &datagram, QHostAddress &address, quint16 &port, QHostAddress &destinationAddress)
+{
+#if QT_VERSION >= QT_VERSION_CHECK(5, 8, 0)
+    QNetworkDatagram networkDatagram = m_socket.receiveDatagram();
+    if ( ! networkDatagram.isValid() )
+    {
+        return false;
+    }
+    datagram = networkDatagram.data();
+    address = networkDatagram.senderAddress();
+    port = static_cast<quint16>(networkDatagram.senderPort());
+    destinationAddress = networkDatagram.destinationAddress();
+    return true;
+#else
+    return AbstractSocket::receiveDatagram(datagram, address, port, destinationAddress);
+#endif
+}
+
+
+/**
+ * @brief UdpSocket::writeDatagramFrom send a datagram from a specific local address
+ *
+ * QUdpSocket passes \p sourceAddress to the kernel with the datagram (IP_PKTINFO, IPV6_PKTINFO). Qt versions before 5.8
+ * can't, then the kernel selects the source address.
+ */
+qint64 UdpSocket::writeDatagramFrom(const QByteArray &datagram, const QHostAddress &host, quint16 port, const QHostAddress &sourceAddress)
+{
+#if QT_VERSION >= QT_VERSION_CHECK(5, 8, 0)
+    QNetworkDatagram networkDatagram(datagram, host, port);
+    networkDatagram.setSender(sourceAddress);
+    errno = 0;
+    qint64 bytesWritten = m_socket.writeDatagram(networkDatagram);
+    m_writeErrno = (bytesWritten == -1) ? errno : 0;
+    return bytesWritten;
+#else
+    return AbstractSocket::writeDatagramFrom(datagram, host, port, sourceAddress);
+#endif
+}
+
+
+/**
+ * @brief UdpSocket::isSendErrorTransient check if the last failed write was caused by a full send buffer
+ *
+ * QUdpSocket reports ENOBUFS (the queue of the network interface is full) as NetworkError, its catch-all error that
+ * also covers permanent errors like ENETUNREACH and EACCES. So the errno of the failed write is checked instead: only
+ * EAGAIN/EWOULDBLOCK and ENOBUFS are transient. Platforms that don't report socket errors in errno fall back to
+ * QAbstractSocket::TemporaryError.
+ */
+bool UdpSocket::isSendErrorTransient() const
+{
+#ifdef Q_OS_UNIX
+    return m_writeErrno == EAGAIN || m_writeErrno == EWOULDBLOCK || m_writeErrno == ENOBUFS;
+#else
+    return m_socket.error() == QAbstractSocket::TemporaryError;
+#endif
+}
+
+
+/**
+ * @brief UdpSocket::setWriteNotificationEnabled emit readyWrite() once when the kernel has room in the send buffer again
+ */
+void UdpSocket::setWriteNotificationEnabled(bool enabled)
+{
+    if (m_socket.socketDescriptor() == -1)
+    {
+        AbstractSocket::setWriteNotificationEnabled(enabled);
+        return;
+    }
+    if (!m_writeNotifier)
+    {
+        if (!enabled)
+        {
+            return;
+        }
+        m_writeNotifier.reset(new QSocketNotifier(m_socket.socketDescriptor(), QSocketNotifier::Write));
+        connect(m_writeNotifier.get(), &QSocketNotifier::activated, this, [this]()
+                                                                           {
+                                                                               m_writeNotifier->setEnabled(false);
+                                                                               emit readyWrite();
+                                                                           });
+    }
+    m_writeNotifier->setEnabled(enabled);
+}
+
+
+qintptr UdpSocket::socketDescriptor() const
+{
+    return m_socket.socketDescriptor();
 }
 
 
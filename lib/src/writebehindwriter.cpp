@@ -0,0 +1,279 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#include "qtftp/writebehindwriter.h"
+#include <QSaveFile>
+#ifdef __linux__
+#include <fcntl.h>
+#endif
+#include <cerrno>
+
+namespace QTFTP
+{
+
+UploadFile::UploadFile(const QString &targetPath, qint64 expectedSize) : m_targetPath(targetPath),
+                                                                         m_expectedSize(expectedSize),
+                                                                         m_queuedBytes(0),
+                                                                         m_failed(false)
+{
+}
+
+
+UploadFile::~UploadFile() = default;
+
+
+/**
+ * @brief UploadFile::targetPath get the path the file will have after it was committed
+ */
+const QString &UploadFile::targetPath() const
+{
+    return m_targetPath;
+}
+
+
+/**
+ * @brief UploadFile::queuedBytes get the nr of bytes that were handed to the writer but are not written to disk yet
+ */
+uint64_t UploadFile::queuedBytes() const
+{
+    return m_queuedBytes.load(std::memory_order_relaxed);
+}
+
+
+/**
+ * @brief UploadFile::hasFailed check if opening or writing the file failed, see errorString()
+ */
+bool UploadFile::hasFailed() const
+{
+    return m_failed.load(std::memory_order_acquire);
+}
+
+
+QString UploadFile::errorString() const
+{
+    std::lock_guard<std::mutex> lock(m_errorMutex);
+    return m_errorString;
+}
+
+
+void UploadFile::setFailed(const QString &errorString)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_errorMutex);
+        if (m_errorString.isEmpty())
+        {
+            m_errorString = errorString;
+        }
+    }
+    m_failed.store(true, std::memory_order_release);
+}
+
+
+
+WriteBehindWriter::WriteBehindWriter() : m_stop(false)
+{
+    m_thread = std::thread(&WriteBehindWriter::run, this);
+}
+
+
+/**
+ * @brief WriteBehindWriter::~WriteBehindWriter write all queued data, then stop the writer thread
+ */
+WriteBehindWriter::~WriteBehindWriter()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_jobAvailable.notify_one();
+    m_thread.join();
+}
+
+
+/**
+ * @brief WriteBehindWriter::open start a new upload
+ * @param targetPath path of the file that is uploaded, an existing file is replaced when the upload is committed
+ * @param expectedSize size of the upload if known, disk space for it is reserved. 0 if unknown.
+ * @return handle to pass to write(), commit() and discard()
+ *
+ * The file is opened by the writer thread. If that fails, the handle reports the error in UploadFile::hasFailed().
+ */
+std::shared_ptr<UploadFile> WriteBehindWriter::open(const QString &targetPath, qint64 expectedSize)
+{
+    auto file = std::make_shared<UploadFile>(targetPath, expectedSize);
+    enqueue( Job{Job::Type::Open, file, QByteArray()} );
+    return file;
+}
+
+
+/**
+ * @brief WriteBehindWriter::write append \p data to \p file
+ *
+ * UploadFile::bytesWritten() is emitted when the data was written.
+ */
+void WriteBehindWriter::write(const std::shared_ptr<UploadFile> &file, const QByteArray &data)
+{
+    file->m_queuedBytes.fetch_add(static_cast<uint64_t>(data.size()), std::memory_order_relaxed);
+    enqueue( Job{Job::Type::Write, file, data} );
+}
+
+
+/**
+ * @brief WriteBehindWriter::commit finish the upload when all queued data is written
+ *
+ * The temporary file is renamed to the target path. UploadFile::committed() reports the result.
+ */
+void WriteBehindWriter::commit(const std::shared_ptr<UploadFile> &file)
+{
+    enqueue( Job{Job::Type::Commit, file, QByteArray()} );
+}
+
+
+/**
+ * @brief WriteBehindWriter::discard abort the upload, the temporary file is removed and the target is not touched
+ */
+void WriteBehindWriter::discard(const std::shared_ptr<UploadFile> &file)
+{
+    enqueue( Job{Job::Type::Discard, file, QByteArray()} );
+}
+
+
+void WriteBehindWriter::enqueue(WriteBehindWriter::Job &&job)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_jobs.push_back(std::move(job));
+    }
+    m_jobAvailable.notify_one();
+}
+
+
+/**
+ * @brief WriteBehindWriter::run main loop of the writer thread
+ *
+ * Write jobs for the same file that are queued one after another are merged into one write of at most
+ * MaxWriteSize bytes.
+ */
+void WriteBehindWriter::run()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true)
+    {
+        m_jobAvailable.wait(lock, [this]() { return m_stop || !m_jobs.empty(); });
+        if (m_jobs.empty())
+        {
+            //stop requested and all jobs done
+            return;
+        }
+
+        Job job = std::move(m_jobs.front());
+        m_jobs.pop_front();
+        if (job.m_type == Job::Type::Write)
+        {
+            while (!m_jobs.empty() && m_jobs.front().m_type == Job::Type::Write && m_jobs.front().m_file == job.m_file &&
+                   job.m_data.size() + m_jobs.front().m_data.size() <= MaxWriteSize)
+            {
+                job.m_data.append(m_jobs.front().m_data);
+                m_jobs.pop_front();
+            }
+        }
+        lock.unlock();
+
+        UploadFile &file = *job.m_file;
+        switch (job.m_type)
+        {
+            case Job::Type::Open:
+                doOpen(file);
+                break;
+            case Job::Type::Write:
+                doWrite(file, job.m_data);
+                break;
+            case Job::Type::Commit:
+                doCommit(file);
+                break;
+            case Job::Type::Discard:
+                //QSaveFile removes its temporary file when destroyed without commit
+                file.m_file.reset();
+                break;
+        }
+        job.m_file.reset();
+
+        lock.lock();
+    }
+}
+
+
+void WriteBehindWriter::doOpen(UploadFile &file)
+{
+    file.m_file.reset(new QSaveFile(file.m_targetPath));
+    if ( ! file.m_file->open(QIODevice::WriteOnly) )
+    {
+        file.setFailed(file.m_file->errorString());
+        file.m_file.reset();
+        return;
+    }
+
+#ifdef __linux__
+    if (file.m_expectedSize > 0)
+    {
+        //reserve the blocks up front, so the file is not fragmented and a full disk is detected before any data arrives
+        if (fallocate(file.m_file->handle(), FALLOC_FL_KEEP_SIZE, 0, file.m_expectedSize) == -1 && errno == ENOSPC)
+        {
+            file.setFailed(QObject::tr("Not enough disk space for %1 bytes").arg(file.m_expectedSize));
+            file.m_file.reset();
+        }
+    }
+#endif
+}
+
+
+void WriteBehindWriter::doWrite(UploadFile &file, const QByteArray &data)
+{
+    if (file.m_file && file.m_file->write(data) != data.size())
+    {
+        file.setFailed(file.m_file->errorString());
+        file.m_file.reset();
+    }
+
+    file.m_queuedBytes.fetch_sub(static_cast<uint64_t>(data.size()), std::memory_order_relaxed);
+    emit file.bytesWritten();
+}
+
+
+void WriteBehindWriter::doCommit(UploadFile &file)
+{
+    if (file.m_file && ! file.m_file->commit())
+    {
+        file.setFailed(file.m_file->errorString());
+    }
+    file.m_file.reset();
+
+    if (file.hasFailed())
+    {
+        emit file.committed(false, file.errorString());
+    }
+    else
+    {
+        emit file.committed(true, QString());
+    }
+}
+
+
+} // QTFTP namespace end
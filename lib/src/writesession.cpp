@@ -0,0 +1,610 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#include "qtftp/writesession.h"
+#include "qtftp/tftp_utils.h"
+#include "qtftp/tftp_constants.h"
+#include "qtftp/metrics.h"
+#include <QDir>
+#include <QFileInfo>
+#include <QStorageInfo>
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <arpa/inet.h>
+#endif
+#include <algorithm>
+#include <cassert>
+
+namespace QTFTP
+{
+
+constexpr unsigned int WriteSession::MaxWindowSize;
+constexpr int WriteSession::WriteBatchSize;
+constexpr uint64_t WriteSession::MaxQueuedBytes;
+
+
+/**
+ * @brief WriteSession::WriteSession
+ * @param peerAddr
+ * @param peerPort
+ * @param wrqDatagram must contain a WRQ packet
+ * @param filesDir directory in which the uploaded file is stored
+ * @param writer writes the received data to disk
+ * @param socketFactory
+ * @param metrics metrics of the binding that received the WRQ, may be null
+ * @param localAddr address the session socket is bound to, the address the WRQ was sent to
+ *
+ * A WriteRequest package has the same layout as a ReadRequest package, with opcode 2. Options (RFC2347)
+ * blksize, tsize, timeout and windowsize (RFC7440) are supported.
+ */
+WriteSession::WriteSession(const QHostAddress &peerAddr, uint16_t peerPort, QByteArray wrqDatagram, QString filesDir,
+                           std::shared_ptr<WriteBehindWriter> writer, std::shared_ptr<UdpSocketFactory> socketFactory,
+                           std::shared_ptr<BindingMetrics> metrics, const QHostAddress &localAddr) : Session(peerAddr, peerPort, socketFactory, metrics, localAddr),
+                                                                      m_writer(writer),
+                                                                      m_blockNr(0),
+                                                                      m_blockSize(DefaultTftpBlockSize),
+                                                                      m_windowSize(1),
+                                                                      m_blocksInWindow(0),
+                                                                      m_expectedSize(0),
+                                                                      m_bytesReceived(0),
+                                                                      m_pendingCr(false),
+                                                                      m_gapAcked(false),
+                                                                      m_ackDeferred(false),
+                                                                      m_lastBlockReceived(false)
+{
+    unsigned int optionsOffset = 0;
+    if ( ! parseWrq(wrqDatagram, filesDir, optionsOffset) )
+    {
+        return;
+    }
+
+    bool oackSent = handleWrqOptions(wrqDatagram, optionsOffset);
+    if (state() == State::InError)
+    {
+        return;
+    }
+
+    m_uploadFile = m_writer->open(filePath(), m_expectedSize);
+    connect(m_uploadFile.get(), &UploadFile::bytesWritten, this, &WriteSession::handleBytesWritten);
+    connect(m_uploadFile.get(), &UploadFile::committed, this, &WriteSession::handleCommitted);
+    m_writeBuffer.reserve(WriteBatchSize + static_cast<int>(m_blockSize));
+
+    if (!oackSent)
+    {
+        sendAck(0);
+    }
+}
+
+
+/**
+ * @brief WriteSession::~WriteSession an upload that was not received completely is discarded
+ */
+WriteSession::~WriteSession()
+{
+    if (m_uploadFile && !m_lastBlockReceived)
+    {
+        m_writer->discard(m_uploadFile);
+    }
+}
+
+
+/**
+ * @brief WriteSession::currBlockNr get the number of the last data block that was received in sequence
+ */
+uint16_t WriteSession::currBlockNr() const
+{
+    return m_blockNr;
+}
+
+
+/**
+ * @brief WriteSession::blockSize get the negotiated block size of this session
+ */
+unsigned int WriteSession::blockSize() const
+{
+    return m_blockSize;
+}
+
+
+/**
+ * @brief WriteSession::windowSize get the nr of data blocks the peer may send before it waits for an ACK
+ */
+unsigned int WriteSession::windowSize() const
+{
+    return m_windowSize;
+}
+
+
+/**
+ * @brief WriteSession::bytesReceived get the nr of file bytes received so far, excluding duplicates
+ */
+uint64_t WriteSession::bytesReceived() const
+{
+    return m_bytesReceived;
+}
+
+
+/**
+ * @brief WriteSession::parseWrq read file name and transfer mode from a WRQ and check if the file may be written
+ * @param wrqDatagram must contain a WRQ packet
+ * @param filesDir directory in which the file will be stored
+ * @param optionsOffset if successful, the offset of the first option in \p wrqDatagram will be stored in this parameter
+ * @return true if the upload may start. If false, an error datagram was sent to the peer and the session is in error.
+ */
+bool WriteSession::parseWrq(const QByteArray &wrqDatagram, const QString &filesDir, unsigned int &optionsOffset)
+{
+    assert( ntohs( readWordInByteArray(wrqDatagram, 0) ) == TftpCode::TFTP_WRQ );
+
+    //the file name may contain multi-byte characters, so find the terminating zeroes in the raw bytes
+    int fileNameEnd = wrqDatagram.indexOf('\0', 2);
+    int modeEnd = (fileNameEnd < 0) ? -1 : wrqDatagram.indexOf('\0', fileNameEnd + 1);
+    QString recvdFileName = (fileNameEnd < 0) ? QString() : QString(wrqDatagram.mid(2, fileNameEnd - 2));
+    QString mode = (modeEnd < 0) ? QString() : QString(wrqDatagram.mid(fileNameEnd + 1, modeEnd - fileNameEnd - 1)).toLower();
+    if ( mode == "netascii" )
+    {
+        setTransferMode(TftpCode::NetAscii);
+    }
+    else if ( mode == "octet" )
+    {
+        setTransferMode(TftpCode::Octet);
+    }
+    else
+    {
+        setState(State::InError, QString("WRQ contains unsupported transfer mode ")+mode);
+        QByteArray errorDgram = assembleTftpErrorDatagram(TftpCode::IllegalOp, "Illegal transfer mode");
+        sendDatagram(errorDgram);
+        return false;
+    }
+
+    //the uploaded file must end up inside filesDir
+    QDir filesDirectory(filesDir);
+    QString targetPath = QDir::cleanPath( filesDirectory.absoluteFilePath(recvdFileName) );
+    if (recvdFileName.isEmpty() || !targetPath.startsWith(QDir::cleanPath(filesDirectory.absolutePath()) + '/'))
+    {
+        setState(State::InError, QString("WRQ for file outside files directory: ")+recvdFileName);
+        QByteArray errorDgram = assembleTftpErrorDatagram(TftpCode::AccessViolation, "Access violation");
+        sendDatagram(errorDgram);
+        return false;
+    }
+    setFilePath(filesDir, recvdFileName);
+
+    QFileInfo targetInfo(targetPath);
+    QFileInfo targetDirInfo(targetInfo.absolutePath());
+    if ( !targetDirInfo.isDir() || !targetDirInfo.isWritable() || (targetInfo.exists() && (targetInfo.isDir() || !targetInfo.isWritable())) )
+    {
+        setState(State::InError, "File can not be written");
+        QByteArray errorDgram = assembleTftpErrorDatagram(TftpCode::AccessViolation, "Access violation");
+        sendDatagram(errorDgram);
+        return false;
+    }
+
+    optionsOffset = static_cast<unsigned int>(modeEnd) + 1;
+    return true;
+}
+
+
+/**
+ * @brief WriteSession::handleWrqOptions handle options appended after TFTP WRQ according to RFC2347
+ * @param wrqDgram tftp Write Request datagram
+ * @param offset offset where possible options start
+ * @return true if options were present and an OACK was sent. False if no (recognised) options were present.
+ *
+ * If the peer announces a tsize that does not fit on the disk, an error datagram is sent and the session is in error.
+ */
+bool WriteSession::handleWrqOptions(const QByteArray &wrqDgram, unsigned int offset)
+{
+    unsigned int maxOffset = static_cast<unsigned int>(wrqDgram.size()) - 1;
+    QByteArray oackDatagram(2, 0);
+    assignWordInByteArray(oackDatagram, 0, htons(TftpCode::TFTP_OACK));
+    auto acknowledgeOption = [&oackDatagram](const QString &optionName, const QString &optionValue)
+                             {
+                                 oackDatagram.append(static_cast<const char*>(optionName.toLatin1()));
+                                 oackDatagram.append(char(0x0));
+                                 oackDatagram.append(static_cast<const char*>(optionValue.toLatin1()));
+                                 oackDatagram.append(char(0x0));
+                             };
+
+    while (offset < maxOffset)
+    {
+        int nameEnd = wrqDgram.indexOf('\0', static_cast<int>(offset));
+        int valueEnd = (nameEnd < 0) ? -1 : wrqDgram.indexOf('\0', nameEnd + 1);
+        if (valueEnd < 0)
+        {
+            break;
+        }
+        QString optionName = QString(wrqDgram.mid(static_cast<int>(offset), nameEnd - static_cast<int>(offset))).toLower();
+        QString optionValueStr = QString(wrqDgram.mid(nameEnd + 1, valueEnd - nameEnd - 1));
+        offset = static_cast<unsigned int>(valueEnd) + 1;
+        bool convOk;
+        if (optionName == "blksize")
+        {
+            //RFC2348
+            unsigned int blockSize = optionValueStr.toUInt(&convOk, 10);
+            if (!convOk || blockSize<8 || blockSize>65464)
+            {
+                continue;
+            }
+            m_blockSize = blockSize;
+            acknowledgeOption(optionName, optionValueStr);
+        }
+        else if (optionName == "timeout")
+        {
+            //RFC2349
+            unsigned int retransmitTimeout = optionValueStr.toUInt(&convOk, 10);
+            if (!convOk || retransmitTimeout<1 || retransmitTimeout>255)
+            {
+                continue;
+            }
+            setRetransmitTimeOut(retransmitTimeout * 1000);
+            acknowledgeOption(optionName, optionValueStr);
+        }
+        else if (optionName == "tsize")
+        {
+            //RFC2349, for a WRQ the peer tells the size of the file it will send
+            qint64 tsize = optionValueStr.toLongLong(&convOk, 10);
+            if (!convOk || tsize < 0)
+            {
+                continue;
+            }
+            QStorageInfo storage(QFileInfo(filePath()).absolutePath());
+            if (storage.isValid() && tsize > storage.bytesAvailable())
+            {
+                setState(State::InError, QString("Not enough disk space for upload of %1 bytes").arg(tsize));
+                QByteArray errorDgram = assembleTftpErrorDatagram(TftpCode::DiskFull, "Disk full");
+                sendDatagram(errorDgram);
+                return false;
+            }
+            m_expectedSize = tsize;
+            acknowledgeOption(optionName, optionValueStr);
+        }
+        else if (optionName == "windowsize")
+        {
+            //RFC7440
+            unsigned int windowSize = optionValueStr.toUInt(&convOk, 10);
+            if (!convOk || windowSize<1 || windowSize>65535)
+            {
+                continue;
+            }
+            m_windowSize = std::min(windowSize, MaxWindowSize);
+            acknowledgeOption(optionName, QString::number(m_windowSize));
+        }
+    }
+
+    if (static_cast<unsigned long>(oackDatagram.size()) > sizeof(u_int16_t))
+    {
+        m_oackDatagram = oackDatagram;
+        sendDatagram(m_oackDatagram, true);
+        setState(State::OptionsNegotation);
+        return true;
+    }
+
+    return false;
+}
+
+
+/**
+ * @brief WriteSession::dataReceived handles incoming data for this write session
+ *
+ * Only DATA datagrams are expected. A peer may abort the upload with an ERROR datagram.
+ */
+void WriteSession::dataReceived()
+{
+    if (state() == State::InError)
+    {
+        //we already send an error response, ignore further datagrams
+        return;
+    }
+
+    QByteArray datagram;
+    readDatagram(datagram);
+    if (state() == State::Finished)
+    {
+        //peer did not receive the final ACK yet, the session will be removed
+        return;
+    }
+
+    if (datagram.size() < 4)
+    {
+        abortUpload(TftpCode::Undefined, "Malformed datagram");
+        return;
+    }
+
+    uint16_t opCode =  ntohs( readWordInByteArray(datagram, 0) );
+    if (opCode == TftpCode::TFTP_ERROR)
+    {
+        if (m_uploadFile)
+        {
+            m_writer->discard(m_uploadFile);
+            m_uploadFile.reset();
+        }
+        setState(State::InError, QString("Upload aborted by peer: ") + QString(datagram.constData() + 4));
+        return;
+    }
+    if (opCode != TftpCode::TFTP_DATA)
+    {
+        abortUpload(TftpCode::IllegalOp, "Unexpected TFTP opcode");
+        return;
+    }
+
+    handleData(ntohs( readWordInByteArray(datagram, 2) ), datagram);
+}
+
+
+/**
+ * @brief WriteSession::handleData process a DATA datagram from the peer
+ * @param blockNr block number in the DATA datagram
+ * @param datagram the complete DATA datagram
+ *
+ * Blocks are acknowledged per window. A block that does not follow the last block received in sequence is dropped,
+ * the first one after a gap is answered with an ACK of the last block in sequence, so the peer resends from there.
+ */
+void WriteSession::handleData(uint16_t blockNr, const QByteArray &datagram)
+{
+    if (m_lastBlockReceived)
+    {
+        //the final ACK is sent when the file has been committed
+        return;
+    }
+
+    if (blockNr != static_cast<uint16_t>(m_blockNr + 1))
+    {
+        if (m_ackDeferred)
+        {
+            return;
+        }
+        if (blockNr == m_blockNr && m_blockNr > 0)
+        {
+            //duplicate of the last block received, our ACK may have been lost
+            sendAck(m_blockNr);
+        }
+        else if (static_cast<int16_t>(blockNr - m_blockNr) > 0 && !m_gapAcked)
+        {
+            sendAck(m_blockNr);
+            m_gapAcked = true;
+        }
+        return;
+    }
+
+    auto payloadSize = static_cast<unsigned int>(datagram.size() - 4);
+    if (payloadSize > m_blockSize)
+    {
+        abortUpload(TftpCode::IllegalOp, "Data block larger than block size");
+        return;
+    }
+    if (m_uploadFile->hasFailed())
+    {
+        abortUpload(TftpCode::DiskFull, m_uploadFile->errorString());
+        return;
+    }
+    if (state() == State::OptionsNegotation)
+    {
+        //first DATA block acknowledges our OACK
+        setState(State::Busy);
+    }
+
+    m_blockNr = blockNr;
+    m_gapAcked = false;
+    ++m_blocksInWindow;
+    resetRetransmitCounter();
+    m_bytesReceived += payloadSize;
+    if (metrics())
+    {
+        metrics()->m_bytesReceived.add(payloadSize);
+    }
+    appendToWriteBuffer(datagram.constData() + 4, static_cast<int>(payloadSize));
+
+    if (payloadSize < m_blockSize)
+    {
+        //last block, acknowledge it when the file is on disk
+        m_lastBlockReceived = true;
+        if (m_pendingCr)
+        {
+            m_writeBuffer.append('\r');
+        }
+        flushWriteBuffer();
+        stopRetransmitTimer();
+        m_writer->commit(m_uploadFile);
+        return;
+    }
+
+    if (m_writeBuffer.size() >= WriteBatchSize)
+    {
+        flushWriteBuffer();
+    }
+
+    if (m_blocksInWindow < m_windowSize)
+    {
+        //wait for the rest of the window, but not longer than the retransmit time-out
+        startRetransmitTimer();
+    }
+    else if (m_uploadFile->queuedBytes() > MaxQueuedBytes)
+    {
+        //let the peer wait until the disk caught up
+        m_ackDeferred = true;
+        stopRetransmitTimer();
+    }
+    else
+    {
+        sendAck(m_blockNr);
+    }
+}
+
+
+/**
+ * @brief WriteSession::appendToWriteBuffer add received file data to the write buffer
+ *
+ * In netascii mode CR,LF is stored as LF and CR,NUL as CR. A CR at the end of a block is kept back until the
+ * next block shows what follows it.
+ */
+void WriteSession::appendToWriteBuffer(const char *data, int size)
+{
+    if (transferMode() != TftpCode::NetAscii)
+    {
+        m_writeBuffer.append(data, size);
+        return;
+    }
+
+    for (int i=0; i<size; ++i)
+    {
+        char nextChar = data[i];
+        if (m_pendingCr)
+        {
+            m_pendingCr = false;
+            if (nextChar == '\n')
+            {
+                m_writeBuffer.append('\n');
+                continue;
+            }
+            m_writeBuffer.append('\r');
+            if (nextChar == '\0')
+            {
+                continue;
+            }
+        }
+
+        if (nextChar == '\r')
+        {
+            m_pendingCr = true;
+        }
+        else
+        {
+            m_writeBuffer.append(nextChar);
+        }
+    }
+}
+
+
+/**
+ * @brief WriteSession::flushWriteBuffer hand the collected data to the writer thread
+ */
+void WriteSession::flushWriteBuffer()
+{
+    if (m_writeBuffer.isEmpty())
+    {
+        return;
+    }
+
+    m_writer->write(m_uploadFile, m_writeBuffer);
+    m_writeBuffer = QByteArray();
+    m_writeBuffer.reserve(WriteBatchSize + static_cast<int>(m_blockSize));
+}
+
+
+/**
+ * @brief WriteSession::sendAck send an ACK datagram and start the retransmit timer
+ */
+void WriteSession::sendAck(uint16_t blockNr)
+{
+    QByteArray ackDatagram(4, 0);
+    assignWordInByteArray(ackDatagram, 0, htons(TftpCode::TFTP_ACK));
+    assignWordInByteArray(ackDatagram, 2, htons(blockNr));
+    m_blocksInWindow = 0;
+    sendDatagram(ackDatagram, true);
+}
+
+
+/**
+ * @brief WriteSession::retransmitData send the OACK or the ACK of the last block received in sequence again
+ */
+void WriteSession::retransmitData()
+{
+    if (state() == State::OptionsNegotation)
+    {
+        sendDatagram(m_oackDatagram, true);
+    }
+    else
+    {
+        sendAck(m_blockNr);
+    }
+}
+
+
+/**
+ * @brief WriteSession::handleBytesWritten called when the writer thread wrote data of this session
+ */
+void WriteSession::handleBytesWritten()
+{
+    if (state() == State::InError || state() == State::Finished || m_lastBlockReceived)
+    {
+        return;
+    }
+
+    if (m_uploadFile->hasFailed())
+    {
+        abortUpload(TftpCode::DiskFull, m_uploadFile->errorString());
+        return;
+    }
+    if (m_ackDeferred && m_uploadFile->queuedBytes() <= MaxQueuedBytes)
+    {
+        m_ackDeferred = false;
+        sendAck(m_blockNr);
+    }
+}
+
+
+/**
+ * @brief WriteSession::handleCommitted called when the uploaded file was renamed to its target name, or that failed
+ *
+ * Only now the last block is acknowledged, so the peer learns if its file was actually stored.
+ */
+void WriteSession::handleCommitted(bool success, QString errorString)
+{
+    if (state() == State::InError)
+    {
+        return;
+    }
+    m_uploadFile.reset();
+
+    if (!success)
+    {
+        QByteArray errorDgram = assembleTftpErrorDatagram(TftpCode::DiskFull, errorString);
+        sendDatagram(errorDgram);
+        setState(State::InError, QString("Could not store uploaded file: ") + errorString);
+        return;
+    }
+
+    QByteArray ackDatagram(4, 0);
+    assignWordInByteArray(ackDatagram, 0, htons(TftpCode::TFTP_ACK));
+    assignWordInByteArray(ackDatagram, 2, htons(m_blockNr));
+    sendDatagram(ackDatagram);
+    setState(State::Finished);
+}
+
+
+/**
+ * @brief WriteSession::abortUpload end the session with an error and discard the data received so far
+ */
+void WriteSession::abortUpload(TftpCode::ErrorCode errorCode, const QString &errorMsg)
+{
+    stopRetransmitTimer();
+    if (m_uploadFile)
+    {
+        m_writer->discard(m_uploadFile);
+        m_uploadFile.reset();
+    }
+    //the session may be destroyed when its state changes, so send the error datagram first
+    QByteArray errorDgram = assembleTftpErrorDatagram(errorCode, errorMsg);
+    sendDatagram(errorDgram);
+    setState(State::InError, errorMsg);
+}
+
+
+} // QTFTP namespace end
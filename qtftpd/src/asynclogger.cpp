@@ -0,0 +1,251 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#include "asynclogger.h"
+#include <QtGlobal>
+#ifdef Q_OS_LINUX
+#include <systemd/sd-journal.h>
+#include <sys/uio.h>
+#endif
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+constexpr unsigned int AsyncLogger::MaxBatchSize;
+
+static constexpr std::chrono::milliseconds MaxIdleWait(100);
+
+
+LogRecord::LogRecord() : m_severity(0),
+                         m_hasTransferFields(false),
+                         m_bytesSent(0),
+                         m_durationMs(0),
+                         m_retransmits(0),
+                         m_sessionId(0)
+{
+}
+
+LogRecord::LogRecord(int severity, const std::string &message) : m_severity(severity),
+                                                                 m_message(message),
+                                                                 m_hasTransferFields(false),
+                                                                 m_bytesSent(0),
+                                                                 m_durationMs(0),
+                                                                 m_retransmits(0),
+                                                                 m_sessionId(0)
+{
+}
+
+
+/**
+ * @brief AsyncLogger::AsyncLogger create logger and start its background thread
+ * @param queueCapacity max nr of records waiting to be written, rounded up to a power of 2
+ */
+AsyncLogger::AsyncLogger(unsigned int queueCapacity, bool logToStderr, bool logToSystem) : m_mask(0),
+                                                                                           m_enqueuePos(0),
+                                                                                           m_dequeuePos(0),
+                                                                                           m_droppedCount(0),
+                                                                                           m_reportedDropCount(0),
+                                                                                           m_logToStderr(logToStderr),
+                                                                                           m_logToSystem(logToSystem),
+                                                                                           m_stopRequested(false)
+{
+    size_t capacity = 2;
+    while (capacity < queueCapacity)
+    {
+        capacity *= 2;
+    }
+    m_mask = capacity - 1;
+    m_slots.reset(new Slot[capacity]);
+    for (size_t index=0; index<capacity; ++index)
+    {
+        m_slots[index].m_sequence.store(index, std::memory_order_relaxed);
+    }
+
+    m_drainThread = std::thread(&AsyncLogger::drainQueue, this);
+}
+
+
+AsyncLogger::~AsyncLogger()
+{
+    stop();
+}
+
+
+/**
+ * @brief AsyncLogger::log queue a record for writing, never blocks
+ * @return false if the queue was full and the record was dropped
+ *
+ * May be called from any thread.
+ */
+bool AsyncLogger::log(LogRecord record)
+{
+    size_t position = m_enqueuePos.load(std::memory_order_relaxed);
+    Slot *slot = nullptr;
+    for (;;)
+    {
+        slot = &m_slots[position & m_mask];
+        size_t sequence = slot->m_sequence.load(std::memory_order_acquire);
+        auto difference = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(position);
+        if (difference == 0)
+        {
+            if (m_enqueuePos.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (difference < 0)
+        {
+            //queue full
+            m_droppedCount.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        else
+        {
+            position = m_enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+
+    slot->m_record = std::move(record);
+    slot->m_sequence.store(position + 1, std::memory_order_release);
+    m_wakeUp.notify_one();
+    return true;
+}
+
+
+uint64_t AsyncLogger::droppedCount() const
+{
+    return m_droppedCount.load(std::memory_order_relaxed);
+}
+
+
+/**
+ * @brief AsyncLogger::stop write all queued records and stop the background thread
+ *
+ * Records logged after stop() are not written.
+ */
+void AsyncLogger::stop()
+{
+    if (!m_drainThread.joinable())
+    {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> wakeUpLock(m_wakeUpMutex);
+        m_stopRequested.store(true);
+    }
+    m_wakeUp.notify_one();
+    m_drainThread.join();
+}
+
+
+bool AsyncLogger::pop(LogRecord &record)
+{
+    Slot &slot = m_slots[m_dequeuePos & m_mask];
+    if (slot.m_sequence.load(std::memory_order_acquire) != m_dequeuePos + 1)
+    {
+        return false;
+    }
+    record = std::move(slot.m_record);
+    slot.m_sequence.store(m_dequeuePos + m_mask + 1, std::memory_order_release);
+    ++m_dequeuePos;
+    return true;
+}
+
+
+void AsyncLogger::drainQueue()
+{
+    std::vector<LogRecord> batch(MaxBatchSize + 1);
+    for (;;)
+    {
+        unsigned int batchSize = 0;
+        while (batchSize < MaxBatchSize && pop(batch[batchSize]))
+        {
+            ++batchSize;
+        }
+
+        uint64_t droppedCount = m_droppedCount.load(std::memory_order_relaxed);
+        if (droppedCount != m_reportedDropCount)
+        {
+            batch[batchSize++] = LogRecord(LOG_WARNING, std::to_string(droppedCount - m_reportedDropCount) + " log message(s) dropped because the log queue was full");
+            m_reportedDropCount = droppedCount;
+        }
+
+        if (batchSize > 0)
+        {
+            writeBatch(batch.data(), batchSize);
+            continue;
+        }
+
+        if (m_stopRequested.load())
+        {
+            return;
+        }
+        std::unique_lock<std::mutex> wakeUpLock(m_wakeUpMutex);
+        //time-out because producers notify without holding the mutex, so a wake-up can be missed
+        m_wakeUp.wait_for(wakeUpLock, MaxIdleWait);
+    }
+}
+
+
+void AsyncLogger::writeBatch(const LogRecord *records, unsigned int nrOfRecords)
+{
+    if (m_logToStderr)
+    {
+        std::string stderrOutput;
+        for (unsigned int index=0; index<nrOfRecords; ++index)
+        {
+            stderrOutput += records[index].m_message;
+            stderrOutput += '\n';
+        }
+        std::cerr << stderrOutput << std::flush;
+    }
+
+#ifdef Q_OS_LINUX
+    if (m_logToSystem)
+    {
+        std::vector<std::string> fields;
+        std::vector<struct iovec> fieldVector;
+        for (unsigned int index=0; index<nrOfRecords; ++index)
+        {
+            const LogRecord &record = records[index];
+            fields.clear();
+            fields.push_back("MESSAGE=" + record.m_message);
+            fields.push_back("PRIORITY=" + std::to_string(record.m_severity));
+            if (record.m_hasTransferFields)
+            {
+                fields.push_back("QTFTP_PEER=" + record.m_peer);
+                fields.push_back("QTFTP_FILE=" + record.m_file);
+                fields.push_back("QTFTP_BYTES_SENT=" + std::to_string(record.m_bytesSent));
+                fields.push_back("QTFTP_DURATION_MS=" + std::to_string(record.m_durationMs));
+                fields.push_back("QTFTP_RETRANSMITS=" + std::to_string(record.m_retransmits));
+                fields.push_back("QTFTP_SESSION_ID=" + std::to_string(record.m_sessionId));
+            }
+            fieldVector.clear();
+            for (auto &nextField : fields)
+            {
+                fieldVector.push_back( { &nextField[0], nextField.size() } );
+            }
+            sd_journal_sendv(fieldVector.data(), static_cast<int>(fieldVector.size()));
+        }
+    }
+#else
+    Q_UNUSED(m_logToSystem)
+#endif
+}
@@ -0,0 +1,99 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#ifndef ASYNCLOGGER_H
+#define ASYNCLOGGER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/**
+ * @brief The LogRecord struct is one log message with optional structured fields of a TFTP transfer
+ */
+struct LogRecord
+{
+    public:
+        LogRecord();
+        LogRecord(int severity, const std::string &message);
+
+        int         m_severity;     /// syslog priority (LOG_ERR, LOG_INFO, ...)
+        std::string m_message;
+        bool        m_hasTransferFields;
+        std::string m_peer;
+        std::string m_file;
+        uint64_t    m_bytesSent;
+        int64_t     m_durationMs;
+        uint32_t    m_retransmits;
+        uint32_t    m_sessionId;
+};
+
+
+/**
+ * @brief The AsyncLogger class writes log records to stderr and/or the system journal from a background thread
+ *
+ * Producers put records in a bounded lock-free queue and never block. The background thread drains the queue
+ * in batches. When the queue is full the record is dropped and counted; the nr of dropped records is reported
+ * in the log as soon as there is room again.
+ */
+class AsyncLogger
+{
+    public:
+        static constexpr unsigned int MaxBatchSize = 64;
+
+        AsyncLogger(unsigned int queueCapacity, bool logToStderr, bool logToSystem);
+        ~AsyncLogger();
+        AsyncLogger(const AsyncLogger &) = delete;
+        AsyncLogger &operator=(const AsyncLogger &) = delete;
+
+        bool log(LogRecord record);
+        uint64_t droppedCount() const;
+        void stop();
+
+    private:
+        struct Slot
+        {
+            std::atomic<size_t> m_sequence;
+            LogRecord           m_record;
+        };
+
+        bool pop(LogRecord &record);
+        void drainQueue();
+        void writeBatch(const LogRecord *records, unsigned int nrOfRecords);
+
+        std::unique_ptr<Slot[]> m_slots;
+        size_t                  m_mask;
+        std::atomic<size_t>     m_enqueuePos;
+        size_t                  m_dequeuePos;        /// only used by the background thread
+        std::atomic<uint64_t>   m_droppedCount;
+        uint64_t                m_reportedDropCount; /// only used by the background thread
+        bool                    m_logToStderr;
+        bool                    m_logToSystem;
+        std::atomic<bool>       m_stopRequested;
+        std::mutex              m_wakeUpMutex;
+        std::condition_variable m_wakeUp;
+        std::thread             m_drainThread;
+};
+
+#endif // ASYNCLOGGER_H
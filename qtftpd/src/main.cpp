@@ -20,8 +20,16 @@
 
 #include "qtftp/tftpserver.h"
 #include "qtftp/readsession.h"
+#include "qtftp/multicastreadsession.h"
+#include "qtftp/writesession.h"
 #include "qtftp/udpsocketfactory.h"
 #include "qtftp/tftp_error.h"
+#include "qtftp/tracering.h"
+#include "qtftp/packfile.h"
+#include "qtftp/filenamerewriter.h"
+#include "qtftp/subnetroutes.h"
+#include "metricshttpserver.h"
+#include "asynclogger.h"
 #include <QCoreApplication>
 #include <QCommandLineParser>
 #include <QHostAddress>
@@ -33,18 +41,30 @@
 #include <iostream>
 #include <limits>
 #include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <memory>
 #ifdef Q_OS_LINUX
 #include <systemd/sd-journal.h>
+#include <systemd/sd-daemon.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <pwd.h>
 #endif
+#ifdef Q_OS_UNIX
+#include <signal.h>
+#endif
 
 using namespace std::string_literals;
 
 static bool g_disableLogToStderr = false;
 static bool g_disableLogToSystem = false;
 
+static constexpr unsigned int LogQueueCapacity = 8192;
+static constexpr unsigned int DefaultLagProbeIntervalMs = 1000;
+static constexpr quint64 LagWarningThresholdUs = 1000000;
+static constexpr uint16_t DefaultMulticastPort = 1758;
+
 struct TftpBindings
 {
     public:
@@ -55,22 +75,87 @@ struct TftpBindings
         QHostAddress m_bindAddr;
         QString m_filesDir;
         bool    m_allowUploads;
+        QString m_packFile; /// empty if the binding only serves files from m_filesDir
+        std::shared_ptr<QTFTP::FileNameRewriter> m_fileNameRewriter; /// null if file names are not rewritten
+        std::shared_ptr<QTFTP::SubnetRoutes> m_subnetRoutes; /// null if all clients read from m_filesDir
+        unsigned int m_maxSessions; /// 0 if the nr of sessions of the binding is not limited
+        uint64_t m_pacingRate;      /// bytes per second, 0 if the binding is not rate limited
+        unsigned int m_schedulingWeight; /// share of the sending capacity relative to other bindings
+        int m_receiveBufferSize;    /// SO_RCVBUF of the sockets of the binding, 0 for the kernel default
+        int m_sendBufferSize;       /// SO_SNDBUF of the sockets of the binding, 0 for the kernel default
+        bool m_autoTuneBuffers;     /// raise the buffer sizes when datagrams are dropped
 };
 
 TftpBindings::TftpBindings() : m_portNr(0),
-                               m_allowUploads(false)
+                               m_allowUploads(false),
+                               m_maxSessions(0),
+                               m_pacingRate(0),
+                               m_schedulingWeight(1),
+                               m_receiveBufferSize(0),
+                               m_sendBufferSize(0),
+                               m_autoTuneBuffers(false)
 {
 }
 
 TftpBindings::TftpBindings(uint16_t portNr, const QHostAddress &bindAddr, const QString &filesDir, bool allowUploads) : m_portNr(portNr),
                                                                                                                         m_bindAddr(bindAddr),
                                                                                                                         m_filesDir(filesDir),
-                                                                                                                        m_allowUploads(allowUploads)
+                                                                                                                        m_allowUploads(allowUploads),
+                                                                                                                        m_maxSessions(0),
+                                                                                                                        m_pacingRate(0),
+                                                                                                                        m_schedulingWeight(1),
+                                                                                                                        m_receiveBufferSize(0),
+                                                                                                                        m_sendBufferSize(0),
+                                                                                                                        m_autoTuneBuffers(false)
 {
 
 }
 
 
+/**
+ * @brief The TftpdConfig struct contains all settings read from the qtftpd configuration file
+ */
+struct TftpdConfig
+{
+    public:
+        TftpdConfig();
+
+        std::vector<TftpBindings> m_bindings;
+        uint16_t     m_metricsPort;  /// 0 if the metrics HTTP endpoint is disabled
+        QHostAddress m_metricsAddr;
+        QHostAddress m_multicastAddr; /// null if multicast transfers are disabled
+        uint16_t     m_multicastPort;
+        unsigned int m_multicastGroups;
+        bool         m_wildcardBind; /// bindings with the same port share one socket bound to the wildcard address
+        unsigned int m_maxSessions;       /// 0 if the nr of sessions of all bindings together is not limited
+        unsigned int m_maxQueuedRequests;
+        unsigned int m_maxQueueWaitMs;
+        unsigned int m_maxRequestsPerSecond; /// per client address, 0 if not limited
+        uint64_t     m_pacingRate;         /// bytes per second of all sections together, 0 for no limit
+        uint64_t     m_subnetPacingRate;   /// bytes per second to each client subnet, 0 for no limit
+        uint64_t     m_sessionPacingRate;  /// bytes per second of each transfer, 0 for no limit
+        uint64_t     m_priorityFileSize;   /// downloads of files up to this size are sent first, 0 for none
+        bool         m_kernelTimestamps;   /// measure ACK delays with kernel receive timestamps
+};
+
+TftpdConfig::TftpdConfig() : m_metricsPort(0),
+                             m_metricsAddr(QHostAddress::LocalHost),
+                             m_multicastPort(DefaultMulticastPort),
+                             m_multicastGroups(1),
+                             m_wildcardBind(false),
+                             m_maxSessions(0),
+                             m_maxQueuedRequests(0),
+                             m_maxQueueWaitMs(QTFTP::TftpServer::DefaultMaxQueueWaitMs),
+                             m_maxRequestsPerSecond(0),
+                             m_pacingRate(0),
+                             m_subnetPacingRate(0),
+                             m_sessionPacingRate(0),
+                             m_priorityFileSize(0),
+                             m_kernelTimestamps(false)
+{
+}
+
+
 
 static QVariant getSectionValue(const QSettings &configFile, const QString &section, const QString &key)
 {
@@ -82,7 +167,53 @@ static QVariant getSectionValue(const QSettings &configFile, const QString &sect
     return keyValue;
 }
 
-static std::vector<TftpBindings> readConfigFile(const QString &fileName)
+/**
+ * @brief readRateValue read a rate limit in bytes per second
+ * @return 0 if \p key is not present
+ * @throw std::runtime_error if the value is not a number
+ */
+static uint64_t readRateValue(const QSettings &config, const QString &key)
+{
+    auto rateValue = config.value(key);
+    if (!rateValue.isValid())
+    {
+        return 0;
+    }
+    bool conversionOk = false;
+    uint64_t rate = rateValue.toULongLong(&conversionOk);
+    if (!conversionOk)
+    {
+        throw std::runtime_error("Config file "s + config.fileName().toStdString() + " invalid: '" + key.toStdString() + "' not a valid nr of bytes per second" );
+    }
+    return rate;
+}
+
+/**
+ * @brief readBufferSize read a socket buffer size in bytes
+ * @return 0 if \p key is not present
+ * @throw std::runtime_error if the value is not a number
+ */
+static int readBufferSize(const QSettings &config, const QString &key)
+{
+    auto sizeValue = config.value(key);
+    if (!sizeValue.isValid())
+    {
+        return 0;
+    }
+    bool conversionOk = false;
+    int bufferSize = sizeValue.toInt(&conversionOk);
+    if (!conversionOk || bufferSize < 0)
+    {
+        throw std::runtime_error("Config file "s + config.fileName().toStdString() + " invalid: '" + key.toStdString() + "' not a valid nr of bytes" );
+    }
+    return bufferSize;
+}
+
+/**
+ * @brief readConfigFile read bindings from the sections and global settings from the top of the configuration file
+ * @throw std::runtime_error if the configuration file can't be read or contains invalid settings
+ */
+static TftpdConfig readConfigFile(const QString &fileName)
 {
     QFileInfo configFileInfo(fileName);
     if (!configFileInfo.exists() || !configFileInfo.isReadable())
@@ -103,8 +234,131 @@ static std::vector<TftpBindings> readConfigFile(const QString &fileName)
     }
 #endif
 #endif
-    std::vector<TftpBindings> bindings;
+    TftpdConfig tftpdConfig;
     QSettings config(fileName, QSettings::IniFormat);
+
+    //keys before the first section are global settings
+    auto metricsPortValue = config.value("metrics_port");
+    if (metricsPortValue.isValid())
+    {
+        bool conversionOk = false;
+        uint64_t longportnr = metricsPortValue.toULongLong(&conversionOk);
+        if (!conversionOk || longportnr == 0 || longportnr > std::numeric_limits<std::uint16_t>::max())
+        {
+            throw std::runtime_error("Config file "s + fileName.toStdString() + " invalid: 'metrics_port' not a valid portnr" );
+        }
+        tftpdConfig.m_metricsPort = static_cast<uint16_t>(longportnr);
+    }
+    auto metricsAddrValue = config.value("metrics_addr");
+    if (metricsAddrValue.isValid() && !tftpdConfig.m_metricsAddr.setAddress(metricsAddrValue.toString()))
+    {
+        throw std::runtime_error("Config file "s + fileName.toStdString() + " invalid: 'metrics_addr' not a valid IP address" );
+    }
+    auto multicastAddrValue = config.value("multicast_addr");
+    if (multicastAddrValue.isValid())
+    {
+        if (!tftpdConfig.m_multicastAddr.setAddress(multicastAddrValue.toString()) ||
+            tftpdConfig.m_multicastAddr.protocol() != QAbstractSocket::IPv4Protocol || !tftpdConfig.m_multicastAddr.isMulticast())
+        {
+            throw std::runtime_error("Config file "s + fileName.toStdString() + " invalid: 'multicast_addr' not a valid IPv4 multicast address" );
+        }
+    }
+    auto multicastPortValue = config.value("multicast_port");
+    if (multicastPortValue.isValid())
+    {
+        bool conversionOk = false;
+        uint64_t longportnr = multicastPortValue.toULongLong(&conversionOk);
+        if (!conversionOk || longportnr == 0 || longportnr > std::numeric_limits<std::uint16_t>::max())
+        {
+            throw std::runtime_error("Config file "s + fileName.toStdString() + " invalid: 'multicast_port' not a valid portnr" );
+        }
+        tftpdConfig.m_multicastPort = static_cast<uint16_t>(longportnr);
+    }
+    auto multicastGroupsValue = config.value("multicast_groups");
+    if (multicastGroupsValue.isValid())
+    {
+        bool conversionOk = false;
+        tftpdConfig.m_multicastGroups = multicastGroupsValue.toUInt(&conversionOk);
+        if (!conversionOk || tftpdConfig.m_multicastGroups == 0 || tftpdConfig.m_multicastGroups > 256)
+        {
+            throw std::runtime_error("Config file "s + fileName.toStdString() + " invalid: 'multicast_groups' should be 1..256" );
+        }
+    }
+    auto wildcardBindValue = config.value("wildcard_bind");
+    if (wildcardBindValue.isValid())
+    {
+        QString wildcardBindStr = wildcardBindValue.toString().toLower();
+        if (wildcardBindStr != "true" && wildcardBindStr != "false")
+        {
+            throw std::runtime_error("Config file "s + fileName.toStdString() + " invalid: 'wildcard_bind' should be 'true' or 'false'" );
+        }
+        tftpdConfig.m_wildcardBind = (wildcardBindStr == "true");
+    }
+    auto maxSessionsValue = config.value("max_sessions");
+    if (maxSessionsValue.isValid())
+    {
+        bool conversionOk = false;
+        tftpdConfig.m_maxSessions = maxSessionsValue.toUInt(&conversionOk);
+        if (!conversionOk)
+        {
+            throw std::runtime_error("Config file "s + fileName.toStdString() + " invalid: 'max_sessions' not a valid number" );
+        }
+    }
+    auto maxQueuedRequestsValue = config.value("max_queued_requests");
+    if (maxQueuedRequestsValue.isValid())
+    {
+        bool conversionOk = false;
+        tftpdConfig.m_maxQueuedRequests = maxQueuedRequestsValue.toUInt(&conversionOk);
+        if (!conversionOk)
+        {
+            throw std::runtime_error("Config file "s + fileName.toStdString() + " invalid: 'max_queued_requests' not a valid number" );
+        }
+    }
+    auto maxQueueWaitValue = config.value("max_queue_wait_ms");
+    if (maxQueueWaitValue.isValid())
+    {
+        bool conversionOk = false;
+        tftpdConfig.m_maxQueueWaitMs = maxQueueWaitValue.toUInt(&conversionOk);
+        if (!conversionOk || tftpdConfig.m_maxQueueWaitMs == 0)
+        {
+            throw std::runtime_error("Config file "s + fileName.toStdString() + " invalid: 'max_queue_wait_ms' should be a number larger than 0" );
+        }
+    }
+    auto maxRequestsValue = config.value("max_requests_per_second");
+    if (maxRequestsValue.isValid())
+    {
+        bool conversionOk = false;
+        tftpdConfig.m_maxRequestsPerSecond = maxRequestsValue.toUInt(&conversionOk);
+        if (!conversionOk)
+        {
+            throw std::runtime_error("Config file "s + fileName.toStdString() + " invalid: 'max_requests_per_second' not a valid number" );
+        }
+    }
+
+    tftpdConfig.m_pacingRate = readRateValue(config, "pacing_rate");
+    tftpdConfig.m_subnetPacingRate = readRateValue(config, "subnet_pacing_rate");
+    tftpdConfig.m_sessionPacingRate = readRateValue(config, "session_pacing_rate");
+    auto priorityFileSizeValue = config.value("priority_file_size");
+    if (priorityFileSizeValue.isValid())
+    {
+        bool conversionOk = false;
+        tftpdConfig.m_priorityFileSize = priorityFileSizeValue.toULongLong(&conversionOk);
+        if (!conversionOk)
+        {
+            throw std::runtime_error("Config file "s + fileName.toStdString() + " invalid: 'priority_file_size' not a valid nr of bytes" );
+        }
+    }
+    auto kernelTimestampsValue = config.value("kernel_timestamps");
+    if (kernelTimestampsValue.isValid())
+    {
+        QString kernelTimestampsStr = kernelTimestampsValue.toString().toLower();
+        if (kernelTimestampsStr != "true" && kernelTimestampsStr != "false")
+        {
+            throw std::runtime_error("Config file "s + fileName.toStdString() + " invalid: 'kernel_timestamps' should be 'true' or 'false'" );
+        }
+        tftpdConfig.m_kernelTimestamps = (kernelTimestampsStr == "true");
+    }
+
     auto sections = config.childGroups();
     for (const auto &nextSection : sections)
     {
@@ -157,14 +411,104 @@ static std::vector<TftpBindings> readConfigFile(const QString &fileName)
             }
         }
 #endif
-        bindings.emplace_back(portnr, bindAddr, filesDirInfo.absoluteFilePath(), !uploadDisabled);
+        tftpdConfig.m_bindings.emplace_back(portnr, bindAddr, filesDirInfo.absoluteFilePath(), !uploadDisabled);
+        auto packValue = config.value(nextSection + "/pack_file");
+        if (packValue.isValid())
+        {
+            QFileInfo packFileInfo(packValue.toString());
+            if (!packFileInfo.isFile())
+            {
+                throw std::runtime_error("Config file "s + fileName.toStdString() + " invalid: 'pack_file' in section [" + nextSection.toStdString() + "] does not exist or not a file" );
+            }
+            tftpdConfig.m_bindings.back().m_packFile = packFileInfo.absoluteFilePath();
+        }
+        auto rewriteRulesValue = config.value(nextSection + "/rewrite_rules");
+        if (rewriteRulesValue.isValid())
+        {
+            QFileInfo rewriteRulesInfo(rewriteRulesValue.toString());
+            if (!rewriteRulesInfo.isFile())
+            {
+                throw std::runtime_error("Config file "s + fileName.toStdString() + " invalid: 'rewrite_rules' in section [" + nextSection.toStdString() + "] does not exist or not a file" );
+            }
+            auto fileNameRewriter = std::make_shared<QTFTP::FileNameRewriter>();
+            try
+            {
+                fileNameRewriter->loadRules(rewriteRulesInfo.absoluteFilePath());
+            }
+            catch (const QTFTP::TftpError &rulesErr)
+            {
+                throw std::runtime_error("Config file "s + fileName.toStdString() + " invalid: " + rulesErr.what());
+            }
+            tftpdConfig.m_bindings.back().m_fileNameRewriter = fileNameRewriter;
+        }
+        auto subnetRoutesValue = config.value(nextSection + "/subnet_routes");
+        if (subnetRoutesValue.isValid())
+        {
+            QFileInfo subnetRoutesInfo(subnetRoutesValue.toString());
+            if (!subnetRoutesInfo.isFile())
+            {
+                throw std::runtime_error("Config file "s + fileName.toStdString() + " invalid: 'subnet_routes' in section [" + nextSection.toStdString() + "] does not exist or not a file" );
+            }
+            auto subnetRoutes = std::make_shared<QTFTP::SubnetRoutes>();
+            try
+            {
+                subnetRoutes->loadRoutes(subnetRoutesInfo.absoluteFilePath(), filesDirInfo.absoluteFilePath());
+            }
+            catch (const QTFTP::TftpError &routesErr)
+            {
+                throw std::runtime_error("Config file "s + fileName.toStdString() + " invalid: " + routesErr.what());
+            }
+            tftpdConfig.m_bindings.back().m_subnetRoutes = subnetRoutes;
+        }
+        auto sectionMaxSessionsValue = config.value(nextSection + "/max_sessions");
+        if (sectionMaxSessionsValue.isValid())
+        {
+            bool maxSessionsOk = false;
+            tftpdConfig.m_bindings.back().m_maxSessions = sectionMaxSessionsValue.toUInt(&maxSessionsOk);
+            if (!maxSessionsOk)
+            {
+                throw std::runtime_error("Config file "s + fileName.toStdString() + " invalid: 'max_sessions' in section [" + nextSection.toStdString() + "] not a valid number" );
+            }
+        }
+        tftpdConfig.m_bindings.back().m_pacingRate = readRateValue(config, nextSection + "/pacing_rate");
+        auto schedulingWeightValue = config.value(nextSection + "/scheduling_weight");
+        if (schedulingWeightValue.isValid())
+        {
+            bool weightOk = false;
+            tftpdConfig.m_bindings.back().m_schedulingWeight = schedulingWeightValue.toUInt(&weightOk);
+            if (!weightOk || tftpdConfig.m_bindings.back().m_schedulingWeight == 0)
+            {
+                throw std::runtime_error("Config file "s + fileName.toStdString() + " invalid: 'scheduling_weight' in section [" + nextSection.toStdString() + "] should be a number larger than 0" );
+            }
+        }
+        tftpdConfig.m_bindings.back().m_receiveBufferSize = readBufferSize(config, nextSection + "/receive_buffer");
+        tftpdConfig.m_bindings.back().m_sendBufferSize = readBufferSize(config, nextSection + "/send_buffer");
+        auto autoTuneValue = config.value(nextSection + "/socket_buffer_autotune");
+        if (autoTuneValue.isValid())
+        {
+            QString autoTuneStr = autoTuneValue.toString().toLower();
+            if (autoTuneStr != "true" && autoTuneStr != "false")
+            {
+                throw std::runtime_error("Config file "s + fileName.toStdString() + " invalid: 'socket_buffer_autotune' in section [" + nextSection.toStdString() + "] should be 'true' or 'false'" );
+            }
+            tftpdConfig.m_bindings.back().m_autoTuneBuffers = (autoTuneStr == "true");
+        }
     }
 
 
-    return bindings;
+    return tftpdConfig;
 }
 
 
+#ifdef Q_OS_UNIX
+static void dumpTraceOnSignal(int)
+{
+    //only async-signal-safe calls are allowed here, dumpToConfiguredFile() does not allocate or lock
+    QTFTP::TraceRecorder::dumpToConfiguredFile();
+}
+#endif
+
+
 static void logTftpdMsg(int severity, const QString &msg)
 {
     if (! g_disableLogToStderr)
@@ -180,6 +524,22 @@ static void logTftpdMsg(int severity, const QString &msg)
     }
 }
 
+/**
+ * @brief logTransferMsg log the end of a transfer with structured fields via the asynchronous logger
+ */
+static void logTransferMsg(AsyncLogger &asyncLogger, int severity, const QString &msg, const QTFTP::Session &session)
+{
+    LogRecord record(severity, msg.toStdString());
+    record.m_hasTransferFields = true;
+    record.m_peer = session.peerIdent().m_address.toString().toStdString() + ':' + std::to_string(session.peerIdent().m_port);
+    record.m_file = session.filePath().toStdString();
+    record.m_bytesSent = session.bytesSent();
+    record.m_durationMs = session.durationMs();
+    record.m_retransmits = session.totalRetransmits();
+    record.m_sessionId = session.sessionId();
+    asyncLogger.log(std::move(record));
+}
+
 int main(int argc, char *argv[])
 {
     QCoreApplication app(argc, argv);
@@ -195,6 +555,7 @@ int main(int argc, char *argv[])
     QCommandLineOption configFileOption( {"c", "config"}, QObject::tr("Read configuration from file"), "configValue", "/etc/qtftpd.conf" );
     QCommandLineOption stderrOption( {"e", "no-stderr"}, QObject::tr("Do not send errors to stderr"));
     QCommandLineOption systemLogOption( {"s", "no-systemlog"}, QObject::tr("Do not send errors to system log daemon"));
+    QCommandLineOption traceOption( {"t", "trace-file"}, QObject::tr("Record a packet trace, dumped to this file on SIGUSR1 and when a transfer fails"), "traceFile");
 #ifdef Q_OS_UNIX
     QCommandLineOption userOption( {"u", "user"}, QObject::tr("User to run daemon"), "userValue", "tftp");
     parser.addOption(userOption);
@@ -204,13 +565,34 @@ int main(int argc, char *argv[])
     parser.addOption(configFileOption);
     parser.addOption(stderrOption);
     parser.addOption(systemLogOption);
+    parser.addOption(traceOption);
     parser.process(app);
 
     g_disableLogToStderr = parser.isSet(stderrOption);
     g_disableLogToSystem = parser.isSet(systemLogOption);
 
+    if (parser.isSet(traceOption))
+    {
+        QTFTP::TraceRecorder::setDumpFile(parser.value(traceOption));
+        QTFTP::TraceRecorder::setDumpOnSessionError(true);
+        QTFTP::TraceRecorder::setEnabled(true);
+#ifdef Q_OS_UNIX
+        struct sigaction dumpAction;
+        memset(&dumpAction, 0, sizeof(dumpAction));
+        dumpAction.sa_handler = dumpTraceOnSignal;
+        sigemptyset(&dumpAction.sa_mask);
+        dumpAction.sa_flags = SA_RESTART;
+        if (sigaction(SIGUSR1, &dumpAction, nullptr) != 0)
+        {
+            logTftpdMsg(LOG_WARNING, QObject::tr("Could not install SIGUSR1 handler, trace can only be dumped on failed transfers"));
+        }
+#endif
+    }
+
+    //log messages of transfers are written by a background thread, to keep journal calls off the event loop
+    AsyncLogger asyncLogger(LogQueueCapacity, !g_disableLogToStderr, !g_disableLogToSystem);
     QTFTP::TftpServer tftpServer(std::make_shared<QTFTP::UdpSocketFactory>(), nullptr);
-    std::vector<TftpBindings> bindings;
+    TftpdConfig tftpdConfig;
 
     if ( parser.isSet(dirOption))
     {
@@ -242,7 +624,7 @@ int main(int argc, char *argv[])
             return 4;
         }
 
-        bindings.emplace_back(static_cast<uint16_t>(portNr), QHostAddress::LocalHost, dirInfo.absoluteFilePath(), true);
+        tftpdConfig.m_bindings.emplace_back(static_cast<uint16_t>(portNr), QHostAddress::LocalHost, dirInfo.absoluteFilePath(), dirInfo.isWritable());
     }
 
     if (parser.isSet(configFileOption))
@@ -250,7 +632,7 @@ int main(int argc, char *argv[])
         auto configFileName = parser.value(configFileOption);
         try
         {
-            bindings = readConfigFile(configFileName);
+            tftpdConfig = readConfigFile(configFileName);
         }
         catch(const std::runtime_error &configErr)
         {
@@ -259,16 +641,62 @@ int main(int argc, char *argv[])
         }
     }
 
-    if (bindings.empty())
+    if (tftpdConfig.m_bindings.empty())
     {
         logTftpdMsg(LOG_ERR, QObject::tr("Error: no directorie(s) given to serve files to/from") );
         return 7;
     }
-    for (const auto &nextBinding : bindings)
+    if (tftpdConfig.m_wildcardBind)
+    {
+        tftpServer.enableWildcardBinding();
+    }
+    tftpServer.setSessionLimits(tftpdConfig.m_maxSessions, tftpdConfig.m_maxQueuedRequests, tftpdConfig.m_maxQueueWaitMs);
+    tftpServer.setMaxRequestsPerSecond(tftpdConfig.m_maxRequestsPerSecond);
+    tftpServer.setGlobalPacingRate(tftpdConfig.m_pacingRate);
+    tftpServer.setSubnetPacingRate(tftpdConfig.m_subnetPacingRate);
+    tftpServer.setSessionPacingRate(tftpdConfig.m_sessionPacingRate);
+    tftpServer.setPriorityTransferSize(static_cast<int64_t>(tftpdConfig.m_priorityFileSize));
+    tftpServer.setKernelTimestamping(tftpdConfig.m_kernelTimestamps);
+    for (const auto &nextBinding : tftpdConfig.m_bindings)
     {
         try
         {
-            tftpServer.bind(nextBinding.m_filesDir, nextBinding.m_bindAddr, nextBinding.m_portNr);
+            tftpServer.bind(nextBinding.m_filesDir, nextBinding.m_bindAddr, nextBinding.m_portNr, nextBinding.m_allowUploads);
+            if (!nextBinding.m_packFile.isEmpty())
+            {
+                auto packFile = std::make_shared<QTFTP::PackFile>(nextBinding.m_packFile);
+                if (!packFile->open())
+                {
+                    logTftpdMsg(LOG_ERR, QObject::tr("Error while opening pack file %1: %2").arg(nextBinding.m_packFile).arg(packFile->errorString()) );
+                    return 11;
+                }
+                tftpServer.addBlockSourceProvider(std::make_shared<QTFTP::PackProvider>(packFile), nextBinding.m_bindAddr, nextBinding.m_portNr);
+            }
+            if (nextBinding.m_fileNameRewriter)
+            {
+                tftpServer.setFileNameRewriter(nextBinding.m_fileNameRewriter, nextBinding.m_bindAddr, nextBinding.m_portNr);
+            }
+            if (nextBinding.m_subnetRoutes)
+            {
+                tftpServer.setSubnetRoutes(nextBinding.m_subnetRoutes, nextBinding.m_bindAddr, nextBinding.m_portNr);
+            }
+            if (nextBinding.m_maxSessions > 0)
+            {
+                tftpServer.setMaxSessions(nextBinding.m_maxSessions, nextBinding.m_bindAddr, nextBinding.m_portNr);
+            }
+            if (nextBinding.m_pacingRate > 0)
+            {
+                tftpServer.setPacingRate(nextBinding.m_pacingRate, 0, nextBinding.m_bindAddr, nextBinding.m_portNr);
+            }
+            if (nextBinding.m_schedulingWeight > 1)
+            {
+                tftpServer.setSchedulingWeight(nextBinding.m_schedulingWeight, nextBinding.m_bindAddr, nextBinding.m_portNr);
+            }
+            if (nextBinding.m_receiveBufferSize > 0 || nextBinding.m_sendBufferSize > 0)
+            {
+                tftpServer.setSocketBufferSizes(nextBinding.m_receiveBufferSize, nextBinding.m_sendBufferSize, nextBinding.m_bindAddr, nextBinding.m_portNr);
+            }
+            tftpServer.setSocketBufferAutoTuning(nextBinding.m_autoTuneBuffers, nextBinding.m_bindAddr, nextBinding.m_portNr);
         }
         catch(const QTFTP::TftpError &tftpErr)
         {
@@ -277,18 +705,59 @@ int main(int argc, char *argv[])
         }
     }
 
+    if (!tftpdConfig.m_multicastAddr.isNull())
+    {
+        tftpServer.enableMulticast(tftpdConfig.m_multicastAddr, tftpdConfig.m_multicastPort, tftpdConfig.m_multicastGroups);
+    }
+
+    MetricsHttpServer metricsServer(tftpServer.metrics());
+    metricsServer.setExtraMetricsSource([&asyncLogger]()
+                                        {
+                                            return QByteArray("# HELP qtftpd_log_messages_dropped_total Log messages dropped because the log queue was full\n"
+                                                              "# TYPE qtftpd_log_messages_dropped_total counter\n"
+                                                              "qtftpd_log_messages_dropped_total ") + QByteArray::number(static_cast<qulonglong>(asyncLogger.droppedCount())) + '\n';
+                                        });
+    if (tftpdConfig.m_metricsPort != 0)
+    {
+        if (!metricsServer.listen(tftpdConfig.m_metricsAddr, tftpdConfig.m_metricsPort))
+        {
+            logTftpdMsg(LOG_ERR, QObject::tr("Error while starting metrics endpoint at address %1 and portNr %2: %3").arg(tftpdConfig.m_metricsAddr.toString()).arg(tftpdConfig.m_metricsPort).arg(metricsServer.errorString()) );
+            return 10;
+        }
+    }
+
     //report successful or failed file download
-    QObject::connect(&tftpServer, &QTFTP::TftpServer::newReadSession, [](std::shared_ptr<const QTFTP::ReadSession> newReadSession)
-                                                                      { QObject::connect(newReadSession.get(), &QTFTP::ReadSession::finished, [newReadSession]()
+    QObject::connect(&tftpServer, &QTFTP::TftpServer::newReadSession, [&asyncLogger](std::shared_ptr<const QTFTP::ReadSession> newReadSession)
+                                                                      { QObject::connect(newReadSession.get(), &QTFTP::ReadSession::finished, [&asyncLogger, newReadSession]()
+                                                                                                                                              {
+                                                                                                                                                  logTransferMsg(asyncLogger, LOG_INFO, QObject::tr("Download of file %1 by %2 finished").arg(newReadSession->filePath()).arg(newReadSession->peerIdent().m_address.toString()), *newReadSession);
+                                                                                                                                              });
+                                                                        QObject::connect(newReadSession.get(), &QTFTP::ReadSession::error, [&asyncLogger, newReadSession](QString errMsg)
                                                                                                                                               {
-                                                                                                                                                  logTftpdMsg(LOG_INFO, QObject::tr("Download of file %1 by %2 finished").arg(newReadSession->filePath()).arg(newReadSession->peerIdent().m_address.toString()));
+                                                                                                                                                  logTransferMsg(asyncLogger, LOG_ERR, QObject::tr("Download of file %1 by %2 failed: %3").arg(newReadSession->filePath()).arg(newReadSession->peerIdent().m_address.toString()).arg(errMsg), *newReadSession);
                                                                                                                                               });
-                                                                        QObject::connect(newReadSession.get(), &QTFTP::ReadSession::error, [newReadSession](QString errMsg)
+                                                                        auto multicastSession = std::dynamic_pointer_cast<const QTFTP::MulticastReadSession>(newReadSession);
+                                                                        if (multicastSession)
+                                                                        {
+                                                                            QObject::connect(multicastSession.get(), &QTFTP::MulticastReadSession::clientJoined, [&asyncLogger, multicastSession](QHostAddress peerAddr, quint16)
                                                                                                                                               {
-                                                                                                                                                  logTftpdMsg(LOG_ERR, QObject::tr("Download of file %1 by %2 failed: %3").arg(newReadSession->filePath()).arg(newReadSession->peerIdent().m_address.toString()).arg(errMsg));
+                                                                                                                                                  asyncLogger.log(LogRecord(LOG_INFO, QObject::tr("%1 joined multicast download of file %2").arg(peerAddr.toString()).arg(multicastSession->filePath()).toStdString()));
                                                                                                                                               });
+                                                                        }
                                                                       });
 
+    //report successful or failed file upload
+    QObject::connect(&tftpServer, &QTFTP::TftpServer::newWriteSession, [&asyncLogger](std::shared_ptr<const QTFTP::WriteSession> newWriteSession)
+                                                                       { QObject::connect(newWriteSession.get(), &QTFTP::WriteSession::finished, [&asyncLogger, newWriteSession]()
+                                                                                                                                                {
+                                                                                                                                                    logTransferMsg(asyncLogger, LOG_INFO, QObject::tr("Upload of file %1 by %2 finished").arg(newWriteSession->filePath()).arg(newWriteSession->peerIdent().m_address.toString()), *newWriteSession);
+                                                                                                                                                });
+                                                                         QObject::connect(newWriteSession.get(), &QTFTP::WriteSession::error, [&asyncLogger, newWriteSession](QString errMsg)
+                                                                                                                                                {
+                                                                                                                                                    logTransferMsg(asyncLogger, LOG_ERR, QObject::tr("Upload of file %1 by %2 failed: %3").arg(newWriteSession->filePath()).arg(newWriteSession->peerIdent().m_address.toString()).arg(errMsg), *newWriteSession);
+                                                                                                                                                });
+                                                                       });
+
 #ifdef Q_OS_UNIX
     //Recommended way to run qtftp on Linux is to add CAP_NET_BIND_SERVICE capability to qtftpd executable and run as normal user.
     //If we are running as root, we should drop privileges now that listening socket are opened.
@@ -322,6 +791,31 @@ int main(int argc, char *argv[])
     }
 #endif
 
+    //measure event loop lag, and if systemd watchdog is enabled ping it from the event loop so a stalled loop gets qtftpd restarted
+    unsigned int lagProbeIntervalMs = DefaultLagProbeIntervalMs;
+    QTFTP::EventLoopLagMonitor &lagMonitor = tftpServer.eventLoopLagMonitor();
+#ifdef Q_OS_LINUX
+    uint64_t watchdogUs = 0;
+    if (sd_watchdog_enabled(0, &watchdogUs) > 0)
+    {
+        lagProbeIntervalMs = static_cast<unsigned int>(std::min<uint64_t>(lagProbeIntervalMs, std::max<uint64_t>(watchdogUs / 3000, 1)));
+        QObject::connect(&lagMonitor, &QTFTP::EventLoopLagMonitor::tick, [](quint64) { sd_notify(0, "WATCHDOG=1"); });
+    }
+#endif
+    QObject::connect(&lagMonitor, &QTFTP::EventLoopLagMonitor::tick, [&asyncLogger](quint64 lagUs)
+                                                                      {
+                                                                          if (lagUs >= LagWarningThresholdUs)
+                                                                          {
+                                                                              asyncLogger.log(LogRecord(LOG_WARNING, QObject::tr("Event loop was blocked for %1 ms").arg(lagUs / 1000).toStdString()));
+                                                                          }
+                                                                      });
+    lagMonitor.start(lagProbeIntervalMs);
+
+#ifdef Q_OS_LINUX
+    sd_notify(0, "READY=1");
+    QObject::connect(&app, &QCoreApplication::aboutToQuit, []() { sd_notify(0, "STOPPING=1"); });
+#endif
+
     int returnCode = 0;
     try
     {
@@ -0,0 +1,128 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#include "metricshttpserver.h"
+#include "qtftp/metrics.h"
+#include <QTcpSocket>
+#include <QTimer>
+
+static constexpr int MaxRequestLineLength = 8192;
+static constexpr int ClientTimeOutms = 5000;
+
+
+MetricsHttpServer::MetricsHttpServer(const QTFTP::ServerMetrics &metrics, QObject *parent) : QObject(parent),
+                                                                                             m_metrics(metrics)
+{
+    connect(&m_tcpServer, &QTcpServer::newConnection, this, &MetricsHttpServer::acceptConnections);
+}
+
+
+/**
+ * @brief MetricsHttpServer::listen start accepting HTTP connections
+ * @return false if the server could not listen on \p address and \p port, see errorString() for the reason
+ */
+bool MetricsHttpServer::listen(const QHostAddress &address, quint16 port)
+{
+    return m_tcpServer.listen(address, port);
+}
+
+
+QString MetricsHttpServer::errorString() const
+{
+    return m_tcpServer.errorString();
+}
+
+
+/**
+ * @brief MetricsHttpServer::setExtraMetricsSource set a function that renders additional metrics in Prometheus text format
+ */
+void MetricsHttpServer::setExtraMetricsSource(std::function<QByteArray()> extraMetricsSource)
+{
+    m_extraMetricsSource = extraMetricsSource;
+}
+
+
+void MetricsHttpServer::acceptConnections()
+{
+    while (m_tcpServer.hasPendingConnections())
+    {
+        QTcpSocket *clientSocket = m_tcpServer.nextPendingConnection();
+        connect(clientSocket, &QTcpSocket::disconnected, clientSocket, &QObject::deleteLater);
+        connect(clientSocket, &QTcpSocket::readyRead, this, [this, clientSocket]() { handleRequest(clientSocket); });
+        //don't let idle clients keep a connection open forever
+        QTimer::singleShot(ClientTimeOutms, clientSocket, [clientSocket]() { clientSocket->abort(); });
+    }
+}
+
+
+/**
+ * @brief MetricsHttpServer::handleRequest answer the request of a client as soon as its request line is complete
+ *
+ * The request headers are ignored, a scraper does not need to send anything but the request line.
+ */
+void MetricsHttpServer::handleRequest(QTcpSocket *clientSocket)
+{
+    if (!clientSocket->canReadLine())
+    {
+        if (clientSocket->bytesAvailable() > MaxRequestLineLength)
+        {
+            clientSocket->abort();
+        }
+        return;
+    }
+
+    QList<QByteArray> requestLine = clientSocket->readLine(MaxRequestLineLength).trimmed().split(' ');
+    //no further readyRead handling for this connection, the response closes it
+    disconnect(clientSocket, &QTcpSocket::readyRead, this, nullptr);
+
+    if (requestLine.size() != 3 || !requestLine.at(2).startsWith("HTTP/"))
+    {
+        sendResponse(clientSocket, "400 Bad Request", "text/plain", "Bad request\n");
+    }
+    else if (requestLine.at(0) != "GET")
+    {
+        sendResponse(clientSocket, "405 Method Not Allowed", "text/plain", "Only GET is supported\n");
+    }
+    else if (requestLine.at(1) != "/metrics")
+    {
+        sendResponse(clientSocket, "404 Not Found", "text/plain", "Metrics are available at /metrics\n");
+    }
+    else
+    {
+        QByteArray metricsText = m_metrics.toPrometheusText();
+        if (m_extraMetricsSource)
+        {
+            metricsText += m_extraMetricsSource();
+        }
+        sendResponse(clientSocket, "200 OK", "text/plain; version=0.0.4; charset=utf-8", metricsText);
+    }
+}
+
+
+void MetricsHttpServer::sendResponse(QTcpSocket *clientSocket, const QByteArray &status, const QByteArray &contentType, const QByteArray &body)
+{
+    QByteArray response = "HTTP/1.0 " + status + "\r\n";
+    response += "Content-Type: " + contentType + "\r\n";
+    response += "Content-Length: " + QByteArray::number(body.size()) + "\r\n";
+    response += "Connection: close\r\n\r\n";
+    response += body;
+    clientSocket->write(response);
+    clientSocket->disconnectFromHost();
+}
@@ -0,0 +1,64 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#ifndef METRICSHTTPSERVER_H
+#define METRICSHTTPSERVER_H
+
+#include <QObject>
+#include <QTcpServer>
+#include <QHostAddress>
+#include <functional>
+
+namespace QTFTP
+{
+class ServerMetrics;
+}
+
+class QTcpSocket;
+
+/**
+ * @brief The MetricsHttpServer class serves the metrics of a TftpServer in Prometheus text format
+ *
+ * Only "GET /metrics" is supported. Every response closes the connection.
+ */
+class MetricsHttpServer : public QObject
+{
+    Q_OBJECT
+
+    public:
+        explicit MetricsHttpServer(const QTFTP::ServerMetrics &metrics, QObject *parent = nullptr);
+
+        bool listen(const QHostAddress &address, quint16 port);
+        QString errorString() const;
+        void setExtraMetricsSource(std::function<QByteArray()> extraMetricsSource);
+
+    private slots:
+        void acceptConnections();
+
+    private:
+        void handleRequest(QTcpSocket *clientSocket);
+        void sendResponse(QTcpSocket *clientSocket, const QByteArray &status, const QByteArray &contentType, const QByteArray &body);
+
+        const QTFTP::ServerMetrics &m_metrics;
+        std::function<QByteArray()> m_extraMetricsSource; /// metrics of the daemon itself, appended to the library metrics
+        QTcpServer m_tcpServer;
+};
+
+#endif // METRICSHTTPSERVER_H
@@ -0,0 +1,119 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#include "qtftp/congestioncontroller.h"
+#include <QTest>
+
+namespace QTFTP
+{
+
+class CongestionControllerTest : public QObject
+{
+    Q_OBJECT
+
+    private slots:
+        void windowGrowsOnCleanAcks();
+        void windowHalvesOnceOnLossBurst();
+        void windowShrinksOnRisingDelay();
+        void unknownDelayOnlyGrowsWindow();
+};
+
+
+void CongestionControllerTest::windowGrowsOnCleanAcks()
+{
+    CongestionController controller(16);
+    QCOMPARE(controller.window(), CongestionController::InitialWindow);
+
+    //one block more for each window of acknowledged blocks
+    controller.ackReceived(4, 1000);
+    QCOMPARE(controller.window(), 5u);
+    controller.ackReceived(5, 1000);
+    QCOMPARE(controller.window(), 6u);
+
+    //never more than the negotiated window size
+    for (int ackNr=0; ackNr<100; ++ackNr)
+    {
+        controller.ackReceived(16, 1000);
+    }
+    QCOMPARE(controller.window(), 16u);
+}
+
+
+void CongestionControllerTest::windowHalvesOnceOnLossBurst()
+{
+    CongestionController controller(16);
+    for (int ackNr=0; ackNr<100; ++ackNr)
+    {
+        controller.ackReceived(16, 1000);
+    }
+
+    controller.lossDetected();
+    QCOMPARE(controller.window(), 8u);
+    //more losses of the same window don't decrease the window again
+    controller.lossDetected();
+    QCOMPARE(controller.window(), 8u);
+
+    //a time-out does
+    controller.timeOut();
+    QCOMPARE(controller.window(), 4u);
+    controller.timeOut();
+    controller.timeOut();
+    controller.timeOut();
+    QCOMPARE(controller.window(), 1u);
+}
+
+
+void CongestionControllerTest::windowShrinksOnRisingDelay()
+{
+    CongestionController controller(16);
+    controller.ackReceived(4, 10000);
+    QCOMPARE(controller.window(), 5u);
+
+    //jitter of less than MinQueueingDelayUs is not a congestion signal
+    controller.ackReceived(5, 11500);
+    QCOMPARE(controller.window(), 6u);
+
+    controller.ackReceived(6, 30000);
+    QCOMPARE(controller.window(), 3u);
+    QVERIFY(controller.smoothedAckDelayUs() > 10000);
+}
+
+
+void CongestionControllerTest::unknownDelayOnlyGrowsWindow()
+{
+    CongestionController controller(16);
+    controller.ackReceived(4, 10000);
+    QCOMPARE(controller.window(), 5u);
+
+    //a window with retransmitted blocks has no valid ACK delay, but still grows the window
+    controller.ackReceived(5, CongestionController::UnknownAckDelay);
+    QCOMPARE(controller.window(), 6u);
+    QCOMPARE(controller.smoothedAckDelayUs(), uint64_t(10000));
+
+    //and did not raise the lowest delay, so a delay twice as large still signals congestion
+    controller.ackReceived(6, 30000);
+    QCOMPARE(controller.window(), 3u);
+}
+
+
+} // namespace QTFTP end
+
+QTEST_MAIN(QTFTP::CongestionControllerTest)
+#include "congestioncontroller_ut.moc"
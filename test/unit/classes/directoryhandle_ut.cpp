@@ -0,0 +1,162 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#include "qtftp/directoryhandle.h"
+#include "qtftp/blocksource.h"
+#include "testfiles.h"
+#include <QTest>
+#include <QTemporaryDir>
+#include <QDir>
+#include <QFile>
+#include <memory>
+
+namespace QTFTP
+{
+
+static constexpr int DeepTreeDepth = 12;
+
+
+class DirectoryHandleTest : public QObject
+{
+    Q_OBJECT
+
+    private slots:
+        void initTestCase();
+        void filesOpenedBeneathDirectory();
+        void symbolicLinksStayInside();
+        void rrqLookupRate_data();
+        void rrqLookupRate();
+
+    private:
+        QTemporaryDir m_tempDir;
+        QString       m_filesDir;
+        QString       m_deepFileName;
+};
+
+
+void DirectoryHandleTest::initTestCase()
+{
+#ifndef __linux__
+    QSKIP("Directory handles are only supported on Linux");
+#endif
+    m_filesDir = m_tempDir.path() + "/files";
+    QStringList pathParts;
+    for (int level=0; level<DeepTreeDepth; ++level)
+    {
+        pathParts << QString("level%1").arg(level);
+    }
+    QVERIFY(QDir().mkpath(m_filesDir + "/" + pathParts.join("/")));
+    m_deepFileName = pathParts.join("/") + "/image.bin";
+    QVERIFY(writeFile(m_filesDir + "/" + m_deepFileName, QByteArray(1000, 'd')));
+    QVERIFY(writeFile(m_tempDir.path() + "/outside.bin", QByteArray(10, 'o')));
+    QVERIFY(QFile::link(m_tempDir.path() + "/outside.bin", m_filesDir + "/link_outside.bin"));
+    QVERIFY(QFile::link("../outside.bin", m_filesDir + "/link_escape.bin"));
+    QVERIFY(QFile::link(m_deepFileName, m_filesDir + "/link_inside.bin"));
+    QVERIFY(QFile::link("level0", m_filesDir + "/link_dir"));
+    QVERIFY(QFile::link("../link_inside.bin", m_filesDir + "/level0/link_up.bin"));
+}
+
+
+void DirectoryHandleTest::filesOpenedBeneathDirectory()
+{
+    DirectoryHandle dirHandle(m_filesDir);
+    QVERIFY(dirHandle.open());
+
+    QFile file;
+    qint64 fileSize = 0;
+    QDateTime lastModified;
+    QCOMPARE(dirHandle.openFile(DirectoryHandle::relativeName("/" + m_deepFileName), file, fileSize, lastModified), 0);
+    QCOMPARE(fileSize, qint64(1000));
+    QCOMPARE(file.readAll(), QByteArray(1000, 'd'));
+
+    QVERIFY(DirectoryHandle::relativeName("../outside.bin").isEmpty());
+    QVERIFY(DirectoryHandle::relativeName("level0/../../outside.bin").isEmpty());
+    QFile outsideFile;
+    int errorNr = dirHandle.openFile("link_outside.bin", outsideFile, fileSize, lastModified);
+    QVERIFY(DirectoryHandle::isNotFoundError(errorNr));
+    QVERIFY(DirectoryHandle::isNotFoundError(dirHandle.openFile("level0/missing.bin", outsideFile, fileSize, lastModified)));
+    QVERIFY(!DirectoryHandle::isNotFoundError(dirHandle.openFile("level0", outsideFile, fileSize, lastModified)));
+}
+
+
+/**
+ * @brief DirectoryHandleTest::symbolicLinksStayInside links that stay inside the directory are followed, the ones that leave it are not
+ */
+void DirectoryHandleTest::symbolicLinksStayInside()
+{
+    DirectoryHandle dirHandle(m_filesDir);
+    QVERIFY(dirHandle.open());
+
+    QFile file;
+    qint64 fileSize = 0;
+    QDateTime lastModified;
+    QCOMPARE(dirHandle.openFile("link_inside.bin", file, fileSize, lastModified), 0);
+    QCOMPARE(fileSize, qint64(1000));
+    file.close();
+
+    QString viaLinkedDir = m_deepFileName;
+    viaLinkedDir.replace(0, QString("level0").size(), "link_dir");
+    QCOMPARE(dirHandle.openFile(viaLinkedDir, file, fileSize, lastModified), 0);
+    file.close();
+
+    //a link to a link, with a ".." that does not leave the directory
+    QCOMPARE(dirHandle.openFile("link_dir/link_up.bin", file, fileSize, lastModified), 0);
+    QCOMPARE(file.readAll(), QByteArray(1000, 'd'));
+    file.close();
+
+    QVERIFY(DirectoryHandle::isNotFoundError(dirHandle.openFile("link_escape.bin", file, fileSize, lastModified)));
+    QVERIFY(DirectoryHandle::isNotFoundError(dirHandle.openFile("link_outside.bin", file, fileSize, lastModified)));
+    QVERIFY(!file.isOpen());
+}
+
+
+void DirectoryHandleTest::rrqLookupRate_data()
+{
+    QTest::addColumn<bool>("useDirHandle");
+    QTest::newRow("by path") << false;
+    QTest::newRow("directory handle") << true;
+}
+
+
+/**
+ * @brief DirectoryHandleTest::rrqLookupRate measure the lookup and open of a requested file in a deep tree, as done for each RRQ
+ */
+void DirectoryHandleTest::rrqLookupRate()
+{
+    QFETCH(bool, useDirHandle);
+    auto dirHandle = std::make_shared<DirectoryHandle>(m_filesDir);
+    QVERIFY(dirHandle->open());
+    DirectoryProvider provider(m_filesDir, nullptr, useDirHandle ? dirHandle : nullptr);
+
+    QBENCHMARK
+    {
+        auto source = provider.find(m_deepFileName, QHostAddress::LocalHost);
+        if (!source || !source->open() || source->size() != 1000)
+        {
+            QFAIL("Could not open file in deep tree");
+        }
+    }
+}
+
+
+} // namespace QTFTP end
+
+QTEST_MAIN(QTFTP::DirectoryHandleTest)
+#include "directoryhandle_ut.moc"
@@ -0,0 +1,100 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#include "qtftp/directoryindex.h"
+#include "testfiles.h"
+#include <QTest>
+#include <QTemporaryDir>
+#include <QDir>
+#include <QFile>
+
+namespace QTFTP
+{
+
+
+class DirectoryIndexTest : public QObject
+{
+    Q_OBJECT
+
+    private slots:
+        void initTestCase();
+        void existingFilesFound();
+        void changesSeenByNextLookup();
+
+    private:
+        QTemporaryDir m_tempDir;
+};
+
+
+void DirectoryIndexTest::initTestCase()
+{
+#ifndef __linux__
+    QSKIP("Directory index needs inotify");
+#endif
+}
+
+
+void DirectoryIndexTest::existingFilesFound()
+{
+    QDir(m_tempDir.path()).mkpath("pxelinux.cfg");
+    QVERIFY(writeFile(m_tempDir.path() + "/pxelinux.cfg/default", QByteArray(120, 'd')));
+    DirectoryIndex index(m_tempDir.path());
+    QVERIFY(index.start());
+
+    DirectoryIndex::FileMetadata metadata{0, QDateTime()};
+    QCOMPARE(index.lookup("pxelinux.cfg/default", &metadata), DirectoryIndex::LookupResult::Found);
+    QCOMPARE(metadata.m_size, qint64(120));
+    QCOMPARE(index.lookup("pxelinux.cfg/01-52-54-00-12-34-56"), DirectoryIndex::LookupResult::Missing);
+    QCOMPARE(index.lookup("pxelinux.cfg/default/x"), DirectoryIndex::LookupResult::Missing);
+    QCOMPARE(index.lookup("missing_dir/default"), DirectoryIndex::LookupResult::Missing);
+    QCOMPARE(index.lookup("pxelinux.cfg"), DirectoryIndex::LookupResult::Unknown);
+    QCOMPARE(index.lookup("../default"), DirectoryIndex::LookupResult::Unknown);
+    QCOMPARE(index.lookup("/etc/hostname"), DirectoryIndex::LookupResult::Unknown);
+}
+
+
+void DirectoryIndexTest::changesSeenByNextLookup()
+{
+    DirectoryIndex index(m_tempDir.path());
+    QVERIFY(index.start());
+    QCOMPARE(index.lookup("late.bin"), DirectoryIndex::LookupResult::Missing);
+
+    QVERIFY(writeFile(m_tempDir.path() + "/late.bin", QByteArray(10, 'l')));
+    DirectoryIndex::FileMetadata metadata{0, QDateTime()};
+    QCOMPARE(index.lookup("late.bin", &metadata), DirectoryIndex::LookupResult::Found);
+    QCOMPARE(metadata.m_size, qint64(10));
+
+    QVERIFY(writeFile(m_tempDir.path() + "/late.bin", QByteArray(20, 'l')));
+    QCOMPARE(index.lookup("late.bin", &metadata), DirectoryIndex::LookupResult::Found);
+    QCOMPARE(metadata.m_size, qint64(20));
+
+    QDir(m_tempDir.path()).mkpath("new_dir");
+    QVERIFY(writeFile(m_tempDir.path() + "/new_dir/file", QByteArray(5, 'n')));
+    QCOMPARE(index.lookup("new_dir/file"), DirectoryIndex::LookupResult::Found);
+
+    QVERIFY(QFile::remove(m_tempDir.path() + "/late.bin"));
+    QCOMPARE(index.lookup("late.bin"), DirectoryIndex::LookupResult::Missing);
+}
+
+
+} // namespace QTFTP end
+
+QTEST_MAIN(QTFTP::DirectoryIndexTest)
+#include "directoryindex_ut.moc"
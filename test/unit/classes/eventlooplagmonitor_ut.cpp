@@ -0,0 +1,102 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#include "qtftp/eventlooplagmonitor.h"
+#include "qtftp/histogram.h"
+#include <QTest>
+#include <QSignalSpy>
+#include <chrono>
+#include <thread>
+
+namespace QTFTP
+{
+
+static constexpr unsigned int MonitorIntervalMs = 10;
+static constexpr unsigned int BlockedMs = 100;
+static constexpr uint64_t MinBlockedLagUs = (BlockedMs - MonitorIntervalMs) * 1000;
+
+
+class EventLoopLagMonitorTest : public QObject
+{
+    Q_OBJECT
+
+    private slots:
+        void blockedLoopRecorded();
+        void stallCountedOnce();
+};
+
+
+/**
+ * @brief EventLoopLagMonitorTest::blockedLoopRecorded a timer expiry handled late because the event loop was blocked is measured
+ */
+void EventLoopLagMonitorTest::blockedLoopRecorded()
+{
+    Histogram lagHistogram;
+    EventLoopLagMonitor monitor(lagHistogram);
+    QSignalSpy tickSpy(&monitor, &EventLoopLagMonitor::tick);
+    monitor.start(MonitorIntervalMs);
+    QVERIFY(monitor.isActive());
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(BlockedMs));
+    QVERIFY(tickSpy.wait(1000));
+
+    QCOMPARE(tickSpy.count(), 1);
+    QVERIFY(monitor.lastLagUs() >= MinBlockedLagUs);
+    QCOMPARE(tickSpy.at(0).at(0).toULongLong(), monitor.lastLagUs());
+    QCOMPARE(monitor.maxLagUs(), monitor.lastLagUs());
+    QCOMPARE(lagHistogram.count(), uint64_t(1));
+    QCOMPARE(lagHistogram.countBelow(MinBlockedLagUs / 2), uint64_t(0));
+    QVERIFY(lagHistogram.sum() >= MinBlockedLagUs);
+
+    monitor.stop();
+    QVERIFY(!monitor.isActive());
+}
+
+
+/**
+ * @brief EventLoopLagMonitorTest::stallCountedOnce the measurements after a stall are not delayed by it, the maximum remains
+ */
+void EventLoopLagMonitorTest::stallCountedOnce()
+{
+    Histogram lagHistogram;
+    EventLoopLagMonitor monitor(lagHistogram);
+    QSignalSpy tickSpy(&monitor, &EventLoopLagMonitor::tick);
+    monitor.start(MonitorIntervalMs);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(BlockedMs));
+    QTRY_COMPARE_WITH_TIMEOUT(tickSpy.count(), 4, 1000);
+    monitor.stop();
+
+    QVERIFY(tickSpy.at(0).at(0).toULongLong() >= MinBlockedLagUs);
+    for (int tickNr=1; tickNr<tickSpy.count(); ++tickNr)
+    {
+        QVERIFY(tickSpy.at(tickNr).at(0).toULongLong() < MinBlockedLagUs);
+    }
+    QVERIFY(monitor.lastLagUs() < MinBlockedLagUs);
+    QVERIFY(monitor.maxLagUs() >= MinBlockedLagUs);
+    QCOMPARE(lagHistogram.count(), uint64_t(4));
+    QCOMPARE(lagHistogram.countBelow(MinBlockedLagUs / 2), uint64_t(3));
+}
+
+
+} // namespace QTFTP end
+
+QTEST_MAIN(QTFTP::EventLoopLagMonitorTest)
+#include "eventlooplagmonitor_ut.moc"
@@ -0,0 +1,135 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#include "qtftp/filenamerewriter.h"
+#include "qtftp/tftp_error.h"
+#include <QTest>
+#include <QStringList>
+
+namespace QTFTP
+{
+
+static constexpr int BenchmarkPrefixRules = 300;
+
+
+class FileNameRewriterTest : public QObject
+{
+    Q_OBJECT
+
+    private slots:
+        void rulesAppliedInOrder();
+        void prefixRulesChain();
+        void invalidRulesRefused();
+        void rewriteRate_data();
+        void rewriteRate();
+};
+
+
+void FileNameRewriterTest::rulesAppliedInOrder()
+{
+    FileNameRewriter rewriter;
+    rewriter.addRule("rg", "\\\\", "/");
+    rewriter.addRule("pi", "/vendorboot/", "");
+    rewriter.addRule("ri", "^pxelinux\\.cfg/(01-.*)$", "pxelinux.cfg/mac/\\1");
+    rewriter.addRule("re", "\\.0$", ".efi");
+    rewriter.addRule("p", "boot/", "never/");
+
+    QCOMPARE(rewriter.rewrite("\\VendorBoot\\PXELINUX.CFG\\01-aa-bb"), QString("pxelinux.cfg/mac/01-aa-bb"));
+    QCOMPARE(rewriter.rewrite("boot/kernel"), QString("never/kernel"));
+    QCOMPARE(rewriter.rewrite("boot/pxelinux.0"), QString("boot/pxelinux.efi"));
+    QCOMPARE(rewriter.rewrite("pxelinux.0"), QString("pxelinux.efi"));
+    QCOMPARE(rewriter.rewrite("other.bin"), QString("other.bin"));
+    //cached result
+    QCOMPARE(rewriter.rewrite("pxelinux.0"), QString("pxelinux.efi"));
+}
+
+
+void FileNameRewriterTest::prefixRulesChain()
+{
+    FileNameRewriter rewriter;
+    rewriter.addRule("p", "a/", "b/");
+    rewriter.addRule("r", "^b/", "c/");
+    rewriter.addRule("pi", "images/", "img/");
+    rewriter.addRule("p", "images/x86/", "x86/");
+    rewriter.addRule("r", "^img/x86/efi/", "efi/");
+    rewriter.addRule("p", "efi/", "uefi/");
+
+    QCOMPARE(rewriter.rewrite("a/x"), QString("c/x"));
+    QCOMPARE(rewriter.rewrite("b/x"), QString("c/x"));
+    QCOMPARE(rewriter.rewrite("images/x86/kernel"), QString("x86/kernel"));
+    QCOMPARE(rewriter.rewrite("IMAGES/x86/efi/kernel"), QString("uefi/kernel"));
+    QCOMPARE(rewriter.rewrite("images/x86/efi/kernel"), QString("x86/efi/kernel"));
+    QCOMPARE(rewriter.rewrite("img/x86/efi/kernel"), QString("uefi/kernel"));
+}
+
+
+void FileNameRewriterTest::invalidRulesRefused()
+{
+    FileNameRewriter rewriter;
+    QVERIFY_EXCEPTION_THROWN(rewriter.addRule("x", "a", "b"), TftpError);
+    QVERIFY_EXCEPTION_THROWN(rewriter.addRule("i", "a", "b"), TftpError);
+    QVERIFY_EXCEPTION_THROWN(rewriter.addRule("r", "(unbalanced", "b"), TftpError);
+    QCOMPARE(rewriter.ruleCount(), size_t(0));
+}
+
+
+void FileNameRewriterTest::rewriteRate_data()
+{
+    QTest::addColumn<int>("maxCachedNames");
+    QTest::newRow("uncached") << 0;
+    QTest::newRow("cached") << FileNameRewriter::DefaultMaxCachedNames;
+}
+
+
+/**
+ * @brief FileNameRewriterTest::rewriteRate measure rewriting with a few hundred prefix rules and some regular expressions
+ */
+void FileNameRewriterTest::rewriteRate()
+{
+    QFETCH(int, maxCachedNames);
+    FileNameRewriter rewriter(maxCachedNames);
+    rewriter.addRule("rg", "\\\\", "/");
+    for (int ruleNr=0; ruleNr<BenchmarkPrefixRules; ++ruleNr)
+    {
+        rewriter.addRule("pi", QString("/vendor%1/").arg(ruleNr), QString("vendor/%1/").arg(ruleNr));
+    }
+    rewriter.addRule("ri", "^vendor/(\\d+)/pxelinux\\.cfg/", "cfg/\\1/");
+
+    QStringList fileNames;
+    for (int nameNr=0; nameNr<64; ++nameNr)
+    {
+        fileNames << QString("\\Vendor%1\\pxelinux.cfg\\01-52-54-00-12-34-%2").arg(nameNr * 4).arg(nameNr, 2, 16, QChar('0'));
+    }
+    QCOMPARE(rewriter.rewrite(fileNames.at(1)), QString("cfg/4/01-52-54-00-12-34-01"));
+
+    QBENCHMARK
+    {
+        for (const auto &nextName : fileNames)
+        {
+            rewriter.rewrite(nextName);
+        }
+    }
+}
+
+
+} // namespace QTFTP end
+
+QTEST_MAIN(QTFTP::FileNameRewriterTest)
+#include "filenamerewriter_ut.moc"
@@ -0,0 +1,167 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#include "qtftp/histogram.h"
+#include "qtftp/metrics.h"
+#include <QTest>
+#include <algorithm>
+#include <limits>
+
+namespace QTFTP
+{
+
+
+class HistogramTest : public QObject
+{
+    Q_OBJECT
+
+    private slots:
+        void bucketBoundsAreConsistent();
+        void percentileOfUniformValues();
+        void mergeAndReset();
+        void ackDelaysAggregatedPerSubnet();
+        void prometheusBucketIncludesBound();
+};
+
+
+void HistogramTest::bucketBoundsAreConsistent()
+{
+    for (unsigned int index=0; index<Histogram::BucketCount; ++index)
+    {
+        QCOMPARE(Histogram::bucketIndex(Histogram::bucketLowerBound(index)), index);
+        if (index+1 < Histogram::BucketCount)
+        {
+            QCOMPARE(Histogram::bucketIndex(Histogram::bucketLowerBound(index+1) - 1), index);
+        }
+    }
+    //values above the range of the histogram end up in the last bucket
+    QCOMPARE(Histogram::bucketIndex(std::numeric_limits<uint64_t>::max()), Histogram::BucketCount-1);
+}
+
+
+void HistogramTest::percentileOfUniformValues()
+{
+    Histogram histogram;
+    QCOMPARE(histogram.percentile(0.5), uint64_t(0));
+
+    for (uint64_t value=1; value<=1000; ++value)
+    {
+        histogram.record(value);
+    }
+    QCOMPARE(histogram.count(), uint64_t(1000));
+    QCOMPARE(histogram.mean(), uint64_t(501)); // 500.5 rounded
+    QCOMPARE(histogram.countBelow(64), uint64_t(63));
+
+    //relative error of a log-linear histogram with 8 sub-buckets is at most 12.5%
+    auto p50 = histogram.percentile(0.5);
+    QVERIFY(p50 >= 500 * 0.875 && p50 <= 500 * 1.125);
+    auto p99 = histogram.percentile(0.99);
+    QVERIFY(p99 >= 990 * 0.875 && p99 <= 990 * 1.125);
+}
+
+
+void HistogramTest::mergeAndReset()
+{
+    Histogram first;
+    Histogram second;
+    first.record(10);
+    second.record(20);
+    second.record(30);
+
+    first.merge(second);
+    QCOMPARE(first.count(), uint64_t(3));
+    QCOMPARE(first.sum(), uint64_t(60));
+    QCOMPARE(second.count(), uint64_t(2));
+
+    first.reset();
+    QCOMPARE(first.count(), uint64_t(0));
+    QCOMPARE(first.sum(), uint64_t(0));
+    QCOMPARE(first.countBelow(1000), uint64_t(0));
+}
+
+
+void HistogramTest::ackDelaysAggregatedPerSubnet()
+{
+    ServerMetrics serverMetrics;
+    auto bindingMetrics = serverMetrics.addBinding(QHostAddress::LocalHost, 69);
+
+    Histogram sessionDelays;
+    sessionDelays.record(1000);
+    serverMetrics.mergeAckDelays(bindingMetrics.get(), QHostAddress("10.1.2.3"), sessionDelays);
+    serverMetrics.mergeAckDelays(bindingMetrics.get(), QHostAddress("10.1.2.200"), sessionDelays);
+    serverMetrics.mergeAckDelays(bindingMetrics.get(), QHostAddress("10.1.3.1"), sessionDelays);
+
+    QCOMPARE(bindingMetrics->m_ackRttUs.count(), uint64_t(3));
+    QCOMPARE(serverMetrics.ackDelays().count(), uint64_t(3));
+    auto subnets = serverMetrics.ackDelaysBySubnet();
+    QCOMPARE(subnets.size(), size_t(2));
+    auto firstSubnet = std::find_if(subnets.begin(), subnets.end(), [](const SubnetLatency &subnet) { return subnet.m_network == QHostAddress("10.1.2.0"); });
+    QVERIFY(firstSubnet != subnets.end());
+    QCOMPARE(firstSubnet->m_prefixLength, 24);
+    QCOMPARE(firstSubnet->m_count, uint64_t(2));
+
+    serverMetrics.resetAckDelays();
+    QCOMPARE(bindingMetrics->m_ackRttUs.count(), uint64_t(0));
+    QCOMPARE(serverMetrics.ackDelaysBySubnet().size(), size_t(0));
+}
+
+
+
+/**
+ * @brief HistogramTest::prometheusBucketIncludesBound a sample that equals the upper bound of a bucket is counted in that bucket, a larger one is not
+ */
+void HistogramTest::prometheusBucketIncludesBound()
+{
+    ServerMetrics serverMetrics;
+    auto bindingMetrics = serverMetrics.addBinding(QHostAddress::LocalHost, 69);
+    bindingMetrics->m_ackRttUs.record(1023);
+    bindingMetrics->m_ackRttUs.record(1024);
+
+    QByteArray output = serverMetrics.toPrometheusText();
+    QList<QByteArray> ackRttBuckets;
+    for (const auto &nextLine : output.split('\n'))
+    {
+        if (nextLine.startsWith("qtftp_ack_rtt_seconds_bucket{"))
+        {
+            ackRttBuckets.append(nextLine);
+        }
+    }
+    auto bucketCount = [&ackRttBuckets](const QByteArray &bound)
+                       {
+                           for (const auto &nextBucket : ackRttBuckets)
+                           {
+                               if (nextBucket.contains("le=\"" + bound + "\"}"))
+                               {
+                                   return nextBucket.mid(nextBucket.lastIndexOf(' ') + 1).toInt();
+                               }
+                           }
+                           return -1;
+                       };
+    QCOMPARE(bucketCount("0.000255"), 0);
+    QCOMPARE(bucketCount("0.001023"), 1);
+    QCOMPARE(bucketCount("0.004095"), 2);
+    QCOMPARE(bucketCount("+Inf"), 2);
+}
+
+
+} // namespace QTFTP end
+
+QTEST_MAIN(QTFTP::HistogramTest)
+#include "histogram_ut.moc"
@@ -0,0 +1,209 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#include "qtftp/multicastreadsession.h"
+#include "qtftp/tftp_constants.h"
+#include "udpsocketstubfactory.h"
+#include "udpsocketstub.h"
+#include "simulatednetworkstream.h"
+#include <QFile>
+#include <QTest>
+#include <QTemporaryDir>
+#include <QStringList>
+#include <string>
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <arpa/inet.h>
+#endif
+
+namespace QTFTP
+{
+
+
+class MulticastReadSessionTest : public QObject
+{
+    Q_OBJECT
+
+    private slots:
+        void masterOackNamesGroup();
+        void clientJoinsWithOtherNameForm();
+        void clientJoinsWithNonAsciiName();
+        void nextClientTakesOverAsMaster();
+
+    private:
+        static QByteArray assembleRrq(const QString &fileName, const QStringList &options);
+        static std::string multicastOack(const char *optionValue);
+        static void sendFromClient(UdpSocketStubFactory &socketFactory, const QHostAddress &clientAddr, uint16_t clientPort,
+                                   uint16_t opcode, uint16_t word);
+};
+
+
+/**
+ * @brief MulticastReadSessionTest::assembleRrq assemble an octet mode RRQ
+ * @param options option names and values, alternating
+ */
+QByteArray MulticastReadSessionTest::assembleRrq(const QString &fileName, const QStringList &options)
+{
+    QByteArray rrqDatagram;
+    rrqDatagram.append(char(0x0));
+    rrqDatagram.append(char(0x1));
+    rrqDatagram.append(fileName.toUtf8());
+    rrqDatagram.append(char(0x0));
+    rrqDatagram.append("octet");
+    rrqDatagram.append(char(0x0));
+    for (const auto &nextPart : options)
+    {
+        rrqDatagram.append(nextPart.toUtf8());
+        rrqDatagram.append(char(0x0));
+    }
+    return rrqDatagram;
+}
+
+
+/**
+ * @brief MulticastReadSessionTest::multicastOack the OACK with only the multicast option and value \p optionValue
+ */
+std::string MulticastReadSessionTest::multicastOack(const char *optionValue)
+{
+    std::string oack("\x00\x06multicast", 11);
+    oack += '\0';
+    oack += optionValue;
+    oack += '\0';
+    return oack;
+}
+
+
+/**
+ * @brief MulticastReadSessionTest::sendFromClient send a datagram of two 16 bit words to the session socket, like an ACK or ERROR
+ */
+void MulticastReadSessionTest::sendFromClient(UdpSocketStubFactory &socketFactory, const QHostAddress &clientAddr, uint16_t clientPort,
+                                              uint16_t opcode, uint16_t word)
+{
+    auto sessionSocket = socketFactory.getSocketBySource(QHostAddress::Any, 0);
+    socketFactory.setSocketPeer(QHostAddress::Any, sessionSocket->localPort(), clientAddr, clientPort);
+    uint16_t words[2] = { htons(opcode), htons(word) };
+    QByteArray datagram(reinterpret_cast<char*>(words), sizeof(words));
+    if (opcode == TftpCode::TFTP_ERROR)
+    {
+        datagram.append(char(0x0)); //empty error message
+    }
+    sessionSocket->getInputStream() << datagram;
+}
+
+
+/**
+ * @brief MulticastReadSessionTest::masterOackNamesGroup the first client is told the group address and port, and that it is master
+ */
+void MulticastReadSessionTest::masterOackNamesGroup()
+{
+    auto socketFactory = std::make_shared<UdpSocketStubFactory>();
+    MulticastReadSession session(QHostAddress("10.6.11.123"), 1234, assembleRrq("600_byte_file.txt", {"multicast", ""}), TFTP_TEST_FILES_DIR,
+                                 QHostAddress("239.255.0.1"), 1758, 2000, socketFactory);
+    QVERIFY(session.isMulticast());
+    auto sessionSocket = socketFactory->getSocketBySource(QHostAddress::Any, 0);
+    QCOMPARE(sessionSocket->getOutputStream().str(), multicastOack("239.255.0.1,1758,1"));
+    QCOMPARE(sessionSocket->peerAddress(), QHostAddress("10.6.11.123"));
+
+    //without the multicast option the transfer is a plain unicast transfer
+    auto unicastFactory = std::make_shared<UdpSocketStubFactory>();
+    MulticastReadSession unicastSession(QHostAddress("10.6.11.123"), 1234, assembleRrq("600_byte_file.txt", {}), TFTP_TEST_FILES_DIR,
+                                        QHostAddress("239.255.0.1"), 1758, 2000, unicastFactory);
+    QVERIFY(!unicastSession.isMulticast());
+    QCOMPARE(unicastFactory->getSocketBySource(QHostAddress::Any, 0)->getOutputStream().str().size(), size_t(4 + 512));
+}
+
+
+/**
+ * @brief MulticastReadSessionTest::clientJoinsWithOtherNameForm
+ *
+ * A client that requests the file of a multicast transfer with a leading '/' is served by the same transfer,
+ * a client that requests another file is not.
+ */
+void MulticastReadSessionTest::clientJoinsWithOtherNameForm()
+{
+    auto socketFactory = std::make_shared<UdpSocketStubFactory>();
+    MulticastReadSession session(QHostAddress("10.6.11.123"), 1234, assembleRrq("600_byte_file.txt", {"multicast", ""}), TFTP_TEST_FILES_DIR,
+                                 QHostAddress("239.255.0.1"), 1758, 2000, socketFactory);
+    QVERIFY(session.isMulticast());
+    QCOMPARE(session.clientCount(), size_t(1));
+
+    QVERIFY(session.addClient(QHostAddress("10.6.11.124"), 1235, assembleRrq("/600_byte_file.txt", {"multicast", ""}), TFTP_TEST_FILES_DIR));
+    QCOMPARE(session.clientCount(), size_t(2));
+    QVERIFY(!session.addClient(QHostAddress("10.6.11.125"), 1236, assembleRrq("16_byte_file.txt", {"multicast", ""}), TFTP_TEST_FILES_DIR));
+    QCOMPARE(session.clientCount(), size_t(2));
+}
+
+
+/**
+ * @brief MulticastReadSessionTest::clientJoinsWithNonAsciiName the transfer mode is found after a file name with multi-byte characters
+ */
+void MulticastReadSessionTest::clientJoinsWithNonAsciiName()
+{
+    QTemporaryDir filesDir;
+    QString fileName = QString::fromUtf8("gr\xc3\xbc\xc3\x9f" "e.bin");
+    QFile file(filesDir.path() + "/" + fileName);
+    QVERIFY(file.open(QIODevice::WriteOnly) && file.write(QByteArray(100, 'g')) == 100);
+    file.close();
+
+    auto socketFactory = std::make_shared<UdpSocketStubFactory>();
+    MulticastReadSession session(QHostAddress("10.6.11.123"), 1234, assembleRrq(fileName, {"multicast", ""}), filesDir.path(),
+                                 QHostAddress("239.255.0.1"), 1758, 2000, socketFactory);
+    QVERIFY(session.isMulticast());
+    QVERIFY(session.addClient(QHostAddress("10.6.11.124"), 1235, assembleRrq(fileName, {"multicast", ""}), filesDir.path()));
+    QCOMPARE(session.clientCount(), size_t(2));
+}
+
+
+/**
+ * @brief MulticastReadSessionTest::nextClientTakesOverAsMaster when the master client leaves, the next client becomes master
+ *
+ * The new master reports the last block it received, and the transfer continues with the block after it.
+ */
+void MulticastReadSessionTest::nextClientTakesOverAsMaster()
+{
+    auto socketFactory = std::make_shared<UdpSocketStubFactory>();
+    MulticastReadSession session(QHostAddress("10.6.11.123"), 1234, assembleRrq("600_byte_file.txt", {"multicast", ""}), TFTP_TEST_FILES_DIR,
+                                 QHostAddress("239.255.0.1"), 1758, 2000, socketFactory);
+    QVERIFY(session.addClient(QHostAddress("10.6.11.124"), 1235, assembleRrq("600_byte_file.txt", {"multicast", ""}), TFTP_TEST_FILES_DIR));
+    auto sessionSocket = socketFactory->getSocketBySource(QHostAddress::Any, 0);
+    QCOMPARE(sessionSocket->getOutputStream().str(), multicastOack("239.255.0.1,1758,1") + multicastOack("239.255.0.1,1758,0"));
+
+    sessionSocket->getOutputStream().reset();
+    sendFromClient(*socketFactory, QHostAddress("10.6.11.123"), 1234, TftpCode::TFTP_ERROR, 0);
+    QCOMPARE(session.clientCount(), size_t(1));
+    QVERIFY(!session.hasClient(SessionIdent(QHostAddress("10.6.11.123"), 1234)));
+    QCOMPARE(sessionSocket->getOutputStream().str(), multicastOack("239.255.0.1,1758,1"));
+    QCOMPARE(sessionSocket->peerAddress(), QHostAddress("10.6.11.124"));
+
+    sessionSocket->getOutputStream().reset();
+    sendFromClient(*socketFactory, QHostAddress("10.6.11.124"), 1235, TftpCode::TFTP_ACK, 0);
+    std::string dataDatagram = sessionSocket->getOutputStream().str();
+    QCOMPARE(dataDatagram.size(), size_t(4 + 512));
+    QCOMPARE(dataDatagram.substr(0, 4), std::string("\x00\x03\x00\x01", 4));
+    QCOMPARE(sessionSocket->peerAddress(), QHostAddress("239.255.0.1"));
+    QCOMPARE(sessionSocket->peerPort(), quint16(1758));
+}
+
+
+} // namespace QTFTP end
+
+QTEST_MAIN(QTFTP::MulticastReadSessionTest)
+#include "multicastreadsession_ut.moc"
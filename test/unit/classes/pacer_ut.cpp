@@ -0,0 +1,105 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#include "qtftp/pacer.h"
+#include "qtftp/metrics.h"
+#include <QTest>
+
+namespace QTFTP
+{
+
+class PacerTest : public QObject
+{
+    Q_OBJECT
+
+    private slots:
+        void bucketDelaysAfterBurst();
+        void datagramQueuedBeyondRate();
+        void cancelledDatagramNotSent();
+};
+
+
+void PacerTest::bucketDelaysAfterBurst()
+{
+    auto now = std::chrono::steady_clock::now();
+    TokenBucket bucket;
+    QVERIFY(!bucket.isLimited());
+    QCOMPARE(bucket.delay(now).count(), int64_t(0));
+
+    bucket.setRate(1000, 100);
+    QCOMPARE(bucket.delay(now).count(), int64_t(0));
+    bucket.consume(200);
+    //100 bytes in debt at 1000 bytes per second
+    auto debtDelay = std::chrono::duration_cast<std::chrono::milliseconds>(bucket.delay(now));
+    QVERIFY(debtDelay.count() >= 99 && debtDelay.count() <= 100);
+    QCOMPARE(bucket.delay(now + std::chrono::milliseconds(101)).count(), int64_t(0));
+}
+
+
+void PacerTest::datagramQueuedBeyondRate()
+{
+    auto metrics = std::make_shared<PacingMetrics>();
+    Pacer pacer(metrics);
+    QVERIFY(!pacer.isEnabled());
+    pacer.setGlobalRate(10000, 1000);
+    QVERIFY(pacer.isEnabled());
+
+    //the pacer only uses the session pointer to keep the datagrams of a session together
+    int sessionKey = 0;
+    auto session = reinterpret_cast<const Session*>(&sessionKey);
+    TokenBucket sessionBucket;
+    bool deferredSent = false;
+    QVERIFY(pacer.admit(session, sessionBucket, nullptr, QHostAddress("10.6.11.1"), 1500, [](){}));
+    QVERIFY(!pacer.admit(session, sessionBucket, nullptr, QHostAddress("10.6.11.1"), 1500, [&deferredSent](){ deferredSent = true; }));
+    QCOMPARE(pacer.queuedCount(), size_t(1));
+    QCOMPARE(metrics->m_queuedDatagrams.value(), int64_t(1));
+
+    QTRY_VERIFY_WITH_TIMEOUT(deferredSent, 1000);
+    QCOMPARE(pacer.queuedCount(), size_t(0));
+    QCOMPARE(metrics->m_queuedDatagrams.value(), int64_t(0));
+    QCOMPARE(metrics->m_datagramsDelayed.value(), uint64_t(1));
+}
+
+
+void PacerTest::cancelledDatagramNotSent()
+{
+    auto metrics = std::make_shared<PacingMetrics>();
+    Pacer pacer(metrics);
+    pacer.setSessionRate(1000, 100);
+
+    int sessionKey = 0;
+    auto session = reinterpret_cast<const Session*>(&sessionKey);
+    TokenBucket sessionBucket;
+    pacer.initSessionBucket(sessionBucket);
+    bool deferredSent = false;
+    QVERIFY(pacer.admit(session, sessionBucket, nullptr, QHostAddress("10.6.11.1"), 200, [](){}));
+    QVERIFY(!pacer.admit(session, sessionBucket, nullptr, QHostAddress("10.6.11.1"), 200, [&deferredSent](){ deferredSent = true; }));
+    pacer.cancel(session);
+    QCOMPARE(pacer.queuedCount(), size_t(0));
+    QCOMPARE(metrics->m_queuedDatagrams.value(), int64_t(0));
+    QTest::qWait(300);
+    QVERIFY(!deferredSent);
+}
+
+
+} // namespace QTFTP end
+
+QTEST_MAIN(QTFTP::PacerTest)
+#include "pacer_ut.moc"
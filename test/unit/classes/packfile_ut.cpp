@@ -0,0 +1,94 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#include "qtftp/packfile.h"
+#include "testfiles.h"
+#include <QTest>
+#include <QTemporaryDir>
+#include <memory>
+
+namespace QTFTP
+{
+
+
+class PackFileTest : public QObject
+{
+    Q_OBJECT
+
+    private slots:
+        void filesFoundByName();
+        void providerReadsFromPack();
+
+    private:
+        QTemporaryDir m_tempDir;
+};
+
+
+void PackFileTest::filesFoundByName()
+{
+    QVERIFY(writeFile(m_tempDir.path() + "/files/pxelinux.0", QByteArray(1000, 'p')));
+    QVERIFY(writeFile(m_tempDir.path() + "/files/boot/kernel", QByteArray(3000, 'k')));
+    QVERIFY(writeFile(m_tempDir.path() + "/files/boot/empty", QByteArray()));
+    QString packPath = m_tempDir.path() + "/boot.pak";
+    QString errorString;
+    QVERIFY2(PackFile::build(m_tempDir.path() + "/files", packPath, &errorString), qPrintable(errorString));
+
+    PackFile packFile(packPath);
+    QVERIFY2(packFile.open(), qPrintable(packFile.errorString()));
+    QCOMPARE(packFile.fileCount(), uint32_t(3));
+
+    const char *data = nullptr;
+    qint64 size = 0;
+    QVERIFY(packFile.find("/boot/kernel", &data, &size));
+    QCOMPARE(QByteArray(data, static_cast<int>(size)), QByteArray(3000, 'k'));
+    QVERIFY(packFile.find("boot//empty", &data, &size));
+    QCOMPARE(size, qint64(0));
+    QVERIFY(packFile.find("pxelinux.0", &data, &size));
+    QCOMPARE(size, qint64(1000));
+    QVERIFY(!packFile.find("boot/missing", &data, &size));
+    QVERIFY(!packFile.find("../files/pxelinux.0", &data, &size));
+}
+
+
+void PackFileTest::providerReadsFromPack()
+{
+    QVERIFY(writeFile(m_tempDir.path() + "/files/image.bin", QByteArray(700, 'i')));
+    QString packPath = m_tempDir.path() + "/image.pak";
+    QVERIFY(PackFile::build(m_tempDir.path() + "/files", packPath));
+    auto packFile = std::make_shared<PackFile>(packPath);
+    QVERIFY(packFile->open());
+
+    PackProvider provider(packFile);
+    QVERIFY(provider.find("not_packed.bin", QHostAddress::LocalHost) == nullptr);
+    auto blockSource = provider.find("image.bin", QHostAddress::LocalHost);
+    QVERIFY(blockSource != nullptr);
+    QVERIFY(blockSource->open());
+    QCOMPARE(blockSource->size(), qint64(700));
+    char block[512];
+    QCOMPARE(blockSource->readAt(512, block, sizeof(block)), qint64(188));
+    QCOMPARE(QByteArray(block, 188), QByteArray(188, 'i'));
+    QVERIFY(!blockSource->shareKey().isEmpty());
+}
+
+
+} // namespace QTFTP end
+
+QTEST_MAIN(QTFTP::PackFileTest)
+#include "packfile_ut.moc"
@@ -23,7 +23,9 @@
 #define NOMINMAX
 #endif
 #include "qtftp/readsession.h"
+#include "qtftp/metrics.h"
 #include "udpsocketstubfactory.h"
+#include "udpsocketstub.h"
 #include "simulatednetworkstream.h"
 //#include <gtest/gtest.h>
 #include <QCoreApplication>
@@ -87,6 +89,10 @@ class ReadSessionTest : public QObject
         void transmitFileLargerThanOneBlockAscii();
         void detectSlowNetwork();
         void transmitOackOnOptionsRrq();
+        void transferGeneratedFileFromProvider();
+        void windowedTransferRecoversFromLoss();
+        void duplicateWindowAckResendsOnce();
+        void kernelTimestampsExcludeReadLag();
 
 };
 
@@ -670,8 +676,221 @@ void ReadSessionTest::transmitOackOnOptionsRrq()
 
 }
 
+
+void ReadSessionTest::transferGeneratedFileFromProvider()
+{
+    auto provider = std::make_shared<MemoryProvider>();
+    provider->addGenerator("boot.cfg", [](const QString &, const QHostAddress &peerAddr) { return QByteArray("ip=") + peerAddr.toString().toLatin1(); });
+
+    QByteArray rrqDatagram = QByteArray::fromRawData(reinterpret_cast<char*>(&m_rrqOpcode), sizeof(m_rrqOpcode));
+    rrqDatagram.append("boot.cfg");       // name of requested file, does not exist in the files directory
+    rrqDatagram.append(char(0x0));
+    rrqDatagram.append("octet");
+    rrqDatagram.append(char(0x0));
+
+    m_readSession  = std::make_unique<ReadSession>(QHostAddress("10.6.11.123"), 1234, rrqDatagram, TFTP_TEST_FILES_DIR, 2000, m_socketFactory,
+                                                   nullptr, nullptr, BlockSourceProviders{provider});
+    SimulatedNetworkStream &outNetworkStream = m_socketFactory->getNetworkStreamBySource(UdpSocketStubFactory::StreamDirection::Output, QHostAddress::Any, 0);
+    QByteArray sentData;
+    outNetworkStream >> sentData;
+
+    QCOMPARE(m_readSession->state(), Session::State::Busy);
+    const uint16_t* sentDataAsWords = reinterpret_cast<const uint16_t*>(sentData.constData());
+    QCOMPARE(sentDataAsWords[0], htons(0x0003));  //0x03 == data packet
+    QCOMPARE(sentData.mid(4), QByteArray("ip=10.6.11.123"));
+}
+
+
 //TODO: test ascii transfer mode with CR as last byte of full block
 
+/**
+ * @brief ReadSessionTest::windowedTransferRecoversFromLoss
+ *
+ * Lose one block of a window on a network with a delay: the window must be sent again from the block the client
+ * acknowledged last and the congestion window must shrink, then grow again on a clean ACK.
+ */
+void ReadSessionTest::windowedTransferRecoversFromLoss()
+{
+    static constexpr int BlockSize = 8;
+    static constexpr int NetworkDelayMs = 20;
+    //previous tests shortened the retransmit time-out, the test relies on ACKs to trigger retransmissions
+    ReadSession::setRetransmitTimeOut(DefaultRetransmitTimeOutms);
+    auto blockLost = std::make_shared<bool>(false);
+    auto dropFirstBlock3 = [blockLost](const QByteArray &datagram)
+                           {
+                               if (!*blockLost && datagram.size() > 4 && datagram.at(1) == 0x03 && datagram.at(3) == 0x03)
+                               {
+                                   *blockLost = true;
+                                   return true;
+                               }
+                               return false;
+                           };
+    m_socketFactory->setImpairment(dropFirstBlock3, NetworkDelayMs);
+
+    QByteArray rrqDatagram = QByteArray::fromRawData(reinterpret_cast<char*>(&m_rrqOpcode), sizeof(m_rrqOpcode));
+    rrqDatagram.append("600_byte_file.txt");
+    rrqDatagram.append(char(0x0));
+    rrqDatagram.append("octet");
+    rrqDatagram.append(char(0x0));
+    rrqDatagram.append("blksize");
+    rrqDatagram.append(char(0x0));
+    rrqDatagram.append(QByteArray::number(BlockSize));
+    rrqDatagram.append(char(0x0));
+    rrqDatagram.append("windowsize");
+    rrqDatagram.append(char(0x0));
+    rrqDatagram.append("8");
+    rrqDatagram.append(char(0x0));
+
+    QByteArray sentData = createReadSessionAndReturnNetworkResponse(QHostAddress("10.6.11.123"), 1234, rrqDatagram);
+    QCOMPARE(m_readSession->state(), Session::State::OptionsNegotation);
+    QCOMPARE(m_readSession->windowSize(), 8u);
+    QCOMPARE(m_readSession->congestionWindow(), CongestionController::InitialWindow);
+
+    SimulatedNetworkStream &inNetworkStream = m_socketFactory->getNetworkStreamBySource(UdpSocketStubFactory::StreamDirection::Input, QHostAddress::Any, 0);
+    SimulatedNetworkStream &outNetworkStream = m_socketFactory->getNetworkStreamBySource(UdpSocketStubFactory::StreamDirection::Output, QHostAddress::Any, 0);
+    auto sendAck = [&inNetworkStream](uint16_t blockNr)
+                   {
+                       QByteArray ackDatagram = QByteArray::fromRawData(reinterpret_cast<char*>(&m_ackOpcode), sizeof(m_ackOpcode));
+                       uint16_t ackBlockNr = htons(blockNr);
+                       ackDatagram.append(reinterpret_cast<const char*>(&ackBlockNr), sizeof(ackBlockNr));
+                       inNetworkStream << ackDatagram;
+                       QTest::qWait(2 * NetworkDelayMs);
+                   };
+    auto blockNrAt = [](const QByteArray &data, int datagramNr)
+                     {
+                         return ntohs( reinterpret_cast<const uint16_t*>(data.constData() + datagramNr * (BlockSize + 4))[1] );
+                     };
+
+    //no ACK delay known yet, so the whole window is sent at once: blocks 1 up to 8, but block 3 is lost
+    sendAck(0);
+    outNetworkStream >> sentData;
+    QCOMPARE(sentData.size(), 7 * (BlockSize + 4));
+    QCOMPARE(blockNrAt(sentData, 1), uint16_t(2));
+    QCOMPARE(blockNrAt(sentData, 2), uint16_t(4));
+
+    //the client times out waiting for block 3 and acknowledges block 2
+    sendAck(2);
+    QCOMPARE(m_readSession->congestionWindow(), CongestionController::InitialWindow / 2);
+    outNetworkStream >> sentData;
+    QCOMPARE(sentData.size(), 8 * (BlockSize + 4));
+    QCOMPARE(blockNrAt(sentData, 0), uint16_t(3));
+    QCOMPARE(blockNrAt(sentData, 7), uint16_t(10));
+    QByteArray expectedBlock;
+    readBytesFromFile(expectedBlock, "600_byte_file.txt", 2 * BlockSize, BlockSize);
+    QCOMPARE(sentData.mid(4, BlockSize), expectedBlock);
+
+    //a clean ACK of the complete window grows the congestion window again, the next window starts at block 11
+    //the window contained retransmitted blocks, so its ACK is no sample of the ACK delay (Karn's rule)
+    sendAck(10);
+    QVERIFY(m_readSession->congestionWindow() > CongestionController::InitialWindow / 2);
+    QCOMPARE(m_readSession->ackDelays().count(), uint64_t(0));
+    outNetworkStream >> sentData;
+    QCOMPARE(sentData.size(), 8 * (BlockSize + 4));
+    QCOMPARE(blockNrAt(sentData, 0), uint16_t(11));
+    QCOMPARE(m_readSession->state(), Session::State::Busy);
+
+    //the ACK of a window of first transmissions is
+    sendAck(18);
+    QCOMPARE(m_readSession->ackDelays().count(), uint64_t(1));
+    QVERIFY(m_readSession->averageAckDelayUs() >= NetworkDelayMs * 1000);
+
+    m_socketFactory->setImpairment(nullptr, 0);
+}
+
+
+/**
+ * @brief ReadSessionTest::duplicateWindowAckResendsOnce
+ *
+ * A duplicated ACK that reports a lost block must not make the session send the window again for each copy.
+ */
+void ReadSessionTest::duplicateWindowAckResendsOnce()
+{
+    static constexpr int BlockSize = 8;
+    ReadSession::setRetransmitTimeOut(DefaultRetransmitTimeOutms);
+
+    QByteArray rrqDatagram = QByteArray::fromRawData(reinterpret_cast<char*>(&m_rrqOpcode), sizeof(m_rrqOpcode));
+    rrqDatagram.append("600_byte_file.txt");
+    rrqDatagram.append(char(0x0));
+    rrqDatagram.append("octet");
+    rrqDatagram.append(char(0x0));
+    rrqDatagram.append("blksize");
+    rrqDatagram.append(char(0x0));
+    rrqDatagram.append(QByteArray::number(BlockSize));
+    rrqDatagram.append(char(0x0));
+    rrqDatagram.append("windowsize");
+    rrqDatagram.append(char(0x0));
+    rrqDatagram.append("8");
+    rrqDatagram.append(char(0x0));
+
+    QByteArray sentData = createReadSessionAndReturnNetworkResponse(QHostAddress("10.6.11.123"), 1234, rrqDatagram);
+    SimulatedNetworkStream &inNetworkStream = m_socketFactory->getNetworkStreamBySource(UdpSocketStubFactory::StreamDirection::Input, QHostAddress::Any, 0);
+    SimulatedNetworkStream &outNetworkStream = m_socketFactory->getNetworkStreamBySource(UdpSocketStubFactory::StreamDirection::Output, QHostAddress::Any, 0);
+    auto sendAck = [&inNetworkStream](uint16_t blockNr)
+                   {
+                       QByteArray ackDatagram = QByteArray::fromRawData(reinterpret_cast<char*>(&m_ackOpcode), sizeof(m_ackOpcode));
+                       uint16_t ackBlockNr = htons(blockNr);
+                       ackDatagram.append(reinterpret_cast<const char*>(&ackBlockNr), sizeof(ackBlockNr));
+                       inNetworkStream << ackDatagram;
+                   };
+
+    sendAck(0);
+    outNetworkStream >> sentData;
+    QCOMPARE(sentData.size(), 8 * (BlockSize + 4));
+
+    //the client missed block 3, the network delivers its ACK twice
+    sendAck(2);
+    sendAck(2);
+    QTest::qWait(10);
+    outNetworkStream >> sentData;
+    QCOMPARE(sentData.size(), 8 * (BlockSize + 4));
+    QCOMPARE(ntohs(reinterpret_cast<const uint16_t*>(sentData.constData())[1]), uint16_t(3));
+    QCOMPARE(m_readSession->congestionWindow(), CongestionController::InitialWindow / 2);
+    QCOMPARE(m_readSession->state(), Session::State::Busy);
+}
+
+
+/**
+ * @brief ReadSessionTest::kernelTimestampsExcludeReadLag
+ *
+ * An ACK that waits in the receive queue because the event loop is busy must not count in the ACK delay when kernel
+ * timestamps are enabled, the wait is recorded as receive queue delay instead.
+ */
+void ReadSessionTest::kernelTimestampsExcludeReadLag()
+{
+    static constexpr int ReadLagMs = 50;
+    ReadSession::setRetransmitTimeOut(DefaultRetransmitTimeOutms);
+    auto metrics = std::make_shared<BindingMetrics>(QHostAddress::Any, 69);
+
+    QByteArray rrqDatagram = QByteArray::fromRawData(reinterpret_cast<char*>(&m_rrqOpcode), sizeof(m_rrqOpcode));
+    rrqDatagram.append("600_byte_file.txt");
+    rrqDatagram.append(char(0x0));
+    rrqDatagram.append("octet");
+    rrqDatagram.append(char(0x0));
+
+    m_readSession.reset();
+    m_readSession = std::make_unique<ReadSession>(QHostAddress("10.6.11.123"), 1234, rrqDatagram, TFTP_TEST_FILES_DIR, 2000, m_socketFactory, metrics);
+    m_readSession->setKernelTimestamping(true);
+    m_socketFactory->getSocketBySource(QHostAddress::Any, 0)->setReadLag(ReadLagMs);
+    SimulatedNetworkStream &inNetworkStream = m_socketFactory->getNetworkStreamBySource(UdpSocketStubFactory::StreamDirection::Input, QHostAddress::Any, 0);
+    SimulatedNetworkStream &outNetworkStream = m_socketFactory->getNetworkStreamBySource(UdpSocketStubFactory::StreamDirection::Output, QHostAddress::Any, 0);
+    QByteArray sentData;
+    outNetworkStream >> sentData;
+
+    QByteArray ackDatagram = QByteArray::fromRawData(reinterpret_cast<char*>(&m_ackOpcode), sizeof(m_ackOpcode));
+    uint16_t ackBlockNr = htons(1);
+    ackDatagram.append(reinterpret_cast<const char*>(&ackBlockNr), sizeof(ackBlockNr));
+    inNetworkStream << ackDatagram;
+    QTest::qWait(2 * ReadLagMs);
+
+    outNetworkStream >> sentData;
+    QCOMPARE(sentData.size(), static_cast<int>(600 - DefaultTftpBlockSize + 4));   //ACK was handled, last block sent
+    QCOMPARE(m_readSession->ackDelays().count(), uint64_t(1));
+    QVERIFY(m_readSession->ackDelays().sum() < ReadLagMs * 1000);
+    QCOMPARE(metrics->m_receiveQueueDelayUs.count(), uint64_t(1));
+    QVERIFY(metrics->m_receiveQueueDelayUs.sum() >= ReadLagMs * 1000);
+}
+
+
 } // namespace QTFTP end
 
 QTEST_MAIN(QTFTP::ReadSessionTest)
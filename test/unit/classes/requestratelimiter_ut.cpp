@@ -0,0 +1,82 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#include "qtftp/requestratelimiter.h"
+#include <QTest>
+#include <chrono>
+
+namespace QTFTP
+{
+
+class RequestRateLimiterTest : public QObject
+{
+    Q_OBJECT
+
+    private slots:
+        void requestsBeyondLimitRejected();
+        void countsDecay();
+};
+
+
+void RequestRateLimiterTest::requestsBeyondLimitRejected()
+{
+    RequestRateLimiter limiter;
+    QVERIFY(limiter.allow(QHostAddress("10.0.0.1")));
+    limiter.setMaxRequestsPerSecond(5);
+
+    auto now = std::chrono::steady_clock::now();
+    QHostAddress floodAddress("10.0.0.2");
+    for (int requestNr=0; requestNr<5; ++requestNr)
+    {
+        QVERIFY(limiter.allow(floodAddress, now));
+    }
+    QVERIFY(!limiter.allow(floodAddress, now));
+    QCOMPARE(limiter.estimate(floodAddress), 5u);
+
+    //other clients are not affected
+    QVERIFY(limiter.allow(QHostAddress("10.0.0.3"), now));
+    QVERIFY(limiter.allow(QHostAddress("fd00::2"), now));
+}
+
+
+void RequestRateLimiterTest::countsDecay()
+{
+    RequestRateLimiter limiter;
+    limiter.setMaxRequestsPerSecond(8);
+
+    auto now = std::chrono::steady_clock::now();
+    QHostAddress peerAddress("192.168.1.20");
+    for (int requestNr=0; requestNr<8; ++requestNr)
+    {
+        QVERIFY(limiter.allow(peerAddress, now));
+    }
+    QVERIFY(!limiter.allow(peerAddress, now));
+
+    //each decay interval halves the count
+    now += std::chrono::milliseconds(2 * RequestRateLimiter::DecayIntervalMs + 10);
+    QVERIFY(limiter.allow(peerAddress, now));
+    QCOMPARE(limiter.estimate(peerAddress), 3u);
+}
+
+
+} // namespace QTFTP end
+
+QTEST_MAIN(QTFTP::RequestRateLimiterTest)
+#include "requestratelimiter_ut.moc"
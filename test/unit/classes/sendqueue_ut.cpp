@@ -0,0 +1,156 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#include "qtftp/sendqueue.h"
+#include "udpsocketstub.h"
+#include <QSignalSpy>
+#include <QTest>
+#include <memory>
+#include <vector>
+
+namespace QTFTP
+{
+
+class SendQueueTest : public QObject
+{
+    Q_OBJECT
+
+    private slots:
+        void datagramsWaitForFullSendBuffer();
+        void slowlyDrainingQueueDoesNotFail();
+        void fullQueueReportsFailure();
+        void permanentErrorReportsFailure();
+};
+
+
+void SendQueueTest::datagramsWaitForFullSendBuffer()
+{
+    auto socket = std::make_shared<UdpSocketStub>();
+    SendQueue sendQueue(socket);
+    QSignalSpy blockedSpy(&sendQueue, &SendQueue::blocked);
+    std::vector<int> sentOrder;
+    QHostAddress peerAddress("127.0.0.1");
+
+    sendQueue.send(QByteArray("a"), peerAddress, 69, [&sentOrder](){ sentOrder.push_back(1); });
+    QCOMPARE(sentOrder.size(), size_t(1));
+    QVERIFY(!sendQueue.isBlocked());
+
+    //a datagram waits while the send buffer is full and is sent, before later datagrams, when the socket is writable again
+    socket->setSendBufferFull(true);
+    sendQueue.send(QByteArray("b"), peerAddress, 69, [&sentOrder](){ sentOrder.push_back(2); });
+    QVERIFY(sendQueue.isBlocked());
+    QCOMPARE(blockedSpy.count(), 1);
+    socket->setSendBufferFull(false);
+    sendQueue.send(QByteArray("c"), peerAddress, 69, [&sentOrder](){ sentOrder.push_back(3); });
+    QCOMPARE(sendQueue.queuedCount(), size_t(0));
+    QCOMPARE(sentOrder, std::vector<int>({1, 2, 3}));
+    QCOMPARE(socket->getOutputStream().str(), std::string("abc"));
+    QCOMPARE(socket->blockedWrites(), 1u);
+    QCOMPARE(blockedSpy.count(), 1);
+}
+
+
+/**
+ * @brief SendQueueTest::slowlyDrainingQueueDoesNotFail
+ *
+ * A queue that stays non-empty for longer than MaxBlockedMs, but writes a datagram now and then, must not give up.
+ */
+void SendQueueTest::slowlyDrainingQueueDoesNotFail()
+{
+    static constexpr int QueuedDatagrams = 20;
+    static constexpr int DrainIntervalMs = SendQueue::MaxBlockedMs / 5;
+    auto socket = std::make_shared<UdpSocketStub>();
+    SendQueue sendQueue(socket);
+    QSignalSpy failedSpy(&sendQueue, &SendQueue::sendFailed);
+    QHostAddress peerAddress("127.0.0.1");
+
+    socket->setSendBufferFull(true);
+    for (int i=0; i<QueuedDatagrams; ++i)
+    {
+        sendQueue.send(QByteArray("a"), peerAddress, 69, [](){});
+    }
+
+    //one datagram leaves every DrainIntervalMs, until well after MaxBlockedMs since the queue was blocked
+    int drainCount = 0;
+    for (int elapsedMs=0; elapsedMs <= SendQueue::MaxBlockedMs + 2 * DrainIntervalMs; elapsedMs+=DrainIntervalMs)
+    {
+        QTest::qWait(DrainIntervalMs);
+        socket->setSendBufferSpace(1);
+        QTest::qWait(2 * SendQueue::RetryIntervalMs);
+        ++drainCount;
+        QCOMPARE(sendQueue.queuedCount(), size_t(QueuedDatagrams - drainCount));
+    }
+    QCOMPARE(failedSpy.count(), 0);
+    QVERIFY(sendQueue.isBlocked());
+}
+
+
+void SendQueueTest::fullQueueReportsFailure()
+{
+    auto socket = std::make_shared<UdpSocketStub>();
+    SendQueue sendQueue(socket);
+    QSignalSpy failedSpy(&sendQueue, &SendQueue::sendFailed);
+    QHostAddress peerAddress("127.0.0.1");
+
+    socket->setSendBufferFull(true);
+    for (size_t i=0; i<=SendQueue::MaxQueuedDatagrams; ++i)
+    {
+        sendQueue.send(QByteArray("a"), peerAddress, 69, [](){});
+    }
+    //the failure is reported from the event loop, not to the caller of send()
+    QCOMPARE(failedSpy.count(), 0);
+    QVERIFY(failedSpy.wait(100));
+    QVERIFY(!sendQueue.isBlocked());
+
+    //a failed queue drops further datagrams
+    socket->setSendBufferFull(false);
+    sendQueue.send(QByteArray("b"), peerAddress, 69, [](){});
+    QCOMPARE(socket->getOutputStream().str(), std::string());
+    QCOMPARE(failedSpy.count(), 1);
+}
+
+
+/**
+ * @brief SendQueueTest::permanentErrorReportsFailure
+ *
+ * A permanent socket error must not be thrown to the caller of send(), callers like the event loop don't catch it.
+ */
+void SendQueueTest::permanentErrorReportsFailure()
+{
+    auto socket = std::make_shared<UdpSocketStub>();
+    SendQueue sendQueue(socket);
+    QSignalSpy failedSpy(&sendQueue, &SendQueue::sendFailed);
+    QHostAddress peerAddress("127.0.0.1");
+    bool isSent = false;
+
+    socket->setSendError(true);
+    sendQueue.send(QByteArray("a"), peerAddress, 69, [&isSent](){ isSent = true; });
+    QCOMPARE(failedSpy.count(), 0);
+    QVERIFY(failedSpy.wait(100));
+    QVERIFY(!isSent);
+    QVERIFY(!sendQueue.isBlocked());
+    QCOMPARE(socket->blockedWrites(), 0u);
+}
+
+
+} // namespace QTFTP end
+
+QTEST_MAIN(QTFTP::SendQueueTest)
+#include "sendqueue_ut.moc"
@@ -0,0 +1,104 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#include "qtftp/sendscheduler.h"
+#include <QTest>
+#include <algorithm>
+#include <vector>
+
+namespace QTFTP
+{
+
+class SendSchedulerTest : public QObject
+{
+    Q_OBJECT
+
+    private slots:
+        void priorityTransferSentFirst();
+        void roundRobinSharesByWeight();
+};
+
+
+void SendSchedulerTest::priorityTransferSentFirst()
+{
+    SendScheduler scheduler;
+    scheduler.setRoundBytes(4000);
+    scheduler.setPriorityTransferSize(1024);
+    QVERIFY(scheduler.isPriorityTransfer(500));
+    QVERIFY(!scheduler.isPriorityTransfer(1025));
+
+    //the scheduler only uses the session pointer to keep the datagrams of a session together
+    int largeKey = 0, smallKey = 0;
+    auto largeSession = reinterpret_cast<const Session*>(&largeKey);
+    auto smallSession = reinterpret_cast<const Session*>(&smallKey);
+    std::vector<char> sendOrder;
+
+    //the first datagrams fit in this pass of the event loop
+    int sentNow = 0;
+    for (int datagramNr=0; datagramNr<10; ++datagramNr)
+    {
+        if (scheduler.schedule(largeSession, nullptr, false, 1000, [&sendOrder](){ sendOrder.push_back('L'); }))
+        {
+            ++sentNow;
+        }
+    }
+    QCOMPARE(sentNow, 4);
+    QVERIFY(!scheduler.schedule(smallSession, nullptr, true, 500, [&sendOrder](){ sendOrder.push_back('S'); }));
+    QCOMPARE(scheduler.queuedCount(), size_t(7));
+
+    QTRY_VERIFY_WITH_TIMEOUT(scheduler.queuedCount() == 0, 1000);
+    QCOMPARE(sendOrder.size(), size_t(7));
+    QCOMPARE(sendOrder.front(), 'S');
+}
+
+
+void SendSchedulerTest::roundRobinSharesByWeight()
+{
+    static constexpr uint64_t DatagramSize = 1024;
+    SendScheduler scheduler;
+    scheduler.setRoundBytes(3 * SendScheduler::Quantum);
+    int bindingKey1 = 0, bindingKey2 = 0;
+    auto binding1 = reinterpret_cast<const BindingMetrics*>(&bindingKey1);
+    auto binding2 = reinterpret_cast<const BindingMetrics*>(&bindingKey2);
+    scheduler.setBindingWeight(binding2, 2);
+
+    int fillKey = 0, keyA = 0, keyB = 0;
+    std::vector<char> sendOrder;
+    //fill this pass of the event loop, so the datagrams of A and B are queued
+    QVERIFY(scheduler.schedule(reinterpret_cast<const Session*>(&fillKey), nullptr, false, 3 * SendScheduler::Quantum, [](){}));
+    for (int datagramNr=0; datagramNr<40; ++datagramNr)
+    {
+        QVERIFY(!scheduler.schedule(reinterpret_cast<const Session*>(&keyA), binding1, false, DatagramSize, [&sendOrder](){ sendOrder.push_back('A'); }));
+        QVERIFY(!scheduler.schedule(reinterpret_cast<const Session*>(&keyB), binding2, false, DatagramSize, [&sendOrder](){ sendOrder.push_back('B'); }));
+    }
+
+    QTRY_VERIFY_WITH_TIMEOUT(scheduler.queuedCount() == 0, 1000);
+    QCOMPARE(sendOrder.size(), size_t(80));
+    //in the first pass B, with twice the weight, sends twice as much as A
+    auto firstPassEnd = sendOrder.begin() + static_cast<int>(3 * SendScheduler::Quantum / DatagramSize);
+    QCOMPARE(std::count(sendOrder.begin(), firstPassEnd, 'A'), static_cast<std::ptrdiff_t>(SendScheduler::Quantum / DatagramSize));
+    QCOMPARE(std::count(sendOrder.begin(), firstPassEnd, 'B'), static_cast<std::ptrdiff_t>(2 * SendScheduler::Quantum / DatagramSize));
+}
+
+
+} // namespace QTFTP end
+
+QTEST_MAIN(QTFTP::SendSchedulerTest)
+#include "sendscheduler_ut.moc"
@@ -0,0 +1,160 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#include "qtftp/subnetroutes.h"
+#include "qtftp/tftp_error.h"
+#include <QTest>
+#include <QTemporaryDir>
+#include <QDir>
+#include <QFile>
+#include <QTextStream>
+#include <vector>
+
+namespace QTFTP
+{
+
+static constexpr int BenchmarkRoutes = 50000;
+
+
+class SubnetRoutesTest : public QObject
+{
+    Q_OBJECT
+
+    private slots:
+        void initTestCase();
+        void longestPrefixWins();
+        void invalidRoutesRefused();
+        void routesFileLoaded();
+        void lookupRate();
+
+    private:
+        QTemporaryDir m_tempDir;
+};
+
+
+void SubnetRoutesTest::initTestCase()
+{
+    QVERIFY(m_tempDir.isValid());
+    QVERIFY(QDir().mkpath(m_tempDir.path() + "/production"));
+    QVERIFY(QDir().mkpath(m_tempDir.path() + "/test"));
+    QVERIFY(QDir().mkpath(m_tempDir.path() + "/lab"));
+}
+
+
+void SubnetRoutesTest::longestPrefixWins()
+{
+    SubnetRoutes routes;
+    routes.addRoute(QHostAddress("10.1.0.0"), 16, m_tempDir.path() + "/production");
+    routes.addRoute(QHostAddress("10.1.128.0"), 24, m_tempDir.path() + "/test");
+    routes.addRoute(QHostAddress("10.1.128.7"), 32, m_tempDir.path() + "/lab");
+    routes.addRoute(QHostAddress("fd00:10:1::"), 48, m_tempDir.path() + "/production");
+    QCOMPARE(routes.routeCount(), static_cast<size_t>(4));
+
+    QCOMPARE(routes.find(QHostAddress("10.1.2.3"))->m_filesDir, m_tempDir.path() + "/production");
+    QCOMPARE(routes.find(QHostAddress("10.1.128.3"))->m_filesDir, m_tempDir.path() + "/test");
+    QCOMPARE(routes.find(QHostAddress("10.1.128.7"))->m_filesDir, m_tempDir.path() + "/lab");
+    QCOMPARE(routes.find(QHostAddress("::ffff:10.1.128.3"))->m_filesDir, m_tempDir.path() + "/test");
+    QCOMPARE(routes.find(QHostAddress("fd00:10:1:5::1"))->m_filesDir, m_tempDir.path() + "/production");
+    QVERIFY(routes.find(QHostAddress("10.2.0.1")) == nullptr);
+    QVERIFY(routes.find(QHostAddress("fd00:10:2::1")) == nullptr);
+
+    //routes to the same directory share a provider
+    QCOMPARE(routes.find(QHostAddress("10.1.2.3"))->m_directoryProvider, routes.find(QHostAddress("fd00:10:1::1"))->m_directoryProvider);
+
+    routes.addRoute(QHostAddress("0.0.0.0"), 0, m_tempDir.path() + "/lab");
+    QCOMPARE(routes.find(QHostAddress("10.2.0.1"))->m_filesDir, m_tempDir.path() + "/lab");
+}
+
+
+void SubnetRoutesTest::invalidRoutesRefused()
+{
+    SubnetRoutes routes;
+    routes.addRoute(QHostAddress("10.1.0.0"), 16, m_tempDir.path() + "/production");
+    QVERIFY_EXCEPTION_THROWN(routes.addRoute(QHostAddress("10.1.0.0"), 16, m_tempDir.path() + "/test"), TftpError);
+    QVERIFY_EXCEPTION_THROWN(routes.addRoute(QHostAddress("10.1.0.0"), 33, m_tempDir.path() + "/test"), TftpError);
+    QVERIFY_EXCEPTION_THROWN(routes.addRoute(QHostAddress(), 8, m_tempDir.path() + "/test"), TftpError);
+    QVERIFY_EXCEPTION_THROWN(routes.addRoute(QHostAddress("10.2.0.0"), 16, m_tempDir.path() + "/missing"), TftpError);
+    QCOMPARE(routes.routeCount(), static_cast<size_t>(1));
+}
+
+
+void SubnetRoutesTest::routesFileLoaded()
+{
+    QFile routesFile(m_tempDir.path() + "/fleet.routes");
+    QVERIFY(routesFile.open(QIODevice::WriteOnly | QIODevice::Text));
+    QTextStream routesStream(&routesFile);
+    routesStream << "# fleets\n"
+                 << "10.1.0.0/16      production\n"
+                 << "\n"
+                 << "fd00:10:1::/48   " << m_tempDir.path() << "/test\n";
+    routesStream.flush();
+    routesFile.close();
+
+    SubnetRoutes routes;
+    routes.loadRoutes(routesFile.fileName(), m_tempDir.path());
+    QCOMPARE(routes.routeCount(), static_cast<size_t>(2));
+    QCOMPARE(routes.find(QHostAddress("10.1.2.3"))->m_filesDir, m_tempDir.path() + "/production");
+    QCOMPARE(routes.find(QHostAddress("fd00:10:1::1"))->m_filesDir, m_tempDir.path() + "/test");
+
+    QVERIFY(routesFile.open(QIODevice::Append | QIODevice::Text));
+    routesFile.write("10.3.0.0/40 lab\n");
+    routesFile.close();
+    SubnetRoutes invalidRoutes;
+    QVERIFY_EXCEPTION_THROWN(invalidRoutes.loadRoutes(routesFile.fileName(), m_tempDir.path()), TftpError);
+}
+
+
+void SubnetRoutesTest::lookupRate()
+{
+    const QString dirs[] = { m_tempDir.path() + "/production", m_tempDir.path() + "/test", m_tempDir.path() + "/lab" };
+    SubnetRoutes routes;
+    for (int routeNr=0; routeNr<BenchmarkRoutes; ++routeNr)
+    {
+        //a /24 per route in 10.0.0.0/8, and a /64 per route in fd00::/16
+        quint32 ipv4Net = 0x0a000000 | (static_cast<quint32>(routeNr) << 8);
+        routes.addRoute(QHostAddress(ipv4Net), 24, dirs[routeNr % 3]);
+        routes.addRoute(QHostAddress(QString("fd00:%1:%2::").arg(routeNr >> 16, 0, 16).arg(routeNr & 0xffff, 0, 16)), 64, dirs[routeNr % 3]);
+    }
+    QCOMPARE(routes.routeCount(), static_cast<size_t>(2 * BenchmarkRoutes));
+
+    std::vector<QHostAddress> peers;
+    for (int peerNr=0; peerNr<256; ++peerNr)
+    {
+        int routeNr = (peerNr * 193) % BenchmarkRoutes;
+        peers.emplace_back(0x0a000000 | (static_cast<quint32>(routeNr) << 8) | 42);
+        peers.emplace_back(QString("fd00:%1:%2::42").arg(routeNr >> 16, 0, 16).arg(routeNr & 0xffff, 0, 16));
+    }
+    QCOMPARE(routes.find(peers.at(2))->m_filesDir, dirs[193 % 3]);
+    QCOMPARE(routes.find(peers.at(3))->m_filesDir, dirs[193 % 3]);
+
+    QBENCHMARK
+    {
+        for (const auto &nextPeer : peers)
+        {
+            routes.find(nextPeer);
+        }
+    }
+}
+
+
+} // namespace QTFTP end
+
+QTEST_MAIN(QTFTP::SubnetRoutesTest)
+#include "subnetroutes_ut.moc"
@@ -21,10 +21,15 @@
 #include "qtftp/tftpserver.h"
 #include "qtftp/tftp_constants.h"
 #include "udpsocketstubfactory.h"
+#include "udpsocketstub.h"
 #include "simulatednetworkstream.h"
 #include "qtftp/tftp_error.h"
+#include "qtftp/blocksource.h"
 #include <QByteArray>
+#include <QFile>
 #include <QTest>
+#include <QTemporaryDir>
+#include <QTimer>
 #ifdef _WIN32
 #include <winsock2.h>
 #else
@@ -34,6 +39,34 @@
 namespace QTFTP
 {
 
+static constexpr int BenchmarkBindings = 100;
+static constexpr uint16_t BenchmarkFirstPort = 3000;
+
+
+/**
+ * @brief The UnreadableProvider class serves a file that can be opened but not read, so starting its session fails
+ */
+class UnreadableProvider : public BlockSourceProvider
+{
+    public:
+        std::shared_ptr<BlockSource> find(const QString &fileName, const QHostAddress &peerAddr) override
+        {
+            Q_UNUSED(peerAddr);
+            return (fileName == "unreadable.bin") ? std::make_shared<UnreadableSource>() : nullptr;
+        }
+
+    private:
+        class UnreadableSource : public BlockSource
+        {
+            public:
+                bool open() override { return true; }
+                QString errorString() const override { return QString(); }
+                QString name() const override { return "unreadable.bin"; }
+                qint64 size() const override { return 100; }
+                qint64 readAt(qint64, char *, qint64) override { return -1; }
+        };
+};
+
 
 class TftpServerTest : public QObject
 {
@@ -67,6 +100,19 @@ class TftpServerTest : public QObject
     private slots:
         void readRequestSendsNoOutputOnMainSocket();
         void readRequestSendsDataPacketOnSessionSocket();
+        void wildcardBindingDispatchesRequest();
+        void wildcardBindingDispatchesByDestination();
+        void fullServerRejectsReadRequest();
+        void fullServerQueuesReadRequest();
+        void queuedRequestExpires();
+        void failingQueuedRequestIsSkipped();
+        void autoTuningRaisesBufferOnDrops();
+        void busyBindingDoesNotStarveOthers();
+        void requestDispatchRate();
+
+    private:
+        static QByteArray assembleRrq(const char *fileName);
+        void acknowledgeLastBlock(const QHostAddress &peerAddr, uint16_t peerPort);
 };
 
 uint16_t TftpServerTest::m_rrqOpcode( 0x0 );
@@ -119,6 +165,358 @@ void TftpServerTest::readRequestSendsDataPacketOnSessionSocket()
     //correct contents of data packet is tested in unit tests of class ReadSession
 }
 
+void TftpServerTest::wildcardBindingDispatchesRequest()
+{
+    TftpServer wildcardServer(m_socketFactory);
+    wildcardServer.enableWildcardBinding();
+    wildcardServer.bind(TFTP_TEST_FILES_DIR, QHostAddress::Any, 2346);
+    QVERIFY_EXCEPTION_THROWN(wildcardServer.bind(TFTP_TEST_FILES_DIR, QHostAddress::Any, 2346), TftpError);
+    QCOMPARE(wildcardServer.bindings().size(), size_t(1));
+
+    //the stub socket reports its local address as destination, so the request goes to the binding for the wildcard address
+    m_socketFactory->setSocketPeer(QHostAddress::Any, 2346, QHostAddress("10.6.11.210"), 1500);
+    SimulatedNetworkStream &inputNetworkStream = m_socketFactory->getNetworkStreamBySource(UdpSocketStubFactory::StreamDirection::Input, QHostAddress::Any, 2346);
+    QByteArray rrqDatagram = QByteArray::fromRawData(reinterpret_cast<char*>(&m_rrqOpcode), sizeof(m_rrqOpcode));
+    rrqDatagram.append("16_byte_file.txt");
+    rrqDatagram.append(char(0x0));
+    rrqDatagram.append("octet");
+    rrqDatagram.append(char(0x0));
+    inputNetworkStream << rrqDatagram;
+    m_socketFactory->setSocketPeer(QHostAddress::Any, 2346, QHostAddress("10.6.11.211"), 1501);
+
+    try
+    {
+        SimulatedNetworkStream &outputSessionStream = m_socketFactory->getNetworkStreamByDest(UdpSocketStubFactory::StreamDirection::Output, QHostAddress("10.6.11.210"), 1500);
+        QCOMPARE(outputSessionStream.str().size(), size_t(20));
+    }
+    catch (std::logic_error &/*err*/)
+    {
+        QFAIL("Test failed because simulated network stream couldn't be found.");
+    }
+}
+
+
+/**
+ * @brief TftpServerTest::wildcardBindingDispatchesByDestination two bindings share a wildcard socket
+ *
+ * Each request is served from the files directory of the binding for the address it was sent to, and is answered from
+ * that address.
+ */
+void TftpServerTest::wildcardBindingDispatchesByDestination()
+{
+    QTemporaryDir secondFilesDir;
+    QFile secondFile(secondFilesDir.path() + "/second_file.txt");
+    QVERIFY(secondFile.open(QIODevice::WriteOnly) && secondFile.write("0123456789") == 10);
+    secondFile.close();
+
+    TftpServer wildcardServer(m_socketFactory);
+    wildcardServer.enableWildcardBinding();
+    wildcardServer.bind(TFTP_TEST_FILES_DIR, QHostAddress("10.0.0.1"), 2349);
+    wildcardServer.bind(secondFilesDir.path(), QHostAddress("10.0.0.2"), 2349);
+    QCOMPARE(wildcardServer.bindings().size(), size_t(2));
+    auto wildcardSocket = m_socketFactory->getSocketBySource(QHostAddress::Any, 2349);
+    SimulatedNetworkStream &inputNetworkStream = wildcardSocket->getInputStream();
+
+    QByteArray rrqDatagram = QByteArray::fromRawData(reinterpret_cast<char*>(&m_rrqOpcode), sizeof(m_rrqOpcode));
+    rrqDatagram.append("second_file.txt");
+    rrqDatagram.append(char(0x0));
+    rrqDatagram.append("octet");
+    rrqDatagram.append(char(0x0));
+    wildcardSocket->setDestinationAddress(QHostAddress("10.0.0.2"));
+    m_socketFactory->setSocketPeer(QHostAddress::Any, 2349, QHostAddress("10.6.11.212"), 1502);
+    inputNetworkStream << rrqDatagram;
+
+    rrqDatagram = QByteArray::fromRawData(reinterpret_cast<char*>(&m_rrqOpcode), sizeof(m_rrqOpcode));
+    rrqDatagram.append("16_byte_file.txt");
+    rrqDatagram.append(char(0x0));
+    rrqDatagram.append("octet");
+    rrqDatagram.append(char(0x0));
+    wildcardSocket->setDestinationAddress(QHostAddress("10.0.0.1"));
+    m_socketFactory->setSocketPeer(QHostAddress::Any, 2349, QHostAddress("10.6.11.213"), 1503);
+    inputNetworkStream << rrqDatagram;
+
+    //the session sockets are bound to the address of their binding, so their DATA comes from that address
+    try
+    {
+        auto secondSessionSocket = m_socketFactory->getSocketBySource(QHostAddress("10.0.0.2"), 0);
+        QCOMPARE(secondSessionSocket->peerAddress(), QHostAddress("10.6.11.212"));
+        QCOMPARE(secondSessionSocket->getOutputStream().str().size(), size_t(14));
+        auto firstSessionSocket = m_socketFactory->getSocketBySource(QHostAddress("10.0.0.1"), 0);
+        QCOMPARE(firstSessionSocket->peerAddress(), QHostAddress("10.6.11.213"));
+        QCOMPARE(firstSessionSocket->getOutputStream().str().size(), size_t(20));
+    }
+    catch (std::logic_error &/*err*/)
+    {
+        QFAIL("Test failed because simulated socket of a session couldn't be found.");
+    }
+
+    //a reply sent on the shared socket comes from the address the request was sent to
+    uint16_t wrqOpcode = htons(0x0002);
+    QByteArray wrqDatagram = QByteArray::fromRawData(reinterpret_cast<char*>(&wrqOpcode), sizeof(wrqOpcode));
+    wrqDatagram.append("upload.bin");
+    wrqDatagram.append(char(0x0));
+    wrqDatagram.append("octet");
+    wrqDatagram.append(char(0x0));
+    wildcardSocket->setDestinationAddress(QHostAddress("10.0.0.2"));
+    m_socketFactory->setSocketPeer(QHostAddress::Any, 2349, QHostAddress("10.6.11.214"), 1504);
+    inputNetworkStream << wrqDatagram;
+    QCOMPARE(wildcardSocket->lastSourceAddress(), QHostAddress("10.0.0.2"));
+    wildcardSocket->setDestinationAddress(QHostAddress("10.0.0.1"));
+    m_socketFactory->setSocketPeer(QHostAddress::Any, 2349, QHostAddress("10.6.11.215"), 1505);
+    inputNetworkStream << wrqDatagram;
+    QCOMPARE(wildcardSocket->lastSourceAddress(), QHostAddress("10.0.0.1"));
+    QCOMPARE(wildcardSocket->peerAddress(), QHostAddress("10.6.11.215"));
+}
+
+
+void TftpServerTest::fullServerRejectsReadRequest()
+{
+    TftpServer limitedServer(m_socketFactory);
+    limitedServer.bind(TFTP_TEST_FILES_DIR, QHostAddress::Any, 2347);
+    limitedServer.setSessionLimits(1, 0);
+
+    QByteArray rrqDatagram = QByteArray::fromRawData(reinterpret_cast<char*>(&m_rrqOpcode), sizeof(m_rrqOpcode));
+    rrqDatagram.append("16_byte_file.txt");
+    rrqDatagram.append(char(0x0));
+    rrqDatagram.append("octet");
+    rrqDatagram.append(char(0x0));
+    SimulatedNetworkStream &inputNetworkStream = m_socketFactory->getNetworkStreamBySource(UdpSocketStubFactory::StreamDirection::Input, QHostAddress::Any, 2347);
+    SimulatedNetworkStream &outputNetworkStream = m_socketFactory->getNetworkStreamBySource(UdpSocketStubFactory::StreamDirection::Output, QHostAddress::Any, 2347);
+
+    //the first session waits for the ACK of its first block, so it keeps the only session slot
+    m_socketFactory->setSocketPeer(QHostAddress::Any, 2347, QHostAddress("10.6.11.230"), 1700);
+    inputNetworkStream << rrqDatagram;
+    QCOMPARE(outputNetworkStream.str().size(), size_t(0));
+    QCOMPARE(limitedServer.metrics().activeSessions(), int64_t(1));
+
+    //without room in the queue the second client gets an error on the main socket right away
+    m_socketFactory->setSocketPeer(QHostAddress::Any, 2347, QHostAddress("10.6.11.231"), 1701);
+    inputNetworkStream << rrqDatagram;
+    QVERIFY(outputNetworkStream.str().size() > 0);
+    QCOMPARE(limitedServer.metrics().admission().m_requestsRejected.value(), uint64_t(1));
+    QCOMPARE(limitedServer.metrics().activeSessions(), int64_t(1));
+}
+
+
+QByteArray TftpServerTest::assembleRrq(const char *fileName)
+{
+    QByteArray rrqDatagram = QByteArray::fromRawData(reinterpret_cast<char*>(&m_rrqOpcode), sizeof(m_rrqOpcode));
+    rrqDatagram.append(fileName);
+    rrqDatagram.append(char(0x0));
+    rrqDatagram.append("octet");
+    rrqDatagram.append(char(0x0));
+    return rrqDatagram;
+}
+
+
+/**
+ * @brief TftpServerTest::acknowledgeLastBlock send the ACK of block 1 to the session of a client, that ends a transfer of 16_byte_file.txt
+ */
+void TftpServerTest::acknowledgeLastBlock(const QHostAddress &peerAddr, uint16_t peerPort)
+{
+    uint16_t ackWords[2] = { htons(0x0004), htons(0x0001) };
+    SimulatedNetworkStream &sessionInputStream = m_socketFactory->getNetworkStreamByDest(UdpSocketStubFactory::StreamDirection::Input, peerAddr, peerPort);
+    sessionInputStream << QByteArray(reinterpret_cast<char*>(ackWords), sizeof(ackWords));
+}
+
+
+/**
+ * @brief TftpServerTest::fullServerQueuesReadRequest a request that finds no free session slot waits for the session in progress to end
+ */
+void TftpServerTest::fullServerQueuesReadRequest()
+{
+    TftpServer limitedServer(m_socketFactory);
+    limitedServer.bind(TFTP_TEST_FILES_DIR, QHostAddress::Any, 2350);
+    limitedServer.setSessionLimits(1, 1);
+    SimulatedNetworkStream &inputNetworkStream = m_socketFactory->getNetworkStreamBySource(UdpSocketStubFactory::StreamDirection::Input, QHostAddress::Any, 2350);
+    SimulatedNetworkStream &outputNetworkStream = m_socketFactory->getNetworkStreamBySource(UdpSocketStubFactory::StreamDirection::Output, QHostAddress::Any, 2350);
+
+    m_socketFactory->setSocketPeer(QHostAddress::Any, 2350, QHostAddress("10.6.11.240"), 1710);
+    inputNetworkStream << assembleRrq("16_byte_file.txt");
+    m_socketFactory->setSocketPeer(QHostAddress::Any, 2350, QHostAddress("10.6.11.241"), 1711);
+    inputNetworkStream << assembleRrq("16_byte_file.txt");
+    inputNetworkStream << assembleRrq("16_byte_file.txt"); //a retransmitted request is not queued twice
+    m_socketFactory->setSocketPeer(QHostAddress::Any, 2350, QHostAddress("10.6.11.249"), 1719);
+
+    QCOMPARE(outputNetworkStream.str().size(), size_t(0));
+    QCOMPARE(limitedServer.metrics().admission().m_queuedRequests.value(), int64_t(1));
+    QCOMPARE(limitedServer.metrics().admission().m_requestsRejected.value(), uint64_t(0));
+    QVERIFY_EXCEPTION_THROWN(m_socketFactory->getNetworkStreamByDest(UdpSocketStubFactory::StreamDirection::Output, QHostAddress("10.6.11.241"), 1711),
+                             std::logic_error);
+
+    //the end of the first session frees its slot for the queued request
+    acknowledgeLastBlock(QHostAddress("10.6.11.240"), 1710);
+    QCOMPARE(limitedServer.metrics().admission().m_queuedRequests.value(), int64_t(0));
+    QCOMPARE(limitedServer.metrics().activeSessions(), int64_t(1));
+    try
+    {
+        SimulatedNetworkStream &outputSessionStream = m_socketFactory->getNetworkStreamByDest(UdpSocketStubFactory::StreamDirection::Output, QHostAddress("10.6.11.241"), 1711);
+        QCOMPARE(outputSessionStream.str().size(), size_t(20));
+    }
+    catch (std::logic_error &/*err*/)
+    {
+        QFAIL("Queued request was not started when the session in progress ended.");
+    }
+}
+
+
+/**
+ * @brief TftpServerTest::queuedRequestExpires a request that waited longer than the maximum queue wait time makes room for a new one
+ */
+void TftpServerTest::queuedRequestExpires()
+{
+    TftpServer limitedServer(m_socketFactory);
+    limitedServer.bind(TFTP_TEST_FILES_DIR, QHostAddress::Any, 2351);
+    limitedServer.setSessionLimits(1, 1, 50);
+    SimulatedNetworkStream &inputNetworkStream = m_socketFactory->getNetworkStreamBySource(UdpSocketStubFactory::StreamDirection::Input, QHostAddress::Any, 2351);
+    SimulatedNetworkStream &outputNetworkStream = m_socketFactory->getNetworkStreamBySource(UdpSocketStubFactory::StreamDirection::Output, QHostAddress::Any, 2351);
+
+    m_socketFactory->setSocketPeer(QHostAddress::Any, 2351, QHostAddress("10.6.11.242"), 1720);
+    inputNetworkStream << assembleRrq("16_byte_file.txt");
+    m_socketFactory->setSocketPeer(QHostAddress::Any, 2351, QHostAddress("10.6.11.243"), 1721);
+    inputNetworkStream << assembleRrq("16_byte_file.txt");
+    QCOMPARE(limitedServer.metrics().admission().m_queuedRequests.value(), int64_t(1));
+
+    QTest::qWait(100);
+    m_socketFactory->setSocketPeer(QHostAddress::Any, 2351, QHostAddress("10.6.11.244"), 1722);
+    inputNetworkStream << assembleRrq("16_byte_file.txt");
+    m_socketFactory->setSocketPeer(QHostAddress::Any, 2351, QHostAddress("10.6.11.249"), 1729);
+
+    //the expired request is dropped without a reply, the new request takes its place in the queue
+    QCOMPARE(outputNetworkStream.str().size(), size_t(0));
+    QCOMPARE(limitedServer.metrics().admission().m_requestsExpired.value(), uint64_t(1));
+    QCOMPARE(limitedServer.metrics().admission().m_requestsRejected.value(), uint64_t(0));
+    QCOMPARE(limitedServer.metrics().admission().m_queuedRequests.value(), int64_t(1));
+
+    acknowledgeLastBlock(QHostAddress("10.6.11.242"), 1720);
+    QVERIFY_EXCEPTION_THROWN(m_socketFactory->getNetworkStreamByDest(UdpSocketStubFactory::StreamDirection::Output, QHostAddress("10.6.11.243"), 1721),
+                             std::logic_error);
+    QCOMPARE(m_socketFactory->getNetworkStreamByDest(UdpSocketStubFactory::StreamDirection::Output, QHostAddress("10.6.11.244"), 1722).str().size(), size_t(20));
+}
+
+
+/**
+ * @brief TftpServerTest::failingQueuedRequestIsSkipped a queued request whose session can't be started does not hold up the requests behind it
+ */
+void TftpServerTest::failingQueuedRequestIsSkipped()
+{
+    TftpServer limitedServer(m_socketFactory);
+    limitedServer.bind(TFTP_TEST_FILES_DIR, QHostAddress::Any, 2352);
+    limitedServer.addBlockSourceProvider(std::make_shared<UnreadableProvider>(), QHostAddress::Any, 2352);
+    limitedServer.setSessionLimits(1, 2);
+    SimulatedNetworkStream &inputNetworkStream = m_socketFactory->getNetworkStreamBySource(UdpSocketStubFactory::StreamDirection::Input, QHostAddress::Any, 2352);
+
+    m_socketFactory->setSocketPeer(QHostAddress::Any, 2352, QHostAddress("10.6.11.245"), 1730);
+    inputNetworkStream << assembleRrq("16_byte_file.txt");
+    m_socketFactory->setSocketPeer(QHostAddress::Any, 2352, QHostAddress("10.6.11.246"), 1731);
+    inputNetworkStream << assembleRrq("unreadable.bin");
+    m_socketFactory->setSocketPeer(QHostAddress::Any, 2352, QHostAddress("10.6.11.247"), 1732);
+    inputNetworkStream << assembleRrq("16_byte_file.txt");
+    m_socketFactory->setSocketPeer(QHostAddress::Any, 2352, QHostAddress("10.6.11.249"), 1739);
+    QCOMPARE(limitedServer.metrics().admission().m_queuedRequests.value(), int64_t(2));
+
+    //reading the first block of unreadable.bin throws TftpError, startQueuedRequests() goes on with the next request
+    acknowledgeLastBlock(QHostAddress("10.6.11.245"), 1730);
+    QCOMPARE(limitedServer.metrics().admission().m_queuedRequests.value(), int64_t(0));
+    QCOMPARE(limitedServer.metrics().activeSessions(), int64_t(1));
+    QCOMPARE(m_socketFactory->getNetworkStreamByDest(UdpSocketStubFactory::StreamDirection::Output, QHostAddress("10.6.11.247"), 1732).str().size(), size_t(20));
+}
+
+
+void TftpServerTest::autoTuningRaisesBufferOnDrops()
+{
+    TftpServer tunedServer(m_socketFactory);
+    tunedServer.bind(TFTP_TEST_FILES_DIR, QHostAddress::Any, 2348);
+    tunedServer.setSocketBufferAutoTuning(true, QHostAddress::Any, 2348);
+    auto binding = tunedServer.metrics().bindings().front();
+    auto mainSocket = m_socketFactory->getSocketBySource(QHostAddress::Any, 2348);
+    int defaultBufferSize = mainSocket->receiveBufferSize();
+    QCOMPARE(binding->m_receiveBufferBytes.value(), int64_t(defaultBufferSize));
+
+    mainSocket->addReceiveDrops(3);
+    QTRY_COMPARE_WITH_TIMEOUT(binding->m_receiveDrops.value(), uint64_t(3), 3 * TftpServer::SocketStatsIntervalMs);
+    QCOMPARE(mainSocket->receiveBufferSize(), ConnectionRequestSocket::AutoTuneStartBytes);
+    QCOMPARE(binding->m_receiveBufferBytes.value(), int64_t(ConnectionRequestSocket::AutoTuneStartBytes));
+    QCOMPARE(mainSocket->sendBufferSize(), defaultBufferSize);
+}
+
+
+/**
+ * @brief TftpServerTest::busyBindingDoesNotStarveOthers a binding with many pending requests lets the other bindings have a turn
+ */
+void TftpServerTest::busyBindingDoesNotStarveOthers()
+{
+    static constexpr int PendingRequests = 100;
+    TftpServer fairServer(m_socketFactory);
+    fairServer.bind(TFTP_TEST_FILES_DIR, QHostAddress::Any, 2353);
+    fairServer.bind(TFTP_TEST_FILES_DIR, QHostAddress::Any, 2354);
+    m_socketFactory->setSocketPeer(QHostAddress::Any, 2353, QHostAddress("10.6.11.221"), 1601);
+    m_socketFactory->setSocketPeer(QHostAddress::Any, 2354, QHostAddress("10.6.11.222"), 1602);
+    auto busySocket = m_socketFactory->getSocketBySource(QHostAddress::Any, 2353);
+    SimulatedNetworkStream &busyInputStream = m_socketFactory->getNetworkStreamBySource(UdpSocketStubFactory::StreamDirection::Input, QHostAddress::Any, 2353);
+    SimulatedNetworkStream &busyOutputStream = m_socketFactory->getNetworkStreamBySource(UdpSocketStubFactory::StreamDirection::Output, QHostAddress::Any, 2353);
+    SimulatedNetworkStream &quietInputStream = m_socketFactory->getNetworkStreamBySource(UdpSocketStubFactory::StreamDirection::Input, QHostAddress::Any, 2354);
+    SimulatedNetworkStream &quietOutputStream = m_socketFactory->getNetworkStreamBySource(UdpSocketStubFactory::StreamDirection::Output, QHostAddress::Any, 2354);
+
+    //each datagram with an illegal opcode is answered with an error datagram of the same size
+    uint16_t illegalOpcode = htons(0x0009);
+    QByteArray illegalDatagram(reinterpret_cast<char*>(&illegalOpcode), sizeof(illegalOpcode));
+    quietInputStream << illegalDatagram;
+    size_t errorSize = quietOutputStream.str().size();
+    QVERIFY(errorSize > 0);
+    quietOutputStream.reset();
+
+    //all requests of the busy binding are pending when the server gets to read them
+    busySocket->setReadLag(10);
+    for (int requestNr=0; requestNr<PendingRequests; ++requestNr)
+    {
+        busyInputStream << illegalDatagram;
+    }
+
+    //a request of the other binding that arrives after the busy binding got its turn is answered before the busy binding is done
+    size_t busyOutputAtQuietTurn = 0;
+    auto quietTurn = connect(busySocket.get(), &AbstractSocket::readyRead, this, [&]()
+            {
+                QTimer::singleShot(0, this, [&]()
+                                   {
+                                       quietInputStream << illegalDatagram;
+                                       busyOutputAtQuietTurn = busyOutputStream.str().size();
+                                   });
+            });
+    QTRY_COMPARE(busyOutputStream.str().size(), PendingRequests * errorSize);
+    disconnect(quietTurn);
+    QCOMPARE(quietOutputStream.str().size(), errorSize);
+    QVERIFY(busyOutputAtQuietTurn > 0);
+    QVERIFY(busyOutputAtQuietTurn < PendingRequests * errorSize);
+}
+
+
+void TftpServerTest::requestDispatchRate()
+{
+    TftpServer busyServer(m_socketFactory);
+    for (int bindingNr=0; bindingNr<BenchmarkBindings; ++bindingNr)
+    {
+        busyServer.bind(TFTP_TEST_FILES_DIR, QHostAddress::Any, static_cast<uint16_t>(BenchmarkFirstPort + bindingNr));
+    }
+
+    //a datagram with an illegal opcode is answered with an error on the main socket, without creating a session
+    uint16_t illegalOpcode = htons(0x0009);
+    QByteArray illegalDatagram(reinterpret_cast<char*>(&illegalOpcode), sizeof(illegalOpcode));
+    uint16_t lastPort = BenchmarkFirstPort + BenchmarkBindings - 1;
+    m_socketFactory->setSocketPeer(QHostAddress::Any, lastPort, QHostAddress("10.6.11.220"), 1600);
+    SimulatedNetworkStream &inputNetworkStream = m_socketFactory->getNetworkStreamBySource(UdpSocketStubFactory::StreamDirection::Input, QHostAddress::Any, lastPort);
+    SimulatedNetworkStream &outputNetworkStream = m_socketFactory->getNetworkStreamBySource(UdpSocketStubFactory::StreamDirection::Output, QHostAddress::Any, lastPort);
+    inputNetworkStream << illegalDatagram;
+    QVERIFY(outputNetworkStream.str().size() > 0);
+
+    QBENCHMARK
+    {
+        inputNetworkStream << illegalDatagram;
+        outputNetworkStream.reset();
+    }
+}
+
+
 //TODO: If a host receives a octet file and then returns it, the returned file must be identical to the original.
 
 
@@ -0,0 +1,156 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#include "qtftp/tracering.h"
+#include <QTest>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace QTFTP
+{
+
+
+class TraceRingTest : public QObject
+{
+    Q_OBJECT
+
+    private slots:
+        void oldestEventsOverwritten();
+        void snapshotSkipsEventsBeingWritten();
+
+    private:
+        static TraceEvent numberedEvent(uint32_t eventNr);
+        static bool isConsistent(const TraceEvent &event);
+};
+
+
+/**
+ * @brief TraceRingTest::numberedEvent create an event of which every field is derived from \p eventNr
+ */
+TraceEvent TraceRingTest::numberedEvent(uint32_t eventNr)
+{
+    TraceEvent event;
+    event.m_timestampNs = (static_cast<uint64_t>(eventNr) << 32) | eventNr;
+    event.m_sessionId = eventNr;
+    event.m_blockNr = static_cast<uint16_t>(eventNr);
+    event.m_type = TraceEvent::DataSent;
+    event.m_flags = 0;
+    event.m_arg1 = eventNr;
+    event.m_arg2 = ~eventNr;
+    return event;
+}
+
+
+bool TraceRingTest::isConsistent(const TraceEvent &event)
+{
+    uint32_t eventNr = event.m_sessionId;
+    return event.m_timestampNs == ((static_cast<uint64_t>(eventNr) << 32) | eventNr) && event.m_blockNr == static_cast<uint16_t>(eventNr) &&
+           event.m_type == TraceEvent::DataSent && event.m_arg1 == eventNr && event.m_arg2 == ~eventNr;
+}
+
+
+/**
+ * @brief TraceRingTest::oldestEventsOverwritten after wrapping around, a snapshot holds the newest Capacity events, oldest first
+ */
+void TraceRingTest::oldestEventsOverwritten()
+{
+    auto ring = std::make_unique<TraceRing>(3);
+    std::vector<TraceEvent> events(TraceRing::Capacity);
+    QCOMPARE(ring->snapshot(events.data(), TraceRing::Capacity), 0u);
+
+    for (uint32_t eventNr=0; eventNr<10; ++eventNr)
+    {
+        ring->push(numberedEvent(eventNr));
+    }
+    QCOMPARE(ring->snapshot(events.data(), TraceRing::Capacity), 10u);
+    QCOMPARE(events[0].m_sessionId, uint32_t(0));
+
+    const uint32_t totalEvents = TraceRing::Capacity + 100;
+    for (uint32_t eventNr=10; eventNr<totalEvents; ++eventNr)
+    {
+        ring->push(numberedEvent(eventNr));
+    }
+    QCOMPARE(ring->snapshot(events.data(), TraceRing::Capacity), TraceRing::Capacity);
+    for (unsigned int eventIndex=0; eventIndex<TraceRing::Capacity; ++eventIndex)
+    {
+        QCOMPARE(events[eventIndex].m_sessionId, uint32_t(100 + eventIndex));
+        QVERIFY(isConsistent(events[eventIndex]));
+    }
+
+    //a smaller destination gets the oldest events
+    QCOMPARE(ring->snapshot(events.data(), 5), 5u);
+    QCOMPARE(events[4].m_sessionId, uint32_t(104));
+    QCOMPARE(ring->threadIndex(), uint32_t(3));
+}
+
+
+/**
+ * @brief TraceRingTest::snapshotSkipsEventsBeingWritten snapshots taken while the owner thread keeps pushing contain no torn events
+ *
+ * The owner overwrites the ring many times during the test, so snapshots regularly run into the slot that is being
+ * written. Such a slot must be skipped, not copied half-written.
+ */
+void TraceRingTest::snapshotSkipsEventsBeingWritten()
+{
+    auto ring = std::make_unique<TraceRing>(0);
+    std::atomic<bool> stopWriting(false);
+    std::thread writerThread([&ring, &stopWriting]()
+                             {
+                                 for (uint32_t eventNr=0; !stopWriting.load(std::memory_order_relaxed); ++eventNr)
+                                 {
+                                     ring->push(numberedEvent(eventNr));
+                                 }
+                             });
+
+    std::vector<TraceEvent> events(TraceRing::Capacity);
+    unsigned int tornEvents = 0;
+    unsigned int unorderedEvents = 0;
+    uint64_t eventsSeen = 0;
+    for (int snapshotNr=0; snapshotNr<2000; ++snapshotNr)
+    {
+        unsigned int eventCount = ring->snapshot(events.data(), TraceRing::Capacity);
+        for (unsigned int eventIndex=0; eventIndex<eventCount; ++eventIndex)
+        {
+            if (!isConsistent(events[eventIndex]))
+            {
+                ++tornEvents;
+            }
+            if (eventIndex > 0 && events[eventIndex].m_sessionId <= events[eventIndex-1].m_sessionId)
+            {
+                ++unorderedEvents;
+            }
+        }
+        eventsSeen += eventCount;
+    }
+    stopWriting.store(true, std::memory_order_relaxed);
+    writerThread.join();
+
+    QVERIFY(eventsSeen > 0);
+    QCOMPARE(tornEvents, 0u);
+    QCOMPARE(unorderedEvents, 0u);
+}
+
+
+} // namespace QTFTP end
+
+QTEST_MAIN(QTFTP::TraceRingTest)
+#include "tracering_ut.moc"
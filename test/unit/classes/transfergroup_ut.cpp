@@ -0,0 +1,111 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#include "qtftp/transfergroup.h"
+#include "testfiles.h"
+#include <QTest>
+#include <QTemporaryDir>
+#include <QFile>
+
+namespace QTFTP
+{
+
+
+class TransferGroupTest : public QObject
+{
+    Q_OBJECT
+
+    private slots:
+        void sessionsShareFileReads();
+        void netasciiBlocksProducedAgainAfterEviction();
+        void replacedFileGetsNewGroup();
+
+    private:
+        QTemporaryDir m_tempDir;
+};
+
+
+void TransferGroupTest::sessionsShareFileReads()
+{
+    QString filePath = m_tempDir.path() + "/shared.bin";
+    QVERIFY(writeFile(filePath, QByteArray(2048, 'x')));
+    TransferGroupRegistry registry;
+    auto firstGroup = registry.acquire(filePath, 512, TftpCode::Octet);
+    auto secondGroup = registry.acquire(filePath, 512, TftpCode::Octet);
+    QCOMPARE(firstGroup.get(), secondGroup.get());
+    QVERIFY(registry.acquire(filePath, 1024, TftpCode::Octet) != firstGroup);
+
+    //two sessions read all 5 blocks (the last one is empty), the file is only read for the first session
+    for (int sessionNr=0; sessionNr<2; ++sessionNr)
+    {
+        for (uint32_t blockIndex=0; blockIndex<4; ++blockIndex)
+        {
+            QCOMPARE(firstGroup->block(blockIndex).size(), 512);
+        }
+        QVERIFY(firstGroup->block(4).isEmpty());
+    }
+    QCOMPARE(firstGroup->fileReads(), uint64_t(4));
+    QCOMPARE(registry.activeGroupCount(), size_t(1));
+}
+
+
+void TransferGroupTest::netasciiBlocksProducedAgainAfterEviction()
+{
+    QString filePath = m_tempDir.path() + "/lines.txt";
+    QVERIFY(writeFile(filePath, QByteArray("line\n").repeated(100)));
+    TransferGroup group(filePath, 16, TftpCode::NetAscii, 32);
+    QVERIFY(group.open());
+
+    QByteArray firstPass;
+    for (uint32_t blockIndex=0; blockIndex<38; ++blockIndex)
+    {
+        firstPass.append(group.block(blockIndex));
+    }
+    QCOMPARE(firstPass, QByteArray("line\r\n").repeated(100));
+    QVERIFY(group.cachedBytes() <= 32);
+
+    //first block was evicted from the cache, so it has to be produced again from the start of the file
+    QCOMPARE(group.block(0), QByteArray("line\r\nline\r\nline"));
+    QCOMPARE(group.block(1), QByteArray("\r\nline\r\nline\r\nli"));
+}
+
+
+void TransferGroupTest::replacedFileGetsNewGroup()
+{
+    QString filePath = m_tempDir.path() + "/image.bin";
+    QVERIFY(writeFile(filePath, QByteArray(600, 'a')));
+    TransferGroupRegistry registry;
+    auto oldGroup = registry.acquire(filePath, 512, TftpCode::Octet);
+
+    QFile::remove(filePath);
+    QVERIFY(writeFile(filePath, QByteArray(700, 'b')));
+    auto newGroup = registry.acquire(filePath, 512, TftpCode::Octet);
+    QVERIFY(newGroup != oldGroup);
+
+    //sessions in progress keep sending the version they started with
+    QCOMPARE(oldGroup->block(1), QByteArray(88, 'a'));
+    QCOMPARE(newGroup->block(1), QByteArray(188, 'b'));
+}
+
+
+} // namespace QTFTP end
+
+QTEST_MAIN(QTFTP::TransferGroupTest)
+#include "transfergroup_ut.moc"
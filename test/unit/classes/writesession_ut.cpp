@@ -0,0 +1,199 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#include "qtftp/writesession.h"
+#include "qtftp/writebehindwriter.h"
+#include "udpsocketstubfactory.h"
+#include "simulatednetworkstream.h"
+#include <QCoreApplication>
+#include <QByteArray>
+#include <QFile>
+#include <QTemporaryDir>
+#include <QTest>
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <arpa/inet.h>
+#endif
+#include <memory>
+
+namespace QTFTP
+{
+
+
+class WriteSessionTest : public QObject
+{
+    Q_OBJECT
+
+    public:
+        WriteSessionTest() : m_socketFactory(std::make_shared<UdpSocketStubFactory>()),
+                             m_writer(std::make_shared<WriteBehindWriter>())
+        {
+        }
+
+        static QByteArray wrqDatagram(const QString &fileName, const QString &mode, const QByteArray &options=QByteArray())
+        {
+            QByteArray datagram(2, 0);
+            datagram[1] = char(TftpCode::TFTP_WRQ);
+            datagram.append(fileName.toUtf8());
+            datagram.append(char(0x0));
+            datagram.append(mode.toLatin1());
+            datagram.append(char(0x0));
+            datagram.append(options);
+            return datagram;
+        }
+
+        static QByteArray dataDatagram(uint16_t blockNr, const QByteArray &payload)
+        {
+            QByteArray datagram(4, 0);
+            datagram[1] = char(TftpCode::TFTP_DATA);
+            datagram[2] = char(blockNr >> 8);
+            datagram[3] = char(blockNr & 0xff);
+            datagram.append(payload);
+            return datagram;
+        }
+
+        QByteArray createWriteSessionAndReturnNetworkResponse(const QByteArray &wrqDatagram)
+        {
+            m_writeSession = std::make_unique<WriteSession>(QHostAddress("10.6.11.123"), 1234, wrqDatagram, m_filesDir.path(), m_writer, m_socketFactory);
+            return sentDatagram();
+        }
+
+        void sendToSession(const QByteArray &datagram)
+        {
+            SimulatedNetworkStream &inNetworkStream = m_socketFactory->getNetworkStreamBySource(UdpSocketStubFactory::StreamDirection::Input, QHostAddress::Any, 0);
+            inNetworkStream << datagram;
+        }
+
+        QByteArray sentDatagram()
+        {
+            SimulatedNetworkStream &outNetworkStream = m_socketFactory->getNetworkStreamBySource(UdpSocketStubFactory::StreamDirection::Output, QHostAddress::Any, 0);
+            QByteArray sentData;
+            outNetworkStream >> sentData;
+            return sentData;
+        }
+
+        static uint16_t ackedBlock(const QByteArray &datagram)
+        {
+            if (datagram.size() != 4 || ntohs(reinterpret_cast<const uint16_t*>(datagram.constData())[0]) != TftpCode::TFTP_ACK)
+            {
+                return 0xffff;
+            }
+            return ntohs(reinterpret_cast<const uint16_t*>(datagram.constData())[1]);
+        }
+
+        QByteArray uploadedFile(const QString &fileName) const
+        {
+            QFile file(m_filesDir.filePath(fileName));
+            return file.open(QIODevice::ReadOnly) ? file.readAll() : QByteArray();
+        }
+
+        std::shared_ptr<UdpSocketStubFactory> m_socketFactory;
+        std::shared_ptr<WriteBehindWriter> m_writer;
+        QTemporaryDir m_filesDir;
+        std::unique_ptr<WriteSession> m_writeSession;  //must be destroyed before the writer
+
+    private slots:
+        void uploadFileLargerThanOneBlockBinary();
+        void refuseFileOutsideFilesDir();
+        void convertNetasciiLineEndingsAcrossBlocks();
+        void uploadFileWithNonAsciiName();
+};
+
+
+void WriteSessionTest::uploadFileLargerThanOneBlockBinary()
+{
+    QByteArray sentData = createWriteSessionAndReturnNetworkResponse(wrqDatagram("upload.bin", "octet"));
+    QCOMPARE(ackedBlock(sentData), uint16_t(0));
+
+    QByteArray firstBlock(static_cast<int>(DefaultTftpBlockSize), 'a');
+    sendToSession(dataDatagram(1, firstBlock));
+    QCOMPARE(ackedBlock(sentDatagram()), uint16_t(1));
+
+    //the last block is acknowledged when the file is stored
+    QByteArray lastBlock(100, 'b');
+    sendToSession(dataDatagram(2, lastBlock));
+    QTRY_COMPARE(m_writeSession->state(), Session::State::Finished);
+    QCOMPARE(ackedBlock(sentDatagram()), uint16_t(2));
+
+    QCOMPARE(uploadedFile("upload.bin"), firstBlock + lastBlock);
+    QCOMPARE(m_writeSession->bytesReceived(), uint64_t(DefaultTftpBlockSize + 100));
+}
+
+
+void WriteSessionTest::refuseFileOutsideFilesDir()
+{
+    QByteArray sentData = createWriteSessionAndReturnNetworkResponse(wrqDatagram("../escape.txt", "octet"));
+
+    const uint16_t* sentDataAsWords = reinterpret_cast<const uint16_t*>(sentData.constData());
+    QCOMPARE(sentDataAsWords[0], htons(0x0005));  //0x05 == error
+    QCOMPARE(sentDataAsWords[1], htons(0x0002));  //0x02 == access violation
+    QCOMPARE(m_writeSession->state(), Session::State::InError);
+}
+
+
+void WriteSessionTest::convertNetasciiLineEndingsAcrossBlocks()
+{
+    QByteArray options("blksize");
+    options.append(char(0x0));
+    options.append("8");
+    options.append(char(0x0));
+    QByteArray sentData = createWriteSessionAndReturnNetworkResponse(wrqDatagram("ascii.txt", "netascii", options));
+    QCOMPARE(ntohs(reinterpret_cast<const uint16_t*>(sentData.constData())[0]), uint16_t(TftpCode::TFTP_OACK));
+
+    //CR,LF split over two blocks becomes LF, CR,NUL becomes CR
+    sendToSession(dataDatagram(1, QByteArray("abcdefg\r")));
+    QCOMPARE(ackedBlock(sentDatagram()), uint16_t(1));
+    sendToSession(dataDatagram(2, QByteArray("\nhi\r\0", 5)));
+    QTRY_COMPARE(m_writeSession->state(), Session::State::Finished);
+
+    QCOMPARE(uploadedFile("ascii.txt"), QByteArray("abcdefg\nhi\r"));
+}
+
+
+/**
+ * @brief WriteSessionTest::uploadFileWithNonAsciiName
+ *
+ * A UTF-8 file name has more bytes than characters, the transfer mode and options after it must still be found.
+ */
+void WriteSessionTest::uploadFileWithNonAsciiName()
+{
+    QString fileName = QString::fromUtf8("gr\xc3\xbc\xc3\x9f" "e.bin");
+    QByteArray options("blksize");
+    options.append(char(0x0));
+    options.append("16");
+    options.append(char(0x0));
+    QByteArray sentData = createWriteSessionAndReturnNetworkResponse(wrqDatagram(fileName, "octet", options));
+    QCOMPARE(m_writeSession->state(), Session::State::OptionsNegotation);
+    QCOMPARE(ntohs(reinterpret_cast<const uint16_t*>(sentData.constData())[0]), uint16_t(TftpCode::TFTP_OACK));
+    QCOMPARE(m_writeSession->blockSize(), 16u);
+
+    QByteArray lastBlock(10, 'c');
+    sendToSession(dataDatagram(1, lastBlock));
+    QTRY_COMPARE(m_writeSession->state(), Session::State::Finished);
+    QCOMPARE(ackedBlock(sentDatagram()), uint16_t(1));
+    QCOMPARE(uploadedFile(fileName), lastBlock);
+}
+
+
+} // namespace QTFTP end
+
+QTEST_MAIN(QTFTP::WriteSessionTest)
+#include "writesession_ut.moc"
@@ -24,6 +24,8 @@
 #include "simulatednetworkstream.h"
 #include "qtftp/abstractsocket.h"
 #include <QByteArray>
+#include <chrono>
+#include <functional>
 #include <list>
 #include <vector>
 #include <random>
@@ -37,6 +39,8 @@ struct Datagram
         QHostAddress m_sourceIpAddress;
         uint16_t    m_sourcePort;
         QByteArray  m_data;
+        QHostAddress m_destinationAddress;  /// local address the datagram was sent to
+        std::chrono::steady_clock::time_point m_receiveTime;  /// time the datagram was added to the pending datagrams
 };
 
 
@@ -46,6 +50,12 @@ struct Datagram
  * Stub for class QUdpSocket, so that we can unit test the QTFTP classes without the
  * need for a physical network. It uses stringstream objects (wrapped in class SimulatedNetworkStream)
  * to capture the data that is sent and received by the socket.
+ *
+ * To test behaviour on a bad network, sent datagrams can be dropped with a filter and received datagrams can be
+ * delivered with a delay. A full send buffer can be simulated to test how sessions handle EAGAIN, and datagrams
+ * dropped by the kernel to test socket buffer auto-tuning. A busy event loop can be simulated by delaying readyRead()
+ * after a datagram was received, to test kernel receive timestamps. For a socket bound to the wildcard address the
+ * destination address of received datagrams can be set, to test dispatching requests by the address they were sent to.
  */
 class UdpSocketStub : public AbstractSocket
 {
@@ -68,11 +78,33 @@ class UdpSocketStub : public AbstractSocket
 
         qint64 readDatagram(char * data, qint64 maxSize, QHostAddress * address = 0, quint16 * port = 0) override;
         qint64 writeDatagram(const QByteArray &datagram, const QHostAddress &host, quint16 port) override;
+        bool receiveDatagram(QByteArray &datagram, QHostAddress &address, quint16 &port, QHostAddress &destinationAddress) override;
+        qint64 writeDatagramFrom(const QByteArray &datagram, const QHostAddress &host, quint16 port, const QHostAddress &sourceAddress) override;
+        bool isSendErrorTransient() const override;
+        void setWriteNotificationEnabled(bool enabled) override;
+        bool setBufferSizes(int receiveBytes, int sendBytes) override;
+        int receiveBufferSize() const override;
+        int sendBufferSize() const override;
+        bool receiveDrops(uint32_t &drops) const override;
+        bool enableReceiveTimestamps() override;
+        bool lastReceiveTime(std::chrono::steady_clock::time_point &receiveTime) const override;
 
         virtual bool bind(const QHostAddress &address, quint16 port, QAbstractSocket::BindMode mode) override;
 
         virtual void close() override;
 
+        void setDropFilter(std::function<bool(const QByteArray &datagram)> dropFilter);
+        void setInputDelay(int delayMs);
+        unsigned int droppedDatagrams() const;
+        void setSendBufferFull(bool isFull);
+        void setSendBufferSpace(int nrOfDatagrams);
+        void setSendError(bool hasError);
+        unsigned int blockedWrites() const;
+        void addReceiveDrops(uint32_t drops);
+        void setReadLag(int lagMs);
+        void setDestinationAddress(const QHostAddress &address);
+        QHostAddress lastSourceAddress() const;
+
     protected:
         void setLocalAddress(const QHostAddress &address);
         void setLocalPort(quint16 port);
@@ -81,6 +113,7 @@ class UdpSocketStub : public AbstractSocket
 
     private:
         void handleIncomingDatagram();
+        void deliverDatagram(const Datagram &datagram);
 
         SimulatedNetworkStream m_inputStream;
         SimulatedNetworkStream m_outputStream;
@@ -89,6 +122,23 @@ class UdpSocketStub : public AbstractSocket
         uint16_t               m_localPort;
         QHostAddress           m_peerAddress;
         uint16_t               m_peerPort;
+        std::function<bool(const QByteArray &datagram)> m_dropFilter;  /// returns true for sent datagrams that get lost
+        int                    m_inputDelayMs;
+        unsigned int           m_droppedDatagrams;
+        bool                   m_sendBufferFull;     /// writeDatagram() fails with a transient error while true
+        bool                   m_sendError;          /// writeDatagram() fails with a permanent error while true
+        int                    m_sendBufferSpace;    /// nr of writes before the send buffer is full again, -1 for no limit
+        bool                   m_writeNotification;  /// readyWrite() is emitted when the send buffer is no longer full
+        unsigned int           m_blockedWrites;
+        int                    m_receiveBufferSize;
+        int                    m_sendBufferSize;
+        uint32_t               m_receiveDrops;
+        int                    m_readLagMs;          /// delay between receiving a datagram and emitting readyRead()
+        bool                   m_readyReadPending;   /// a delayed readyRead() will be emitted, see setReadLag()
+        bool                   m_receiveTimestamps;
+        std::chrono::steady_clock::time_point m_lastReceiveTime;  /// receive time of the datagram that was read last
+        QHostAddress           m_destinationAddress; /// destination of received datagrams, the local address if null
+        QHostAddress           m_lastSourceAddress;  /// source address passed to the last writeDatagramFrom() call
         static std::vector<uint16_t>  m_portsInUse;
         static std::random_device     m_portRandomizer;
 
@@ -23,6 +23,8 @@
 
 #include "qtftp/udpsocketfactory.h"
 #include "qtftp/abstractsocket.h"
+#include <QByteArray>
+#include <functional>
 #include <vector>
 
 
@@ -44,12 +46,16 @@ class UdpSocketStubFactory : public UdpSocketFactory
 
         std::shared_ptr<AbstractSocket> createNewSocket(QObject *parent=nullptr) override;
         void setSocketPeer(const QHostAddress &destAddr, uint16_t destPort, const QHostAddress &sourceAddr, uint16_t sourcePort);
+        void setImpairment(std::function<bool(const QByteArray &datagram)> dropFilter, int inputDelayMs);
 
         SimulatedNetworkStream &getNetworkStreamBySource(StreamDirection direction, const QHostAddress &sourceAddr, uint16_t sourcePortNr);
         SimulatedNetworkStream &getNetworkStreamByDest(StreamDirection direction, const QHostAddress &destAddr, uint16_t destPortNr);
+        std::shared_ptr<UdpSocketStub> getSocketBySource(const QHostAddress &sourceAddr, uint16_t sourcePortNr);
 
     private:
         std::vector< std::weak_ptr<UdpSocketStub> > m_socketList;
+        std::function<bool(const QByteArray &datagram)> m_dropFilter;
+        int m_inputDelayMs;
 };
 
 
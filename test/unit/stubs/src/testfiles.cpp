@@ -0,0 +1,45 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+#include "testfiles.h"
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+
+namespace QTFTP
+{
+
+
+/**
+ * @brief writeFile create (or replace) a file with the given contents for a test, creating its directory if needed
+ * @return true if the file was written completely, check the result with QVERIFY
+ */
+bool writeFile(const QString &filePath, const QByteArray &contents)
+{
+    if (!QDir().mkpath(QFileInfo(filePath).absolutePath()))
+    {
+        return false;
+    }
+    QFile file(filePath);
+    return file.open(QIODevice::WriteOnly | QIODevice::Truncate) && file.write(contents) == contents.size();
+}
+
+
+} //namespace QTFTP end
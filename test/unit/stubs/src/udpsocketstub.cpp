@@ -20,11 +20,14 @@
 
 #include "udpsocketstub.h"
 #include <QHostAddress>
+#include <QTimer>
 
 
 namespace QTFTP {
 
 
+static constexpr int DefaultBufferSize = 212992;  /// default of net.core.rmem_default and wmem_default on Linux
+
 //static class members initialization
 std::vector<uint16_t>  UdpSocketStub::m_portsInUse;
 std::random_device UdpSocketStub::m_portRandomizer;
@@ -34,7 +37,20 @@ std::random_device UdpSocketStub::m_portRandomizer;
 
 UdpSocketStub::UdpSocketStub(QObject *parent) : AbstractSocket(parent),
                                                 m_localPort(0),
-                                                m_peerPort(0)
+                                                m_peerPort(0),
+                                                m_inputDelayMs(0),
+                                                m_droppedDatagrams(0),
+                                                m_sendBufferFull(false),
+                                                m_sendError(false),
+                                                m_sendBufferSpace(-1),
+                                                m_writeNotification(false),
+                                                m_blockedWrites(0),
+                                                m_receiveBufferSize(DefaultBufferSize),
+                                                m_sendBufferSize(DefaultBufferSize),
+                                                m_receiveDrops(0),
+                                                m_readLagMs(0),
+                                                m_readyReadPending(false),
+                                                m_receiveTimestamps(false)
 {
     connect(&m_inputStream, &SimulatedNetworkStream::newData, this, &UdpSocketStub::handleIncomingDatagram);
 }
@@ -120,6 +136,7 @@ qint64 QTFTP::UdpSocketStub::readDatagram(char *data, qint64 maxSize, QHostAddre
 
     Datagram pendingDatagram(m_pendingInputDatagrams.front());
     m_pendingInputDatagrams.pop_front();
+    m_lastReceiveTime = pendingDatagram.m_receiveTime;
     auto endIter = std::copy_n( pendingDatagram.m_data.data(), std::min<size_t>(pendingDatagram.m_data.size(), maxSize), data);
     qint64 charsCopied = endIter - data;
     if (address)
@@ -140,13 +157,253 @@ void UdpSocketStub::handleIncomingDatagram()
     m_inputStream >> newDatagram.m_data;
     newDatagram.m_sourceIpAddress = m_peerAddress;
     newDatagram.m_sourcePort = m_peerPort;
-    m_pendingInputDatagrams.push_back(newDatagram);
+    newDatagram.m_destinationAddress = m_destinationAddress.isNull() ? m_localAddress : m_destinationAddress;
+    if (m_inputDelayMs > 0)
+    {
+        QTimer::singleShot(m_inputDelayMs, this, [this, newDatagram]() { deliverDatagram(newDatagram); });
+        return;
+    }
+    deliverDatagram(newDatagram);
+}
+
+
+void UdpSocketStub::deliverDatagram(const Datagram &datagram)
+{
+    m_pendingInputDatagrams.push_back(datagram);
+    m_pendingInputDatagrams.back().m_receiveTime = std::chrono::steady_clock::now();
+    if (m_readLagMs > 0)
+    {
+        if (!m_readyReadPending)
+        {
+            m_readyReadPending = true;
+            QTimer::singleShot(m_readLagMs, this, [this]() { m_readyReadPending = false; emit readyRead(); });
+        }
+        return;
+    }
     emit readyRead();
 }
 
 
+/**
+ * @brief UdpSocketStub::setDropFilter lose the sent datagrams for which \p dropFilter returns true
+ *
+ * A lost datagram is not written to the output stream, but writeDatagram() reports success like a real socket would.
+ */
+void UdpSocketStub::setDropFilter(std::function<bool(const QByteArray &datagram)> dropFilter)
+{
+    m_dropFilter = dropFilter;
+}
+
+
+/**
+ * @brief UdpSocketStub::setInputDelay deliver datagrams written to the input stream after \p delayMs, 0 for immediately
+ */
+void UdpSocketStub::setInputDelay(int delayMs)
+{
+    m_inputDelayMs = delayMs;
+}
+
+
+unsigned int UdpSocketStub::droppedDatagrams() const
+{
+    return m_droppedDatagrams;
+}
+
+
+/**
+ * @brief UdpSocketStub::setSendBufferFull let writeDatagram() fail like a socket with a full send buffer (EAGAIN)
+ *
+ * When the send buffer is no longer full, readyWrite() is emitted if write notification is enabled.
+ */
+void UdpSocketStub::setSendBufferFull(bool isFull)
+{
+    m_sendBufferSpace = -1;
+    m_sendBufferFull = isFull;
+    if (!m_sendBufferFull && m_writeNotification)
+    {
+        m_writeNotification = false;
+        emit readyWrite();
+    }
+}
+
+
+/**
+ * @brief UdpSocketStub::setSendBufferSpace let \p nrOfDatagrams writes succeed, after that the send buffer is full again
+ *
+ * Simulates a send buffer that drains slowly. readyWrite() is emitted like in setSendBufferFull().
+ */
+void UdpSocketStub::setSendBufferSpace(int nrOfDatagrams)
+{
+    m_sendBufferSpace = nrOfDatagrams;
+    m_sendBufferFull = (nrOfDatagrams == 0);
+    if (!m_sendBufferFull && m_writeNotification)
+    {
+        m_writeNotification = false;
+        emit readyWrite();
+    }
+}
+
+
+/**
+ * @brief UdpSocketStub::setSendError let writeDatagram() fail like a socket with a permanent error (e.g. ENETUNREACH)
+ */
+void UdpSocketStub::setSendError(bool hasError)
+{
+    m_sendError = hasError;
+}
+
+
+unsigned int UdpSocketStub::blockedWrites() const
+{
+    return m_blockedWrites;
+}
+
+
+bool UdpSocketStub::isSendErrorTransient() const
+{
+    return m_sendBufferFull;
+}
+
+
+void UdpSocketStub::setWriteNotificationEnabled(bool enabled)
+{
+    m_writeNotification = enabled;
+}
+
+
+bool UdpSocketStub::setBufferSizes(int receiveBytes, int sendBytes)
+{
+    if (receiveBytes > 0)
+    {
+        m_receiveBufferSize = receiveBytes;
+    }
+    if (sendBytes > 0)
+    {
+        m_sendBufferSize = sendBytes;
+    }
+    return true;
+}
+
+
+int UdpSocketStub::receiveBufferSize() const
+{
+    return m_receiveBufferSize;
+}
+
+
+int UdpSocketStub::sendBufferSize() const
+{
+    return m_sendBufferSize;
+}
+
+
+bool UdpSocketStub::receiveDrops(uint32_t &drops) const
+{
+    drops = m_receiveDrops;
+    return true;
+}
+
+
+/**
+ * @brief UdpSocketStub::addReceiveDrops simulate \p drops datagrams dropped by the kernel because the receive buffer was full
+ */
+void UdpSocketStub::addReceiveDrops(uint32_t drops)
+{
+    m_receiveDrops += drops;
+}
+
+
+bool UdpSocketStub::enableReceiveTimestamps()
+{
+    m_receiveTimestamps = true;
+    return true;
+}
+
+
+bool UdpSocketStub::lastReceiveTime(std::chrono::steady_clock::time_point &receiveTime) const
+{
+    if (!m_receiveTimestamps || m_lastReceiveTime == std::chrono::steady_clock::time_point())
+    {
+        return false;
+    }
+    receiveTime = m_lastReceiveTime;
+    return true;
+}
+
+
+/**
+ * @brief UdpSocketStub::setReadLag emit readyRead() \p lagMs after a datagram was received, like a busy event loop would
+ *
+ * Datagrams received before the delayed readyRead() is emitted share it, so they are all pending when it is emitted.
+ */
+void UdpSocketStub::setReadLag(int lagMs)
+{
+    m_readLagMs = lagMs;
+}
+
+
+/**
+ * @brief UdpSocketStub::setDestinationAddress let the datagrams received after this call report \p address as destination
+ *
+ * Without a destination address, received datagrams report the local address of the socket, like AbstractSocket does.
+ */
+void UdpSocketStub::setDestinationAddress(const QHostAddress &address)
+{
+    m_destinationAddress = address;
+}
+
+
+/**
+ * @brief UdpSocketStub::lastSourceAddress get the source address of the last datagram sent with writeDatagramFrom()
+ */
+QHostAddress UdpSocketStub::lastSourceAddress() const
+{
+    return m_lastSourceAddress;
+}
+
+
+bool UdpSocketStub::receiveDatagram(QByteArray &datagram, QHostAddress &address, quint16 &port, QHostAddress &destinationAddress)
+{
+    if (m_pendingInputDatagrams.empty())
+    {
+        return false;
+    }
+    destinationAddress = m_pendingInputDatagrams.front().m_destinationAddress;
+    datagram.resize(static_cast<int>(pendingDatagramSize()));
+    datagram.resize(static_cast<int>(readDatagram(datagram.data(), datagram.size(), &address, &port)));
+    return true;
+}
+
+
+qint64 UdpSocketStub::writeDatagramFrom(const QByteArray &datagram, const QHostAddress &host, quint16 port, const QHostAddress &sourceAddress)
+{
+    m_lastSourceAddress = sourceAddress;
+    return writeDatagram(datagram, host, port);
+}
+
+
 qint64 UdpSocketStub::writeDatagram(const QByteArray &datagram, const QHostAddress &host, quint16 port)
 {
+    if (m_sendError)
+    {
+        return -1;
+    }
+    if (m_sendBufferFull)
+    {
+        ++m_blockedWrites;
+        return -1;
+    }
+    if (m_sendBufferSpace > 0 && --m_sendBufferSpace == 0)
+    {
+        m_sendBufferFull = true;
+    }
+    if (m_dropFilter && m_dropFilter(datagram))
+    {
+        ++m_droppedDatagrams;
+        m_peerAddress = host;
+        m_peerPort = port;
+        return datagram.length();
+    }
     m_outputStream << datagram;
     if (!m_outputStream)
     {
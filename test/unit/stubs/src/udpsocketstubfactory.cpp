@@ -26,7 +26,7 @@ namespace QTFTP
 {
 
 
-UdpSocketStubFactory::UdpSocketStubFactory()
+UdpSocketStubFactory::UdpSocketStubFactory() : m_inputDelayMs(0)
 {
 }
 
@@ -39,12 +39,26 @@ UdpSocketStubFactory::~UdpSocketStubFactory()
 std::shared_ptr<AbstractSocket> UdpSocketStubFactory::createNewSocket(QObject *parent)
 {
     auto newSocketPtr = std::make_shared<UdpSocketStub>(parent);
+    newSocketPtr->setDropFilter(m_dropFilter);
+    newSocketPtr->setInputDelay(m_inputDelayMs);
     std::weak_ptr<UdpSocketStub> newSocketWeakPtr(newSocketPtr);
     m_socketList.push_back(newSocketWeakPtr);
     return std::static_pointer_cast<AbstractSocket>(newSocketPtr);
 }
 
 
+/**
+ * @brief UdpSocketStubFactory::setImpairment simulate a lossy, slow network on the sockets created after this call
+ * @param dropFilter returns true for sent datagrams that get lost, may be empty to lose none
+ * @param inputDelayMs delay of received datagrams
+ */
+void UdpSocketStubFactory::setImpairment(std::function<bool(const QByteArray &datagram)> dropFilter, int inputDelayMs)
+{
+    m_dropFilter = dropFilter;
+    m_inputDelayMs = inputDelayMs;
+}
+
+
 /**
  * @brief UdpSocketStubFactory::setSocketPeer
  * @param localAddr
@@ -91,6 +105,25 @@ void UdpSocketStubFactory::setSocketPeer(const QHostAddress &localAddr, uint16_t
  * @return
  */
 SimulatedNetworkStream &UdpSocketStubFactory::getNetworkStreamBySource(UdpSocketStubFactory::StreamDirection direction, const QHostAddress &sourceAddr, uint16_t sourcePortNr)
+{
+    std::shared_ptr<UdpSocketStub> stubSharedPtr = getSocketBySource(sourceAddr, sourcePortNr);
+    if (direction == StreamDirection::Input)
+    {
+        return stubSharedPtr->getInputStream();
+    }
+    else
+    {
+        return stubSharedPtr->getOutputStream();
+    }
+}
+
+
+/**
+ * @brief UdpSocketStubFactory::getSocketBySource
+ * @param sourcePortNr the source port that the socket is bound to, or 0 for any port
+ * @throw std::logic_error if there is no socket with supplied local address and local port
+ */
+std::shared_ptr<UdpSocketStub> UdpSocketStubFactory::getSocketBySource(const QHostAddress &sourceAddr, uint16_t sourcePortNr)
 {
     auto socketFindLambda = [&sourceAddr, sourcePortNr](const std::weak_ptr<UdpSocketStub> &socketStubWeakPtr)
     {
@@ -113,15 +146,7 @@ SimulatedNetworkStream &UdpSocketStubFactory::getNetworkStreamBySource(UdpSocket
     }
 
     //arriving here we should have a valid iterator that points to a non-expired weak_ptr
-    std::shared_ptr<UdpSocketStub> stubSharedPtr(*theSocketIter);
-    if (direction == StreamDirection::Input)
-    {
-        return stubSharedPtr->getInputStream();
-    }
-    else
-    {
-        return stubSharedPtr->getOutputStream();
-    }
+    return std::shared_ptr<UdpSocketStub>(*theSocketIter);
 }
 
 
@@ -0,0 +1,66 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+/*
+ * qtftppack writes all files in a directory to a pack file that qtftpd can serve from memory (see QTFTP::PackFile).
+ */
+
+#include "qtftp/packfile.h"
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <iostream>
+
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("qtftppack");
+    QCoreApplication::setApplicationVersion("1.0.0");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QObject::tr("Pack a directory into a file that qtftpd serves from memory"));
+    parser.addHelpOption();
+    parser.addVersionOption();
+    parser.addPositionalArgument("sourcedir", QObject::tr("Directory with the files to pack"));
+    parser.addPositionalArgument("packfile", QObject::tr("Pack file to write"));
+    parser.process(app);
+
+    if (parser.positionalArguments().size() != 2)
+    {
+        parser.showHelp(1);
+    }
+
+    QString errorString;
+    if (!QTFTP::PackFile::build(parser.positionalArguments().at(0), parser.positionalArguments().at(1), &errorString))
+    {
+        std::cerr << "Error: " << errorString.toStdString() << std::endl;
+        return 2;
+    }
+
+    QTFTP::PackFile packFile(parser.positionalArguments().at(1));
+    if (!packFile.open())
+    {
+        std::cerr << "Error: " << packFile.errorString().toStdString() << std::endl;
+        return 3;
+    }
+    std::cout << "Packed " << packFile.fileCount() << " file(s) into " << packFile.path().toStdString() << std::endl;
+
+    return 0;
+}
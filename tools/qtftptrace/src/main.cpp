@@ -0,0 +1,261 @@
+/****************************************************************************
+* Copyright (c) Contributors as noted in the AUTHORS file
+*
+* This file is part of QTFTP.
+*
+* QTFTP is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2.1 of the License, or
+* (at your option) any later version.
+*
+* QTFTP is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+****************************************************************************/
+
+/*
+ * qtftptrace decodes a binary trace dump written by qtftpd (see QTFTP::TraceRecorder) and prints a
+ * timeline of events for each TFTP session in the dump.
+ */
+
+#include "qtftp/tracering.h"
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDateTime>
+#include <QFile>
+#include <QHostAddress>
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std::string_literals;
+using QTFTP::TraceEvent;
+
+struct DecodedEvent
+{
+    public:
+        TraceEvent m_event;
+        uint32_t   m_threadIndex;
+};
+
+
+static const char *eventName(uint8_t eventType)
+{
+    switch (eventType)
+    {
+        case TraceEvent::Rrq:         return "RRQ";
+        case TraceEvent::Oack:        return "OACK";
+        case TraceEvent::DataSent:    return "DATA";
+        case TraceEvent::AckReceived: return "ACK";
+        case TraceEvent::Retransmit:  return "RETRANSMIT";
+        case TraceEvent::Error:       return "ERROR";
+        case TraceEvent::Finished:    return "FINISHED";
+        default:                      return "?";
+    }
+}
+
+
+/**
+ * @brief ipv6PeerAddress assemble the IPv6 peer address of a session from its PeerAddress6 events
+ * @return the address, or an empty string if the session has no (complete) IPv6 peer address
+ */
+static QString ipv6PeerAddress(const std::vector<DecodedEvent> &sessionEvents)
+{
+    Q_IPV6ADDR address = {};
+    bool hasPart[2] = { false, false };
+    for (const auto &nextEvent : sessionEvents)
+    {
+        const TraceEvent &event = nextEvent.m_event;
+        if (event.m_type != TraceEvent::PeerAddress6 || event.m_blockNr > 1)
+        {
+            continue;
+        }
+        uint32_t words[2] = { event.m_arg1, event.m_arg2 };
+        for (unsigned int byteNr=0; byteNr<8; ++byteNr)
+        {
+            address[event.m_blockNr * 8 + byteNr] = static_cast<quint8>(words[byteNr / 4] >> (24 - 8 * (byteNr % 4)));
+        }
+        hasPart[event.m_blockNr] = true;
+    }
+    return (hasPart[0] && hasPart[1]) ? QHostAddress(address).toString() : QString();
+}
+
+
+static QString eventDetails(const TraceEvent &event, const QString &ipv6Peer)
+{
+    switch (event.m_type)
+    {
+        case TraceEvent::Rrq:
+            if (event.m_flags & TraceEvent::FlagIpv6Peer)
+            {
+                return ipv6Peer.isEmpty() ? QString("peer port %1 (IPv6)").arg(event.m_arg1) : QString("peer [%1]:%2").arg(ipv6Peer).arg(event.m_arg1);
+            }
+            if (event.m_arg2 != 0)
+            {
+                return QString("peer %1:%2").arg(QHostAddress(event.m_arg2).toString()).arg(event.m_arg1);
+            }
+            return QString("peer port %1").arg(event.m_arg1);
+        case TraceEvent::Oack:
+            return QString("blksize %1").arg(event.m_arg1);
+        case TraceEvent::DataSent:
+            return QString("block %1, %2 bytes").arg(event.m_blockNr).arg(event.m_arg1);
+        case TraceEvent::AckReceived:
+            return QString("block %1, %2 us after send").arg(event.m_blockNr).arg(event.m_arg1);
+        case TraceEvent::Retransmit:
+            return QString("block %1, %2 bytes, retry %3").arg(event.m_blockNr).arg(event.m_arg1).arg(event.m_arg2);
+        default:
+            return QString();
+    }
+}
+
+
+/**
+ * @brief readTraceDump read all events from a dump file written by TraceRecorder::dumpToFd()
+ * @throw std::runtime_error if the file can't be read or is not a valid trace dump
+ */
+static std::vector<DecodedEvent> readTraceDump(const QString &fileName, QTFTP::TraceFileHeader &fileHeader)
+{
+    QFile dumpFile(fileName);
+    if (!dumpFile.open(QIODevice::ReadOnly))
+    {
+        throw std::runtime_error("Could not open trace dump "s + fileName.toStdString() + ": " + dumpFile.errorString().toStdString());
+    }
+
+    if (dumpFile.read(reinterpret_cast<char*>(&fileHeader), sizeof(fileHeader)) != sizeof(fileHeader) ||
+        std::memcmp(fileHeader.m_magic, "QTFTPTRC", sizeof(fileHeader.m_magic)) != 0)
+    {
+        throw std::runtime_error("File "s + fileName.toStdString() + " is not a qtftp trace dump");
+    }
+    if (fileHeader.m_version != QTFTP::TraceFileVersion || fileHeader.m_eventSize != sizeof(TraceEvent))
+    {
+        throw std::runtime_error("Trace dump "s + fileName.toStdString() + " has unsupported version " + std::to_string(fileHeader.m_version));
+    }
+
+    std::vector<DecodedEvent> events;
+    for (uint32_t ringNr=0; ringNr<fileHeader.m_ringCount; ++ringNr)
+    {
+        QTFTP::TraceRingHeader ringHeader;
+        if (dumpFile.read(reinterpret_cast<char*>(&ringHeader), sizeof(ringHeader)) != sizeof(ringHeader))
+        {
+            throw std::runtime_error("Trace dump "s + fileName.toStdString() + " is truncated");
+        }
+        for (uint32_t eventNr=0; eventNr<ringHeader.m_eventCount; ++eventNr)
+        {
+            DecodedEvent decodedEvent;
+            if (dumpFile.read(reinterpret_cast<char*>(&decodedEvent.m_event), sizeof(TraceEvent)) != sizeof(TraceEvent))
+            {
+                throw std::runtime_error("Trace dump "s + fileName.toStdString() + " is truncated");
+            }
+            decodedEvent.m_threadIndex = ringHeader.m_threadIndex;
+            events.push_back(decodedEvent);
+        }
+    }
+
+    return events;
+}
+
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("qtftptrace");
+    QCoreApplication::setApplicationVersion("1.0.0");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QObject::tr("Print a per-session timeline of a qtftpd trace dump"));
+    parser.addHelpOption();
+    parser.addVersionOption();
+    QCommandLineOption sessionOption( {"s", "session"}, QObject::tr("Only show session with this id"), "sessionId");
+    parser.addOption(sessionOption);
+    parser.addPositionalArgument("dumpfile", QObject::tr("Trace dump written by qtftpd"));
+    parser.process(app);
+
+    if (parser.positionalArguments().size() != 1)
+    {
+        parser.showHelp(1);
+    }
+
+    bool filterOnSession = parser.isSet(sessionOption);
+    uint32_t sessionFilter = 0;
+    if (filterOnSession)
+    {
+        bool convOk = false;
+        sessionFilter = parser.value(sessionOption).toUInt(&convOk);
+        if (!convOk)
+        {
+            std::cerr << "Error: invalid session id" << std::endl;
+            return 1;
+        }
+    }
+
+    QTFTP::TraceFileHeader fileHeader;
+    std::vector<DecodedEvent> events;
+    try
+    {
+        events = readTraceDump(parser.positionalArguments().at(0), fileHeader);
+    }
+    catch (const std::runtime_error &dumpErr)
+    {
+        std::cerr << "Error: " << dumpErr.what() << std::endl;
+        return 2;
+    }
+
+    //group events by session, each session ordered by time
+    std::map<uint32_t, std::vector<DecodedEvent>> sessions;
+    for (const auto &nextEvent : events)
+    {
+        if (!filterOnSession || nextEvent.m_event.m_sessionId == sessionFilter)
+        {
+            sessions[nextEvent.m_event.m_sessionId].push_back(nextEvent);
+        }
+    }
+
+    auto toWallClockMs = [&fileHeader](uint64_t steadyNs)
+    {
+        int64_t ageNs = static_cast<int64_t>(fileHeader.m_steadyClockNs - steadyNs);
+        return static_cast<qint64>((static_cast<int64_t>(fileHeader.m_systemClockNs) - ageNs) / 1000000);
+    };
+
+    std::cout << "Trace dump taken at " << QDateTime::fromMSecsSinceEpoch(toWallClockMs(fileHeader.m_steadyClockNs)).toString("yyyy-MM-dd hh:mm:ss.zzz").toStdString()
+              << ", " << fileHeader.m_ringCount << " thread(s), " << events.size() << " event(s)" << std::endl;
+
+    for (auto &nextSession : sessions)
+    {
+        auto &sessionEvents = nextSession.second;
+        std::stable_sort(sessionEvents.begin(), sessionEvents.end(), [](const DecodedEvent &lhs, const DecodedEvent &rhs)
+                                                                     { return lhs.m_event.m_timestampNs < rhs.m_event.m_timestampNs; });
+        uint64_t firstNs = sessionEvents.front().m_event.m_timestampNs;
+        uint64_t previousNs = firstNs;
+        QString ipv6Peer = ipv6PeerAddress(sessionEvents);
+
+        std::cout << std::endl << "Session " << nextSession.first << ", first event at "
+                  << QDateTime::fromMSecsSinceEpoch(toWallClockMs(firstNs)).toString("hh:mm:ss.zzz").toStdString() << std::endl;
+        for (const auto &nextEvent : sessionEvents)
+        {
+            const TraceEvent &event = nextEvent.m_event;
+            if (event.m_type == TraceEvent::PeerAddress6)
+            {
+                //shown in the RRQ line
+                continue;
+            }
+            QString line = QString("  %1 ms  (+%2 ms)  [thread %3]  %4  %5").arg(static_cast<double>(event.m_timestampNs - firstNs) / 1e6, 12, 'f', 3)
+                                                                            .arg(static_cast<double>(event.m_timestampNs - previousNs) / 1e6, 10, 'f', 3)
+                                                                            .arg(nextEvent.m_threadIndex)
+                                                                            .arg(QString(eventName(event.m_type)), -10)
+                                                                            .arg(eventDetails(event, ipv6Peer));
+            std::cout << line.toStdString() << std::endl;
+            previousNs = event.m_timestampNs;
+        }
+    }
+
+    return 0;
+}